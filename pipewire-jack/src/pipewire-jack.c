@@ -262,6 +262,7 @@ struct client {
 
 	uint32_t node_id;
 	struct spa_source *socket_source;
+	struct spa_source *thread_event;
 
 	JackThreadCallback thread_callback;
 	void *thread_arg;
@@ -334,6 +335,15 @@ struct client {
 	unsigned int allow_mlock:1;
 	unsigned int timemaster_pending:1;
 	unsigned int timemaster_conditional:1;
+	unsigned int futex:1;
+	unsigned int spinning:1;
+	unsigned int freewheeling:1;
+
+	uint64_t spin_wait;
+	struct pw_node_spin spin;
+	struct spa_hook loop_hook;
+
+	uint32_t loop_pending;
 
 	jack_position_t jack_position;
 	jack_transport_state_t jack_state;
@@ -683,6 +693,44 @@ static struct link *find_activation(struct spa_list *links, uint32_t node_id)
 	return NULL;
 }
 
+struct invoke {
+	spa_invoke_func_t func;
+	void *data;
+	bool kicked;
+};
+
+static int
+do_invoke(struct spa_loop *loop,
+                  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct client *c = user_data;
+	const struct invoke *i = data;
+	int res;
+
+	res = i->func(loop, async, seq, NULL, 0, i->data);
+	if (i->kicked)
+		ATOMIC_DEC(c->loop_pending);
+	return res;
+}
+
+/* a thread that sleeps on the futex does not run the loop, kick it so that
+ * it runs the loop until the pending invokes are done */
+static void kick_loop(struct client *c)
+{
+	ATOMIC_INC(c->loop_pending);
+	pw_node_activation_futex_kick(c->activation);
+}
+
+static int data_loop_invoke(struct client *c, spa_invoke_func_t func, uint32_t seq,
+		bool block, void *data)
+{
+	struct invoke i = { func, data, c->futex && !pw_data_loop_in_thread(c->loop) };
+
+	if (i.kicked)
+		kick_loop(c);
+	return pw_data_loop_invoke(c->loop, do_invoke, seq, &i, sizeof(i), block, c);
+}
+
 static int
 do_remove_sources(struct spa_loop *loop,
                   bool async, uint32_t seq, const void *data, size_t size, void *user_data)
@@ -693,13 +741,54 @@ do_remove_sources(struct spa_loop *loop,
 		pw_loop_destroy_source(c->loop->loop, c->socket_source);
 		c->socket_source = NULL;
 	}
+	if (c->thread_event) {
+		pw_loop_destroy_source(c->loop->loop, c->thread_event);
+		c->thread_event = NULL;
+	}
+	if (c->spinning) {
+		spa_hook_remove(&c->loop_hook);
+		c->spinning = false;
+	}
+	return 0;
+}
+
+static void loop_before(void *data)
+{
+	struct client *c = data;
+	if (!c->futex)
+		pw_node_spin_wait(&c->spin, c->activation);
+}
+
+static void loop_after(void *data)
+{
+	struct client *c = data;
+	struct pw_node_activation *a = c->activation;
+
+	if (!c->futex && a->status == PW_NODE_ACTIVATION_TRIGGERED)
+		pw_node_spin_update(&c->spin, a, pw_node_spin_get_nsec());
+}
+
+static const struct spa_loop_control_hooks loop_hooks = {
+	SPA_VERSION_LOOP_CONTROL_HOOKS,
+	.before = loop_before,
+	.after = loop_after,
+};
+
+static int
+do_add_spin(struct spa_loop *loop,
+                  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct client *c = user_data;
+
+	pw_node_spin_init(&c->spin, c->activation, c->spin_wait);
+	pw_loop_add_hook(c->loop->loop, &c->loop_hook, &loop_hooks, c);
+	c->spinning = true;
 	return 0;
 }
 
 static void unhandle_socket(struct client *c)
 {
-	pw_data_loop_invoke(c->loop,
-			do_remove_sources, 1, NULL, 0, true, c);
+	data_loop_invoke(c, do_remove_sources, 1, true, c);
 }
 
 static void reuse_buffer(struct client *c, struct mix *mix, uint32_t id)
@@ -990,23 +1079,24 @@ static inline void check_sample_rate(struct client *c, struct spa_io_position *p
 	}
 }
 
-static inline uint32_t cycle_run(struct client *c)
+static inline void check_freewheel(struct client *c, struct spa_io_position *pos)
+{
+	bool freewheeling = SPA_FLAG_IS_SET(pos->clock.flags, SPA_IO_CLOCK_FLAG_FREEWHEEL);
+	if (SPA_UNLIKELY(freewheeling != c->freewheeling)) {
+		pw_log_info(NAME" %p: freewheel %d", c, freewheeling);
+		c->freewheeling = freewheeling;
+		if (c->freewheel_callback)
+			c->freewheel_callback(freewheeling, c->freewheel_arg);
+	}
+}
+
+static inline uint32_t cycle_start(struct client *c)
 {
-	uint64_t cmd;
 	struct timespec ts;
-	int fd = c->socket_source->fd;
 	struct spa_io_position *pos = c->rt.position;
 	struct pw_node_activation *activation = c->activation;
 	struct pw_node_activation *driver = c->rt.driver_activation;
 
-	/* this is blocking if nothing ready */
-	if (SPA_UNLIKELY(read(fd, &cmd, sizeof(cmd)) != sizeof(cmd))) {
-		pw_log_warn(NAME" %p: read failed %m", c);
-		if (errno == EWOULDBLOCK)
-			return 0;
-	} else if (SPA_UNLIKELY(cmd > 1))
-		pw_log_warn(NAME" %p: missed %"PRIu64" wakeups", c, cmd - 1);
-
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 	activation->status = PW_NODE_ACTIVATION_AWAKE;
 	activation->awake_time = SPA_TIMESPEC_TO_NSEC(&ts);
@@ -1024,6 +1114,7 @@ static inline uint32_t cycle_run(struct client *c)
 
 	check_buffer_frames(c, pos);
 	check_sample_rate(c, pos);
+	check_freewheel(c, pos);
 
 	if (SPA_LIKELY(driver)) {
 		c->jack_state = position_to_jack(driver, &c->jack_position);
@@ -1045,10 +1136,63 @@ static inline uint32_t cycle_run(struct client *c)
 	return c->buffer_frames;
 }
 
+static inline uint32_t cycle_run(struct client *c)
+{
+	uint64_t cmd;
+	int fd = c->socket_source->fd;
+
+	/* this is blocking if nothing ready */
+	if (SPA_UNLIKELY(read(fd, &cmd, sizeof(cmd)) != sizeof(cmd))) {
+		pw_log_warn(NAME" %p: read failed %m", c);
+		if (errno == EWOULDBLOCK)
+			return 0;
+	} else if (SPA_UNLIKELY(cmd > 1))
+		pw_log_warn(NAME" %p: missed %"PRIu64" wakeups", c, cmd - 1);
+
+	return cycle_start(c);
+}
+
+/* only a thread that waits in jack_cycle_wait() sleeps on the futex, peers
+ * wake it up without going through the loop */
+static inline uint32_t cycle_wait_futex(struct client *c)
+{
+	struct pw_node_activation *activation = c->activation;
+	int res;
+
+	if (c->spinning)
+		pw_node_spin_wait(&c->spin, activation);
+
+	while (true) {
+		/* run the loop for the invokes and the stop we were kicked for */
+		while (SPA_UNLIKELY(ATOMIC_LOAD(c->loop_pending) > 0)) {
+			if (pw_data_loop_wait(c->loop, -1) < 0) {
+				pw_log_warn(NAME" %p: wait error %m", c);
+				return 0;
+			}
+		}
+		res = pw_node_activation_futex_wait(activation, NULL);
+		if (SPA_LIKELY(res > 0)) {
+			if (SPA_UNLIKELY(res > 1))
+				pw_log_warn(NAME" %p: missed %d wakeups", c, res - 1);
+			if (c->spinning)
+				pw_node_spin_update(&c->spin, activation,
+						pw_node_spin_get_nsec());
+			return cycle_start(c);
+		}
+		if (res < 0) {
+			pw_log_warn(NAME" %p: futex wait error: %s", c, spa_strerror(res));
+			return 0;
+		}
+	}
+}
+
 static inline uint32_t cycle_wait(struct client *c)
 {
 	int res;
 
+	if (c->futex)
+		return cycle_wait_futex(c);
+
 	res = pw_data_loop_wait(c->loop, -1);
 	if (SPA_UNLIKELY(res <= 0)) {
 		pw_log_warn(NAME" %p: wait error %m", c);
@@ -1089,6 +1233,9 @@ static inline void signal_sync(struct client *c)
 
 			pw_log_trace(NAME" %p: signal %p %p", c, l, state);
 
+			if (pw_node_activation_futex_wake(l->activation))
+				continue;
+
 			if (SPA_UNLIKELY(write(l->signalfd, &cmd, sizeof(cmd)) != sizeof(cmd)))
 				pw_log_warn(NAME" %p: write failed %m", c);
 		}
@@ -1121,6 +1268,19 @@ static inline void cycle_signal(struct client *c, int status)
 	signal_sync(c);
 }
 
+static void enter_thread(struct client *c)
+{
+	if (!c->thread_entered) {
+		c->thread_entered = true;
+		c->thread_callback(c->thread_arg);
+	}
+}
+
+static void on_thread_event(void *data, uint64_t count)
+{
+	enter_thread(data);
+}
+
 static void
 on_rtsocket_condition(void *data, int fd, uint32_t mask)
 {
@@ -1132,10 +1292,7 @@ on_rtsocket_condition(void *data, int fd, uint32_t mask)
 		return;
 	}
 	if (SPA_UNLIKELY(c->thread_callback)) {
-		if (!c->thread_entered) {
-			c->thread_entered = true;
-			c->thread_callback(c->thread_arg);
-		}
+		enter_thread(c);
 	} else if (SPA_LIKELY(mask & SPA_IO_IN)) {
 		uint32_t buffer_frames;
 		int status;
@@ -1159,8 +1316,7 @@ do_clear_link(struct spa_loop *loop,
 
 static void clear_link(struct client *c, struct link *link)
 {
-	pw_data_loop_invoke(c->loop,
-			do_clear_link, 1, NULL, 0, true, link);
+	data_loop_invoke(c, do_clear_link, 1, true, link);
 	pw_memmap_free(link->mem);
 	close(link->signalfd);
 	spa_list_remove(&link->link);
@@ -1206,6 +1362,10 @@ static int client_node_transport(void *object,
 					  readfd,
 					  SPA_IO_ERR | SPA_IO_HUP,
 					  true, on_rtsocket_condition, c);
+	c->thread_event = pw_loop_add_event(c->loop->loop, on_thread_event, c);
+
+	if (c->spin_wait > 0)
+		data_loop_invoke(c, do_add_spin, 1, true, c);
 
 	c->has_transport = true;
 	pw_thread_loop_signal(c->context.loop, false);
@@ -1273,8 +1433,7 @@ static int update_driver_activation(struct client *c)
 
 	link = find_activation(&c->links, c->driver_id);
 	c->driver_activation = link ? link->activation : NULL;
-	pw_data_loop_invoke(c->loop,
-                       do_update_driver_activation, SPA_ID_INVALID, NULL, 0, true, c);
+	data_loop_invoke(c, do_update_driver_activation, SPA_ID_INVALID, true, c);
 	install_timemaster(c);
 
 	return 0;
@@ -1348,7 +1507,14 @@ static int client_node_command(void *object, const struct spa_command *command)
 		break;
 
 	case SPA_NODE_COMMAND_Start:
-		if (!c->started) {
+		if (c->futex) {
+			/* the wakeups go to the futex, enter the thread
+			 * from the loop, it stays in jack_cycle_wait() */
+			if (!c->started)
+				pw_loop_signal_event(c->loop->loop, c->thread_event);
+			c->started = true;
+			c->first = true;
+		} else if (!c->started) {
 			pw_loop_update_io(c->loop->loop,
 					  c->socket_source,
 					  SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP);
@@ -1857,8 +2023,7 @@ static int client_node_set_activation(void *object,
 		link->signalfd = signalfd;
 		spa_list_append(&c->links, &link->link);
 
-		pw_data_loop_invoke(c->loop,
-                       do_activate_link, SPA_ID_INVALID, NULL, 0, false, link);
+		data_loop_invoke(c, do_activate_link, SPA_ID_INVALID, false, link);
 	}
 	else {
 		link = find_activation(&c->links, node_id);
@@ -2200,7 +2365,7 @@ jack_client_t * jack_client_open (const char *client_name,
 {
 	struct client *client;
 	struct spa_dict props;
-	struct spa_dict_item items[6];
+	struct spa_dict_item items[7];
 	const struct spa_support *support;
 	uint32_t n_support;
 	const char *str;
@@ -2299,6 +2464,10 @@ jack_client_t * jack_client_open (const char *client_name,
 	items[props.n_items++] = SPA_DICT_ITEM_INIT(PW_KEY_MEDIA_ROLE, "DSP");
 	if ((str = getenv("PIPEWIRE_LATENCY")) != NULL)
 		items[props.n_items++] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_LATENCY, str);
+	if ((str = getenv("PIPEWIRE_SPIN_WAIT")) != NULL) {
+		client->spin_wait = pw_properties_parse_uint64(str);
+		items[props.n_items++] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_SPIN_WAIT, str);
+	}
 	items[props.n_items++] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_ALWAYS_PROCESS, "true");
 
 	client->node = pw_core_create_object(client->core,
@@ -2491,10 +2660,19 @@ static int do_activate(struct client *c)
 
 	pw_thread_loop_lock(c->context.loop);
 
+	/* a thread that waits in jack_cycle_wait() sleeps on the futex when
+	 * the server says that all the peers can wake it up that way. The
+	 * process callback is called from the loop and needs the eventfd. */
+	c->futex = c->thread_callback != NULL &&
+		ATOMIC_LOAD(c->activation->wakeup_futex);
+	ATOMIC_STORE(c->activation->wakeup, c->futex ?
+			PW_NODE_ACTIVATION_WAKEUP_FUTEX :
+			PW_NODE_ACTIVATION_WAKEUP_EVENTFD);
+
 	if ((res = pw_data_loop_start(c->loop)) < 0)
 		goto done;
 
-	pw_log_debug(NAME" %p: activate", c);
+	pw_log_debug(NAME" %p: activate futex:%d", c, c->futex);
 	pw_client_node_set_active(c->node, true);
 
 	res = do_sync(c);
@@ -2540,7 +2718,12 @@ int jack_deactivate (jack_client_t *client)
 
 	pw_thread_loop_lock(c->context.loop);
 	pw_log_debug(NAME" %p: deactivate", c);
+	/* the stop event is only seen when the thread runs the loop */
+	if (c->futex)
+		kick_loop(c);
 	pw_data_loop_stop(c->loop);
+	ATOMIC_STORE(c->loop_pending, 0);
+	c->thread_entered = false;
 
 	pw_client_node_set_active(c->node, false);
 
@@ -2896,8 +3079,28 @@ int jack_set_latency_callback (jack_client_t *client,
 SPA_EXPORT
 int jack_set_freewheel(jack_client_t* client, int onoff)
 {
-	pw_log_warn(NAME" %p: not implemented %d", client, onoff);
-	return -ENOTSUP;
+	struct client *c = (struct client *) client;
+	struct spa_node_info ni;
+	struct spa_dict_item items[1];
+
+	spa_return_val_if_fail(c != NULL, -EINVAL);
+
+	pw_log_info(NAME" %p: freewheel %d", c, onoff);
+
+	ni = SPA_NODE_INFO_INIT();
+	ni.max_input_ports = MAX_PORTS;
+	ni.max_output_ports = MAX_PORTS;
+	ni.change_mask = SPA_NODE_CHANGE_MASK_PROPS;
+	items[0] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_FREEWHEEL, onoff ? "true" : "false");
+	ni.props = &SPA_DICT_INIT_ARRAY(items);
+
+	pw_thread_loop_lock(c->context.loop);
+	pw_client_node_update(c->node,
+			PW_CLIENT_NODE_UPDATE_INFO,
+			0, NULL, &ni);
+	pw_thread_loop_unlock(c->context.loop);
+
+	return 0;
 }
 
 SPA_EXPORT
@@ -39,6 +39,8 @@ extern "C" {
 #define SPA_KEY_NODE_PAUSE_ON_IDLE	"node.pause-on-idle"	/**< if the node should be paused
 								  *  immediately when idle. */
 #define SPA_KEY_NODE_MONITOR		"node.monitor"		/**< the node has monitor ports */
+#define SPA_KEY_NODE_FREEWHEEL		"node.freewheel"	/**< the driver starts a cycle as soon
+								  *  as the previous one completed. */
 
 
 /** port keys */
@@ -39,9 +39,15 @@ enum spa_profiler {
 	SPA_PROFILER_info,				/**< Generic info, counter and CPU load */
 	SPA_PROFILER_clock,				/**< clock information */
 	SPA_PROFILER_driverBlock,			/**< generic driver info block */
+	SPA_PROFILER_driverAdapt,			/**< driver quantum adaptation info */
+	SPA_PROFILER_driverCriticalPath,		/**< period, critical path length and
+							  *  the ids of the nodes on it */
 
 	SPA_PROFILER_START_Follower	= 0x20000,	/**< follower related profiler properties */
 	SPA_PROFILER_followerBlock,			/**< generic follower info block */
+	SPA_PROFILER_followerSpin,			/**< follower spin-wait info */
+	SPA_PROFILER_followerSlack,			/**< follower slack against the driver period */
+	SPA_PROFILER_followerHistogram,			/**< follower processing time histogram */
 
 	SPA_PROFILER_START_CUSTOM	= 0x1000000,
 };
@@ -338,7 +338,12 @@ static const struct spa_type_info spa_type_profiler[] = {
 	{ SPA_PROFILER_info, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "info", NULL, },
 	{ SPA_PROFILER_clock, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "clock", NULL, },
 	{ SPA_PROFILER_driverBlock, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "driverBlock", NULL, },
+	{ SPA_PROFILER_driverAdapt, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "driverAdapt", NULL, },
+	{ SPA_PROFILER_driverCriticalPath, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "driverCriticalPath", NULL, },
 	{ SPA_PROFILER_followerBlock, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "followerBlock", NULL, },
+	{ SPA_PROFILER_followerSpin, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "followerSpin", NULL, },
+	{ SPA_PROFILER_followerSlack, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "followerSlack", NULL, },
+	{ SPA_PROFILER_followerHistogram, SPA_TYPE_Struct, SPA_TYPE_INFO_PROFILER_BASE "followerHistogram", NULL, },
 	{ 0, 0, NULL, NULL },
 };
 
@@ -172,6 +172,8 @@ static inline void spa_log_trace_fp (struct spa_log *l, const char *format, ...)
 								  *  stderr. */
 #define SPA_KEY_LOG_TIMESTAMP		"log.timestamp"		/**< log timestamps */
 #define SPA_KEY_LOG_LINE		"log.line"		/**< log file and line numbers */
+#define SPA_KEY_LOG_DEFERRED		"log.deferred"		/**< format and write the messages in a
+								  *  separate thread */
 
 #ifdef __cplusplus
 }  /* extern "C" */
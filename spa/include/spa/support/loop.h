@@ -214,7 +214,7 @@ typedef void (*spa_source_signal_func_t) (void *data, int signal_number);
 struct spa_loop_utils_methods {
 	/* the version of this structure. This can be used to expand this
 	 * structure in the future */
-#define SPA_VERSION_LOOP_UTILS_METHODS	0
+#define SPA_VERSION_LOOP_UTILS_METHODS	1
 	uint32_t version;
 
 	struct spa_source *(*add_io) (void *object,
@@ -249,6 +249,12 @@ struct spa_loop_utils_methods {
 	 * should only be called when the loop is not running or from the
 	 * context of the running loop */
 	void (*destroy_source) (void *object, struct spa_source *source);
+
+	/** Let a timer fire up to \a slack nanoseconds after it expires so that
+	 * it can fire together with other timers. since version 1 */
+	int (*set_timer_slack) (void *object,
+				struct spa_source *source,
+				uint64_t slack);
 };
 
 #define spa_loop_utils_method_v(o,method,version,...)			\
@@ -289,6 +295,7 @@ struct spa_loop_utils_methods {
 #define spa_loop_utils_update_timer(l,...)	spa_loop_utils_method_r(l,update_timer,0,__VA_ARGS__)
 #define spa_loop_utils_add_signal(l,...)	spa_loop_utils_method_s(l,add_signal,0,__VA_ARGS__)
 #define spa_loop_utils_destroy_source(l,...)	spa_loop_utils_method_v(l,destroy_source,0,__VA_ARGS__)
+#define spa_loop_utils_set_timer_slack(l,...)	spa_loop_utils_method_r(l,set_timer_slack,1,__VA_ARGS__)
 
 #ifdef __cplusplus
 }  /* extern "C" */
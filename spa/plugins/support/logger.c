@@ -23,16 +23,19 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <spa/support/log.h>
 #include <spa/support/loop.h>
 #include <spa/support/system.h>
 #include <spa/support/plugin.h>
+#include <spa/utils/list.h>
 #include <spa/utils/ringbuffer.h>
 #include <spa/utils/type.h>
 #include <spa/utils/names.h>
@@ -47,6 +50,49 @@
 
 #define TRACE_BUFFER (16*1024)
 
+#define DEFERRED_BUFFER		(128*1024)		/* for each thread */
+#define DEFERRED_MAX_ARGS	32
+#define DEFERRED_MAX_TEXT	1024
+#define DEFERRED_INTERVAL	(10 * SPA_NSEC_PER_MSEC)
+
+/* In deferred mode, the threads that log don't format the messages. They
+ * copy the format, the arguments and the strings they point to in a record
+ * in a ringbuffer of their own and a separate thread formats and writes the
+ * records of all threads in the order of their timestamps. When the
+ * ringbuffer of a thread is full, its messages are dropped and counted. */
+struct thread_ring {
+	struct spa_list link;
+	struct spa_ringbuffer rb;
+	uint32_t dropped;		/* updated by the thread */
+	uint32_t reported;		/* updated by the log thread */
+	int exited;
+	uint8_t data[DEFERRED_BUFFER];
+};
+
+#define RECORD_FORMATTED	(1<<0)	/* the text is the message, not a format */
+
+/* followed by the arguments and by the text with the format, the file, the
+ * function and the strings of the arguments */
+struct record {
+	uint32_t size;
+	uint16_t level;
+	uint16_t flags;
+	uint32_t n_args;
+	uint32_t text_size;
+	uint64_t time;
+	int32_t line;
+	int32_t err;			/* errno for %m */
+};
+
+#define NO_STRING	UINT32_MAX
+
+union arg {
+	int64_t i;
+	double d;
+	const void *p;
+	uint32_t str;			/* offset in the text or NO_STRING */
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_log log;
@@ -62,26 +108,22 @@ struct impl {
 	unsigned int colors:1;
 	unsigned int timestamp:1;
 	unsigned int line:1;
+	unsigned int deferred:1;
+
+	struct spa_list link;
+	pthread_key_t ring_key;
+	pthread_mutex_t ring_lock;
+	struct spa_list rings;
+	pthread_t thread;
+	int running;
 };
 
-static SPA_PRINTF_FUNC(6,0) void
-impl_log_logv(void *object,
-	      enum spa_log_level level,
-	      const char *file,
-	      int line,
-	      const char *func,
-	      const char *fmt,
-	      va_list args)
+static int format_prefix(struct impl *impl, char *p, int len, enum spa_log_level level,
+		const struct timespec *now, const char *file, int line, const char *func)
 {
-	struct impl *impl = object;
-	char location[1024], *p;
 	static const char *levels[] = { "-", "E", "W", "I", "D", "T", "*T*" };
-	const char *prefix = "", *suffix = "";
-	int size, len;
-	bool do_trace;
-
-	if ((do_trace = (level == SPA_LOG_LEVEL_TRACE && impl->have_source)))
-		level++;
+	const char *prefix = "";
+	int size;
 
 	if (impl->colors) {
 		if (level <= SPA_LOG_LEVEL_ERROR)
@@ -90,31 +132,568 @@ impl_log_logv(void *object,
 			prefix = "\x1B[1;33m";
 		else if (level <= SPA_LOG_LEVEL_INFO)
 			prefix = "\x1B[1;32m";
-		if (prefix[0])
-			suffix = "\x1B[0m";
 	}
 
-	p = location;
-	len = sizeof(location);
-
 	size = snprintf(p, len, "%s[%s]", prefix, levels[level]);
 
 	if (impl->timestamp) {
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 		size += snprintf(p + size, len - size, "[%09lu.%06lu]",
-			now.tv_sec & 0x1FFFFFFF, now.tv_nsec / 1000);
+			now->tv_sec & 0x1FFFFFFF, now->tv_nsec / 1000);
 
 	}
 	if (impl->line && line != 0) {
 		size += snprintf(p + size, len - size, "[%s:%i %s()]",
-			strrchr(file, '/') + 1, line, func);
+			file, line, func);
 	}
 	size += snprintf(p + size, len - size, " ");
-	size += vsnprintf(p + size, len - size, fmt, args);
+	return SPA_MIN(size, len - 1);
+}
+
+static int format_suffix(struct impl *impl, char *p, int len, enum spa_log_level level)
+{
+	int size = 0;
+
+	if (impl->colors && level <= SPA_LOG_LEVEL_INFO)
+		size = snprintf(p, len, "\x1B[0m\n");
+	else if (impl->colors)
+		size = snprintf(p, len, "\n");
+	return SPA_MIN(size, len - 1);
+}
+
+static inline const char *file_name(const char *file)
+{
+	const char *p = strrchr(file, '/');
+	return p ? p + 1 : file;
+}
+
+enum arg_len {
+	LEN_INT,
+	LEN_LONG,
+	LEN_LLONG,
+	LEN_SIZE,
+	LEN_INTMAX,
+	LEN_PTRDIFF,
+	LEN_LDOUBLE,
+};
+
+struct spec {
+	char conv;
+	uint8_t len;
+	bool star_width;
+	bool star_prec;
+	int prec;		/* -1 when there is no precision */
+};
+
+/* parse the conversion after a %, returns what comes after it or NULL when
+ * the conversion can't be deferred */
+static const char *parse_spec(const char *p, struct spec *s)
+{
+	s->len = LEN_INT;
+	s->star_width = s->star_prec = false;
+	s->prec = -1;
+
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'')
+		p++;
+	if (*p == '*') {
+		s->star_width = true;
+		p++;
+	} else {
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			s->star_prec = true;
+			p++;
+		} else {
+			s->prec = 0;
+			while (*p >= '0' && *p <= '9')
+				s->prec = SPA_MIN(s->prec * 10 + (*p++ - '0'), DEFERRED_MAX_TEXT);
+		}
+	}
+	switch (*p) {
+	case 'h':
+		if (*++p == 'h')
+			p++;
+		break;
+	case 'l':
+		if (*++p == 'l') {
+			s->len = LEN_LLONG;
+			p++;
+		} else
+			s->len = LEN_LONG;
+		break;
+	case 'q':
+		s->len = LEN_LLONG;
+		p++;
+		break;
+	case 'L':
+		s->len = LEN_LDOUBLE;
+		p++;
+		break;
+	case 'j':
+		s->len = LEN_INTMAX;
+		p++;
+		break;
+	case 'z':
+	case 'Z':
+		s->len = LEN_SIZE;
+		p++;
+		break;
+	case 't':
+		s->len = LEN_PTRDIFF;
+		p++;
+		break;
+	}
+	switch (*p) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+	case 'p': case 'm':
+		break;
+	case 's':
+		/* wide strings are not copied */
+		if (s->len != LEN_INT)
+			return NULL;
+		break;
+	default:
+		return NULL;
+	}
+	s->conv = *p;
+	return p + 1;
+}
+
+static inline bool is_float(char conv)
+{
+	return strchr("eEfFgGaA", conv) != NULL;
+}
+
+static struct thread_ring *get_ring(struct impl *impl)
+{
+	struct thread_ring *r;
+
+	if (SPA_LIKELY((r = pthread_getspecific(impl->ring_key)) != NULL))
+		return r;
+
+	/* the first message of a thread */
+	if ((r = calloc(1, sizeof(struct thread_ring))) == NULL)
+		return NULL;
+	spa_ringbuffer_init(&r->rb);
+
+	pthread_mutex_lock(&impl->ring_lock);
+	spa_list_append(&impl->rings, &r->link);
+	pthread_mutex_unlock(&impl->ring_lock);
+
+	pthread_setspecific(impl->ring_key, r);
+	return r;
+}
+
+static void ring_exited(void *data)
+{
+	struct thread_ring *r = data;
+	__atomic_store_n(&r->exited, 1, __ATOMIC_RELEASE);
+}
+
+/* copy at most len bytes of str, it does not need to be terminated
+ * when it is longer than that. Returns max when text is full. */
+static inline int copy_text_len(char *text, int size, int max, const char *str, int len)
+{
+	if (size >= max)
+		return max;
+	while (size < max - 1 && len-- > 0 && *str)
+		text[size++] = *str++;
+	text[size++] = '\0';
+	return size;
+}
+
+static inline int copy_text(char *text, int size, int max, const char *str)
+{
+	return copy_text_len(text, size, max, str, max);
+}
+
+static SPA_PRINTF_FUNC(6,0) void
+deferred_logv(struct impl *impl,
+	      enum spa_log_level level,
+	      const char *file,
+	      int line,
+	      const char *func,
+	      const char *fmt,
+	      va_list args)
+{
+	struct thread_ring *r;
+	struct record rec;
+	union arg a[DEFERRED_MAX_ARGS];
+	char text[DEFERRED_MAX_TEXT];
+	struct timespec now;
+	struct spec spec;
+	const char *p;
+	int32_t filled;
+	uint32_t index, n_args = 0, size;
+	int text_size = 0, err = errno;
+	va_list copy;
+
+	if (SPA_UNLIKELY((r = get_ring(impl)) == NULL))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	va_copy(copy, args);
+
+	text_size = copy_text(text, text_size, DEFERRED_MAX_TEXT, fmt);
+	text_size = copy_text(text, text_size, DEFERRED_MAX_TEXT, file ? file_name(file) : "");
+	text_size = copy_text(text, text_size, DEFERRED_MAX_TEXT, func ? func : "");
+
+	rec.flags = 0;
+	if (text_size >= DEFERRED_MAX_TEXT)
+		goto format;
+
+	for (p = fmt; *p; p++) {
+		if (*p != '%')
+			continue;
+		if (p[1] == '%') {
+			p++;
+			continue;
+		}
+		if ((p = parse_spec(p + 1, &spec)) == NULL ||
+		    n_args + 3 > DEFERRED_MAX_ARGS)
+			goto format;
+		p--;
+
+		if (spec.star_width)
+			a[n_args++].i = va_arg(args, int);
+		if (spec.star_prec) {
+			int prec = va_arg(args, int);
+			a[n_args++].i = prec;
+			spec.prec = prec < 0 ? -1 : prec;
+		}
 
-	if (impl->colors)
-		size += snprintf(p + size, len - size, "%s\n", suffix);
+		switch (spec.conv) {
+		case 'm':
+			break;
+		case 'p':
+			a[n_args++].p = va_arg(args, void *);
+			break;
+		case 's':
+		{
+			const char *str = va_arg(args, const char *);
+			if (str == NULL) {
+				a[n_args++].str = NO_STRING;
+			} else {
+				a[n_args++].str = text_size;
+				text_size = copy_text_len(text, text_size, DEFERRED_MAX_TEXT, str,
+						spec.prec < 0 ? DEFERRED_MAX_TEXT : spec.prec);
+				/* the string might be cut, format it here */
+				if (text_size >= DEFERRED_MAX_TEXT)
+					goto format;
+			}
+			break;
+		}
+		default:
+			if (is_float(spec.conv)) {
+				if (spec.len == LEN_LDOUBLE)
+					a[n_args++].d = va_arg(args, long double);
+				else
+					a[n_args++].d = va_arg(args, double);
+				break;
+			}
+			switch (spec.len) {
+			case LEN_LONG:
+				a[n_args++].i = va_arg(args, long);
+				break;
+			case LEN_LLONG:
+			case LEN_LDOUBLE:
+				a[n_args++].i = va_arg(args, long long);
+				break;
+			case LEN_SIZE:
+				a[n_args++].i = va_arg(args, size_t);
+				break;
+			case LEN_INTMAX:
+				a[n_args++].i = va_arg(args, intmax_t);
+				break;
+			case LEN_PTRDIFF:
+				a[n_args++].i = va_arg(args, ptrdiff_t);
+				break;
+			default:
+				a[n_args++].i = va_arg(args, int);
+				break;
+			}
+			break;
+		}
+	}
+	goto done;
+
+format:
+	/* something we can't defer, format it here */
+	n_args = 0;
+	rec.flags = RECORD_FORMATTED;
+	text_size = vsnprintf(text, DEFERRED_MAX_TEXT, fmt, copy);
+	text_size = SPA_CLAMP(text_size, 0, DEFERRED_MAX_TEXT - 1) + 1;
+	text_size = copy_text(text, text_size, DEFERRED_MAX_TEXT, file ? file_name(file) : "");
+	text_size = copy_text(text, text_size, DEFERRED_MAX_TEXT, func ? func : "");
+	text[DEFERRED_MAX_TEXT - 1] = '\0';
+done:
+	va_end(copy);
+
+	rec.level = level;
+	rec.n_args = n_args;
+	rec.text_size = text_size;
+	rec.time = SPA_TIMESPEC_TO_NSEC(&now);
+	rec.line = line;
+	rec.err = err;
+	size = SPA_ROUND_UP_N(sizeof(rec) + n_args * sizeof(union arg) + text_size, 8);
+	rec.size = size;
+
+	filled = spa_ringbuffer_get_write_index(&r->rb, &index);
+	if (SPA_UNLIKELY(filled < 0 || filled + size > DEFERRED_BUFFER)) {
+		__atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	spa_ringbuffer_write_data(&r->rb, r->data, DEFERRED_BUFFER,
+			index & (DEFERRED_BUFFER - 1), &rec, sizeof(rec));
+	spa_ringbuffer_write_data(&r->rb, r->data, DEFERRED_BUFFER,
+			(index + sizeof(rec)) & (DEFERRED_BUFFER - 1),
+			a, n_args * sizeof(union arg));
+	spa_ringbuffer_write_data(&r->rb, r->data, DEFERRED_BUFFER,
+			(index + sizeof(rec) + n_args * sizeof(union arg)) & (DEFERRED_BUFFER - 1),
+			text, text_size);
+	spa_ringbuffer_write_update(&r->rb, index + size);
+}
+
+/* format a deferred message, one conversion at a time */
+static int format_record(char *p, int len, const struct record *rec,
+		const union arg *a, const char *text)
+{
+	const char *f = text, *start;
+	char spec_str[64];
+	struct spec spec;
+	uint32_t n = 0;
+	int size = 0, res;
+
+#define APPEND(...)							\
+	if ((res = snprintf(p + size, len - size, __VA_ARGS__)) > 0)	\
+		size = SPA_MIN(size + res, len - 1);
+
+	while (*f && size < len - 1) {
+		int sl = 0;
+
+		if (*f != '%' || f[1] == '%') {
+			p[size++] = *f;
+			f += *f == '%' ? 2 : 1;
+			p[size] = '\0';
+			continue;
+		}
+		start = f;
+		f = parse_spec(f + 1, &spec);
+
+		/* make a spec for one argument, with the width and precision filled in */
+		while (start < f && sl < (int)sizeof(spec_str) - 16) {
+			if (*start == '*') {
+				int v = n < rec->n_args ? (int)a[n++].i : 0;
+				sl += snprintf(spec_str + sl, sizeof(spec_str) - sl, "%d", v);
+			} else {
+				spec_str[sl++] = *start;
+			}
+			start++;
+		}
+		spec_str[sl] = '\0';
+
+		if (spec.conv != 'm' && n >= rec->n_args)
+			break;
+
+		switch (spec.conv) {
+		case 'm':
+			APPEND("%s", strerror(rec->err));
+			break;
+		case 'p':
+			APPEND(spec_str, a[n++].p);
+			break;
+		case 's':
+			APPEND(spec_str, a[n].str == NO_STRING ? NULL : text + a[n].str);
+			n++;
+			break;
+		default:
+			if (is_float(spec.conv)) {
+				if (spec.len == LEN_LDOUBLE) {
+					APPEND(spec_str, (long double)a[n++].d);
+				} else {
+					APPEND(spec_str, a[n++].d);
+				}
+				break;
+			}
+			switch (spec.len) {
+			case LEN_LONG:
+				APPEND(spec_str, (long)a[n++].i);
+				break;
+			case LEN_LLONG:
+			case LEN_LDOUBLE:
+				APPEND(spec_str, (long long)a[n++].i);
+				break;
+			case LEN_SIZE:
+				APPEND(spec_str, (size_t)a[n++].i);
+				break;
+			case LEN_INTMAX:
+				APPEND(spec_str, (intmax_t)a[n++].i);
+				break;
+			case LEN_PTRDIFF:
+				APPEND(spec_str, (ptrdiff_t)a[n++].i);
+				break;
+			default:
+				APPEND(spec_str, (int)a[n++].i);
+				break;
+			}
+			break;
+		}
+	}
+#undef APPEND
+	return size;
+}
+
+static void write_record(struct impl *impl, const struct record *rec,
+		const union arg *a, const char *text)
+{
+	char location[1024];
+	const char *file, *func;
+	struct timespec now;
+	int size, len = sizeof(location);
+
+	file = text + strlen(text) + 1;
+	func = file + strlen(file) + 1;
+	now.tv_sec = rec->time / SPA_NSEC_PER_SEC;
+	now.tv_nsec = rec->time % SPA_NSEC_PER_SEC;
+
+	size = format_prefix(impl, location, len, rec->level, &now, file, rec->line, func);
+	if (rec->flags & RECORD_FORMATTED)
+		size += snprintf(location + size, len - size, "%s", text);
+	else
+		size += format_record(location + size, len - size, rec, a, text);
+	size = SPA_MIN(size, len - 1);
+	format_suffix(impl, location + size, len - size, rec->level);
+
+	fputs(location, impl->file);
+}
+
+/* write the records of all threads in the order of their timestamps */
+static void flush_deferred(struct impl *impl)
+{
+	struct thread_ring *r, *t;
+	uint64_t buffer[(sizeof(struct record) +
+			DEFERRED_MAX_ARGS * sizeof(union arg) + DEFERRED_MAX_TEXT) / 8 + 1];
+	struct record *rec = (struct record *) buffer;
+	uint32_t index;
+
+	pthread_mutex_lock(&impl->ring_lock);
+	while (true) {
+		struct thread_ring *best = NULL;
+		uint32_t best_index = 0;
+		uint64_t best_time = UINT64_MAX;
+
+		spa_list_for_each(r, &impl->rings, link) {
+			struct record hdr;
+
+			if (spa_ringbuffer_get_read_index(&r->rb, &index) < (int32_t)sizeof(hdr))
+				continue;
+			spa_ringbuffer_read_data(&r->rb, r->data, DEFERRED_BUFFER,
+					index & (DEFERRED_BUFFER - 1), &hdr, sizeof(hdr));
+			if (hdr.time < best_time) {
+				best = r;
+				best_index = index;
+				best_time = hdr.time;
+			}
+		}
+		if (best == NULL)
+			break;
+
+		spa_ringbuffer_read_data(&best->rb, best->data, DEFERRED_BUFFER,
+				best_index & (DEFERRED_BUFFER - 1), rec, sizeof(*rec));
+		spa_ringbuffer_read_data(&best->rb, best->data, DEFERRED_BUFFER,
+				(best_index + sizeof(*rec)) & (DEFERRED_BUFFER - 1),
+				SPA_MEMBER(rec, sizeof(*rec), void), rec->size - sizeof(*rec));
+		spa_ringbuffer_read_update(&best->rb, best_index + rec->size);
+
+		write_record(impl, rec, SPA_MEMBER(rec, sizeof(*rec), union arg),
+				SPA_MEMBER(rec, sizeof(*rec) + rec->n_args * sizeof(union arg), char));
+	}
+	spa_list_for_each_safe(r, t, &impl->rings, link) {
+		uint32_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+
+		if (dropped != r->reported) {
+			fprintf(impl->file, "%s[W] %u log messages dropped%s\n",
+					impl->colors ? "\x1B[1;33m" : "",
+					dropped - r->reported,
+					impl->colors ? "\x1B[0m" : "");
+			r->reported = dropped;
+		}
+		if (__atomic_load_n(&r->exited, __ATOMIC_ACQUIRE) &&
+		    spa_ringbuffer_get_read_index(&r->rb, &index) == 0) {
+			spa_list_remove(&r->link);
+			free(r);
+		}
+	}
+	pthread_mutex_unlock(&impl->ring_lock);
+
+	fflush(impl->file);
+}
+
+/* the deferred loggers, the messages they have left are written when the
+ * process exits */
+static pthread_mutex_t deferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct spa_list deferred_loggers = { &deferred_loggers, &deferred_loggers };
+
+static void __attribute__((destructor)) flush_at_exit(void)
+{
+	struct impl *impl;
+
+	pthread_mutex_lock(&deferred_lock);
+	spa_list_for_each(impl, &deferred_loggers, link)
+		flush_deferred(impl);
+	pthread_mutex_unlock(&deferred_lock);
+}
+
+static void *deferred_thread(void *data)
+{
+	struct impl *impl = data;
+	struct timespec ts = { 0, DEFERRED_INTERVAL };
+
+	while (__atomic_load_n(&impl->running, __ATOMIC_ACQUIRE)) {
+		nanosleep(&ts, NULL);
+		flush_deferred(impl);
+	}
+	return NULL;
+}
+
+static SPA_PRINTF_FUNC(6,0) void
+impl_log_logv(void *object,
+	      enum spa_log_level level,
+	      const char *file,
+	      int line,
+	      const char *func,
+	      const char *fmt,
+	      va_list args)
+{
+	struct impl *impl = object;
+	char location[1024], *p;
+	struct timespec now;
+	int size, len;
+	bool do_trace;
+
+	if (impl->deferred) {
+		deferred_logv(impl, level, file, line, func, fmt, args);
+		return;
+	}
+
+	if ((do_trace = (level == SPA_LOG_LEVEL_TRACE && impl->have_source)))
+		level++;
+
+	p = location;
+	len = sizeof(location);
+
+	if (impl->timestamp)
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	size = format_prefix(impl, p, len, level, &now, file_name(file), line, func);
+	size += vsnprintf(p + size, len - size, fmt, args);
+	size = SPA_MIN(size, len - 1);
+	size += format_suffix(impl, p + size, len - size, level);
 
 	if (SPA_UNLIKELY(do_trace)) {
 		uint32_t index;
@@ -211,6 +790,25 @@ static int impl_clear(struct spa_handle *handle)
 		spa_system_close(this->system, this->source.fd);
 		this->have_source = false;
 	}
+	if (this->deferred) {
+		struct thread_ring *r;
+
+		pthread_mutex_lock(&deferred_lock);
+		spa_list_remove(&this->link);
+		pthread_mutex_unlock(&deferred_lock);
+
+		__atomic_store_n(&this->running, 0, __ATOMIC_RELEASE);
+		pthread_join(this->thread, NULL);
+		flush_deferred(this);
+
+		spa_list_consume(r, &this->rings, link) {
+			spa_list_remove(&r->link);
+			free(r);
+		}
+		pthread_key_delete(this->ring_key);
+		pthread_mutex_destroy(&this->ring_lock);
+		this->deferred = false;
+	}
 	return 0;
 }
 
@@ -272,6 +870,8 @@ impl_init(const struct spa_handle_factory *factory,
 			this->colors = (strcmp(str, "true") == 0 || atoi(str) == 1);
 		if ((str = spa_dict_lookup(info, SPA_KEY_LOG_LEVEL)) != NULL)
 			this->log.level = atoi(str);
+		if ((str = spa_dict_lookup(info, SPA_KEY_LOG_DEFERRED)) != NULL)
+			this->deferred = (strcmp(str, "true") == 0 || atoi(str) == 1);
 		if ((str = spa_dict_lookup(info, SPA_KEY_LOG_FILE)) != NULL) {
 			this->file = fopen(str, "w");
 			if (this->file == NULL)
@@ -283,6 +883,25 @@ impl_init(const struct spa_handle_factory *factory,
 
 	spa_ringbuffer_init(&this->trace_rb);
 
+	if (this->deferred) {
+		int res;
+
+		spa_list_init(&this->rings);
+		pthread_mutex_init(&this->ring_lock, NULL);
+		pthread_key_create(&this->ring_key, ring_exited);
+		this->running = 1;
+		if ((res = pthread_create(&this->thread, NULL, deferred_thread, this)) != 0) {
+			fprintf(stderr, "Warning: failed to start log thread: %s\n", strerror(res));
+			pthread_key_delete(this->ring_key);
+			pthread_mutex_destroy(&this->ring_lock);
+			this->deferred = false;
+		} else {
+			pthread_mutex_lock(&deferred_lock);
+			spa_list_append(&deferred_loggers, &this->link);
+			pthread_mutex_unlock(&deferred_lock);
+		}
+	}
+
 	spa_log_debug(&this->log, NAME " %p: initialized", this);
 
 	return 0;
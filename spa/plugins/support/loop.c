@@ -38,27 +38,58 @@
 #include <spa/utils/names.h>
 #include <spa/utils/result.h>
 #include <spa/utils/type.h>
-#include <spa/utils/ringbuffer.h>
 
 #define NAME "loop"
 
 #define DATAS_SIZE (4096 * 8)
+#define ITEM_ALIGN 8
+
+/* the timers of the loop share one timerfd. They are kept in a hierarchical
+ * timer wheel, a slot in level 0 is one tick and a slot in each next level
+ * is as long as all the slots of the level before it. */
+#define TIMER_TICK_SHIFT	20		/* a tick is about 1 msec */
+#define TIMER_LEVEL_BITS	6
+#define TIMER_LEVEL_SIZE	(1u << TIMER_LEVEL_BITS)
+#define TIMER_LEVEL_MASK	(TIMER_LEVEL_SIZE - 1)
+#define TIMER_LEVELS		6
+#define TIMER_MAX_TICKS		(1ull << (TIMER_LEVEL_BITS * TIMER_LEVELS))
 
 /** \cond */
 
+/* result of a blocking invoke, lives on the stack of the invoking thread */
+struct invoke_result {
+	int res;
+	bool done;
+};
+
+/* The invoke queue is written by any number of threads and read by the
+ * loop thread. A thread reserves space by moving write_index with a CAS,
+ * fills the item and then sets ready. The loop thread handles the items
+ * in order as long as they are ready and clears the space of each item
+ * before it is reused, so that free space never looks like a ready item. */
 struct invoke_item {
-	size_t item_size;
+	uint32_t item_size;
+	uint32_t ready;
 	spa_invoke_func_t func;
 	uint32_t seq;
 	void *data;
 	size_t size;
-	bool block;
+	struct invoke_result *result;
 	void *user_data;
-	int res;
 };
 
 static int loop_signal_event(void *object, struct spa_source *source);
 
+struct timer_wheel {
+	pthread_mutex_t lock;		/* timers can be updated from any thread */
+	struct spa_source *source;	/* the timerfd */
+	uint64_t now;			/* the tick where the wheel was run last */
+	uint64_t next;			/* when the timerfd expires, 0 when disarmed */
+	uint64_t pending[TIMER_LEVELS];	/* the slots that have timers */
+	struct spa_list slots[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+	struct spa_list expired;
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_loop loop;
@@ -76,10 +107,20 @@ struct impl {
 	pthread_t thread;
 
 	struct spa_source *wakeup;
-	int ack_fd;
+	uint32_t wakeup_pending;	/* the loop thread will flush the queue */
+	bool flushing;
+
+	pthread_mutex_t lock;		/* for the blocking invokes */
+	pthread_cond_t cond;
 
-	struct spa_ringbuffer buffer;
-	uint8_t buffer_data[DATAS_SIZE];
+	/* the indexes are kept apart so that they don't share a cache line */
+	uint32_t write_index;		/* reserved by the invoking threads */
+	uint8_t padding1[64];
+	uint32_t read_index;		/* handled by the loop thread */
+	uint8_t padding2[64];
+	uint8_t buffer_data[DATAS_SIZE] SPA_ALIGNED(ITEM_ALIGN);
+
+	struct timer_wheel timers;
 };
 
 struct source_impl {
@@ -98,6 +139,17 @@ struct source_impl {
 	} func;
 	bool enabled;
 	struct spa_source *fallback;
+
+	/* timers */
+	bool timer;
+	bool armed;			/* in a slot of the wheel or expired */
+	int level;			/* level of the slot, -1 when expired */
+	uint32_t slot;
+	struct spa_list timer_link;
+	uint64_t expire;		/* when the timer expires */
+	uint64_t fire;			/* when the timer fires, with the slack */
+	uint64_t interval;
+	uint64_t slack;
 };
 /** \endcond */
 
@@ -121,30 +173,101 @@ static int loop_remove_source(void *object, struct spa_source *source)
 	return spa_system_pollfd_del(impl->system, impl->poll_fd, source->fd);
 }
 
-static void flush_items(struct impl *impl, bool async)
+static void flush_items(struct impl *impl)
 {
-	uint32_t index;
-	int res;
+	uint32_t index = impl->read_index;
+
+	/* an invoke from one of the items runs right away, the items after
+	 * it are handled when it returns */
+	if (impl->flushing)
+		return;
+	impl->flushing = true;
 
-	while (spa_ringbuffer_get_read_index(&impl->buffer, &index) > 0) {
+	while (true) {
 		struct invoke_item *item;
-		bool block;
+		uint32_t offset, item_size, l0;
+		int res;
 
-		item = SPA_MEMBER(impl->buffer_data, index & (DATAS_SIZE - 1), struct invoke_item);
-		block = item->block;
+		offset = index & (DATAS_SIZE - 1);
+		item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
+		if (!__atomic_load_n(&item->ready, __ATOMIC_ACQUIRE))
+			break;
 
-		item->res = item->func ? item->func(&impl->loop,
+		res = item->func ? item->func(&impl->loop,
 				true, item->seq, item->data, item->size,
 			   item->user_data) : 0;
 
-		spa_ringbuffer_read_update(&impl->buffer, index + item->item_size);
-
-		if (block && async) {
-			if ((res = spa_system_eventfd_write(impl->system, impl->ack_fd, 1)) < 0)
-				spa_log_warn(impl->log, NAME " %p: failed to write event fd: %s",
-						impl, spa_strerror(res));
+		if (item->result) {
+			pthread_mutex_lock(&impl->lock);
+			item->result->res = res;
+			item->result->done = true;
+			pthread_cond_broadcast(&impl->cond);
+			pthread_mutex_unlock(&impl->lock);
 		}
+
+		/* the data of an item can wrap around to the start */
+		item_size = item->item_size;
+		l0 = DATAS_SIZE - offset;
+		memset(item, 0, SPA_MIN(item_size, l0));
+		if (item_size > l0)
+			memset(impl->buffer_data, 0, item_size - l0);
+
+		index += item_size;
+		__atomic_store_n(&impl->read_index, index, __ATOMIC_RELEASE);
+	}
+	impl->flushing = false;
+}
+
+static struct invoke_item *reserve_item(struct impl *impl, size_t size,
+		uint32_t *item_size, void **data)
+{
+	uint32_t ridx, idx, offset, l0, avail, needed;
+	bool wrap;
+	int32_t filled;
+
+	size = SPA_ROUND_UP_N(size, ITEM_ALIGN);
+	if (size > DATAS_SIZE - sizeof(struct invoke_item)) {
+		errno = ENOSPC;
+		return NULL;
 	}
+
+	do {
+		/* load the read index first, it can't get past the write index */
+		ridx = __atomic_load_n(&impl->read_index, __ATOMIC_ACQUIRE);
+		idx = __atomic_load_n(&impl->write_index, __ATOMIC_RELAXED);
+		filled = idx - ridx;
+		if (filled < 0 || filled > DATAS_SIZE) {
+			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
+			errno = EPIPE;
+			return NULL;
+		}
+		avail = DATAS_SIZE - filled;
+		offset = idx & (DATAS_SIZE - 1);
+		l0 = DATAS_SIZE - offset;
+
+		needed = sizeof(struct invoke_item) + size;
+		wrap = l0 < needed;
+		if (!wrap) {
+			/* when there is no room for the next item at the
+			 * end, it is added to this item */
+			if (l0 < sizeof(struct invoke_item) + needed)
+				needed = l0;
+		} else {
+			/* the data goes to the start of the buffer */
+			needed = l0 + size;
+		}
+		if (avail < needed) {
+			spa_log_warn(impl->log, NAME " %p: queue full %d", impl, avail);
+			errno = EPIPE;
+			return NULL;
+		}
+	} while (!__atomic_compare_exchange_n(&impl->write_index, &idx, idx + needed,
+				true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	*item_size = needed;
+	*data = wrap ? impl->buffer_data :
+		SPA_MEMBER(impl->buffer_data, offset + sizeof(struct invoke_item), void);
+	return SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
 }
 
 static int
@@ -159,65 +282,46 @@ loop_invoke(void *object,
 	struct impl *impl = object;
 	bool in_thread = pthread_equal(impl->thread, pthread_self());
 	struct invoke_item *item;
+	struct invoke_result result = { 0, false };
+	uint32_t item_size;
+	void *item_data;
 	int res;
 
 	if (in_thread) {
-		flush_items(impl, false);
+		flush_items(impl);
 		res = func ? func(&impl->loop, false, seq, data, size, user_data) : 0;
 	} else {
-		int32_t filled;
-		uint32_t avail, idx, offset, l0;
-
-		filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
-		if (filled < 0 || filled > DATAS_SIZE) {
-			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
-			return -EPIPE;
-		}
-		avail = DATAS_SIZE - filled;
-		if (avail < sizeof(struct invoke_item)) {
-			spa_log_warn(impl->log, NAME " %p: queue full %d", impl, avail);
-			return -EPIPE;
-		}
-		offset = idx & (DATAS_SIZE - 1);
+		if ((item = reserve_item(impl, size, &item_size, &item_data)) == NULL)
+			return -errno;
 
-		l0 = DATAS_SIZE - offset;
-
-		item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
+		item->item_size = item_size;
 		item->func = func;
 		item->seq = seq;
+		item->data = item_data;
 		item->size = size;
-		item->block = block;
+		item->result = block ? &result : NULL;
 		item->user_data = user_data;
-
-		spa_log_trace(impl->log, NAME " %p: add item %p filled:%d", impl, item, filled);
-
-		if (l0 > sizeof(struct invoke_item) + size) {
-			item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
-			item->item_size = sizeof(struct invoke_item) + size;
-			if (l0 < sizeof(struct invoke_item) + item->item_size)
-				item->item_size = l0;
-		} else {
-			item->data = impl->buffer_data;
-			item->item_size = l0 + size;
-		}
 		memcpy(item->data, data, size);
 
-		spa_ringbuffer_write_update(&impl->buffer, idx + item->item_size);
+		spa_log_trace(impl->log, NAME " %p: add item %p size:%u", impl, item, item_size);
 
-		loop_signal_event(impl, impl->wakeup);
+		__atomic_store_n(&item->ready, 1, __ATOMIC_RELEASE);
 
-		if (block) {
-			uint64_t count = 1;
+		/* only the first item after a flush wakes up the loop */
+		if (!__atomic_exchange_n(&impl->wakeup_pending, 1, __ATOMIC_SEQ_CST))
+			loop_signal_event(impl, impl->wakeup);
 
+		if (block) {
 			spa_loop_control_hook_before(&impl->hooks_list);
 
-			if ((res = spa_system_eventfd_read(impl->system, impl->ack_fd, &count)) < 0)
-				spa_log_warn(impl->log, NAME " %p: failed to read event fd: %s",
-						impl, spa_strerror(res));
+			pthread_mutex_lock(&impl->lock);
+			while (!result.done)
+				pthread_cond_wait(&impl->cond, &impl->lock);
+			pthread_mutex_unlock(&impl->lock);
 
 			spa_loop_control_hook_after(&impl->hooks_list);
 
-			res = item->res;
+			res = result.res;
 		}
 		else {
 			if (seq != SPA_ID_INVALID)
@@ -232,7 +336,8 @@ loop_invoke(void *object,
 static void wakeup_func(void *data, uint64_t count)
 {
 	struct impl *impl = data;
-	flush_items(impl, true);
+	__atomic_exchange_n(&impl->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+	flush_items(impl);
 }
 
 static int loop_get_fd(void *object)
@@ -507,18 +612,228 @@ static int loop_signal_event(void *object, struct spa_source *source)
 	return res;
 }
 
-static void source_timer_func(struct spa_source *source)
+static uint64_t get_time(struct impl *impl)
 {
-	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
-	uint64_t expirations;
+	struct timespec ts;
+	spa_system_clock_gettime(impl->system, CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+/* fire somewhere between the expire time and the slack after it, on a time
+ * with as many low bits cleared as possible so that timers with slack
+ * that expire around the same time fire together */
+static inline uint64_t apply_slack(uint64_t expire, uint64_t slack)
+{
+	uint64_t limit = expire + slack, mask;
+
+	if (slack == 0 || (mask = expire ^ limit) == 0)
+		return expire;
+	mask = (1ull << (63 - __builtin_clzll(mask))) - 1;
+	return limit & ~mask;
+}
+
+/* the distance from index to the next slot with timers, -1 when there are none */
+static inline int next_pending(uint64_t pending, uint32_t index)
+{
+	if (pending == 0)
+		return -1;
+	if (index)
+		pending = (pending >> index) | (pending << (TIMER_LEVEL_SIZE - index));
+	return __builtin_ctzll(pending);
+}
+
+static void wheel_insert(struct timer_wheel *w, struct source_impl *s)
+{
+	uint64_t tick = s->fire >> TIMER_TICK_SHIFT, delta;
+	uint32_t level = 0;
+
+	if (tick < w->now)
+		tick = w->now;
+	delta = tick - w->now;
+	if (delta >= TIMER_MAX_TICKS) {
+		/* put it in the last slot, it's moved again when that expires */
+		tick = w->now + TIMER_MAX_TICKS - 1;
+		delta = TIMER_MAX_TICKS - 1;
+	}
+	if (delta >= TIMER_LEVEL_SIZE)
+		level = (63 - __builtin_clzll(delta)) / TIMER_LEVEL_BITS;
+
+	s->level = level;
+	s->slot = (tick >> (level * TIMER_LEVEL_BITS)) & TIMER_LEVEL_MASK;
+	spa_list_append(&w->slots[level][s->slot], &s->timer_link);
+	w->pending[level] |= 1ull << s->slot;
+}
+
+static void wheel_remove(struct timer_wheel *w, struct source_impl *s)
+{
+	spa_list_remove(&s->timer_link);
+	if (s->level >= 0 && spa_list_is_empty(&w->slots[s->level][s->slot]))
+		w->pending[s->level] &= ~(1ull << s->slot);
+	s->armed = false;
+}
+
+static inline void wheel_expire(struct timer_wheel *w, struct source_impl *s)
+{
+	spa_list_remove(&s->timer_link);
+	s->level = -1;
+	spa_list_append(&w->expired, &s->timer_link);
+}
+
+/* find the slot that expires first. Level 0 slots start at their tick, the
+ * slots of the other levels start after the current tick. When they start
+ * at the same tick, the slot of the higher level is returned. */
+static uint64_t wheel_next_slot(struct timer_wheel *w, int *level, uint32_t *slot)
+{
+	uint64_t start, best = UINT64_MAX;
+	uint32_t l, shift, index;
+	int d;
+
+	for (l = 0; l < TIMER_LEVELS; l++) {
+		shift = l * TIMER_LEVEL_BITS;
+		index = (w->now >> shift) & TIMER_LEVEL_MASK;
+		if (l == 0) {
+			if ((d = next_pending(w->pending[0], index)) < 0)
+				continue;
+			start = w->now + d;
+		} else {
+			if ((d = next_pending(w->pending[l], (index + 1) & TIMER_LEVEL_MASK)) < 0)
+				continue;
+			start = ((w->now >> shift) + d + 1) << shift;
+		}
+		if (start <= best) {
+			best = start;
+			*level = l;
+			*slot = (start >> shift) & TIMER_LEVEL_MASK;
+		}
+	}
+	return best;
+}
+
+/* move the timers that fire before now to the expired list and the timers
+ * of the slots that started to the lower levels */
+static void wheel_run(struct timer_wheel *w, uint64_t now)
+{
+	uint64_t start, tick = now >> TIMER_TICK_SHIFT;
+	struct source_impl *s, *t;
+	struct spa_list list;
+	uint32_t slot;
+	int level;
+
+	while ((start = wheel_next_slot(w, &level, &slot)) <= tick) {
+		if (level == 0 && start == tick)
+			break;
+
+		w->now = start;
+		spa_list_init(&list);
+		spa_list_insert_list(&list, &w->slots[level][slot]);
+		spa_list_init(&w->slots[level][slot]);
+		w->pending[level] &= ~(1ull << slot);
+
+		spa_list_consume(s, &list, timer_link) {
+			spa_list_remove(&s->timer_link);
+			if (s->fire <= now) {
+				s->level = -1;
+				spa_list_append(&w->expired, &s->timer_link);
+			} else {
+				wheel_insert(w, s);
+			}
+		}
+	}
+	w->now = tick;
+
+	/* the slot of the current tick only has the timers that fire before now */
+	slot = tick & TIMER_LEVEL_MASK;
+	if (w->pending[0] & (1ull << slot)) {
+		spa_list_for_each_safe(s, t, &w->slots[0][slot], timer_link) {
+			if (s->fire <= now)
+				wheel_expire(w, s);
+		}
+		if (spa_list_is_empty(&w->slots[0][slot]))
+			w->pending[0] &= ~(1ull << slot);
+	}
+}
+
+/* when the timerfd needs to expire, 0 when there are no timers */
+static uint64_t wheel_next_time(struct timer_wheel *w)
+{
+	struct source_impl *s;
+	uint64_t start, next;
+	uint32_t slot;
+	int level;
+
+	if (!spa_list_is_empty(&w->expired))
+		return 1;
+	if ((start = wheel_next_slot(w, &level, &slot)) == UINT64_MAX)
+		return 0;
+	if (level > 0)
+		return SPA_MAX(start << TIMER_TICK_SHIFT, 1ull);
+
+	next = UINT64_MAX;
+	spa_list_for_each(s, &w->slots[0][slot], timer_link)
+		next = SPA_MIN(next, s->fire);
+	return next;
+}
+
+/* the timerfd is set again when a timer fires before it. When the first
+ * timer is removed, the timerfd expires for nothing and is set again then. */
+static void timers_update(struct impl *impl, bool force)
+{
+	struct timer_wheel *w = &impl->timers;
+	struct itimerspec its;
+	uint64_t next;
 	int res;
 
-	if (SPA_UNLIKELY((res = spa_system_timerfd_read(impl->impl->system,
-				source->fd, &expirations)) < 0))
-		spa_log_warn(impl->impl->log, NAME " %p: failed to read timer fd %d: %s",
-				source, source->fd, spa_strerror(res));
+	next = wheel_next_time(w);
+	if (!force && (next == 0 || (w->next != 0 && next >= w->next)))
+		return;
+	if (next == w->next)
+		return;
+
+	w->next = next;
+	spa_zero(its);
+	its.it_value.tv_sec = next / SPA_NSEC_PER_SEC;
+	its.it_value.tv_nsec = next % SPA_NSEC_PER_SEC;
+	if (SPA_UNLIKELY((res = spa_system_timerfd_settime(impl->system,
+				w->source->fd, SPA_FD_TIMER_ABSTIME, &its, NULL)) < 0))
+		spa_log_warn(impl->log, NAME " %p: failed to set timer fd %d: %s",
+				impl, w->source->fd, spa_strerror(res));
+}
+
+static void timers_func(void *data, int fd, uint32_t mask)
+{
+	struct impl *impl = data;
+	struct timer_wheel *w = &impl->timers;
+	struct source_impl *s;
+	uint64_t expirations, now;
+
+	/* this fails when the timerfd was set again after it expired */
+	spa_system_timerfd_read(impl->system, fd, &expirations);
+
+	pthread_mutex_lock(&w->lock);
+	w->next = 0;
+	now = get_time(impl);
+	wheel_run(w, now);
+
+	while (!spa_list_is_empty(&w->expired)) {
+		s = spa_list_first(&w->expired, struct source_impl, timer_link);
+		wheel_remove(w, s);
+
+		expirations = 1;
+		if (s->interval > 0) {
+			expirations = (now - s->expire) / s->interval + 1;
+			s->expire += expirations * s->interval;
+			s->fire = apply_slack(s->expire, s->slack);
+			s->armed = true;
+			wheel_insert(w, s);
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		s->func.timer(s->source.data, expirations);
 
-	impl->func.timer(source->data, expirations);
+		pthread_mutex_lock(&w->lock);
+	}
+	timers_update(impl, true);
+	pthread_mutex_unlock(&w->lock);
 }
 
 static struct spa_source *loop_add_timer(void *object,
@@ -526,39 +841,21 @@ static struct spa_source *loop_add_timer(void *object,
 {
 	struct impl *impl = object;
 	struct source_impl *source;
-	int res;
 
 	source = calloc(1, sizeof(struct source_impl));
 	if (source == NULL)
-		goto error_exit;
-
-	if ((res = spa_system_timerfd_create(impl->system, CLOCK_MONOTONIC,
-			SPA_FD_CLOEXEC | SPA_FD_NONBLOCK)) < 0)
-		goto error_exit_free;
+		return NULL;
 
 	source->source.loop = &impl->loop;
-	source->source.func = source_timer_func;
 	source->source.data = data;
-	source->source.fd = res;
-	source->source.mask = SPA_IO_IN;
+	source->source.fd = -1;
 	source->impl = impl;
-	source->close = true;
+	source->timer = true;
 	source->func.timer = func;
 
-	if ((res = loop_add_source(impl, &source->source)) < 0)
-		goto error_exit_close;
-
 	spa_list_insert(&impl->source_list, &source->link);
 
 	return &source->source;
-
-error_exit_close:
-	spa_system_close(impl->system, source->source.fd);
-error_exit_free:
-	free(source);
-	errno = -res;
-error_exit:
-	return NULL;
 }
 
 static int
@@ -566,23 +863,59 @@ loop_update_timer(void *object, struct spa_source *source,
 		  struct timespec *value, struct timespec *interval, bool absolute)
 {
 	struct impl *impl = object;
-	struct itimerspec its;
-	int flags = 0, res;
+	struct timer_wheel *w = &impl->timers;
+	struct source_impl *s = SPA_CONTAINER_OF(source, struct source_impl, source);
+	uint64_t now, expire = 0;
 
-	spa_zero(its);
+	/* like timerfd_settime(), a zero value disarms the timer */
 	if (SPA_LIKELY(value)) {
-		its.it_value = *value;
+		expire = SPA_TIMESPEC_TO_NSEC(value);
 	} else if (interval) {
-		its.it_value = *interval;
+		expire = SPA_TIMESPEC_TO_NSEC(interval);
 		absolute = true;
 	}
-	if (SPA_UNLIKELY(interval))
-		its.it_interval = *interval;
-	if (SPA_LIKELY(absolute))
-		flags |= SPA_FD_TIMER_ABSTIME;
 
-	if (SPA_UNLIKELY((res = spa_system_timerfd_settime(impl->system, source->fd, flags, &its, NULL)) < 0))
-		return res;
+	pthread_mutex_lock(&w->lock);
+	if (s->armed)
+		wheel_remove(w, s);
+
+	if (expire != 0) {
+		now = get_time(impl);
+		/* bring the wheel to now, the timers that expired are handled
+		 * by the timerfd */
+		wheel_run(w, now);
+		if (!absolute)
+			expire += now;
+
+		s->expire = expire;
+		s->interval = interval ? SPA_TIMESPEC_TO_NSEC(interval) : 0;
+		s->fire = apply_slack(expire, s->slack);
+		s->armed = true;
+		wheel_insert(w, s);
+		timers_update(impl, false);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return 0;
+}
+
+static int
+loop_set_timer_slack(void *object, struct spa_source *source, uint64_t slack)
+{
+	struct impl *impl = object;
+	struct timer_wheel *w = &impl->timers;
+	struct source_impl *s = SPA_CONTAINER_OF(source, struct source_impl, source);
+
+	pthread_mutex_lock(&w->lock);
+	s->slack = slack;
+	if (s->armed && s->level >= 0) {
+		wheel_remove(w, s);
+		s->fire = apply_slack(s->expire, slack);
+		s->armed = true;
+		wheel_insert(w, s);
+		timers_update(impl, false);
+	}
+	pthread_mutex_unlock(&w->lock);
 
 	return 0;
 }
@@ -650,6 +983,13 @@ static void loop_destroy_source(void *object, struct spa_source *source)
 
 	if (impl->fallback)
 		loop_destroy_source(impl->impl, impl->fallback);
+	else if (impl->timer) {
+		struct timer_wheel *w = &impl->impl->timers;
+		pthread_mutex_lock(&w->lock);
+		if (impl->armed)
+			wheel_remove(w, impl);
+		pthread_mutex_unlock(&w->lock);
+	}
 	else if (source->loop)
 		loop_remove_source(impl->impl, source);
 
@@ -689,6 +1029,7 @@ static const struct spa_loop_utils_methods impl_loop_utils = {
 	.update_timer = loop_update_timer,
 	.add_signal = loop_add_signal,
 	.destroy_source = loop_destroy_source,
+	.set_timer_slack = loop_set_timer_slack,
 };
 
 static int impl_get_interface(struct spa_handle *handle, const char *type, void **interface)
@@ -726,9 +1067,12 @@ static int impl_clear(struct spa_handle *handle)
 
 	process_destroy(impl);
 
-	spa_system_close(impl->system, impl->ack_fd);
 	spa_system_close(impl->system, impl->poll_fd);
 
+	pthread_mutex_destroy(&impl->timers.lock);
+	pthread_cond_destroy(&impl->cond);
+	pthread_mutex_destroy(&impl->lock);
+
 	return 0;
 }
 
@@ -747,6 +1091,7 @@ impl_init(const struct spa_handle_factory *factory,
 	  uint32_t n_support)
 {
 	struct impl *impl;
+	uint32_t i, j;
 	int res;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
@@ -789,29 +1134,49 @@ impl_init(const struct spa_handle_factory *factory,
 	spa_list_init(&impl->destroy_list);
 	spa_hook_list_init(&impl->hooks_list);
 
-	spa_ringbuffer_init(&impl->buffer);
+	impl->write_index = impl->read_index = 0;
+	memset(impl->buffer_data, 0, sizeof(impl->buffer_data));
+	pthread_mutex_init(&impl->lock, NULL);
+	pthread_cond_init(&impl->cond, NULL);
 
 	impl->wakeup = loop_add_event(impl, wakeup_func, impl);
 	if (impl->wakeup == NULL) {
 		res = -errno;
 		spa_log_error(impl->log, NAME " %p: can't create wakeup event: %m", impl);
-		goto error_exit_free_poll;
+		goto error_exit_free_lock;
 	}
-	if ((res = spa_system_eventfd_create(impl->system,
-			SPA_FD_EVENT_SEMAPHORE | SPA_FD_CLOEXEC)) < 0) {
-		spa_log_error(impl->log, NAME " %p: can't create ack event: %s",
+
+	pthread_mutex_init(&impl->timers.lock, NULL);
+	for (i = 0; i < TIMER_LEVELS; i++)
+		for (j = 0; j < TIMER_LEVEL_SIZE; j++)
+			spa_list_init(&impl->timers.slots[i][j]);
+	spa_list_init(&impl->timers.expired);
+
+	if ((res = spa_system_timerfd_create(impl->system, CLOCK_MONOTONIC,
+			SPA_FD_CLOEXEC | SPA_FD_NONBLOCK)) < 0) {
+		spa_log_error(impl->log, NAME " %p: can't create timer fd: %s",
 				impl, spa_strerror(res));
-		goto error_exit_free_wakeup;
+		goto error_exit_free_timers;
+	}
+	impl->timers.source = loop_add_io(impl, res, SPA_IO_IN, true, timers_func, impl);
+	if (impl->timers.source == NULL) {
+		spa_system_close(impl->system, res);
+		res = -errno;
+		spa_log_error(impl->log, NAME " %p: can't add timer source: %m", impl);
+		goto error_exit_free_timers;
 	}
-	impl->ack_fd = res;
 
 	spa_log_debug(impl->log, NAME " %p: initialized", impl);
 
 	return 0;
 
-error_exit_free_wakeup:
+error_exit_free_timers:
+	pthread_mutex_destroy(&impl->timers.lock);
 	loop_destroy_source(impl, impl->wakeup);
-error_exit_free_poll:
+	process_destroy(impl);
+error_exit_free_lock:
+	pthread_cond_destroy(&impl->cond);
+	pthread_mutex_destroy(&impl->lock);
 	spa_system_close(impl->system, impl->poll_fd);
 error_exit:
 	return res;
@@ -27,11 +27,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <spa/support/plugin.h>
 #include <spa/support/log.h>
 #include <spa/support/loop.h>
 #include <spa/utils/names.h>
+#include <spa/utils/result.h>
 #include <spa/node/node.h>
 #include <spa/node/keys.h>
 #include <spa/node/io.h>
@@ -42,6 +44,10 @@
 
 #define DEFAULT_FREEWHEEL	false
 
+/* when freewheeling, a cycle that did not complete after this time is
+ * abandoned and the next one is started */
+#define FREEWHEEL_TIMEOUT	(10 * SPA_NSEC_PER_SEC)
+
 struct props {
 	bool freewheel;
 };
@@ -109,19 +115,36 @@ static void set_timer(struct impl *this, uint64_t next_time)
 			this->timer_source.fd, SPA_FD_TIMER_ABSTIME, &this->timerspec, NULL);
 }
 
+static uint64_t get_time_nsec(struct impl *this)
+{
+	struct timespec now;
+	spa_system_clock_gettime(this->data_system, CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_NSEC(&now);
+}
+
 static void on_timeout(struct spa_source *source)
 {
 	struct impl *this = source->data;
 	uint64_t expirations, nsec, duration = 10;
 	uint32_t rate;
+	bool freewheel = this->props.freewheel;
+	int res;
 
 	spa_log_trace(this->log, "timeout");
 
-	if (spa_system_timerfd_read(this->data_system,
-				this->timer_source.fd, &expirations) < 0)
-		perror("read timerfd");
+	/* the timer can be stopped or set again after it expired, it then
+	 * has nothing to read and we wait for the next expiration */
+	if ((res = spa_system_timerfd_read(this->data_system,
+				this->timer_source.fd, &expirations)) < 0) {
+		if (res != -EAGAIN)
+			spa_log_error(this->log, NAME" %p: read timerfd: %s",
+					this, spa_strerror(res));
+		return;
+	}
 
-	nsec = this->next_time;
+	/* when freewheeling, the cycle starts now and not at the time
+	 * the previous cycle would have ended */
+	nsec = freewheel ? get_time_nsec(this) : this->next_time;
 
 	if (SPA_LIKELY(this->position)) {
 		duration = this->position->clock.duration;
@@ -134,6 +157,10 @@ static void on_timeout(struct spa_source *source)
 	this->next_time = nsec + duration * SPA_NSEC_PER_SEC / rate;
 
 	if (SPA_LIKELY(this->clock)) {
+		if (freewheel)
+			SPA_FLAG_SET(this->clock->flags, SPA_IO_CLOCK_FLAG_FREEWHEEL);
+		else
+			SPA_FLAG_CLEAR(this->clock->flags, SPA_IO_CLOCK_FLAG_FREEWHEEL);
 		this->clock->nsec = nsec;
 		this->clock->position += duration;
 		this->clock->duration = duration;
@@ -142,10 +169,13 @@ static void on_timeout(struct spa_source *source)
 		this->clock->next_nsec = this->next_time;
 	}
 
+	/* when freewheeling, process() starts the next cycle once the graph
+	 * completed, which can happen before ready() returns. The timer only
+	 * fires when that takes too long. */
+	set_timer(this, freewheel ? nsec + FREEWHEEL_TIMEOUT : this->next_time);
+
 	spa_node_call_ready(&this->callbacks,
 			SPA_STATUS_HAVE_DATA | SPA_STATUS_NEED_DATA);
-
-	set_timer(this, this->next_time);
 }
 
 static int impl_node_send_command(void *object, const struct spa_command *command)
@@ -158,18 +188,13 @@ static int impl_node_send_command(void *object, const struct spa_command *comman
 
 	switch (SPA_NODE_COMMAND_ID(command)) {
 	case SPA_NODE_COMMAND_Start:
-	{
-		struct timespec now;
-
 		if (this->started)
 			return 0;
 
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		this->next_time = SPA_TIMESPEC_TO_NSEC(&now);
+		this->next_time = get_time_nsec(this);
 		this->started = true;
 		set_timer(this, this->next_time);
 		break;
-	}
 	case SPA_NODE_COMMAND_Suspend:
 	case SPA_NODE_COMMAND_Pause:
 		if (!this->started)
@@ -234,14 +259,13 @@ impl_node_set_callbacks(void *object,
 static int impl_node_process(void *object)
 {
 	struct impl *this = object;
-	struct timespec now;
 
 	spa_return_val_if_fail(this != NULL, -EINVAL);
 	spa_log_trace(this->log, "process %d", this->props.freewheel);
 
-	if (this->props.freewheel) {
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		this->next_time = SPA_TIMESPEC_TO_NSEC(&now);
+	/* the graph completed, start the next cycle right away */
+	if (this->props.freewheel && this->started) {
+		this->next_time = get_time_nsec(this);
 		set_timer(this, this->next_time);
 	}
 	return SPA_STATUS_OK;
@@ -302,6 +326,7 @@ impl_init(const struct spa_handle_factory *factory,
 	  uint32_t n_support)
 {
 	struct impl *this;
+	const char *str;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -344,7 +369,8 @@ impl_init(const struct spa_handle_factory *factory,
 
 	this->timer_source.func = on_timeout;
 	this->timer_source.data = this;
-	this->timer_source.fd = spa_system_timerfd_create(this->data_system, CLOCK_MONOTONIC, SPA_FD_CLOEXEC);
+	this->timer_source.fd = spa_system_timerfd_create(this->data_system,
+			CLOCK_MONOTONIC, SPA_FD_CLOEXEC | SPA_FD_NONBLOCK);
 	this->timer_source.mask = SPA_IO_IN;
 	this->timer_source.rmask = 0;
 	this->timerspec.it_value.tv_sec = 0;
@@ -354,6 +380,11 @@ impl_init(const struct spa_handle_factory *factory,
 
 	reset_props(&this->props);
 
+	if (info && (str = spa_dict_lookup(info, SPA_KEY_NODE_FREEWHEEL)) != NULL)
+		this->props.freewheel = (strcmp(str, "true") == 0 || atoi(str) == 1);
+
+	spa_log_debug(this->log, NAME" %p: freewheel %d", this, this->props.freewheel);
+
 	spa_loop_add_source(this->data_loop, &this->timer_source);
 
 	return 0;
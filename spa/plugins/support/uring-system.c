@@ -0,0 +1,1183 @@
+/* Spa
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include <linux/io_uring.h>
+
+#include <spa/support/log.h>
+#include <spa/support/system.h>
+#include <spa/support/plugin.h>
+#include <spa/utils/list.h>
+#include <spa/utils/type.h>
+#include <spa/utils/names.h>
+
+#define NAME "uring-system"
+
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#  define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+#endif
+
+#define RING_ENTRIES	256
+#define RING_CQ_ENTRIES	4096
+
+/* user_data of the submissions that don't complete an entry */
+#define DATA_IGNORE	0
+#define DATA_TIMEOUT	1
+
+/* how the entry of an fd is armed */
+#define MODE_POLL	0	/* one-shot poll, armed again after each event */
+#define MODE_POLL_MULTI	1	/* multishot poll, stays armed */
+#define MODE_READ	2	/* read of the 8 byte counter of an eventfd or timerfd */
+
+/* flags of the fds we created */
+#define FD_COUNTER	(1<<0)	/* nonblocking eventfd or timerfd */
+#define FD_EVENT	(1<<1)	/* the counter can be written back */
+
+/* the fds are kept in pages that are never moved or freed before the
+ * plugin is cleared, so that they can be looked up without a lock */
+#define FD_PAGE_SHIFT	8
+#define FD_PAGE_SIZE	(1u << FD_PAGE_SHIFT)
+#define FD_MAX_PAGES	256u
+
+/* The state of an fd. The counter that the ring read for one of our
+ * eventfds or timerfds is kept here until the callback reads it, it is
+ * only changed with atomic operations so that the loop thread can take
+ * it without a lock. */
+struct fd_state {
+	uint32_t flags;
+	int stash_res;		/* error of the read, returned by the next read */
+	uint64_t stash;		/* counter read by the ring */
+	struct ring *ring;	/* the ring when the fd is a pollfd */
+};
+
+/* An fd that is added to a ring. Entries are only freed when they
+ * are removed and no submission for them is pending in the kernel
+ * anymore. A counter that is read for a removed entry is given to the
+ * entry that replaced it or written back to the eventfd, the other
+ * completions of removed entries are ignored. */
+struct entry {
+	struct spa_list link;
+	struct spa_list rearm_link;
+	int fd;
+	uint32_t events;
+	void *data;
+	uint32_t mode;
+	uint32_t inflight;
+	uint32_t batch;
+	int index;
+	unsigned int queued:1;
+	unsigned int removed:1;
+	unsigned int closed:1;
+	uint64_t value;		/* target of MODE_READ */
+};
+
+struct ring {
+	struct spa_list link;
+	int fd;
+
+	/* protects the entries and the queues of the ring, fds can be added
+	 * and removed from any thread while the loop thread waits */
+	pthread_mutex_t lock;
+
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t sq_mask;
+	uint32_t sq_entries;
+	uint32_t sq_local_tail;
+	struct io_uring_sqe *sqes;
+
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	struct spa_list entries;
+	struct spa_list rearm;
+	struct entry **fds;
+	uint32_t n_fds;
+	uint32_t batch;
+	struct __kernel_timespec ts;
+};
+
+struct impl {
+	struct spa_handle handle;
+	struct spa_system system;
+        struct spa_log *log;
+
+	/* protects the list of rings */
+	pthread_mutex_t lock;
+	struct spa_list rings;
+	struct fd_state *fds[FD_MAX_PAGES];
+	bool no_multishot;
+	bool no_read;
+};
+
+static inline int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned to_submit,
+		unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int ensure_size(void **array, uint32_t *size, uint32_t index, size_t elem)
+{
+	uint32_t n;
+	void *p;
+
+	if (index < *size)
+		return 0;
+	n = SPA_MAX(*size * 2, 64u);
+	while (n <= index)
+		n *= 2;
+	if ((p = realloc(*array, n * elem)) == NULL)
+		return -errno;
+	memset(SPA_MEMBER(p, *size * elem, void), 0, (n - *size) * elem);
+	*array = p;
+	*size = n;
+	return 0;
+}
+
+static inline struct fd_state *find_fd(struct impl *impl, int fd)
+{
+	struct fd_state *page;
+
+	if (fd < 0 || (uint32_t)fd >= FD_PAGE_SIZE * FD_MAX_PAGES)
+		return NULL;
+	page = __atomic_load_n(&impl->fds[fd >> FD_PAGE_SHIFT], __ATOMIC_ACQUIRE);
+	return page ? &page[fd & (FD_PAGE_SIZE - 1)] : NULL;
+}
+
+static struct fd_state *ensure_fd(struct impl *impl, int fd)
+{
+	struct fd_state *page, *old = NULL;
+	uint32_t index;
+
+	if (fd < 0 || (uint32_t)fd >= FD_PAGE_SIZE * FD_MAX_PAGES)
+		return NULL;
+	index = (uint32_t)fd >> FD_PAGE_SHIFT;
+	if ((page = __atomic_load_n(&impl->fds[index], __ATOMIC_ACQUIRE)) == NULL) {
+		if ((page = calloc(FD_PAGE_SIZE, sizeof(struct fd_state))) == NULL)
+			return NULL;
+		if (!__atomic_compare_exchange_n(&impl->fds[index], &old, page,
+					false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(page);
+			page = old;
+		}
+	}
+	return &page[fd & (FD_PAGE_SIZE - 1)];
+}
+
+static inline uint32_t fd_flags(struct impl *impl, int fd)
+{
+	struct fd_state *s = find_fd(impl, fd);
+	return s ? __atomic_load_n(&s->flags, __ATOMIC_ACQUIRE) : 0;
+}
+
+/* fds that don't fit in the pages are polled like other fds */
+static void set_fd_flags(struct impl *impl, int fd, uint32_t flags)
+{
+	struct fd_state *s;
+
+	if ((s = ensure_fd(impl, fd)) != NULL)
+		__atomic_store_n(&s->flags, flags, __ATOMIC_RELEASE);
+}
+
+static struct ring *find_ring(struct impl *impl, int fd)
+{
+	struct fd_state *s;
+	struct ring *r;
+
+	if ((s = find_fd(impl, fd)) != NULL &&
+	    (r = __atomic_load_n(&s->ring, __ATOMIC_ACQUIRE)) != NULL)
+		return r;
+
+	pthread_mutex_lock(&impl->lock);
+	spa_list_for_each(r, &impl->rings, link)
+		if (r->fd == fd)
+			goto done;
+	r = NULL;
+done:
+	pthread_mutex_unlock(&impl->lock);
+	return r;
+}
+
+static inline struct entry *find_entry(struct ring *r, int fd)
+{
+	return (uint32_t)fd < r->n_fds ? r->fds[fd] : NULL;
+}
+
+/* the number of queued submissions that the kernel did not take yet. The
+ * kernel never takes more than are queued so when this is passed from
+ * different threads at the same time, all of them get submitted once. */
+static inline uint32_t ring_unsubmitted(struct ring *r)
+{
+	return r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static int ring_submit(struct ring *r)
+{
+	uint32_t n;
+
+	while ((n = ring_unsubmitted(r)) > 0) {
+		if (sys_io_uring_enter(r->fd, n, 0, 0) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+static struct io_uring_sqe *get_sqe(struct ring *r)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t head;
+
+	head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if (r->sq_local_tail - head >= r->sq_entries) {
+		if (ring_submit(r) < 0)
+			return NULL;
+		head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+		if (r->sq_local_tail - head >= r->sq_entries)
+			return NULL;
+	}
+	sqe = &r->sqes[r->sq_local_tail & r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static inline void queue_sqe(struct ring *r)
+{
+	r->sq_local_tail++;
+	__atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t poll_mask(uint32_t events)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+	return events;
+}
+
+/* the callback drains our eventfds and timerfds, they are read by the ring
+ * or get a multishot poll */
+static inline uint32_t counter_mode(struct impl *impl)
+{
+	if (!__atomic_load_n(&impl->no_read, __ATOMIC_RELAXED))
+		return MODE_READ;
+#ifdef IORING_POLL_ADD_MULTI
+	if (!__atomic_load_n(&impl->no_multishot, __ATOMIC_RELAXED))
+		return MODE_POLL_MULTI;
+#endif
+	return MODE_POLL;
+}
+
+static int arm_entry(struct impl *impl, struct ring *r, struct entry *e)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = get_sqe(r)) == NULL)
+		return -EBUSY;
+
+	sqe->fd = e->fd;
+	sqe->user_data = (uintptr_t)e;
+	switch (e->mode) {
+	case MODE_READ:
+		sqe->opcode = IORING_OP_READ;
+		sqe->addr = (uintptr_t)&e->value;
+		sqe->len = sizeof(e->value);
+		sqe->off = (uint64_t)-1;
+		break;
+	case MODE_POLL_MULTI:
+#ifdef IORING_POLL_ADD_MULTI
+		sqe->len = IORING_POLL_ADD_MULTI;
+#endif
+		/* fallthrough */
+	default:
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = poll_mask(e->events);
+		break;
+	}
+	queue_sqe(r);
+	e->inflight++;
+	return 0;
+}
+
+static int cancel_entry(struct ring *r, struct entry *e)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = get_sqe(r)) == NULL)
+		return -EBUSY;
+
+	sqe->opcode = e->mode == MODE_READ ?
+		IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)e;
+	sqe->user_data = DATA_IGNORE;
+	queue_sqe(r);
+	return 0;
+}
+
+static void queue_rearm(struct ring *r, struct entry *e)
+{
+	if (!e->queued) {
+		spa_list_append(&r->rearm, &e->rearm_link);
+		e->queued = true;
+	}
+}
+
+static void add_event(struct ring *r, struct entry *e, uint32_t events,
+		struct spa_poll_event *ev, int *n_ev)
+{
+	if (e->batch == r->batch && e->index >= 0) {
+		ev[e->index].events |= events;
+	} else {
+		e->batch = r->batch;
+		e->index = *n_ev;
+		ev[*n_ev].events = events;
+		ev[*n_ev].data = e->data;
+		(*n_ev)++;
+	}
+}
+
+/* only an eventfd can be written, the expirations of a timerfd that
+ * is not polled anymore are dropped */
+static void write_counter(struct impl *impl, int fd, uint64_t value)
+{
+	if (value > 0 && (fd_flags(impl, fd) & FD_EVENT) &&
+	    write(fd, &value, sizeof(value)) != sizeof(value))
+		spa_log_warn(impl->log, NAME " %p: can't restore counter of fd %d: %m",
+				impl, fd);
+}
+
+static void stash_counter(struct impl *impl, int fd, uint64_t value, int res)
+{
+	struct fd_state *s;
+
+	if ((s = find_fd(impl, fd)) == NULL)
+		return;
+	if (res < 0)
+		__atomic_store_n(&s->stash_res, res, __ATOMIC_RELEASE);
+	else
+		__atomic_fetch_add(&s->stash, value, __ATOMIC_RELEASE);
+}
+
+/* take the counter that the ring read for the fd, -EAGAIN when there is
+ * none. This is called from the loop thread and doesn't lock. */
+static int take_stash(struct impl *impl, int fd, uint64_t *value)
+{
+	struct fd_state *s;
+	uint64_t v;
+	int res;
+
+	if ((s = find_fd(impl, fd)) == NULL ||
+	    (__atomic_load_n(&s->stash, __ATOMIC_ACQUIRE) == 0 &&
+	     __atomic_load_n(&s->stash_res, __ATOMIC_ACQUIRE) == 0))
+		return -EAGAIN;
+
+	res = __atomic_exchange_n(&s->stash_res, 0, __ATOMIC_ACQ_REL);
+	v = __atomic_exchange_n(&s->stash, 0, __ATOMIC_ACQ_REL);
+	if (res < 0)
+		return res;
+	if (v == 0)
+		return -EAGAIN;
+	*value = v;
+	return 0;
+}
+
+/* the fd is not polled anymore, write the counter that was read for it
+ * back so that the next reader gets it */
+static void restore_stash(struct impl *impl, int fd)
+{
+	uint64_t value;
+
+	if (take_stash(impl, fd, &value) == 0)
+		write_counter(impl, fd, value);
+}
+
+/* a counter was read for an entry that is removed, give it to the entry
+ * that replaced it or write it back so that the next reader gets it.
+ * Returns the entry that should report the counter. */
+static struct entry *restore_counter(struct impl *impl, struct ring *r,
+		struct entry *e, uint64_t value)
+{
+	struct entry *n;
+
+	/* the fd number can be reused after a close */
+	if (e->closed)
+		return NULL;
+	if ((n = find_entry(r, e->fd)) != NULL) {
+		stash_counter(impl, e->fd, value, 0);
+		return n;
+	}
+	write_counter(impl, e->fd, value);
+	return NULL;
+}
+
+static void free_entry(struct entry *e)
+{
+	if (e->queued)
+		spa_list_remove(&e->rearm_link);
+	spa_list_remove(&e->link);
+	free(e);
+}
+
+static void remove_entry(struct impl *impl, struct ring *r, struct entry *e)
+{
+	r->fds[e->fd] = NULL;
+	e->removed = true;
+	if (e->inflight == 0)
+		free_entry(e);
+	else
+		cancel_entry(r, e);
+}
+
+static void destroy_ring(struct ring *r)
+{
+	struct entry *e;
+
+	spa_list_consume(e, &r->entries, link)
+		free_entry(e);
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	if (r->sq_ptr)
+		munmap(r->sq_ptr, r->sq_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r->fds);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
+
+static ssize_t impl_read(void *object, int fd, void *buf, size_t count)
+{
+	ssize_t res = read(fd, buf, count);
+	return res < 0 ? -errno : res;
+}
+
+static ssize_t impl_write(void *object, int fd, const void *buf, size_t count)
+{
+	ssize_t res = write(fd, buf, count);
+	return res < 0 ? -errno : res;
+}
+
+static int impl_ioctl(void *object, int fd, unsigned long request, ...)
+{
+	int res;
+	va_list ap;
+	long arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, long);
+	res = ioctl(fd, request, arg);
+	va_end(ap);
+
+	return res < 0 ? -errno : res;
+}
+
+static int impl_close(void *object, int fd)
+{
+	struct impl *impl = object;
+	struct fd_state *s;
+	struct ring *r, *rr, *found = NULL;
+	struct entry *e;
+	int res;
+
+	pthread_mutex_lock(&impl->lock);
+	spa_list_for_each_safe(r, rr, &impl->rings, link) {
+		if (r->fd == fd) {
+			spa_list_remove(&r->link);
+			found = r;
+			break;
+		}
+		/* a read that is still in flight for the fd must not restore
+		 * the counter to a new fd with the same number */
+		pthread_mutex_lock(&r->lock);
+		spa_list_for_each(e, &r->entries, link)
+			if (e->fd == fd && e->removed)
+				e->closed = true;
+		pthread_mutex_unlock(&r->lock);
+	}
+	if ((s = find_fd(impl, fd)) != NULL) {
+		__atomic_store_n(&s->ring, NULL, __ATOMIC_RELEASE);
+		__atomic_store_n(&s->flags, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&s->stash_res, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&s->stash, 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&impl->lock);
+
+	if (found != NULL) {
+		destroy_ring(found);
+		return 0;
+	}
+	res = close(fd);
+	return res < 0 ? -errno : res;
+}
+
+/* clock */
+static int impl_clock_gettime(void *object,
+			int clockid, struct timespec *value)
+{
+	int res = clock_gettime(clockid, value);
+	return res < 0 ? -errno : res;
+}
+
+static int impl_clock_getres(void *object,
+			int clockid, struct timespec *res)
+{
+	int r = clock_getres(clockid, res);
+	return r < 0 ? -errno : r;
+}
+
+/* poll */
+static int impl_pollfd_create(void *object, int flags)
+{
+	struct impl *impl = object;
+	struct io_uring_params p;
+	struct fd_state *s;
+	struct ring *r;
+	uint32_t i, *sq_array;
+	int res;
+
+	if ((r = calloc(1, sizeof(struct ring))) == NULL)
+		return -errno;
+
+	pthread_mutex_init(&r->lock, NULL);
+	spa_list_init(&r->entries);
+	spa_list_init(&r->rearm);
+
+	spa_zero(p);
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = RING_CQ_ENTRIES;
+	/* the ring fd is always close-on-exec */
+	if ((r->fd = sys_io_uring_setup(RING_ENTRIES, &p)) < 0) {
+		res = -errno;
+		spa_log_error(impl->log, NAME " %p: can't setup ring: %m", impl);
+		goto error;
+	}
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_size = r->cq_size = SPA_MAX(r->sq_size, r->cq_size);
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		r->sq_ptr = NULL;
+		res = -errno;
+		goto error;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			r->cq_ptr = NULL;
+			res = -errno;
+			goto error;
+		}
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		res = -errno;
+		goto error;
+	}
+
+	r->sq_head = SPA_MEMBER(r->sq_ptr, p.sq_off.head, uint32_t);
+	r->sq_tail = SPA_MEMBER(r->sq_ptr, p.sq_off.tail, uint32_t);
+	r->sq_mask = *SPA_MEMBER(r->sq_ptr, p.sq_off.ring_mask, uint32_t);
+	r->sq_entries = p.sq_entries;
+	r->sq_local_tail = *r->sq_tail;
+	sq_array = SPA_MEMBER(r->sq_ptr, p.sq_off.array, uint32_t);
+	for (i = 0; i < p.sq_entries; i++)
+		sq_array[i] = i;
+
+	r->cq_head = SPA_MEMBER(r->cq_ptr, p.cq_off.head, uint32_t);
+	r->cq_tail = SPA_MEMBER(r->cq_ptr, p.cq_off.tail, uint32_t);
+	r->cq_mask = *SPA_MEMBER(r->cq_ptr, p.cq_off.ring_mask, uint32_t);
+	r->cqes = SPA_MEMBER(r->cq_ptr, p.cq_off.cqes, struct io_uring_cqe);
+
+	pthread_mutex_lock(&impl->lock);
+	spa_list_append(&impl->rings, &r->link);
+	if ((s = ensure_fd(impl, r->fd)) != NULL)
+		__atomic_store_n(&s->ring, r, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&impl->lock);
+
+	spa_log_debug(impl->log, NAME " %p: ring %d entries:%u/%u features:%08x",
+			impl, r->fd, p.sq_entries, p.cq_entries, p.features);
+
+	return r->fd;
+
+error:
+	destroy_ring(r);
+	return res;
+}
+
+static int add_entry(struct impl *impl, struct ring *r, int fd, uint32_t events,
+		void *data, struct entry **result)
+{
+	struct entry *e;
+	int res;
+
+	if (fd < 0)
+		return -EBADF;
+	if (find_entry(r, fd) != NULL)
+		return -EEXIST;
+	if ((res = ensure_size((void**)&r->fds, &r->n_fds, fd, sizeof(struct entry *))) < 0)
+		return res;
+	if ((e = calloc(1, sizeof(struct entry))) == NULL)
+		return -errno;
+	e->fd = fd;
+	e->events = events;
+	e->data = data;
+	e->index = -1;
+
+	/* the counter of our own eventfds and timerfds is read by the ring
+	 * so that the callback doesn't need another syscall to read it. Other
+	 * fds get a one-shot poll, a multishot poll only completes again when
+	 * the fd is woken up, not while it stays readable. */
+	e->mode = MODE_POLL;
+	if (events == SPA_IO_IN && (fd_flags(impl, fd) & FD_COUNTER))
+		e->mode = counter_mode(impl);
+
+	spa_list_append(&r->entries, &e->link);
+	r->fds[fd] = e;
+
+	if ((res = arm_entry(impl, r, e)) < 0 ||
+	    (res = ring_submit(r)) < 0) {
+		remove_entry(impl, r, e);
+		return res;
+	}
+	if (result)
+		*result = e;
+	return 0;
+}
+
+static int impl_pollfd_add(void *object, int pfd, int fd, uint32_t events, void *data)
+{
+	struct impl *impl = object;
+	struct ring *r;
+	int res;
+
+	if ((r = find_ring(impl, pfd)) == NULL)
+		return -EBADF;
+
+	pthread_mutex_lock(&r->lock);
+	res = add_entry(impl, r, fd, events, data, NULL);
+	pthread_mutex_unlock(&r->lock);
+	return res;
+}
+
+static int impl_pollfd_del(void *object, int pfd, int fd)
+{
+	struct impl *impl = object;
+	struct ring *r;
+	struct entry *e;
+	int res = 0;
+
+	if ((r = find_ring(impl, pfd)) == NULL)
+		return -EBADF;
+
+	pthread_mutex_lock(&r->lock);
+	if ((e = find_entry(r, fd)) == NULL)
+		res = -ENOENT;
+	else {
+		remove_entry(impl, r, e);
+		restore_stash(impl, fd);
+		res = ring_submit(r);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return res;
+}
+
+static int impl_pollfd_mod(void *object, int pfd, int fd, uint32_t events, void *data)
+{
+	struct impl *impl = object;
+	struct ring *r;
+	struct entry *e;
+	int res = 0;
+
+	if ((r = find_ring(impl, pfd)) == NULL)
+		return -EBADF;
+
+	pthread_mutex_lock(&r->lock);
+	if ((e = find_entry(r, fd)) == NULL)
+		res = -ENOENT;
+	else if (e->events == events)
+		e->data = data;
+	else {
+		/* the completions of the old submission can't be told apart from
+		 * the new ones, make a new entry for the new events. The counter
+		 * that was read for the old one stays for the new entry, a read
+		 * that is still in flight gives it to the new entry when it
+		 * completes. */
+		remove_entry(impl, r, e);
+		if ((res = add_entry(impl, r, fd, events, data, NULL)) < 0)
+			restore_stash(impl, fd);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return res;
+}
+
+static void complete_entry(struct impl *impl, struct ring *r, struct entry *e,
+		struct io_uring_cqe *cqe, struct spa_poll_event *ev, int *n_ev)
+{
+	uint32_t events = 0;
+	bool more = false;
+
+#ifdef IORING_CQE_F_MORE
+	more = cqe->flags & IORING_CQE_F_MORE;
+#endif
+	if (!more)
+		e->inflight--;
+
+	if (e->removed) {
+		struct entry *n = NULL;
+
+		if (e->mode == MODE_READ && cqe->res == sizeof(uint64_t))
+			n = restore_counter(impl, r, e, e->value);
+		if (n != NULL)
+			add_event(r, n, SPA_IO_IN, ev, n_ev);
+		if (e->inflight == 0)
+			free_entry(e);
+		return;
+	}
+
+	switch (e->mode) {
+	case MODE_READ:
+		if (cqe->res == sizeof(uint64_t)) {
+			stash_counter(impl, e->fd, e->value, 0);
+			events = SPA_IO_IN;
+		} else if (cqe->res == -EINVAL || cqe->res == -EAGAIN || cqe->res == -EOPNOTSUPP) {
+			/* old kernel that can't wait for a read */
+			spa_log_info(impl->log, NAME " %p: no async read (%d), polling fd %d",
+					impl, cqe->res, e->fd);
+			__atomic_store_n(&impl->no_read, true, __ATOMIC_RELAXED);
+			e->mode = counter_mode(impl);
+		} else if (cqe->res < 0) {
+			/* like a timerfd with cancel-on-set, the next read
+			 * returns the error */
+			stash_counter(impl, e->fd, 0, cqe->res);
+			events = SPA_IO_IN;
+		}
+		break;
+	case MODE_POLL_MULTI:
+		if (cqe->res == -EINVAL && !more) {
+			spa_log_info(impl->log, NAME " %p: no multishot poll, polling fd %d",
+					impl, e->fd);
+			__atomic_store_n(&impl->no_multishot, true, __ATOMIC_RELAXED);
+			e->mode = MODE_POLL;
+			break;
+		}
+		/* fallthrough */
+	default:
+		if (cqe->res > 0)
+			events = cqe->res;
+		else if (cqe->res < 0 && cqe->res != -ECANCELED)
+			events = SPA_IO_ERR;
+		break;
+	}
+
+	if (events != 0)
+		add_event(r, e, events, ev, n_ev);
+	if (e->inflight == 0)
+		queue_rearm(r, e);
+}
+
+static int impl_pollfd_wait(void *object, int pfd,
+		struct spa_poll_event *ev, int n_ev, int timeout)
+{
+	struct impl *impl = object;
+	struct ring *r;
+	struct entry *e;
+	struct io_uring_sqe *sqe;
+	uint32_t head, tail, n_submit, min_complete = 0, flags = 0;
+	bool wait;
+	int res, n = 0;
+
+	if ((r = find_ring(impl, pfd)) == NULL)
+		return -EBADF;
+
+	pthread_mutex_lock(&r->lock);
+
+	/* arm the one-shot polls and the reads again, this keeps the
+	 * level-triggered behaviour of epoll */
+	spa_list_consume(e, &r->rearm, rearm_link) {
+		if (arm_entry(impl, r, e) < 0)
+			break;
+		spa_list_remove(&e->rearm_link);
+		e->queued = false;
+	}
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	wait = head == tail && timeout != 0;
+	if (wait && timeout > 0) {
+		if ((sqe = get_sqe(r)) != NULL) {
+			/* the timeout completes after one other completion so
+			 * it doesn't stay around when an fd wakes us up */
+			r->ts.tv_sec = timeout / 1000;
+			r->ts.tv_nsec = (timeout % 1000) * SPA_NSEC_PER_MSEC;
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = (uintptr_t)&r->ts;
+			sqe->len = 1;
+			sqe->off = 1;
+			sqe->user_data = DATA_TIMEOUT;
+			queue_sqe(r);
+		} else {
+			/* no room for the timeout, don't block */
+			wait = false;
+		}
+	}
+	if (wait) {
+		min_complete = 1;
+		flags = IORING_ENTER_GETEVENTS;
+	}
+	n_submit = ring_unsubmitted(r);
+	pthread_mutex_unlock(&r->lock);
+
+	/* submit and wait in one syscall, what was not submitted is
+	 * submitted the next time */
+	if (n_submit > 0 || flags != 0) {
+		if (SPA_UNLIKELY(sys_io_uring_enter(r->fd, n_submit, min_complete, flags) < 0)) {
+			res = -errno;
+			if (res != -EBUSY && res != -EAGAIN)
+				return res;
+		}
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->batch++;
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && n < n_ev) {
+		struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+
+		if (cqe->user_data != DATA_IGNORE && cqe->user_data != DATA_TIMEOUT)
+			complete_entry(impl, r, (struct entry*)(uintptr_t)cqe->user_data,
+					cqe, ev, &n);
+		head++;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&r->lock);
+
+	return n;
+}
+
+/* timers */
+static int impl_timerfd_create(void *object, int clockid, int flags)
+{
+	int fl = 0, res;
+	if (flags & SPA_FD_CLOEXEC)
+		fl |= TFD_CLOEXEC;
+	if (flags & SPA_FD_NONBLOCK)
+		fl |= TFD_NONBLOCK;
+	res = timerfd_create(clockid, fl);
+	if (res < 0)
+		return -errno;
+	if (flags & SPA_FD_NONBLOCK)
+		set_fd_flags(object, res, FD_COUNTER);
+	return res;
+}
+
+static int impl_timerfd_settime(void *object,
+			int fd, int flags,
+			const struct itimerspec *new_value,
+			struct itimerspec *old_value)
+{
+	int fl = 0, res;
+	if (flags & SPA_FD_TIMER_ABSTIME)
+		fl |= TFD_TIMER_ABSTIME;
+	if (flags & SPA_FD_TIMER_CANCEL_ON_SET)
+		fl |= TFD_TIMER_CANCEL_ON_SET;
+	res = timerfd_settime(fd, fl, new_value, old_value);
+	return res < 0 ? -errno : res;
+}
+
+static int impl_timerfd_gettime(void *object,
+			int fd, struct itimerspec *curr_value)
+{
+	int res = timerfd_gettime(fd, curr_value);
+	return res < 0 ? -errno : res;
+
+}
+
+static int impl_timerfd_read(void *object, int fd, uint64_t *expirations)
+{
+	int res;
+
+	if ((res = take_stash(object, fd, expirations)) != -EAGAIN)
+		return res;
+	if (read(fd, expirations, sizeof(uint64_t)) != sizeof(uint64_t))
+		return -errno;
+	return 0;
+}
+
+/* events */
+static int impl_eventfd_create(void *object, int flags)
+{
+	int fl = 0, res;
+	if (flags & SPA_FD_CLOEXEC)
+		fl |= EFD_CLOEXEC;
+	if (flags & SPA_FD_NONBLOCK)
+		fl |= EFD_NONBLOCK;
+	if (flags & SPA_FD_EVENT_SEMAPHORE)
+		fl |= EFD_SEMAPHORE;
+	res = eventfd(0, fl);
+	if (res < 0)
+		return -errno;
+	/* a semaphore must be read once for each count */
+	if ((flags & SPA_FD_NONBLOCK) && !(flags & SPA_FD_EVENT_SEMAPHORE))
+		set_fd_flags(object, res, FD_COUNTER | FD_EVENT);
+	return res;
+}
+
+static int impl_eventfd_write(void *object, int fd, uint64_t count)
+{
+	if (write(fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+		return -errno;
+	return 0;
+}
+
+static int impl_eventfd_read(void *object, int fd, uint64_t *count)
+{
+	int res;
+
+	if ((res = take_stash(object, fd, count)) != -EAGAIN)
+		return res;
+	if (read(fd, count, sizeof(uint64_t)) != sizeof(uint64_t))
+		return -errno;
+	return 0;
+}
+
+/* signals */
+static int impl_signalfd_create(void *object, int signal, int flags)
+{
+	sigset_t mask;
+	int res, fl = 0;
+
+	if (flags & SPA_FD_CLOEXEC)
+		fl |= SFD_CLOEXEC;
+	if (flags & SPA_FD_NONBLOCK)
+		fl |= SFD_NONBLOCK;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, signal);
+	res = signalfd(-1, &mask, fl);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	return res < 0 ? -errno : res;
+}
+
+static int impl_signalfd_read(void *object, int fd, int *signal)
+{
+	struct signalfd_siginfo signal_info;
+	int len;
+
+	len = read(fd, &signal_info, sizeof signal_info);
+	if (!(len == -1 && errno == EAGAIN) && len != sizeof signal_info)
+		return -errno;
+
+	*signal = signal_info.ssi_signo;
+
+	return 0;
+}
+
+static const struct spa_system_methods impl_system = {
+	SPA_VERSION_SYSTEM_METHODS,
+	.read = impl_read,
+	.write = impl_write,
+	.ioctl = impl_ioctl,
+	.close = impl_close,
+	.clock_gettime = impl_clock_gettime,
+	.clock_getres = impl_clock_getres,
+	.pollfd_create = impl_pollfd_create,
+	.pollfd_add = impl_pollfd_add,
+	.pollfd_mod = impl_pollfd_mod,
+	.pollfd_del = impl_pollfd_del,
+	.pollfd_wait = impl_pollfd_wait,
+	.timerfd_create = impl_timerfd_create,
+	.timerfd_settime = impl_timerfd_settime,
+	.timerfd_gettime = impl_timerfd_gettime,
+	.timerfd_read = impl_timerfd_read,
+	.eventfd_create = impl_eventfd_create,
+	.eventfd_write = impl_eventfd_write,
+	.eventfd_read = impl_eventfd_read,
+	.signalfd_create = impl_signalfd_create,
+	.signalfd_read = impl_signalfd_read,
+};
+
+static int impl_get_interface(struct spa_handle *handle, const char *type, void **interface)
+{
+	struct impl *impl;
+
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+	spa_return_val_if_fail(interface != NULL, -EINVAL);
+
+	impl = (struct impl *) handle;
+
+	if (strcmp(type, SPA_TYPE_INTERFACE_System) == 0)
+		*interface = &impl->system;
+	else
+		return -ENOENT;
+
+	return 0;
+}
+
+static int impl_clear(struct spa_handle *handle)
+{
+	struct impl *impl;
+	struct ring *r;
+	uint32_t i;
+
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+
+	impl = (struct impl *) handle;
+
+	spa_list_consume(r, &impl->rings, link) {
+		spa_list_remove(&r->link);
+		destroy_ring(r);
+	}
+	for (i = 0; i < FD_MAX_PAGES; i++)
+		free(impl->fds[i]);
+	pthread_mutex_destroy(&impl->lock);
+	return 0;
+}
+
+static size_t
+impl_get_size(const struct spa_handle_factory *factory,
+	      const struct spa_dict *params)
+{
+	return sizeof(struct impl);
+}
+
+static int
+impl_init(const struct spa_handle_factory *factory,
+	  struct spa_handle *handle,
+	  const struct spa_dict *info,
+	  const struct spa_support *support,
+	  uint32_t n_support)
+{
+	struct impl *impl;
+	struct io_uring_params p;
+	int fd;
+
+	spa_return_val_if_fail(factory != NULL, -EINVAL);
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+
+	handle->get_interface = impl_get_interface;
+	handle->clear = impl_clear;
+
+	impl = (struct impl *) handle;
+	impl->system.iface = SPA_INTERFACE_INIT(
+			SPA_TYPE_INTERFACE_System,
+			SPA_VERSION_SYSTEM,
+			&impl_system, impl);
+
+	impl->log = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_Log);
+
+	/* fail early when io_uring is not available or disabled, there is
+	 * no fallback and the loop that wants this system can't be made */
+	spa_zero(p);
+	if ((fd = sys_io_uring_setup(1, &p)) < 0) {
+		int res = -errno;
+		spa_log_error(impl->log, NAME " %p: io_uring not available: %m", impl);
+		return res;
+	}
+	close(fd);
+	if (!(p.features & IORING_FEAT_NODROP)) {
+		spa_log_error(impl->log, NAME " %p: io_uring is too old", impl);
+		return -ENOTSUP;
+	}
+
+	pthread_mutex_init(&impl->lock, NULL);
+	spa_list_init(&impl->rings);
+
+	spa_log_debug(impl->log, NAME " %p: initialized", impl);
+
+	return 0;
+}
+
+static const struct spa_interface_info impl_interfaces[] = {
+	{SPA_TYPE_INTERFACE_System,},
+};
+
+static int
+impl_enum_interface_info(const struct spa_handle_factory *factory,
+			 const struct spa_interface_info **info,
+			 uint32_t *index)
+{
+	spa_return_val_if_fail(factory != NULL, -EINVAL);
+	spa_return_val_if_fail(info != NULL, -EINVAL);
+	spa_return_val_if_fail(index != NULL, -EINVAL);
+
+	if (*index >= SPA_N_ELEMENTS(impl_interfaces))
+		return 0;
+
+	*info = &impl_interfaces[(*index)++];
+	return 1;
+}
+
+const struct spa_handle_factory spa_support_uring_system_factory = {
+	SPA_VERSION_HANDLE_FACTORY,
+	SPA_NAME_SUPPORT_SYSTEM,
+	NULL,
+	impl_get_size,
+	impl_init,
+	impl_enum_interface_info
+};
@@ -0,0 +1,138 @@
+/* Spa
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <spa/support/plugin.h>
+#include <spa/support/log.h>
+#include <spa/utils/dict.h>
+#include <spa/utils/names.h>
+#include <spa/utils/type.h>
+
+#define N_BURSTS	500
+#define BURST_SIZE	64
+#define BURST_PAUSE	(1 * SPA_NSEC_PER_MSEC)
+
+/* Log messages with timestamps and line numbers like the realtime threads
+ * do, in short bursts so that the log thread of the deferred logger can
+ * keep up. The cost of each call is what the thread that logs pays, with
+ * the logger that formats and writes in the calling thread and with the
+ * logger that leaves that to its own thread. */
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static struct spa_handle *load_logger(void *hnd, const struct spa_dict *info)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	const struct spa_handle_factory *factory;
+	struct spa_handle *handle;
+	uint32_t i;
+
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL)
+		return NULL;
+
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (strcmp(factory->name, SPA_NAME_SUPPORT_LOG) != 0)
+			continue;
+		handle = calloc(1, spa_handle_factory_get_size(factory, info));
+		if (spa_handle_factory_init(factory, handle, info, NULL, 0) < 0) {
+			free(handle);
+			return NULL;
+		}
+		return handle;
+	}
+	return NULL;
+}
+
+static void test_log(void *hnd, bool deferred)
+{
+	struct spa_dict_item items[5];
+	struct spa_handle *handle;
+	struct spa_log *log;
+	struct timespec pause = { 0, BURST_PAUSE };
+	uint64_t t1, t2, total = 0, max = 0;
+	void *iface;
+	int i, j;
+
+	items[0] = SPA_DICT_ITEM_INIT(SPA_KEY_LOG_LEVEL, "4");
+	items[1] = SPA_DICT_ITEM_INIT(SPA_KEY_LOG_FILE, "/dev/null");
+	items[2] = SPA_DICT_ITEM_INIT(SPA_KEY_LOG_TIMESTAMP, "true");
+	items[3] = SPA_DICT_ITEM_INIT(SPA_KEY_LOG_LINE, "true");
+	items[4] = SPA_DICT_ITEM_INIT(SPA_KEY_LOG_DEFERRED, deferred ? "true" : "false");
+
+	handle = load_logger(hnd, &SPA_DICT_INIT_ARRAY(items));
+	spa_assert(handle != NULL);
+	spa_assert(spa_handle_get_interface(handle, SPA_TYPE_INTERFACE_Log, &iface) == 0);
+	log = iface;
+
+	for (i = 0; i < N_BURSTS; i++) {
+		for (j = 0; j < BURST_SIZE; j++) {
+			t1 = get_time();
+			spa_log_debug(log, "node %p: cycle %d position %"PRIu64" rate %f name %s",
+					log, i, (uint64_t)j * 1024, 1.000012, "alsa_output.pci");
+			t2 = get_time();
+			total += t2 - t1;
+			max = SPA_MAX(max, t2 - t1);
+		}
+		nanosleep(&pause, NULL);
+	}
+	spa_handle_clear(handle);
+	free(handle);
+
+	fprintf(stderr, "%s: count %u = %"PRIu64" nsec/message, max %"PRIu64" nsec\n",
+			deferred ? "deferred" : "sync", N_BURSTS * BURST_SIZE,
+			total / (N_BURSTS * BURST_SIZE), max);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir;
+	char path[PATH_MAX];
+	void *hnd;
+
+	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL) {
+		printf("SPA_PLUGIN_DIR not set, skipping log benchmark\n");
+		return 0;
+	}
+	snprintf(path, sizeof(path), "%s/support/libspa-support.so", dir);
+	if ((hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s, skipping log benchmark\n", path, dlerror());
+		return 0;
+	}
+
+	test_log(hnd, false);
+	test_log(hnd, true);
+
+	dlclose(hnd);
+	return 0;
+}
@@ -0,0 +1,435 @@
+/* Spa
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <spa/support/plugin.h>
+#include <spa/support/system.h>
+#include <spa/support/loop.h>
+#include <spa/utils/names.h>
+#include <spa/utils/type.h>
+
+#define MAX_COUNT	100000
+#define N_EVENTS	32
+#define N_BURSTS	10000
+#define N_TIMERS	1000
+#define MAX_TIMEOUT	200		/* msec */
+
+/* Two loops wake each other up with an event source in turn, like the
+ * data loops of a driver and a follower. Then one loop signals a burst of
+ * events to itself and dispatches them. This runs with the epoll system
+ * and with the io_uring system, the kernel time shows the cost of the
+ * syscalls that each of them needs for a wakeup and the syscalls are
+ * counted. Last, a lot of timers
+ * are armed and cancelled and then fire, they all share the timerfd of
+ * the loop. */
+struct system {
+	const char *name;
+	const char *lib;
+	void *hnd;
+	struct spa_handle *handle;
+	struct spa_system *system;
+};
+
+static struct system systems[] = {
+	{ "epoll", "support/libspa-support", },
+	{ "io_uring", "support/libspa-uring", },
+};
+
+struct loop {
+	struct spa_handle *handle;
+	struct spa_loop_control *control;
+	struct spa_loop_utils *utils;
+	struct spa_source *event;
+	struct loop *peer;
+	uint32_t count;
+	bool running;
+	pthread_t thread;
+};
+
+struct stats {
+	struct timespec ts;
+	struct rusage ru;
+	uint64_t n_syscalls;
+};
+
+/* The syscalls that the systems make for a wakeup are counted with these
+ * wrappers. The benchmark exports them so that the plugins use them
+ * instead of the ones of libc. */
+static uint64_t n_syscalls;
+
+#define CALL_NEXT(name,...)							\
+({										\
+	static __typeof__(&name) _f;						\
+	if (_f == NULL)								\
+		_f = (__typeof__(&name)) dlsym(RTLD_NEXT, #name);		\
+	__atomic_add_fetch(&n_syscalls, 1, __ATOMIC_RELAXED);			\
+	_f(__VA_ARGS__);							\
+})
+
+SPA_EXPORT ssize_t read(int fd, void *buf, size_t count)
+{
+	return CALL_NEXT(read, fd, buf, count);
+}
+
+SPA_EXPORT ssize_t write(int fd, const void *buf, size_t count)
+{
+	return CALL_NEXT(write, fd, buf, count);
+}
+
+SPA_EXPORT int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	return CALL_NEXT(epoll_wait, epfd, events, maxevents, timeout);
+}
+
+SPA_EXPORT int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	return CALL_NEXT(epoll_ctl, epfd, op, fd, event);
+}
+
+SPA_EXPORT int timerfd_settime(int fd, int flags, const struct itimerspec *new_value,
+		struct itimerspec *old_value)
+{
+	return CALL_NEXT(timerfd_settime, fd, flags, new_value, old_value);
+}
+
+SPA_EXPORT long syscall(long number, ...)
+{
+	va_list ap;
+	long a[6];
+	int i;
+
+	va_start(ap, number);
+	for (i = 0; i < 6; i++)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+
+	return CALL_NEXT(syscall, number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+static struct spa_handle *load_handle(void *hnd, const char *name,
+		const struct spa_support *support, uint32_t n_support)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	const struct spa_handle_factory *factory;
+	struct spa_handle *handle;
+	uint32_t i;
+
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL)
+		return NULL;
+
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (strcmp(factory->name, name) != 0)
+			continue;
+		handle = calloc(1, spa_handle_factory_get_size(factory, NULL));
+		if (spa_handle_factory_init(factory, handle, NULL, support, n_support) < 0) {
+			free(handle);
+			return NULL;
+		}
+		return handle;
+	}
+	return NULL;
+}
+
+static int load_system(const char *dir, struct system *s)
+{
+	char path[PATH_MAX];
+	void *iface;
+
+	snprintf(path, sizeof(path), "%s/%s.so", dir, s->lib);
+	if ((s->hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", path, dlerror());
+		return -1;
+	}
+	if ((s->handle = load_handle(s->hnd, SPA_NAME_SUPPORT_SYSTEM, NULL, 0)) == NULL) {
+		printf("can't make %s system\n", s->name);
+		return -1;
+	}
+	spa_assert(spa_handle_get_interface(s->handle, SPA_TYPE_INTERFACE_System, &iface) == 0);
+	s->system = iface;
+	return 0;
+}
+
+static void make_loop(void *hnd, struct system *s, struct loop *l)
+{
+	struct spa_support support[1];
+	void *iface;
+
+	support[0] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_System, s->system);
+
+	memset(l, 0, sizeof(*l));
+	l->handle = load_handle(hnd, SPA_NAME_SUPPORT_LOOP, support, 1);
+	spa_assert(l->handle != NULL);
+	spa_assert(spa_handle_get_interface(l->handle, SPA_TYPE_INTERFACE_LoopControl, &iface) == 0);
+	l->control = iface;
+	spa_assert(spa_handle_get_interface(l->handle, SPA_TYPE_INTERFACE_LoopUtils, &iface) == 0);
+	l->utils = iface;
+	l->running = true;
+}
+
+static void free_loop(struct loop *l)
+{
+	spa_loop_utils_destroy_source(l->utils, l->event);
+	spa_handle_clear(l->handle);
+	free(l->handle);
+}
+
+static void stats_start(struct stats *s)
+{
+	clock_gettime(CLOCK_MONOTONIC, &s->ts);
+	getrusage(RUSAGE_SELF, &s->ru);
+	s->n_syscalls = __atomic_load_n(&n_syscalls, __ATOMIC_RELAXED);
+}
+
+static void stats_end(struct stats *s, const char *name, const char *test, uint32_t count)
+{
+	struct timespec ts;
+	struct rusage ru;
+	uint64_t elapsed, stime, syscalls;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	getrusage(RUSAGE_SELF, &ru);
+	syscalls = __atomic_load_n(&n_syscalls, __ATOMIC_RELAXED) - s->n_syscalls;
+
+	elapsed = SPA_TIMESPEC_TO_NSEC(&ts) - SPA_TIMESPEC_TO_NSEC(&s->ts);
+	stime = SPA_TIMEVAL_TO_USEC(&ru.ru_stime) - SPA_TIMEVAL_TO_USEC(&s->ru.ru_stime);
+
+	printf("%s: %s: elapsed %"PRIu64" count %u = %"PRIu64" nsec/wakeup, "
+			"%"PRIu64" nsec kernel/wakeup, %"PRIu64" wakeups/sec, "
+			"%"PRIu64".%02"PRIu64" syscalls/wakeup\n",
+			name, test, elapsed, count, elapsed / count,
+			stime * 1000 / count, count * (uint64_t)SPA_NSEC_PER_SEC / elapsed,
+			syscalls / count, syscalls * 100 / count % 100);
+}
+
+static void on_ping(void *data, uint64_t count)
+{
+	struct loop *l = data;
+
+	if (++l->count >= MAX_COUNT)
+		l->running = false;
+	spa_loop_utils_signal_event(l->peer->utils, l->peer->event);
+}
+
+static void *loop_start(void *data)
+{
+	struct loop *l = data;
+
+	spa_loop_control_enter(l->control);
+	while (l->running)
+		spa_loop_control_iterate(l->control, -1);
+	spa_loop_control_leave(l->control);
+
+	return NULL;
+}
+
+static void test_ping_pong(void *hnd, struct system *s)
+{
+	struct loop l[2];
+	struct stats st;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		make_loop(hnd, s, &l[i]);
+		l[i].event = spa_loop_utils_add_event(l[i].utils, on_ping, &l[i]);
+		spa_assert(l[i].event != NULL);
+	}
+	l[0].peer = &l[1];
+	l[1].peer = &l[0];
+
+	stats_start(&st);
+
+	pthread_create(&l[1].thread, NULL, loop_start, &l[1]);
+	spa_loop_utils_signal_event(l[0].utils, l[0].event);
+	loop_start(&l[0]);
+	pthread_join(l[1].thread, NULL);
+
+	stats_end(&st, s->name, "ping-pong", 2 * MAX_COUNT);
+
+	for (i = 0; i < 2; i++)
+		free_loop(&l[i]);
+}
+
+static void on_burst(void *data, uint64_t count)
+{
+	struct loop *l = data;
+	l->count++;
+}
+
+static void test_burst(void *hnd, struct system *s)
+{
+	struct loop l;
+	struct spa_source *events[N_EVENTS];
+	struct stats st;
+	int i, j;
+
+	make_loop(hnd, s, &l);
+	l.event = spa_loop_utils_add_event(l.utils, on_burst, &l);
+	for (i = 0; i < N_EVENTS; i++)
+		events[i] = spa_loop_utils_add_event(l.utils, on_burst, &l);
+
+	stats_start(&st);
+
+	spa_loop_control_enter(l.control);
+	for (i = 0; i < N_BURSTS; i++) {
+		for (j = 0; j < N_EVENTS; j++)
+			spa_loop_utils_signal_event(l.utils, events[j]);
+		while (l.count < (uint32_t)(i + 1) * N_EVENTS)
+			spa_loop_control_iterate(l.control, -1);
+	}
+	spa_loop_control_leave(l.control);
+
+	stats_end(&st, s->name, "burst", N_BURSTS * N_EVENTS);
+
+	for (i = 0; i < N_EVENTS; i++)
+		spa_loop_utils_destroy_source(l.utils, events[i]);
+	free_loop(&l);
+}
+
+struct timer {
+	struct loop *loop;
+	struct spa_source *source;
+	uint64_t expire;
+	uint64_t late;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static void on_timer(void *data, uint64_t expirations)
+{
+	struct timer *t = data;
+	t->late = get_time() - t->expire;
+	t->loop->count++;
+}
+
+static void arm_timer(struct loop *l, struct timer *t, uint64_t timeout)
+{
+	struct timespec value;
+
+	t->expire = get_time() + timeout;
+	value.tv_sec = t->expire / SPA_NSEC_PER_SEC;
+	value.tv_nsec = t->expire % SPA_NSEC_PER_SEC;
+	spa_loop_utils_update_timer(l->utils, t->source, &value, NULL, true);
+}
+
+static void test_timers(void *hnd, struct system *s)
+{
+	static struct timer timers[N_TIMERS];
+	struct loop l;
+	struct timespec zero = { 0, 0 };
+	uint64_t t1, t2, t3, late = 0, max_late = 0;
+	uint32_t i;
+
+	make_loop(hnd, s, &l);
+	l.event = spa_loop_utils_add_event(l.utils, on_burst, &l);
+	for (i = 0; i < N_TIMERS; i++) {
+		timers[i].loop = &l;
+		timers[i].source = spa_loop_utils_add_timer(l.utils, on_timer, &timers[i]);
+		spa_assert(timers[i].source != NULL);
+	}
+
+	t1 = get_time();
+	for (i = 0; i < N_TIMERS; i++)
+		arm_timer(&l, &timers[i], (rand() % (MAX_TIMEOUT * 1000)) * SPA_NSEC_PER_USEC);
+	t2 = get_time();
+	for (i = 0; i < N_TIMERS; i++)
+		spa_loop_utils_update_timer(l.utils, timers[i].source, &zero, NULL, false);
+	t3 = get_time();
+
+	printf("%s: timers: arm %"PRIu64" nsec/timer, cancel %"PRIu64" nsec/timer\n",
+			s->name, (t2 - t1) / N_TIMERS, (t3 - t2) / N_TIMERS);
+
+	for (i = 0; i < N_TIMERS; i++)
+		arm_timer(&l, &timers[i], (rand() % (MAX_TIMEOUT * 1000)) * SPA_NSEC_PER_USEC);
+
+	spa_loop_control_enter(l.control);
+	while (l.count < N_TIMERS)
+		spa_loop_control_iterate(l.control, -1);
+	spa_loop_control_leave(l.control);
+
+	for (i = 0; i < N_TIMERS; i++) {
+		late += timers[i].late;
+		max_late = SPA_MAX(max_late, timers[i].late);
+		spa_loop_utils_destroy_source(l.utils, timers[i].source);
+	}
+	printf("%s: timers: %u fired, late %"PRIu64" nsec average, %"PRIu64" nsec max\n",
+			s->name, N_TIMERS, late / N_TIMERS, max_late);
+
+	free_loop(&l);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir;
+	char path[PATH_MAX];
+	void *hnd;
+	uint32_t i;
+
+	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL) {
+		printf("SPA_PLUGIN_DIR not set, skipping loop benchmark\n");
+		return 0;
+	}
+	/* the loop implementation is the same for all systems */
+	snprintf(path, sizeof(path), "%s/support/libspa-support.so", dir);
+	if ((hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s, skipping loop benchmark\n", path, dlerror());
+		return 0;
+	}
+
+	for (i = 0; i < SPA_N_ELEMENTS(systems); i++) {
+		struct system *s = &systems[i];
+
+		if (load_system(dir, s) < 0) {
+			printf("%s: skipped\n", s->name);
+			continue;
+		}
+		/* warmup */
+		test_ping_pong(hnd, s);
+
+		test_ping_pong(hnd, s);
+		test_burst(hnd, s);
+		test_timers(hnd, s);
+
+		spa_handle_clear(s->handle);
+		free(s->handle);
+	}
+	return 0;
+}
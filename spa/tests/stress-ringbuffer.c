@@ -1,16 +1,32 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sched.h>
 #include <errno.h>
 #include <semaphore.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <time.h>
 
 #include <spa/utils/ringbuffer.h>
+#include <spa/utils/type.h>
+#include <spa/utils/names.h>
+#include <spa/utils/result.h>
+#include <spa/support/plugin.h>
+#include <spa/support/loop.h>
+#include <spa/support/system.h>
 
 #define DEFAULT_SIZE 0x2000
 #define ARRAY_SIZE 63
 #define MAX_VALUE 0x10000
 
+#define N_PRODUCERS 4
+#define N_INVOKES 200000
+#define MAX_INVOKE_SIZE 256
+#define BLOCK_INTERVAL 64
+
 #ifdef __FreeBSD__
 static int sched_getcpu(void) { return -1; };
 #endif
@@ -100,6 +116,201 @@ static void *writer_start(void *arg)
 	return NULL;
 }
 
+/* many threads invoke into one loop with items of different sizes, the
+ * loop checks that the items of each thread arrive in order and intact */
+struct invoke_data {
+	struct spa_loop *loop;
+	struct spa_loop_control *control;
+	volatile bool running;
+	uint32_t next_seq[N_PRODUCERS];
+	uint64_t count;
+	uint64_t retries;
+};
+
+struct invoke_payload {
+	uint32_t producer;
+	uint32_t seq;
+	uint8_t pattern[MAX_INVOKE_SIZE];
+};
+
+static inline size_t payload_size(uint32_t seq)
+{
+	return offsetof(struct invoke_payload, pattern) + (seq * 7) % MAX_INVOKE_SIZE;
+}
+
+static int do_invoke(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct invoke_data *d = user_data;
+	const struct invoke_payload *p = data;
+	size_t i;
+
+	spa_assert(size == payload_size(p->seq));
+	spa_assert(p->producer < N_PRODUCERS);
+	spa_assert(p->seq == d->next_seq[p->producer]);
+	for (i = 0; i < size - offsetof(struct invoke_payload, pattern); i++)
+		spa_assert(p->pattern[i] == (uint8_t)(p->seq + i));
+
+	d->next_seq[p->producer]++;
+	d->count++;
+	return p->seq;
+}
+
+static int do_stop(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct invoke_data *d = user_data;
+	d->running = false;
+	return 0;
+}
+
+struct producer {
+	struct invoke_data *d;
+	uint32_t id;
+	pthread_t thread;
+};
+
+static void *producer_start(void *arg)
+{
+	struct producer *pr = arg;
+	struct invoke_data *d = pr->d;
+	struct invoke_payload p;
+	uint32_t i;
+	size_t j;
+
+	p.producer = pr->id;
+
+	for (i = 0; i < N_INVOKES; i++) {
+		bool block = (i % BLOCK_INTERVAL) == 0;
+		size_t size = payload_size(i);
+		int res;
+
+		p.seq = i;
+		for (j = 0; j < size - offsetof(struct invoke_payload, pattern); j++)
+			p.pattern[j] = (uint8_t)(i + j);
+
+		while ((res = spa_loop_invoke(d->loop, do_invoke, 0, &p, size, block, d)) == -EPIPE) {
+			__atomic_add_fetch(&d->retries, 1, __ATOMIC_RELAXED);
+			sched_yield();
+		}
+		if (block)
+			spa_assert(res == (int)i);
+		else
+			spa_assert(res >= 0);
+	}
+	return NULL;
+}
+
+static void *loop_start(void *arg)
+{
+	struct invoke_data *d = arg;
+
+	spa_loop_control_enter(d->control);
+	while (d->running)
+		spa_loop_control_iterate(d->control, -1);
+	spa_loop_control_leave(d->control);
+
+	return NULL;
+}
+
+static struct spa_handle *load_handle(void *hnd, const char *name,
+		const struct spa_support *support, uint32_t n_support)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	const struct spa_handle_factory *factory;
+	struct spa_handle *handle;
+	uint32_t i;
+
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL)
+		return NULL;
+
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (strcmp(factory->name, name) != 0)
+			continue;
+		handle = calloc(1, spa_handle_factory_get_size(factory, NULL));
+		if (spa_handle_factory_init(factory, handle, NULL, support, n_support) < 0) {
+			free(handle);
+			return NULL;
+		}
+		return handle;
+	}
+	return NULL;
+}
+
+static void test_invoke(void)
+{
+	const char *dir;
+	char path[PATH_MAX];
+	void *hnd, *iface;
+	struct spa_handle *system_handle, *loop_handle;
+	struct spa_support support[1];
+	struct invoke_data d;
+	struct producer producers[N_PRODUCERS];
+	pthread_t loop_thread;
+	struct timespec ts1, ts2;
+	uint64_t elapsed;
+	uint32_t i;
+
+	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL) {
+		printf("SPA_PLUGIN_DIR not set, skipping invoke test\n");
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/support/libspa-support.so", dir);
+	if ((hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s, skipping invoke test\n", path, dlerror());
+		return;
+	}
+
+	printf("starting invoke stress test with %d producers\n", N_PRODUCERS);
+
+	memset(&d, 0, sizeof(d));
+
+	system_handle = load_handle(hnd, SPA_NAME_SUPPORT_SYSTEM, NULL, 0);
+	spa_assert(system_handle != NULL);
+	spa_assert(spa_handle_get_interface(system_handle, SPA_TYPE_INTERFACE_System, &iface) == 0);
+	support[0] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_System, iface);
+
+	loop_handle = load_handle(hnd, SPA_NAME_SUPPORT_LOOP, support, 1);
+	spa_assert(loop_handle != NULL);
+	spa_assert(spa_handle_get_interface(loop_handle, SPA_TYPE_INTERFACE_Loop, &iface) == 0);
+	d.loop = iface;
+	spa_assert(spa_handle_get_interface(loop_handle, SPA_TYPE_INTERFACE_LoopControl, &iface) == 0);
+	d.control = iface;
+	d.running = true;
+
+	pthread_create(&loop_thread, NULL, loop_start, &d);
+	/* wait for the loop thread to enter the loop */
+	spa_loop_invoke(d.loop, NULL, 0, NULL, 0, true, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (i = 0; i < N_PRODUCERS; i++) {
+		producers[i].d = &d;
+		producers[i].id = i;
+		pthread_create(&producers[i].thread, NULL, producer_start, &producers[i]);
+	}
+	for (i = 0; i < N_PRODUCERS; i++)
+		pthread_join(producers[i].thread, NULL);
+
+	spa_loop_invoke(d.loop, do_stop, 0, NULL, 0, true, &d);
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	pthread_join(loop_thread, NULL);
+
+	spa_assert(d.count == (uint64_t)N_PRODUCERS * N_INVOKES);
+	for (i = 0; i < N_PRODUCERS; i++)
+		spa_assert(d.next_seq[i] == N_INVOKES);
+
+	elapsed = SPA_TIMESPEC_TO_NSEC(&ts2) - SPA_TIMESPEC_TO_NSEC(&ts1);
+	printf("invoked %"PRIu64" items in %"PRIu64" usec = %"PRIu64" items/sec, %"PRIu64" retries\n",
+			d.count, elapsed / 1000,
+			(uint64_t)(d.count * SPA_NSEC_PER_SEC / elapsed), d.retries);
+
+	spa_handle_clear(loop_handle);
+	free(loop_handle);
+	spa_handle_clear(system_handle);
+	free(system_handle);
+	dlclose(hnd);
+}
+
 #define exit_error(msg) \
 do { perror(msg); exit(EXIT_FAILURE); } while (0)
 
@@ -139,5 +350,7 @@ int main(int argc, char *argv[])
 
 	printf("read %u, written %u\n", rb.readindex, rb.writeindex);
 
+	test_invoke();
+
 	return 0;
 }
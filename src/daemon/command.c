@@ -130,6 +130,8 @@ static struct pw_command *parse_command_set_prop(struct pw_properties *propertie
 		pw_log_set_level(atoi(this->args[2]));
 		setenv("PIPEWIRE_DEBUG", this->args[2], 1);
 	}
+	if (strcmp(this->args[1], SPA_KEY_LOG_DEFERRED) == 0)
+		setenv("PIPEWIRE_LOG_DEFERRED", this->args[2], 1);
 
 	return this;
 
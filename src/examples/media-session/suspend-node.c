@@ -43,6 +43,7 @@
 #define SESSION_KEY	"suspend-node"
 
 #define DEFAULT_IDLE_SECONDS	3
+#define DEFAULT_IDLE_SLACK	(100 * SPA_NSEC_PER_MSEC)
 
 struct impl {
 	struct timespec now;
@@ -102,8 +103,11 @@ static void add_idle_timeout(struct node *node)
 	struct impl *impl = node->impl;
 	struct pw_loop *main_loop = pw_context_get_main_loop(impl->context);
 
-	if (node->idle_timeout == NULL)
+	if (node->idle_timeout == NULL) {
 		node->idle_timeout = pw_loop_add_timer(main_loop, idle_timeout, node);
+		pw_loop_set_timer_slack(main_loop, node->idle_timeout,
+				DEFAULT_IDLE_SLACK);
+	}
 
 	value.tv_sec = DEFAULT_IDLE_SECONDS;
 	value.tv_nsec = 0;
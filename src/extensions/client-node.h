@@ -34,7 +34,9 @@ extern "C" {
 
 #define PW_TYPE_INTERFACE_ClientNode		PW_TYPE_INFO_INTERFACE_BASE "ClientNode"
 
-#define PW_VERSION_CLIENT_NODE			3
+/* version 4 uses the layout of struct pw_node_activation that groups the
+ * fields by writer, version 3 clients get the legacy layout */
+#define PW_VERSION_CLIENT_NODE			4
 struct pw_client_node;
 
 #define PW_EXTENSION_MODULE_CLIENT_NODE		PIPEWIRE_MODULE_PREFIX "module-client-node"
@@ -29,24 +29,160 @@
 extern "C" {
 #endif
 
+#include <string.h>
+#include <errno.h>
+
 #include <spa/utils/defs.h>
 
 #define PW_TYPE_INTERFACE_Profiler		PW_TYPE_INFO_INTERFACE_BASE "Profiler"
 
-#define PW_VERSION_PROFILER			3
+#define PW_VERSION_PROFILER			4
 struct pw_profiler;
 
 #define PW_EXTENSION_MODULE_PROFILER		PIPEWIRE_MODULE_PREFIX "module-profiler"
 
+#define PW_PROFILER_RECORD_DRIVER		0
+#define PW_PROFILER_RECORD_FOLLOWER		1
+
+/** timing of the driver in a cycle */
+struct pw_profiler_driver {
+	float cpu_load[3];
+	uint32_t clock_flags;
+	uint32_t clock_id;
+	struct spa_fraction rate;
+	uint32_t n_followers;		/**< number of follower records after this one */
+	uint64_t nsec;
+	uint64_t position;
+	uint64_t duration;
+	uint64_t delay;
+	double rate_diff;
+	uint64_t next_nsec;
+	int64_t period;			/**< the period in nsec */
+	int64_t path_length;		/**< time from the start of the cycle until the
+					  *  last follower finished */
+#define PW_PROFILER_DRIVER_ADAPT	(1<<0)
+#define PW_PROFILER_DRIVER_TRUNCATED	(1<<1)	/**< the driver has more followers than
+						  *  n_followers, the others have no record */
+	uint32_t flags;
+	uint32_t adapt_base;
+	uint32_t adapt_quantum;
+	uint32_t adapt_pending;
+	uint32_t adapt_reason;
+	uint32_t adapt_changes;
+	int64_t adapt_change_time;
+	uint32_t xrun_count;		/**< xruns reported by the driver */
+	uint32_t padding;
+};
+
+/** timing of a follower in a cycle */
+struct pw_profiler_follower {
+#define PW_PROFILER_FOLLOWER_RAN	(1<<0)	/**< the follower ran this cycle, slack is valid */
+#define PW_PROFILER_FOLLOWER_CRITICAL	(1<<1)	/**< the follower is on the critical path */
+#define PW_PROFILER_FOLLOWER_SPIN	(1<<2)	/**< the spin fields are valid */
+#define PW_PROFILER_FOLLOWER_HISTOGRAM	(1<<3)	/**< the histogram is valid */
+#define PW_PROFILER_FOLLOWER_UNFINISHED	(1<<4)	/**< the follower was triggered but did not
+						  *  finish before the next cycle */
+	uint32_t flags;
+	uint32_t spin_hits;
+	uint32_t spin_misses;
+	uint32_t xrun_count;		/**< xruns reported by the follower */
+	int64_t spin_time;
+	int64_t slack;			/**< how much later the follower could have finished */
+#define PW_PROFILER_HISTOGRAM_BUCKETS	16
+	uint32_t buckets[PW_PROFILER_HISTOGRAM_BUCKETS];	/**< processing time histogram
+								  *  since the last one */
+};
+
+/** A record in the profiler ring. Records contain the node ids only, the
+ * names of the nodes can be found with the registry. */
+struct pw_profiler_record {
+	uint64_t seq;			/**< odd while the record is written */
+	uint32_t type;			/**< one of PW_PROFILER_RECORD_* */
+	uint32_t id;			/**< the node id */
+	int64_t count;			/**< the cycle counter of the profiler */
+	int64_t prev_signal;
+	int64_t signal;
+	int64_t awake;
+	int64_t finish;
+	int32_t status;
+	uint32_t padding;
+	union {
+		struct pw_profiler_driver driver;
+		struct pw_profiler_follower follower;
+		uint8_t data[192];
+	};
+};
+
+/** The ring with the profiler records. The profiler writes a driver
+ * record followed by a record for each follower in each cycle, a fraction
+ * of a second after the cycle. It never waits for the readers, each reader
+ * keeps its own index and finds out with pw_profiler_ring_read() when the
+ * profiler overwrote a record it did not read yet. */
+struct pw_profiler_ring {
+#define PW_PROFILER_RING_VERSION	0
+	uint32_t version;
+	uint32_t n_records;		/**< number of records, a power of 2 */
+	uint64_t write_index;		/**< index of the next record */
+	uint32_t padding[12];
+	struct pw_profiler_record records[0];
+};
+
+/** Check if the ring in a mapped area of \a size bytes is valid */
+static inline bool pw_profiler_ring_check(const struct pw_profiler_ring *ring, size_t size)
+{
+	return size >= sizeof(*ring) &&
+		ring->version == PW_PROFILER_RING_VERSION &&
+		ring->n_records > 0 &&
+		(ring->n_records & (ring->n_records - 1)) == 0 &&
+		ring->n_records <= (size - sizeof(*ring)) / sizeof(struct pw_profiler_record);
+}
+
+/** Read the record at \a index.
+ * \return 1 when the record was read, 0 when it was not written yet and
+ * -EPIPE when it was overwritten already */
+static inline int pw_profiler_ring_read(const struct pw_profiler_ring *ring, uint64_t index,
+		struct pw_profiler_record *record)
+{
+	const struct pw_profiler_record *r = &ring->records[index & (ring->n_records - 1)];
+	uint64_t seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+
+	if (seq < 2 * index + 2)
+		return 0;
+	if (seq != 2 * index + 2)
+		return -EPIPE;
+	memcpy(record, r, sizeof(*record));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != seq)
+		return -EPIPE;
+	return 1;
+}
+
+/** The index of the oldest record that can still be read */
+static inline uint64_t pw_profiler_ring_oldest(const struct pw_profiler_ring *ring)
+{
+	uint64_t index = __atomic_load_n(&ring->write_index, __ATOMIC_ACQUIRE);
+	/* leave some room for the records that are written while we read */
+	return index > ring->n_records / 2 ? index - ring->n_records / 2 : 0;
+}
+
 #define PW_PROFILER_EVENT_PROFILE		0
-#define PW_PROFILER_EVENT_NUM			1
+#define PW_PROFILER_EVENT_RING			1
+#define PW_PROFILER_EVENT_NUM			2
 
 /** \ref pw_profiler events */
 struct pw_profiler_events {
-#define PW_VERSION_PROFILER_EVENTS		0
+#define PW_VERSION_PROFILER_EVENTS		1
 	uint32_t version;
 
+	/** the profile of some cycles, for clients before version 4 of
+	 * the interface */
 	void (*profile) (void *object, const struct spa_pod *pod);
+	/**
+	 * The ring with the records, since version 4 of the interface.
+	 * \param fd a memfd with a struct pw_profiler_ring, map it read-only
+	 * \param size the size of the memfd
+	 */
+	void (*ring) (void *object, int fd, uint32_t size);
 };
 
 #define PW_PROFILER_METHOD_ADD_LISTENER		0
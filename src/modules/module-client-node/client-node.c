@@ -69,6 +69,13 @@
 
 #define CHECK_PORT_BUFFER(this,b,p)      (b < p->n_buffers)
 
+/* clients of older versions map struct pw_node_activation_legacy */
+#define ACTIVATION_VERSION	4
+#define LEGACY_NODE		0
+#define LEGACY_DRIVER		1
+#define LEGACY_STRIDE		SPA_ROUND_UP_N(sizeof(struct pw_node_activation_legacy), \
+					PW_NODE_ACTIVATION_CACHE_LINE)
+
 struct buffer {
 	struct spa_buffer *outbuf;
 	struct spa_buffer buffer;
@@ -137,6 +144,12 @@ struct node {
 	struct spa_pod **params;
 };
 
+/* the import of a block of the context pool in the pool of the client */
+struct held {
+	struct pw_memblock *mem;
+	struct pw_memblock *import;
+};
+
 struct impl {
 	struct pw_impl_client_node this;
 
@@ -151,6 +164,10 @@ struct impl {
 	struct spa_hook node_listener;
 	struct spa_hook resource_listener;
 	struct spa_hook object_listener;
+	struct spa_hook pool_listener;
+
+	struct pw_array held;		/* struct held, buffer memory imported in the
+					 * client until it is freed in the context */
 
 	uint32_t node_id;
 
@@ -159,6 +176,11 @@ struct impl {
 
 	int fds[2];
 	int other_fds[2];
+
+	unsigned int legacy:1;		/* the client maps the legacy activation layout */
+	struct pw_memblock *legacy_mem;	/* legacy activations of the node and its driver */
+	uint32_t legacy_driver_id;
+	uint32_t legacy_owner[32];	/* segment owners last copied to the client */
 };
 
 #define pw_client_node_resource(r,m,v,...)	\
@@ -231,6 +253,25 @@ static struct mix *ensure_mix(struct impl *impl, struct port *p, uint32_t mix_id
 	return mix;
 }
 
+/* keep the import of buffer memory in the client while the memory exists
+ * in the context, the client can then keep its block when the memory is
+ * used for new buffers. The context only uses the memory again for links
+ * between the same clients. */
+static void hold_block(struct impl *impl, struct pw_memblock *mem, struct pw_memblock *m)
+{
+	struct held *h;
+
+	pw_array_for_each(h, &impl->held) {
+		if (h->mem == mem)
+			return;
+	}
+	if ((h = pw_array_add(&impl->held, sizeof(struct held))) == NULL)
+		return;
+	h->mem = mem;
+	h->import = m;
+	m->ref++;
+}
+
 static int clear_buffers(struct node *this, struct mix *mix)
 {
 	uint32_t i, j;
@@ -785,11 +826,12 @@ do_port_use_buffers(struct impl *impl,
 		if (m == NULL)
 			return -errno;
 
+		hold_block(impl, mem, m);
 		b->mem = m;
 
 		mb[i].buffer = &b->buffer;
 		mb[i].mem_id = m->id;
-		mb[i].offset = SPA_PTRDIFF(baseptr, SPA_MEMBER(mem->map->ptr, 0, void));
+		mb[i].offset = mem->offset + SPA_PTRDIFF(baseptr, SPA_MEMBER(mem->map->ptr, 0, void));
 		mb[i].size = data_size;
 		spa_log_debug(this->log, NAME" %p: buffer %d %d %d %d", this, i, mb[i].mem_id,
 				mb[i].offset, mb[i].size);
@@ -871,6 +913,91 @@ impl_node_port_reuse_buffer(void *object, uint32_t port_id, uint32_t buffer_id)
 	return -ENOTSUP;
 }
 
+static inline struct pw_node_activation_legacy *
+legacy_activation(struct impl *impl, uint32_t index)
+{
+	return SPA_MEMBER(impl->legacy_mem->map->ptr, index * LEGACY_STRIDE,
+			struct pw_node_activation_legacy);
+}
+
+/* legacy clients map a copy of their activation and one of the activation
+ * of their driver, update them before waking up the client */
+static void legacy_trigger(struct impl *impl, struct pw_node_activation *a)
+{
+	struct pw_impl_node *n = impl->this.node;
+	struct pw_node_activation *da = n->rt.driver_target.activation;
+	struct pw_node_activation_legacy *la = legacy_activation(impl, LEGACY_NODE);
+	struct pw_node_activation_legacy *lda = legacy_activation(impl, LEGACY_DRIVER);
+	uint32_t i, owner;
+
+	la->pending_sync = a->pending_sync;
+	la->pending_new_pos = a->pending_new_pos;
+	la->signal_time = a->signal_time;
+	la->status = PW_NODE_ACTIVATION_TRIGGERED;
+
+	if (da == NULL || da == a)
+		return;
+
+	/* the client claims and releases segments in the copy, pass on what
+	 * changed since the last cycle */
+	for (i = 0; i < SPA_N_ELEMENTS(lda->segment_owner); i++) {
+		owner = ATOMIC_LOAD(lda->segment_owner[i]);
+		if (owner != impl->legacy_owner[i])
+			ATOMIC_CAS(da->segment_owner[i], impl->legacy_owner[i], owner);
+		impl->legacy_owner[i] = ATOMIC_LOAD(da->segment_owner[i]);
+		ATOMIC_CAS(lda->segment_owner[i], owner, impl->legacy_owner[i]);
+	}
+	lda->position = da->position;
+	memcpy(lda->cpu_load, da->cpu_load, sizeof(lda->cpu_load));
+
+	/* the client signals the copy of the driver when it finished */
+	lda->status = PW_NODE_ACTIVATION_NOT_TRIGGERED;
+	lda->state[0].required = 1;
+	pw_node_activation_state_reset(&lda->state[0]);
+}
+
+/* copy what a legacy client updated back to the activations, returns the
+ * status to resume the node with */
+static int legacy_ready(struct impl *impl)
+{
+	struct pw_impl_node *n = impl->this.node;
+	struct pw_node_activation *a = n->rt.activation;
+	struct pw_node_activation *da = n->rt.driver_target.activation;
+	struct pw_node_activation_legacy *la = legacy_activation(impl, LEGACY_NODE);
+	struct pw_node_activation_legacy *lda = legacy_activation(impl, LEGACY_DRIVER);
+	uint32_t command, owner;
+
+	a->awake_time = la->awake_time;
+	a->state[0].status = la->state[0].status;
+	a->pending_sync = la->pending_sync;
+	a->pending_new_pos = la->pending_new_pos;
+	a->sync_timeout = la->sync_timeout;
+	a->segment = la->segment;
+	memcpy(a->cpu_load, la->cpu_load, sizeof(a->cpu_load));
+	a->xrun_count = la->xrun_count;
+	a->xrun_time = la->xrun_time;
+	a->xrun_delay = la->xrun_delay;
+	a->max_delay = la->max_delay;
+
+	/* a driver starts a new cycle */
+	if (da == NULL || da == a) {
+		a->status = la->status;
+		a->signal_time = la->signal_time;
+		return SPA_STATUS_HAVE_DATA;
+	}
+
+	command = ATOMIC_XCHG(lda->command, PW_NODE_ACTIVATION_COMMAND_NONE);
+	if (command != PW_NODE_ACTIVATION_COMMAND_NONE)
+		ATOMIC_STORE(da->command, command);
+
+	owner = ATOMIC_XCHG(lda->reposition_owner, 0);
+	if (owner != 0) {
+		a->reposition = la->reposition;
+		ATOMIC_STORE(da->reposition_owner, owner);
+	}
+	return SPA_STATUS_OK;
+}
+
 static int impl_node_process(void *object)
 {
 	struct node *this = object;
@@ -886,6 +1013,12 @@ static int impl_node_process(void *object)
 	n->rt.activation->status = PW_NODE_ACTIVATION_TRIGGERED;
 	n->rt.activation->signal_time = SPA_TIMESPEC_TO_NSEC(&ts);
 
+	/* legacy clients are always woken up with the eventfd */
+	if (SPA_UNLIKELY(impl->legacy_mem != NULL))
+		legacy_trigger(impl, n->rt.activation);
+	else if (pw_node_activation_futex_wake(n->rt.activation))
+		return SPA_STATUS_OK;
+
 	if (SPA_UNLIKELY(spa_system_eventfd_write(this->data_system, this->writefd, 1) < 0))
 		spa_log_warn(this->log, NAME" %p: error %m", this);
 
@@ -1073,6 +1206,7 @@ static struct pw_client_node_methods client_node_methods = {
 static void node_on_data_fd_events(struct spa_source *source)
 {
 	struct node *this = source->data;
+	struct impl *impl = this->impl;
 
 	if (source->rmask & (SPA_IO_ERR | SPA_IO_HUP)) {
 		spa_log_warn(this->log, NAME" %p: got error", this);
@@ -1089,7 +1223,13 @@ static void node_on_data_fd_events(struct spa_source *source)
 			pw_log_warn(NAME" %p: missed %"PRIu64" wakeups", this, cmd - 1);
 
 		spa_log_trace_fp(this->log, NAME" %p: got ready", this);
-		spa_node_call_ready(&this->callbacks, SPA_STATUS_HAVE_DATA);
+
+		/* a legacy client signals the copy of its driver when it
+		 * finished, we resume the node for it */
+		if (SPA_UNLIKELY(impl->legacy_mem != NULL))
+			spa_node_call_ready(&this->callbacks, legacy_ready(impl));
+		else
+			spa_node_call_ready(&this->callbacks, SPA_STATUS_HAVE_DATA);
 	}
 }
 
@@ -1220,11 +1360,17 @@ void pw_impl_client_node_registered(struct pw_impl_client_node *this, struct pw_
 	struct pw_impl_node *node = this->node;
 	struct pw_impl_client *client = impl->node.client;
 	uint32_t node_id = global->id;
-	struct pw_memblock *m;
+	struct pw_memblock *m, *mem = node->activation;
+	uint32_t size = sizeof(struct pw_node_activation);
 
 	pw_log_debug(NAME " %p: %d", &impl->node, node_id);
 
-	m = pw_mempool_import_block(client->pool, node->activation);
+	if (impl->legacy_mem) {
+		mem = impl->legacy_mem;
+		size = sizeof(struct pw_node_activation_legacy);
+	}
+
+	m = pw_mempool_import_block(client->pool, mem);
 	if (m == NULL) {
 		pw_log_debug(NAME " %p: can't import block: %m", &impl->node);
 		return;
@@ -1240,8 +1386,8 @@ void pw_impl_client_node_registered(struct pw_impl_client_node *this, struct pw_
 					  impl->other_fds[0],
 					  impl->other_fds[1],
 					  m->id,
-					  0,
-					  sizeof(struct pw_node_activation));
+					  mem->offset + LEGACY_NODE * LEGACY_STRIDE,
+					  size);
 
 	if (impl->bind_node_id) {
 		pw_global_bind(global, client, PW_PERM_RWX,
@@ -1270,26 +1416,69 @@ static void node_initialized(void *data)
 
 	size = sizeof(struct spa_io_buffers) * MAX_AREAS;
 
-	impl->io_areas = pw_mempool_alloc(impl->context->pool,
+	/* the io areas are only given to the client of the node */
+	impl->io_areas = pw_mempool_alloc_owned(impl->context->pool,
+			pw_memblock_owner(this->resource->client->serial, 0),
 			PW_MEMBLOCK_FLAG_READWRITE |
 			PW_MEMBLOCK_FLAG_MAP |
-			PW_MEMBLOCK_FLAG_SEAL,
+			PW_MEMBLOCK_FLAG_SEAL |
+			PW_MEMBLOCK_FLAG_SLAB |
+			PW_MEMBLOCK_FLAG_PREFAULT |
+			PW_MEMBLOCK_FLAG_MLOCK,
 			SPA_DATA_MemFd, size);
 	if (impl->io_areas == NULL)
                 return;
 
 	pw_log_debug(NAME " %p: io areas %p", node, impl->io_areas->map->ptr);
 
+	if (impl->legacy) {
+		/* the copies of the activations of the node and its driver in
+		 * the legacy layout are only given to the client of the node */
+		impl->legacy_mem = pw_mempool_alloc_owned(impl->context->pool,
+				pw_memblock_owner(this->resource->client->serial, 0),
+				PW_MEMBLOCK_FLAG_READWRITE |
+				PW_MEMBLOCK_FLAG_MAP |
+				PW_MEMBLOCK_FLAG_SEAL |
+				PW_MEMBLOCK_FLAG_PREFAULT |
+				PW_MEMBLOCK_FLAG_MLOCK,
+				SPA_DATA_MemFd, 2 * LEGACY_STRIDE);
+		if (impl->legacy_mem == NULL)
+			return;
+
+		pw_log_debug(NAME " %p: legacy activations %p", node,
+				impl->legacy_mem->map->ptr);
+	}
+
 	if ((global = pw_impl_node_get_global(this->node)) != NULL)
 		pw_impl_client_node_registered(this, global);
 }
 
+static void pool_removed(void *data, struct pw_memblock *block)
+{
+	struct impl *impl = data;
+	struct held *h;
+
+	pw_array_for_each(h, &impl->held) {
+		if (h->mem == block) {
+			pw_memblock_unref(h->import);
+			pw_array_remove(&impl->held, h);
+			break;
+		}
+	}
+}
+
+static const struct pw_mempool_events pool_events = {
+	PW_VERSION_MEMPOOL_EVENTS,
+	.removed = pool_removed,
+};
+
 static void node_free(void *data)
 {
 	struct impl *impl = data;
 	struct pw_impl_client_node *this = &impl->this;
 	struct node *node = &impl->node;
 	struct spa_system *data_system = node->data_system;
+	struct held *h;
 
 	this->node = NULL;
 
@@ -1297,12 +1486,18 @@ static void node_free(void *data)
 	node_clear(node);
 
 	spa_hook_remove(&impl->node_listener);
+	spa_hook_remove(&impl->pool_listener);
+	pw_array_for_each(h, &impl->held)
+		pw_memblock_unref(h->import);
+	pw_array_clear(&impl->held);
 
 	if (this->resource)
 		pw_resource_destroy(this->resource);
 
 	if (impl->io_areas)
 		pw_memblock_unref(impl->io_areas);
+	if (impl->legacy_mem)
+		pw_memblock_unref(impl->legacy_mem);
 
 	pw_map_clear(&impl->io_map);
 
@@ -1530,6 +1725,10 @@ static void node_peer_added(void *data, struct pw_impl_node *peer)
 
 	if (peer == impl->this.node)
 		return;
+	/* async nodes don't signal their peers, legacy clients only get
+	 * the copy of the activation of their driver */
+	if (impl->this.node->async || impl->legacy)
+		return;
 
 	m = pw_mempool_import_block(this->client->pool, peer->activation);
 	if (m == NULL) {
@@ -1546,7 +1745,7 @@ static void node_peer_added(void *data, struct pw_impl_node *peer)
 					  peer->info.id,
 					  peer->source.fd,
 					  m->id,
-					  0,
+					  peer->activation->offset,
 					  sizeof(struct pw_node_activation));
 }
 
@@ -1558,6 +1757,8 @@ static void node_peer_removed(void *data, struct pw_impl_node *peer)
 
 	if (peer == impl->this.node)
 		return;
+	if (impl->this.node->async || impl->legacy)
+		return;
 
 	m = pw_mempool_find_fd(this->client->pool, peer->activation->fd);
 	if (m == NULL) {
@@ -1580,6 +1781,45 @@ static void node_peer_removed(void *data, struct pw_impl_node *peer)
 	pw_memblock_unref(m);
 }
 
+static void legacy_driver_changed(struct impl *impl, struct pw_impl_node *driver)
+{
+	struct node *this = &impl->node;
+	struct pw_memblock *m;
+
+	if (impl->legacy_mem == NULL || this->resource == NULL)
+		return;
+
+	if (impl->legacy_driver_id != SPA_ID_INVALID) {
+		pw_client_node_resource_set_activation(this->resource,
+					  impl->legacy_driver_id,
+					  -1,
+					  SPA_ID_INVALID,
+					  0,
+					  0);
+		m = pw_mempool_find_fd(this->client->pool, impl->legacy_mem->fd);
+		if (m != NULL)
+			pw_memblock_unref(m);
+		impl->legacy_driver_id = SPA_ID_INVALID;
+	}
+	if (driver == NULL || driver == impl->this.node)
+		return;
+
+	m = pw_mempool_import_block(this->client->pool, impl->legacy_mem);
+	if (m == NULL) {
+		pw_log_debug(NAME " %p: can't ensure mem: %m", this);
+		return;
+	}
+	impl->legacy_driver_id = driver->info.id;
+
+	/* the client signals our eventfd when it finished */
+	pw_client_node_resource_set_activation(this->resource,
+					  driver->info.id,
+					  impl->fds[0],
+					  m->id,
+					  impl->legacy_mem->offset + LEGACY_DRIVER * LEGACY_STRIDE,
+					  sizeof(struct pw_node_activation_legacy));
+}
+
 static void node_driver_changed(void *data, struct pw_impl_node *old, struct pw_impl_node *driver)
 {
 	struct impl *impl = data;
@@ -1587,10 +1827,30 @@ static void node_driver_changed(void *data, struct pw_impl_node *old, struct pw_
 
 	pw_log_debug(NAME " %p: driver changed %p -> %p", this, old, driver);
 
+	if (impl->legacy) {
+		legacy_driver_changed(impl, driver);
+		return;
+	}
+
 	node_peer_removed(data, old);
 	node_peer_added(data, driver);
 }
 
+static void node_data_loop_changed(void *data, struct pw_loop *old, struct pw_loop *loop)
+{
+	struct impl *impl = data;
+	struct node *node = &impl->node;
+
+	pw_log_debug(NAME " %p: data loop %p->%p", node, old, loop);
+
+	if (node->data_source.loop != NULL) {
+		spa_loop_remove_source(node->data_source.loop, &node->data_source);
+		spa_loop_add_source(loop->loop, &node->data_source);
+	}
+	node->data_loop = loop->loop;
+	node->data_system = loop->system;
+}
+
 static const struct pw_impl_node_events node_events = {
 	PW_VERSION_IMPL_NODE_EVENTS,
 	.free = node_free,
@@ -1601,6 +1861,7 @@ static const struct pw_impl_node_events node_events = {
 	.peer_added = node_peer_added,
 	.peer_removed = node_peer_removed,
 	.driver_changed = node_driver_changed,
+	.data_loop_changed = node_data_loop_changed,
 };
 
 static const struct pw_resource_events resource_events = {
@@ -1637,7 +1898,7 @@ struct pw_impl_client_node *pw_impl_client_node_new(struct pw_resource *resource
 	struct pw_impl_client_node *this;
 	struct pw_impl_client *client = pw_resource_get_client(resource);
 	struct pw_context *context = pw_impl_client_get_context(client);
-	const struct spa_support *support;
+	struct spa_support support[16];
 	uint32_t n_support;
 	int res;
 
@@ -1660,9 +1921,12 @@ struct pw_impl_client_node *pw_impl_client_node_new(struct pw_resource *resource
 
 	impl->context = context;
 	impl->fds[0] = impl->fds[1] = -1;
-	pw_log_debug(NAME " %p: new", &impl->node);
+	impl->legacy = resource->version < ACTIVATION_VERSION;
+	impl->legacy_driver_id = SPA_ID_INVALID;
+	pw_log_debug(NAME " %p: new legacy:%d", &impl->node, impl->legacy);
 
-	support = pw_context_get_support(impl->context, &n_support);
+	n_support = pw_context_get_data_loop_support(impl->context, &properties->dict,
+			support, SPA_N_ELEMENTS(support));
 	node_init(&impl->node, NULL, support, n_support);
 	impl->node.impl = impl;
 	impl->node.resource = resource;
@@ -1670,6 +1934,7 @@ struct pw_impl_client_node *pw_impl_client_node_new(struct pw_resource *resource
 	this->flags = do_register ? 0 : 1;
 
 	pw_map_init(&impl->io_map, 64, 64);
+	pw_array_init(&impl->held, 16 * sizeof(struct held));
 
 	this->resource = resource;
 	this->node = pw_spa_node_new(context,
@@ -1687,6 +1952,15 @@ struct pw_impl_client_node *pw_impl_client_node_new(struct pw_resource *resource
 
 	this->node->rt.target.signal = process_node;
 	this->node->rt.target.data = impl;
+#ifdef __linux__
+	/* the node is woken up by the server and by the clients of its peers,
+	 * they all check the wakeup mode. Legacy clients never get the
+	 * activation of a peer. */
+	this->node->rt.activation->wakeup_futex = !impl->legacy;
+#endif
+	/* without a selected data loop, the node runs in the loop of its driver */
+	this->node->movable = pw_properties_get(this->node->properties,
+			PW_KEY_NODE_DATA_LOOP) == NULL;
 
 	pw_resource_add_listener(this->resource,
 				&impl->resource_listener,
@@ -1700,6 +1974,7 @@ struct pw_impl_client_node *pw_impl_client_node_new(struct pw_resource *resource
 	this->node->port_user_data_size = sizeof(struct port);
 
 	pw_impl_node_add_listener(this->node, &impl->node_listener, &node_events, impl);
+	pw_mempool_add_listener(context->pool, &impl->pool_listener, &pool_events, impl);
 
 	return this;
 
@@ -1155,6 +1155,20 @@ static const struct pw_protocol_marshal pw_protocol_native_client_node_marshal =
 	.client_demarshal = pw_protocol_native_client_node_event_demarshal,
 };
 
+/* the messages of version 3 are the same, only the activation layout
+ * differs */
+static const struct pw_protocol_marshal pw_protocol_native_client_node_marshal_v3 = {
+	PW_TYPE_INTERFACE_ClientNode,
+	3,
+	0,
+	PW_CLIENT_NODE_METHOD_NUM,
+	PW_CLIENT_NODE_EVENT_NUM,
+	.client_marshal = &pw_protocol_native_client_node_method_marshal,
+	.server_demarshal = &pw_protocol_native_client_node_method_demarshal,
+	.server_marshal = &pw_protocol_native_client_node_event_marshal,
+	.client_demarshal = pw_protocol_native_client_node_event_demarshal,
+};
+
 struct pw_protocol *pw_protocol_native_ext_client_node_init(struct pw_context *context)
 {
 	struct pw_protocol *protocol;
@@ -1165,6 +1179,7 @@ struct pw_protocol *pw_protocol_native_ext_client_node_init(struct pw_context *c
 		return NULL;
 
 	pw_protocol_add_marshal(protocol, &pw_protocol_native_client_node_marshal);
+	pw_protocol_add_marshal(protocol, &pw_protocol_native_client_node_marshal_v3);
 
 	return protocol;
 }
@@ -89,6 +89,11 @@ struct node_data {
 	struct spa_hook proxy_listener;
 
 	struct spa_list links;
+
+	uint64_t spin_wait;
+	struct pw_node_spin spin;
+	struct spa_hook loop_hook;
+	unsigned int spinning:1;
 };
 
 struct link {
@@ -118,8 +123,11 @@ do_deactivate_link(struct spa_loop *loop,
                 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct link *link = user_data;
+	struct pw_worker_pool *pool = link->data->context->worker_pool;
 	pw_log_trace("link %p deactivate", link);
+	pw_worker_pool_block(pool);
 	spa_list_remove(&link->target.link);
+	pw_worker_pool_unblock(pool);
 	return 0;
 }
 
@@ -134,6 +142,65 @@ static void clear_link(struct node_data *data, struct link *link)
 	free(link);
 }
 
+static void loop_before(void *d)
+{
+	struct node_data *data = d;
+	pw_node_spin_wait(&data->spin, data->node->rt.activation);
+}
+
+static void loop_after(void *d)
+{
+	struct node_data *data = d;
+	struct pw_node_activation *a = data->node->rt.activation;
+
+	if (a->status == PW_NODE_ACTIVATION_TRIGGERED)
+		pw_node_spin_update(&data->spin, a, pw_node_spin_get_nsec());
+}
+
+static const struct spa_loop_control_hooks loop_hooks = {
+	SPA_VERSION_LOOP_CONTROL_HOOKS,
+	.before = loop_before,
+	.after = loop_after,
+};
+
+static int
+do_add_spin(struct spa_loop *loop,
+                bool async, uint32_t seq, const void *d, size_t size, void *user_data)
+{
+	struct node_data *data = user_data;
+	pw_node_spin_init(&data->spin, data->node->rt.activation, data->spin_wait);
+	pw_loop_add_hook(data->context->data_loop, &data->loop_hook, &loop_hooks, data);
+	return 0;
+}
+
+static int
+do_remove_spin(struct spa_loop *loop,
+                bool async, uint32_t seq, const void *d, size_t size, void *user_data)
+{
+	struct node_data *data = user_data;
+	spa_hook_remove(&data->loop_hook);
+	return 0;
+}
+
+static void start_spin(struct node_data *data)
+{
+	if (data->spinning || data->spin_wait == 0)
+		return;
+	pw_log_debug("remote-node %p: spin wait %"PRIu64, data, data->spin_wait);
+	pw_loop_invoke(data->context->data_loop,
+		do_add_spin, SPA_ID_INVALID, NULL, 0, true, data);
+	data->spinning = true;
+}
+
+static void stop_spin(struct node_data *data)
+{
+	if (!data->spinning)
+		return;
+	pw_loop_invoke(data->context->data_loop,
+		do_remove_spin, SPA_ID_INVALID, NULL, 0, true, data);
+	data->spinning = false;
+}
+
 static void clean_transport(struct node_data *data)
 {
 	struct link *l;
@@ -143,6 +210,8 @@ static void clean_transport(struct node_data *data)
 	if (!data->have_transport)
 		return;
 
+	stop_spin(data);
+
 	spa_list_consume(l, &data->links, link)
 		clear_link(data, l);
 
@@ -171,7 +240,10 @@ do_deactivate_mix(struct spa_loop *loop,
                 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct mix *mix = user_data;
+	struct pw_worker_pool *pool = mix->port->node->context->worker_pool;
+	pw_worker_pool_block(pool);
 	spa_list_remove(&mix->mix.rt_link);
+	pw_worker_pool_unblock(pool);
         return 0;
 }
 
@@ -192,8 +264,11 @@ do_activate_mix(struct spa_loop *loop,
                 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct mix *mix = user_data;
+	struct pw_worker_pool *pool = mix->port->node->context->worker_pool;
 
+	pw_worker_pool_block(pool);
 	spa_list_append(&mix->port->rt.mix_list, &mix->mix.rt_link);
+	pw_worker_pool_unblock(pool);
         return 0;
 }
 
@@ -274,6 +349,8 @@ static int client_node_transport(void *object,
 
 	data->have_transport = true;
 
+	start_spin(data);
+
 	if (data->node->active)
 		pw_client_node_set_active(data->client_node, true);
 
@@ -802,6 +879,9 @@ static int link_signal_func(void *user_data)
 	link->target.activation->status = PW_NODE_ACTIVATION_TRIGGERED;
 	link->target.activation->signal_time = SPA_TIMESPEC_TO_NSEC(&ts);
 
+	if (pw_node_activation_futex_wake(link->target.activation))
+		return 0;
+
 	if (SPA_UNLIKELY(spa_system_eventfd_write(data_system, link->signalfd, 1) < 0))
 		pw_log_warn("link %p: write failed %m", link);
 
@@ -814,8 +894,11 @@ do_activate_link(struct spa_loop *loop,
 {
 	struct link *link = user_data;
 	struct node_data *d = link->data;
+	struct pw_worker_pool *pool = d->context->worker_pool;
 	pw_log_trace("link %p activate", link);
+	pw_worker_pool_block(pool);
 	spa_list_append(&d->node->rt.target_list, &link->target.link);
+	pw_worker_pool_unblock(pool);
 	return 0;
 }
 
@@ -1170,6 +1253,9 @@ static struct pw_proxy *node_export(struct pw_core *core, void *object, bool do_
 	if ((str = pw_properties_get(node->properties, "mem.warn-mlock")) != NULL)
 		data->warn_mlock = pw_properties_parse_bool(str);
 
+	if ((str = pw_properties_get(node->properties, PW_KEY_NODE_SPIN_WAIT)) != NULL)
+		data->spin_wait = pw_properties_parse_uint64(str);
+
 	node->exported = true;
 
 	spa_list_init(&data->free_mix);
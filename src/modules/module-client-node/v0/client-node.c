@@ -670,7 +670,7 @@ impl_node_port_set_io(void *object,
 		if (mem_size - mem_offset < size)
 			return -EINVAL;
 
-		mem_offset += mem->map->offset;
+		mem_offset += mem->map->offset + mem->offset;
 		m = ensure_mem(impl, mem->fd, SPA_DATA_MemFd, mem->flags);
 		memid = m->id;
 	}
@@ -764,7 +764,8 @@ impl_node_port_use_buffers(void *object,
 
 		mb[i].buffer = &b->buffer;
 		mb[i].mem_id = b->memid;
-		mb[i].offset = SPA_PTRDIFF(baseptr, SPA_MEMBER(mem->map->ptr, mem->map->offset, void));
+		mb[i].offset = mem->offset +
+			SPA_PTRDIFF(baseptr, SPA_MEMBER(mem->map->ptr, mem->map->offset, void));
 		mb[i].size = data_size;
 
 		for (j = 0; j < buffers[i]->n_metas; j++)
@@ -33,7 +33,6 @@
 #include "config.h"
 
 #include <spa/utils/result.h>
-#include <spa/utils/ringbuffer.h>
 #include <spa/param/profiler.h>
 #include <spa/debug/pod.h>
 
@@ -43,10 +42,15 @@
 
 #define NAME "profiler"
 
-#define MAX_BUFFER		(8 * 1024 * 1024)
-#define MIN_FLUSH		(16 * 1024)
-#define DEFAULT_IDLE		5
-#define DEFAULT_INTERVAL	1
+#define MAX_RECORDS		(32 * 1024)		/* 8MB */
+#define MAX_RAW_RECORDS		(16 * 1024)		/* more than the cycles of a
+							 * flush interval */
+#define MAX_POD_BUFFER		(1024 * 1024)
+#define FLUSH_INTERVAL		(100 * SPA_NSEC_PER_MSEC)
+
+#define MAX_FOLLOWERS		(MAX_RAW_RECORDS / 4)
+#define HISTOGRAM_BUCKETS	PW_PROFILER_HISTOGRAM_BUCKETS
+#define HISTOGRAM_INTERVAL	SPA_NSEC_PER_SEC
 
 int pw_protocol_native_ext_profiler_init(struct pw_context *context);
 
@@ -55,6 +59,8 @@ int pw_protocol_native_ext_profiler_init(struct pw_context *context);
 
 #define pw_profiler_resource_profile(r,...)        \
         pw_profiler_resource(r,profile,0,__VA_ARGS__)
+#define pw_profiler_resource_ring(r,...)        \
+        pw_profiler_resource(r,ring,1,__VA_ARGS__)
 
 static const struct spa_dict_item module_props[] = {
 	{ PW_KEY_MODULE_AUTHOR, "Wim Taymans <wim.taymans@gmail.com>" },
@@ -62,6 +68,28 @@ static const struct spa_dict_item module_props[] = {
 	{ PW_KEY_MODULE_VERSION, PACKAGE_VERSION },
 };
 
+/* what we keep for a node id: its place in the cycle that is analyzed and
+ * the processing time histogram. Bucket 0 counts times below 1 microsecond,
+ * bucket k counts times from 2^(k-1) to 2^k microseconds and the last bucket
+ * everything above */
+struct node_data {
+	struct pw_impl_node *node;	/* the node of the histogram */
+	int64_t cycle;			/* the last cycle with the node */
+	uint32_t slot;			/* the index in the nodes of that cycle */
+	uint32_t count;
+	uint64_t start;
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+struct cycle_node {
+	struct pw_impl_node *node;	/* NULL when the node is gone */
+	struct pw_profiler_record *r;
+	int32_t pred;		/* the last finished node that triggered us or -1 */
+	int64_t latest;		/* latest finish time that still meets the deadline */
+	bool ran;
+	bool critical;
+};
+
 struct impl {
 	struct pw_context *context;
 	struct pw_properties *properties;
@@ -71,15 +99,43 @@ struct impl {
 
 	struct pw_global *global;
 
-	int64_t count;
+	int64_t count;			/* cycles of all drivers, atomic */
 	uint32_t busy;
-	uint32_t empty;
+	uint32_t n_pod_clients;
 	struct spa_source *flush_timeout;
-	unsigned int flushing:1;
 	unsigned int listening:1;
 
-	struct spa_ringbuffer buffer;
-	uint8_t data[MAX_BUFFER];
+	/* the records of the data threads, they only copy the timings of a
+	 * cycle, the main thread does the analysis */
+	struct pw_profiler_ring *raw;
+
+	/* the records for the clients, written by the main thread. The
+	 * clients can write to the ring when they manage to map it writable,
+	 * the index is only stored to it and never read back. */
+	struct pw_memblock *mem;
+	struct pw_profiler_ring *ring;
+	uint64_t ring_index;
+	int ring_fd;			/* read-only fd for the clients */
+
+	/* main thread */
+	uint64_t raw_index;
+	uint32_t n_cycle;
+	uint32_t n_followers;
+	uint32_t max_cycle;
+	struct pw_profiler_record *cycle;
+	uint32_t n_nodes;
+	struct cycle_node *nodes;
+	uint32_t *order;
+	uint32_t n_path;
+	uint32_t *path;			/* the critical path, first finished first */
+	uint32_t n_ids;
+	struct node_data *ids;		/* indexed with the node id */
+	unsigned int warned:1;
+
+	/* to make pods for the clients before version 4 */
+	struct spa_pod_builder builder;
+	struct spa_pod_frame frame;
+	uint8_t pod_buffer[MAX_POD_BUFFER];
 };
 
 struct resource_data {
@@ -87,155 +143,649 @@ struct resource_data {
 
 	struct pw_resource *resource;
 	struct spa_hook resource_listener;
+	bool pods;
 };
 
-static void start_flush(struct impl *impl)
+static void set_flush(struct impl *impl, bool enabled)
 {
 	struct timespec value, interval;
 
 	value.tv_sec = 0;
-        value.tv_nsec = 1;
-	interval.tv_sec = DEFAULT_INTERVAL;
-        interval.tv_nsec = 0;
-        pw_loop_update_timer(impl->context->main_loop,
+	value.tv_nsec = enabled ? FLUSH_INTERVAL : 0;
+	interval = value;
+	pw_loop_update_timer(impl->context->main_loop,
 			impl->flush_timeout, &value, &interval, false);
-	impl->flushing = true;
 }
 
-static void stop_flush(struct impl *impl)
+static const char *node_name(struct impl *impl, uint32_t id)
 {
-	struct timespec value, interval;
+	struct pw_global *global = pw_context_find_global(impl->context, id);
+	struct pw_impl_node *node;
 
-	if (!impl->flushing)
-		return;
+	if (global == NULL || !pw_global_is_type(global, PW_TYPE_INTERFACE_Node))
+		return "";
+	node = pw_global_get_object(global);
+	return node->name;
+}
 
-	value.tv_sec = 0;
-        value.tv_nsec = 0;
-	interval.tv_sec = 0;
-        interval.tv_nsec = 0;
-        pw_loop_update_timer(impl->context->main_loop,
-			impl->flush_timeout, &value, &interval, false);
-	impl->flushing = false;
+static const char *clock_name(struct impl *impl, uint32_t id)
+{
+	struct pw_global *global = pw_context_find_global(impl->context, id);
+	struct pw_impl_node *node;
+
+	if (global == NULL || !pw_global_is_type(global, PW_TYPE_INTERFACE_Node))
+		return "";
+	node = pw_global_get_object(global);
+	return node->rt.activation->position.clock.name;
 }
 
-static void flush_timeout(void *data, uint64_t expirations)
+static void begin_pods(struct impl *impl)
+{
+	spa_pod_builder_init(&impl->builder, impl->pod_buffer, sizeof(impl->pod_buffer));
+	spa_pod_builder_push_struct(&impl->builder, &impl->frame);
+}
+
+static void send_pods(struct impl *impl)
 {
-	struct impl *impl = data;
-	int32_t avail, size;
-	uint32_t idx;
-	struct spa_pod_struct *p;
 	struct pw_resource *resource;
+	struct resource_data *data;
+	struct spa_pod *pod;
 
-	avail = spa_ringbuffer_get_read_index(&impl->buffer, &idx);
+	pod = spa_pod_builder_pop(&impl->builder, &impl->frame);
+	if (pod == NULL || SPA_POD_BODY_SIZE(pod) == 0)
+		return;
 
-	pw_log_trace(NAME"%p avail %d", impl, avail);
+	spa_list_for_each(resource, &impl->global->resource_list, link) {
+		data = pw_resource_get_user_data(resource);
+		if (data->pods)
+			pw_profiler_resource_profile(resource, pod);
+	}
+}
+
+/* make the profiler object of the collected records of a cycle */
+static void add_cycle_pod(struct impl *impl, struct spa_pod_builder *b)
+{
+	struct pw_profiler_record *dr = &impl->cycle[0];
+	struct pw_profiler_driver *d = &dr->driver;
+	struct spa_pod_frame f;
+	uint32_t i;
+
+	spa_pod_builder_push_object(b, &f, SPA_TYPE_OBJECT_Profiler, 0);
+
+	spa_pod_builder_prop(b, SPA_PROFILER_info, 0);
+	spa_pod_builder_add_struct(b,
+			SPA_POD_Long(dr->count),
+			SPA_POD_Float(d->cpu_load[0]),
+			SPA_POD_Float(d->cpu_load[1]),
+			SPA_POD_Float(d->cpu_load[2]));
+
+	spa_pod_builder_prop(b, SPA_PROFILER_clock, 0);
+	spa_pod_builder_add_struct(b,
+			SPA_POD_Int(d->clock_flags),
+			SPA_POD_Int(d->clock_id),
+			SPA_POD_String(clock_name(impl, dr->id)),
+			SPA_POD_Long(d->nsec),
+			SPA_POD_Fraction(&d->rate),
+			SPA_POD_Long(d->position),
+			SPA_POD_Long(d->duration),
+			SPA_POD_Long(d->delay),
+			SPA_POD_Double(d->rate_diff),
+			SPA_POD_Long(d->next_nsec));
+
+	spa_pod_builder_prop(b, SPA_PROFILER_driverBlock, 0);
+	spa_pod_builder_add_struct(b,
+			SPA_POD_Int(dr->id),
+			SPA_POD_String(node_name(impl, dr->id)),
+			SPA_POD_Long(dr->prev_signal),
+			SPA_POD_Long(dr->signal),
+			SPA_POD_Long(dr->awake),
+			SPA_POD_Long(dr->finish),
+			SPA_POD_Int(dr->status));
+
+	if (d->flags & PW_PROFILER_DRIVER_ADAPT) {
+		spa_pod_builder_prop(b, SPA_PROFILER_driverAdapt, 0);
+		spa_pod_builder_add_struct(b,
+			SPA_POD_Int(d->adapt_base),
+			SPA_POD_Int(d->adapt_quantum),
+			SPA_POD_Int(d->adapt_pending),
+			SPA_POD_Int(d->adapt_reason),
+			SPA_POD_Int(d->adapt_changes),
+			SPA_POD_Long(d->adapt_change_time));
+	}
+
+	for (i = 1; i < impl->n_cycle; i++) {
+		struct pw_profiler_record *r = &impl->cycle[i];
+
+		spa_pod_builder_prop(b, SPA_PROFILER_followerBlock, 0);
+		spa_pod_builder_add_struct(b,
+			SPA_POD_Int(r->id),
+			SPA_POD_String(node_name(impl, r->id)),
+			SPA_POD_Long(r->prev_signal),
+			SPA_POD_Long(r->signal),
+			SPA_POD_Long(r->awake),
+			SPA_POD_Long(r->finish),
+			SPA_POD_Int(r->status));
+	}
+	for (i = 1; i < impl->n_cycle; i++) {
+		struct pw_profiler_record *r = &impl->cycle[i];
+
+		if (!(r->follower.flags & PW_PROFILER_FOLLOWER_SPIN))
+			continue;
+
+		spa_pod_builder_prop(b, SPA_PROFILER_followerSpin, 0);
+		spa_pod_builder_add_struct(b,
+			SPA_POD_Int(r->id),
+			SPA_POD_String(node_name(impl, r->id)),
+			SPA_POD_Long(r->follower.spin_time),
+			SPA_POD_Int(r->follower.spin_hits),
+			SPA_POD_Int(r->follower.spin_misses));
+	}
+
+	spa_pod_builder_prop(b, SPA_PROFILER_driverCriticalPath, 0);
+	spa_pod_builder_add_struct(b,
+			SPA_POD_Long(d->period),
+			SPA_POD_Long(d->path_length),
+			SPA_POD_Array(sizeof(uint32_t), SPA_TYPE_Int,
+				impl->n_path, impl->path));
+
+	for (i = 1; i < impl->n_cycle; i++) {
+		struct pw_profiler_record *r = &impl->cycle[i];
+
+		if (!(r->follower.flags & PW_PROFILER_FOLLOWER_RAN))
+			continue;
+
+		spa_pod_builder_prop(b, SPA_PROFILER_followerSlack, 0);
+		spa_pod_builder_add_struct(b,
+			SPA_POD_Int(r->id),
+			SPA_POD_String(node_name(impl, r->id)),
+			SPA_POD_Long(r->follower.slack),
+			SPA_POD_Bool(r->follower.flags & PW_PROFILER_FOLLOWER_CRITICAL));
+
+		if (!(r->follower.flags & PW_PROFILER_FOLLOWER_HISTOGRAM))
+			continue;
+
+		spa_pod_builder_prop(b, SPA_PROFILER_followerHistogram, 0);
+		spa_pod_builder_add_struct(b,
+			SPA_POD_Int(r->id),
+			SPA_POD_String(node_name(impl, r->id)),
+			SPA_POD_Array(sizeof(uint32_t), SPA_TYPE_Int,
+				HISTOGRAM_BUCKETS, r->follower.buckets));
+	}
+	spa_pod_builder_pop(b, &f);
+}
 
-	if (avail <= 0) {
-		if (++impl->empty == DEFAULT_IDLE)
-			stop_flush(impl);
+static void add_cycle(struct impl *impl)
+{
+	struct spa_pod_builder *b = &impl->builder;
+	struct spa_pod_builder_state state;
+
+	spa_pod_builder_get_state(b, &state);
+	add_cycle_pod(impl, b);
+	if (b->state.offset <= b->size)
 		return;
+
+	/* does not fit anymore, send what we have and try again */
+	spa_pod_builder_reset(b, &state);
+	send_pods(impl);
+	begin_pods(impl);
+
+	spa_pod_builder_get_state(b, &state);
+	add_cycle_pod(impl, b);
+	if (b->state.offset > b->size) {
+		pw_log_warn(NAME " %p: profile too large %d", impl, b->state.offset);
+		spa_pod_builder_reset(b, &state);
+	}
+}
+
+static struct pw_impl_node *find_node(struct impl *impl, uint32_t id)
+{
+	struct pw_global *global = pw_context_find_global(impl->context, id);
+
+	if (global == NULL || !pw_global_is_type(global, PW_TYPE_INTERFACE_Node))
+		return NULL;
+	return pw_global_get_object(global);
+}
+
+static int find_cycle_node(struct impl *impl, struct pw_impl_node *node)
+{
+	struct node_data *nd;
+
+	if (node->info.id >= impl->n_ids)
+		return -1;
+	nd = &impl->ids[node->info.id];
+	if (nd->cycle != impl->cycle[0].count || nd->node != node)
+		return -1;
+	return nd->slot;
+}
+
+static struct node_data *get_node_data(struct impl *impl, uint32_t id)
+{
+	if (id >= impl->n_ids) {
+		uint32_t n_ids = SPA_MAX(id + 1, impl->n_ids * 2);
+		struct node_data *ids;
+
+		if ((ids = realloc(impl->ids, n_ids * sizeof(*ids))) == NULL)
+			return NULL;
+		memset(&ids[impl->n_ids], 0, (n_ids - impl->n_ids) * sizeof(*ids));
+		impl->ids = ids;
+		impl->n_ids = n_ids;
+	}
+	return &impl->ids[id];
+}
+
+/* Collect the followers of the cycle and for each of them the node that
+ * finished last of all nodes that trigger it. This is the predecessor on
+ * the critical path. The links are the ones of now, not of the cycle,
+ * the graph rarely changes in the meantime. Returns the nodes that ran
+ * this cycle ordered from the last to the first finish time. */
+static uint32_t collect_cycle(struct impl *impl)
+{
+	struct pw_profiler_record *dr = &impl->cycle[0];
+	struct pw_impl_port *p;
+	struct pw_impl_link *l;
+	uint32_t i, j, n_ran = 0;
+
+	impl->n_nodes = impl->n_cycle - 1;
+	for (i = 0; i < impl->n_nodes; i++) {
+		struct cycle_node *c = &impl->nodes[i];
+		struct node_data *nd;
+
+		c->r = &impl->cycle[i + 1];
+		c->node = find_node(impl, c->r->id);
+		c->pred = -1;
+		c->critical = false;
+		c->ran = c->r->status == PW_NODE_ACTIVATION_FINISHED &&
+			c->r->signal >= dr->signal;
+
+		if (c->node == NULL || (nd = get_node_data(impl, c->r->id)) == NULL)
+			continue;
+		if (nd->node != c->node) {
+			spa_zero(*nd);
+			nd->node = c->node;
+		}
+		nd->cycle = dr->count;
+		nd->slot = i;
 	}
-	impl->empty = 0;
 
-	size = avail + sizeof(struct spa_pod_struct);
-	p = alloca(size);
-	*p = SPA_POD_INIT_Struct(avail);
+	for (i = 0; i < impl->n_nodes; i++) {
+		struct cycle_node *c = &impl->nodes[i];
 
-	spa_ringbuffer_read_data(&impl->buffer, impl->data, MAX_BUFFER,
-			idx % MAX_BUFFER,
-			SPA_MEMBER(p, sizeof(struct spa_pod_struct), void), avail);
-	spa_ringbuffer_read_update(&impl->buffer, idx + avail);
+		if (!c->ran)
+			continue;
+
+		/* async nodes don't trigger their peers */
+		if (c->node != NULL && !c->node->async) {
+			spa_list_for_each(p, &c->node->output_ports, link) {
+				spa_list_for_each(l, &p->links, output_link) {
+					int k = find_cycle_node(impl, l->input->node);
+					struct cycle_node *s;
+
+					if (k < 0 || k == (int)i || l->detached)
+						continue;
+					s = &impl->nodes[k];
+					if (s->pred < 0 ||
+					    impl->nodes[s->pred].r->finish < c->r->finish)
+						s->pred = i;
+				}
+			}
+		}
+
+		/* insertion sort, latest finish time first */
+		for (j = n_ran++; j > 0; j--) {
+			if (impl->nodes[impl->order[j - 1]].r->finish >= c->r->finish)
+				break;
+			impl->order[j] = impl->order[j - 1];
+		}
+		impl->order[j] = i;
+	}
+	return n_ran;
+}
+
+/* the time a node started, the driver can trigger a node after the node
+ * that really woke it up */
+static inline int64_t cycle_node_start(struct impl *impl, struct cycle_node *c)
+{
+	int64_t start = c->r->signal;
+	if (c->pred >= 0)
+		start = SPA_MAX(start, impl->nodes[c->pred].r->finish);
+	return start;
+}
+
+/* Walk the nodes from last to first finish time and calculate the latest
+ * time each node can finish so that all nodes it triggers still finish
+ * before the deadline, given the time they needed this cycle. */
+static void calculate_slack(struct impl *impl, uint32_t n_ran, int64_t deadline)
+{
+	struct pw_impl_port *p;
+	struct pw_impl_link *l;
+	uint32_t i;
+
+	for (i = 0; i < n_ran; i++) {
+		struct cycle_node *c = &impl->nodes[impl->order[i]];
+		int64_t latest = deadline;
+
+		if (c->node != NULL && !c->node->async) {
+			spa_list_for_each(p, &c->node->output_ports, link) {
+				spa_list_for_each(l, &p->links, output_link) {
+					int k = find_cycle_node(impl, l->input->node);
+					struct cycle_node *s;
+
+					if (k < 0 || k == (int)impl->order[i] || l->detached)
+						continue;
+					s = &impl->nodes[k];
+					if (!s->ran)
+						continue;
+					latest = SPA_MIN(latest, s->latest -
+						(s->r->finish - cycle_node_start(impl, s)));
+				}
+			}
+		}
+		c->latest = latest;
+	}
+}
+
+static void update_stats(struct node_data *nd, uint64_t now, uint64_t nsec)
+{
+	uint64_t usec = nsec / 1000;
+	uint32_t bucket = 0;
 
-	spa_list_for_each(resource, &impl->global->resource_list, link)
-		pw_profiler_resource_profile(resource, &p->pod);
+	while (usec > 0 && bucket < HISTOGRAM_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+	if (nd->count++ == 0)
+		nd->start = now;
+	nd->buckets[bucket]++;
 }
 
+/* fill in the critical path, the slack and the histograms of a cycle */
+static void analyze_cycle(struct impl *impl)
+{
+	struct pw_profiler_record *dr = &impl->cycle[0];
+	struct pw_profiler_driver *d = &dr->driver;
+	uint32_t i, n_ran;
+	int32_t end;
+
+	n_ran = collect_cycle(impl);
+	calculate_slack(impl, n_ran, dr->signal + d->period);
+
+	/* walk back from the last finished node, the path is filled from
+	 * the end */
+	impl->n_path = 0;
+	for (end = n_ran > 0 ? (int32_t)impl->order[0] : -1; end >= 0;
+	     end = impl->nodes[end].pred) {
+		impl->nodes[end].critical = true;
+		impl->n_path++;
+	}
+	i = impl->n_path;
+	for (end = n_ran > 0 ? (int32_t)impl->order[0] : -1; end >= 0;
+	     end = impl->nodes[end].pred)
+		impl->path[--i] = impl->nodes[end].r->id;
+
+	d->path_length = n_ran > 0 ?
+		impl->nodes[impl->order[0]].r->finish - dr->signal : 0;
+
+	for (i = 0; i < impl->n_nodes; i++) {
+		struct cycle_node *c = &impl->nodes[i];
+		struct pw_profiler_follower *f = &c->r->follower;
+		struct node_data *nd;
+
+		if (!c->ran)
+			continue;
+
+		f->flags |= PW_PROFILER_FOLLOWER_RAN;
+		if (c->critical)
+			f->flags |= PW_PROFILER_FOLLOWER_CRITICAL;
+		f->slack = c->latest - c->r->finish;
+
+		if (c->node == NULL || c->r->id >= impl->n_ids)
+			continue;
+		nd = &impl->ids[c->r->id];
+		update_stats(nd, dr->signal, c->r->finish - c->r->awake);
+		if (dr->signal - nd->start >= HISTOGRAM_INTERVAL) {
+			f->flags |= PW_PROFILER_FOLLOWER_HISTOGRAM;
+			memcpy(f->buckets, nd->buckets, sizeof(f->buckets));
+			nd->count = 0;
+			spa_zero(nd->buckets);
+		}
+	}
+}
+
+/* the main thread is the only writer of the ring of the clients */
+static void write_record(struct impl *impl, const struct pw_profiler_record *rec)
+{
+	struct pw_profiler_ring *ring = impl->ring;
+	uint64_t index = impl->ring_index++;
+	struct pw_profiler_record *r = &ring->records[index & (MAX_RECORDS - 1)];
+
+	__atomic_store_n(&r->seq, 2 * index + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(SPA_MEMBER(r, sizeof(r->seq), void),
+			SPA_MEMBER(rec, sizeof(rec->seq), void),
+			sizeof(*r) - sizeof(r->seq));
+
+	__atomic_store_n(&r->seq, 2 * index + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->write_index, index + 1, __ATOMIC_RELEASE);
+}
+
+static void complete_cycle(struct impl *impl)
+{
+	uint32_t i;
+
+	analyze_cycle(impl);
+
+	for (i = 0; i < impl->n_cycle; i++)
+		write_record(impl, &impl->cycle[i]);
+
+	if (impl->n_pod_clients > 0)
+		add_cycle(impl);
+}
+
+static int ensure_cycle(struct impl *impl, uint32_t n_records)
+{
+	uint32_t max = impl->max_cycle;
+	void *p;
+
+	if (n_records <= max)
+		return 0;
+	max = SPA_MAX(n_records, max * 2);
+
+	if ((p = realloc(impl->cycle, max * sizeof(*impl->cycle))) == NULL)
+		return -errno;
+	impl->cycle = p;
+	if ((p = realloc(impl->nodes, max * sizeof(*impl->nodes))) == NULL)
+		return -errno;
+	impl->nodes = p;
+	if ((p = realloc(impl->order, max * sizeof(*impl->order))) == NULL)
+		return -errno;
+	impl->order = p;
+	if ((p = realloc(impl->path, max * sizeof(*impl->path))) == NULL)
+		return -errno;
+	impl->path = p;
+
+	impl->max_cycle = max;
+	return 0;
+}
+
+static void add_record(struct impl *impl, struct pw_profiler_record *r)
+{
+	switch (r->type) {
+	case PW_PROFILER_RECORD_DRIVER:
+		if (ensure_cycle(impl, r->driver.n_followers + 1) < 0) {
+			pw_log_error(NAME" %p: can't analyze cycle: %m", impl);
+			impl->n_cycle = 0;
+			return;
+		}
+		if ((r->driver.flags & PW_PROFILER_DRIVER_TRUNCATED) && !impl->warned) {
+			pw_log_warn(NAME" %p: driver %u has more than %u followers, "
+					"the others are not profiled", impl, r->id,
+					MAX_FOLLOWERS);
+			impl->warned = true;
+		}
+		impl->cycle[0] = *r;
+		impl->n_cycle = 1;
+		impl->n_followers = r->driver.n_followers;
+		break;
+	case PW_PROFILER_RECORD_FOLLOWER:
+		/* skip the followers of a cycle that we missed the start of */
+		if (impl->n_cycle == 0 || impl->cycle[0].count != r->count)
+			return;
+		impl->cycle[impl->n_cycle++] = *r;
+		impl->n_followers--;
+		break;
+	default:
+		return;
+	}
+	if (impl->n_followers == 0) {
+		complete_cycle(impl);
+		impl->n_cycle = 0;
+	}
+}
+
+/* analyze the new cycles of the data threads and publish them to the
+ * clients */
+static void flush_timeout(void *data, uint64_t expirations)
+{
+	struct impl *impl = data;
+	struct pw_profiler_record r;
+	int res;
+
+	if (impl->n_pod_clients > 0)
+		begin_pods(impl);
+
+	while ((res = pw_profiler_ring_read(impl->raw, impl->raw_index, &r)) != 0) {
+		if (res < 0) {
+			pw_log_warn(NAME " %p: queue xrun", impl);
+			impl->raw_index = pw_profiler_ring_oldest(impl->raw);
+			impl->n_cycle = 0;
+			continue;
+		}
+		add_record(impl, &r);
+		impl->raw_index++;
+	}
+	if (impl->n_pod_clients > 0)
+		send_pods(impl);
+}
+
+static struct pw_profiler_record *begin_record(struct impl *impl, uint64_t index,
+		uint32_t type, uint32_t id, int64_t count)
+{
+	struct pw_profiler_ring *raw = impl->raw;
+	struct pw_profiler_record *r = &raw->records[index & (raw->n_records - 1)];
+
+	__atomic_store_n(&r->seq, 2 * index + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memset(SPA_MEMBER(r, sizeof(r->seq), void), 0, sizeof(*r) - sizeof(r->seq));
+	r->type = type;
+	r->id = id;
+	r->count = count;
+	return r;
+}
+
+static void end_record(struct impl *impl, uint64_t index, struct pw_profiler_record *r)
+{
+	__atomic_store_n(&r->seq, 2 * index + 2, __ATOMIC_RELEASE);
+}
+
+/* Copy the timings of the cycle of a driver. The drivers of several data
+ * loops do this at the same time, each reserves the records of a cycle at
+ * once so that they stay together. */
 static void context_start(void *data, struct pw_impl_node *node)
 {
 	struct impl *impl = data;
-	char buffer[4096];
-	struct spa_pod_builder b;
-	struct spa_pod_frame f[2];
 	struct pw_node_activation *a = node->rt.activation;
 	struct spa_io_position *pos = &a->position;
 	struct pw_node_target *t;
-	int32_t filled;
-	uint32_t idx, avail;
-
-	spa_pod_builder_init(&b, buffer, sizeof(buffer));
-	spa_pod_builder_push_object(&b, &f[0],
-			SPA_TYPE_OBJECT_Profiler, 0);
-
-	spa_pod_builder_prop(&b, SPA_PROFILER_info, 0);
-	spa_pod_builder_add_struct(&b,
-			SPA_POD_Long(impl->count),
-			SPA_POD_Float(a->cpu_load[0]),
-			SPA_POD_Float(a->cpu_load[1]),
-			SPA_POD_Float(a->cpu_load[2]));
-
-	spa_pod_builder_prop(&b, SPA_PROFILER_clock, 0);
-	spa_pod_builder_add_struct(&b,
-			SPA_POD_Int(pos->clock.flags),
-			SPA_POD_Int(pos->clock.id),
-			SPA_POD_String(pos->clock.name),
-			SPA_POD_Long(pos->clock.nsec),
-			SPA_POD_Fraction(&pos->clock.rate),
-			SPA_POD_Long(pos->clock.position),
-			SPA_POD_Long(pos->clock.duration),
-			SPA_POD_Long(pos->clock.delay),
-			SPA_POD_Double(pos->clock.rate_diff),
-			SPA_POD_Long(pos->clock.next_nsec));
-
-	spa_pod_builder_prop(&b, SPA_PROFILER_driverBlock, 0);
-	spa_pod_builder_add_struct(&b,
-			SPA_POD_Int(node->info.id),
-			SPA_POD_String(node->name),
-			SPA_POD_Long(a->prev_signal_time),
-			SPA_POD_Long(a->signal_time),
-			SPA_POD_Long(a->awake_time),
-			SPA_POD_Long(a->finish_time),
-			SPA_POD_Int(a->status));
+	struct pw_profiler_record *r;
+	struct pw_profiler_driver *d;
+	uint32_t i = 0, n_followers = 0;
+	int64_t count;
+	uint64_t index;
+	bool truncated;
+
+	spa_list_for_each(t, &node->rt.target_list, link) {
+		if (t->node != NULL && t->node != node)
+			n_followers++;
+	}
+	truncated = n_followers > MAX_FOLLOWERS;
+	if (SPA_UNLIKELY(truncated))
+		n_followers = MAX_FOLLOWERS;
+
+	count = __atomic_fetch_add(&impl->count, 1, __ATOMIC_RELAXED);
+	index = __atomic_fetch_add(&impl->raw->write_index, n_followers + 1,
+			__ATOMIC_ACQ_REL);
+
+	r = begin_record(impl, index, PW_PROFILER_RECORD_DRIVER, node->info.id, count);
+	r->prev_signal = a->prev_signal_time;
+	r->signal = a->signal_time;
+	r->awake = a->awake_time;
+	r->finish = a->finish_time;
+	r->status = a->status;
+
+	d = &r->driver;
+	d->cpu_load[0] = a->cpu_load[0];
+	d->cpu_load[1] = a->cpu_load[1];
+	d->cpu_load[2] = a->cpu_load[2];
+	d->clock_flags = pos->clock.flags;
+	d->clock_id = pos->clock.id;
+	d->rate = pos->clock.rate;
+	d->n_followers = n_followers;
+	d->nsec = pos->clock.nsec;
+	d->position = pos->clock.position;
+	d->duration = pos->clock.duration;
+	d->delay = pos->clock.delay;
+	d->rate_diff = pos->clock.rate_diff;
+	d->next_nsec = pos->clock.next_nsec;
+	d->period = pos->clock.rate.denom ? pos->clock.duration * SPA_NSEC_PER_SEC *
+		pos->clock.rate.num / pos->clock.rate.denom : 0;
+	d->xrun_count = a->xrun_count;
+	if (truncated)
+		d->flags |= PW_PROFILER_DRIVER_TRUNCATED;
+
+	if (node->adapt.enabled) {
+		d->flags |= PW_PROFILER_DRIVER_ADAPT;
+		d->adapt_base = node->adapt.base;
+		d->adapt_quantum = node->adapt.quantum;
+		d->adapt_pending = node->adapt.pending;
+		d->adapt_reason = node->adapt.reason;
+		d->adapt_changes = node->adapt.changes;
+		d->adapt_change_time = node->adapt.change_time;
+	}
+	end_record(impl, index++, r);
 
 	spa_list_for_each(t, &node->rt.target_list, link) {
 		struct pw_impl_node *n = t->node;
 		struct pw_node_activation *na;
+		struct pw_profiler_follower *f;
 
 		if (n == NULL || n == node)
 			continue;
+		if (i++ == n_followers)
+			break;
 
 		na = n->rt.activation;
-		spa_pod_builder_prop(&b, SPA_PROFILER_followerBlock, 0);
-		spa_pod_builder_add_struct(&b,
-			SPA_POD_Int(n->info.id),
-			SPA_POD_String(n->name),
-			SPA_POD_Long(a->signal_time),
-			SPA_POD_Long(na->signal_time),
-			SPA_POD_Long(na->awake_time),
-			SPA_POD_Long(na->finish_time),
-			SPA_POD_Int(na->status));
-	}
-	spa_pod_builder_pop(&b, &f[0]);
-
-	filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
-	if (filled < 0 || filled > MAX_BUFFER) {
-		pw_log_warn(NAME " %p: queue xrun %d", impl, filled);
-		goto done;
-	}
-	avail = MAX_BUFFER - filled;
-	if (avail < b.state.offset) {
-		pw_log_warn(NAME " %p: queue full %d < %d", impl, avail, b.state.offset);
-		goto done;
+		r = begin_record(impl, index, PW_PROFILER_RECORD_FOLLOWER, n->info.id, count);
+		r->prev_signal = a->signal_time;
+		r->signal = na->signal_time;
+		r->awake = na->awake_time;
+		r->finish = na->finish_time;
+		r->status = na->status;
+
+		f = &r->follower;
+		f->xrun_count = na->xrun_count;
+		if (na->status == PW_NODE_ACTIVATION_TRIGGERED ||
+		    na->status == PW_NODE_ACTIVATION_AWAKE)
+			f->flags |= PW_PROFILER_FOLLOWER_UNFINISHED;
+		if (na->spin_time != 0 || na->spin_hits != 0 || na->spin_misses != 0) {
+			f->flags |= PW_PROFILER_FOLLOWER_SPIN;
+			f->spin_time = na->spin_time;
+			f->spin_hits = na->spin_hits;
+			f->spin_misses = na->spin_misses;
+		}
+		end_record(impl, index++, r);
 	}
-	spa_ringbuffer_write_data(&impl->buffer,
-			impl->data, MAX_BUFFER,
-			idx % MAX_BUFFER,
-			b.data, b.state.offset);
-	spa_ringbuffer_write_update(&impl->buffer, idx + b.state.offset);
-
-	if (!impl->flushing || filled + b.state.offset > MIN_FLUSH)
-		start_flush(impl);
-done:
-	impl->count++;
 }
 
 static const struct pw_context_driver_events context_events = {
@@ -254,18 +804,25 @@ static int do_stop(struct spa_loop *loop,
 static void stop_listener(struct impl *impl)
 {
 	if (impl->listening) {
-		pw_loop_invoke(impl->context->data_loop,
-                       do_stop, SPA_ID_INVALID, NULL, 0, true, impl);
+		/* the drivers of all data loops emit the start event */
+		pw_context_invoke_data_loops(impl->context,
+				do_stop, SPA_ID_INVALID, NULL, 0, impl);
 		impl->listening = false;
 	}
 }
 
-static void resource_destroy(void *data)
+static void resource_destroy(void *_data)
 {
-	struct impl *impl = data;
+	struct resource_data *data = _data;
+	struct impl *impl = data->impl;
+
+	if (data->pods)
+		impl->n_pod_clients--;
+
 	if (--impl->busy == 0) {
 		pw_log_info(NAME" %p: stopping profiler", impl);
 		stop_listener(impl);
+		set_flush(impl, false);
 	}
 }
 
@@ -284,6 +841,54 @@ do_start(struct spa_loop *loop,
 			&context_events, impl);
 	return 0;
 }
+
+/* the rings are only made when a client needs them */
+static int alloc_rings(struct impl *impl)
+{
+	char path[64];
+
+	impl->raw = calloc(1, sizeof(struct pw_profiler_ring) +
+			MAX_RAW_RECORDS * sizeof(struct pw_profiler_record));
+	if (impl->raw == NULL)
+		return -errno;
+	impl->raw->version = PW_PROFILER_RING_VERSION;
+	impl->raw->n_records = MAX_RAW_RECORDS;
+
+	impl->mem = pw_mempool_alloc(impl->context->pool,
+			PW_MEMBLOCK_FLAG_READWRITE |
+			PW_MEMBLOCK_FLAG_SEAL |
+			PW_MEMBLOCK_FLAG_MAP,
+			SPA_DATA_MemFd,
+			sizeof(struct pw_profiler_ring) +
+			MAX_RECORDS * sizeof(struct pw_profiler_record));
+	if (impl->mem == NULL) {
+		int res = -errno;
+		free(impl->raw);
+		impl->raw = NULL;
+		return res;
+	}
+	impl->ring = impl->mem->map->ptr;
+	impl->ring->version = PW_PROFILER_RING_VERSION;
+	impl->ring->n_records = MAX_RECORDS;
+	impl->ring_index = 0;
+
+	/* the fd of the clients is opened read-only, they can't map it
+	 * writable and change the ring */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", impl->mem->fd);
+	if ((impl->ring_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		int res = -errno;
+		pw_log_error(NAME" %p: can't reopen ring fd %d: %m", impl, impl->mem->fd);
+		pw_memblock_unref(impl->mem);
+		impl->mem = NULL;
+		free(impl->raw);
+		impl->raw = NULL;
+		return res;
+	}
+
+	pw_log_debug(NAME" %p: allocated rings", impl);
+	return 0;
+}
+
 static int
 global_bind(void *_data, struct pw_impl_client *client, uint32_t permissions,
             uint32_t version, uint32_t id)
@@ -292,6 +897,10 @@ global_bind(void *_data, struct pw_impl_client *client, uint32_t permissions,
 	struct pw_global *global = impl->global;
 	struct pw_resource *resource;
 	struct resource_data *data;
+	int res;
+
+	if (impl->mem == NULL && (res = alloc_rings(impl)) < 0)
+		return res;
 
 	resource = pw_resource_new(client, id, permissions,
 			PW_TYPE_INTERFACE_Profiler, version, sizeof(*data));
@@ -304,13 +913,25 @@ global_bind(void *_data, struct pw_impl_client *client, uint32_t permissions,
 	pw_global_add_resource(global, resource);
 
 	pw_resource_add_listener(resource, &data->resource_listener,
-			&resource_events, impl);
+			&resource_events, data);
+
+	if (version >= 4) {
+		/* the client reads the records itself */
+		pw_profiler_resource_ring(resource, impl->ring_fd, impl->mem->size);
+	} else {
+		data->pods = true;
+		impl->n_pod_clients++;
+	}
 
 	if (++impl->busy == 1) {
 		pw_log_info(NAME" %p: starting profiler", impl);
-		pw_loop_invoke(impl->context->data_loop,
-                       do_start, SPA_ID_INVALID, NULL, 0, false, impl);
+		impl->raw_index = __atomic_load_n(&impl->raw->write_index,
+				__ATOMIC_ACQUIRE);
+		impl->n_cycle = 0;
+		pw_context_invoke_data_loops(impl->context,
+				do_start, SPA_ID_INVALID, NULL, 0, impl);
 		impl->listening = true;
+		set_flush(impl, true);
 	}
 	return 0;
 }
@@ -326,6 +947,18 @@ static void module_destroy(void *data)
 	if (impl->properties)
 		pw_properties_free(impl->properties);
 
+	pw_loop_destroy_source(impl->context->main_loop, impl->flush_timeout);
+	if (impl->ring_fd >= 0)
+		close(impl->ring_fd);
+	if (impl->mem)
+		pw_memblock_unref(impl->mem);
+	free(impl->raw);
+	free(impl->cycle);
+	free(impl->nodes);
+	free(impl->order);
+	free(impl->path);
+	free(impl->ids);
+
 	free(impl);
 }
 
@@ -341,6 +974,7 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	struct pw_properties *props;
 	struct impl *impl;
 	struct pw_loop *main_loop = pw_context_get_main_loop(context);
+	int res;
 
 	impl = calloc(1, sizeof(struct impl));
 	if (impl == NULL)
@@ -356,18 +990,17 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 		props = pw_properties_new(NULL, NULL);
 
 	impl->context = context;
+	impl->ring_fd = -1;
 	impl->properties = props;
 
-	spa_ringbuffer_init(&impl->buffer);
-
 	impl->global = pw_global_new(context,
 			PW_TYPE_INTERFACE_Profiler,
 			PW_VERSION_PROFILER,
 			pw_properties_copy(props),
 			global_bind, impl);
 	if (impl->global == NULL) {
-		free(impl);
-		return -errno;
+		res = -errno;
+		goto error_free;
 	}
 
 	impl->flush_timeout = pw_loop_add_timer(main_loop, flush_timeout, impl);
@@ -379,4 +1012,9 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	pw_global_register(impl->global);
 
 	return 0;
+
+error_free:
+	pw_properties_free(props);
+	free(impl);
+	return res;
 }
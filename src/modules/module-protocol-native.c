@@ -23,6 +23,7 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
@@ -78,6 +79,8 @@ static bool debug_messages = 0;
 #define LOCK_SUFFIX     ".lock"
 #define LOCK_SUFFIXLEN  5
 
+#define DEFAULT_RING_SIZE	0u
+
 void pw_protocol_native_init(struct pw_protocol *protocol);
 void pw_protocol_native0_init(struct pw_protocol *protocol);
 
@@ -87,6 +90,8 @@ struct protocol_data {
 	struct pw_protocol *protocol;
 
 	struct server *local;
+
+	uint32_t ring_size;
 };
 
 struct client {
@@ -322,6 +327,8 @@ static void on_start(void *data, uint32_t version)
 {
 	struct client_data *this = data;
 	struct pw_impl_client *client = this->client;
+	struct protocol_data *d = pw_protocol_get_user_data(client->protocol);
+	int res;
 
 	pw_log_debug("version %d", version);
 
@@ -334,6 +341,11 @@ static void on_start(void *data, uint32_t version)
 
 	if (version == 0)
 		client->compat_v2 = &this->compat_v2;
+	else if (d->ring_size > 0 &&
+	    (res = pw_protocol_native_connection_offer_ring(this->connection,
+							    d->ring_size)) < 0)
+		pw_log_warn(NAME" %p: can't offer ring: %s", client->protocol,
+				spa_strerror(res));
 
 	return;
 }
@@ -1157,6 +1169,7 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	struct pw_protocol *this;
 	struct protocol_data *d;
 	const struct pw_properties *props;
+	const char *str;
 	int res;
 
 	if (pw_context_find_protocol(context, PW_TYPE_INFO_PROTOCOL_Native) != NULL)
@@ -1181,6 +1194,11 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	d->module = module;
 
 	props = pw_context_get_properties(context);
+	if ((str = pw_properties_get(props, "protocol.ring-size")) != NULL)
+		d->ring_size = atoi(str);
+	else
+		d->ring_size = DEFAULT_RING_SIZE;
+
 	d->local = create_server(this, context->core, &props->dict);
 
 	if (need_server(context, &props->dict)) {
@@ -0,0 +1,277 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <spa/pod/builder.h>
+#include <spa/pod/parser.h>
+
+#include <pipewire/pipewire.h>
+
+#include "connection.h"
+
+#define RING_SIZE	65536
+#define N_MESSAGES	200000
+#define N_PACED		5000
+
+#define OP_READY	0
+#define OP_CONTROL	1
+#define OP_END		2
+#define OP_STATS	3
+
+/* The receiver runs in its own process like the server does and reads
+ * all messages each time the socket wakes it up. The sender sends small
+ * control updates, like a volume change, in batches and flushes after
+ * each batch, like the main loop does once per iteration. */
+struct stats {
+	uint64_t usec;
+	uint32_t n_wakeups;
+	uint32_t n_messages;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static uint64_t get_cpu_usec(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * SPA_USEC_PER_SEC + ru.ru_utime.tv_usec +
+		ru.ru_stime.tv_sec * SPA_USEC_PER_SEC + ru.ru_stime.tv_usec;
+}
+
+static void send_message(struct pw_protocol_native_connection *conn, uint8_t opcode,
+		int v1, int v2, int v3)
+{
+	struct spa_pod_builder *b;
+
+	b = pw_protocol_native_connection_begin(conn, 1, opcode, NULL);
+	spa_pod_builder_add_struct(b,
+			SPA_POD_Int(v1),
+			SPA_POD_Int(v2),
+			SPA_POD_Int(v3));
+	pw_protocol_native_connection_end(conn, b);
+}
+
+static int flush(struct pw_protocol_native_connection *conn)
+{
+	struct pollfd pfd = { .fd = conn->fd, .events = POLLOUT };
+	int res;
+
+	while ((res = pw_protocol_native_connection_flush(conn)) == -EAGAIN)
+		poll(&pfd, 1, -1);
+	return res;
+}
+
+/* wait for a message and read all messages that are available */
+static int wait_message(struct pw_protocol_native_connection *conn, uint8_t opcode,
+		struct stats *stats)
+{
+	const struct pw_protocol_native_message *msg;
+	struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+	struct spa_pod_parser prs;
+	int res, v1, v2, v3;
+
+	while (true) {
+		res = pw_protocol_native_connection_get_next(conn, &msg);
+		if (res == -EAGAIN) {
+			/* a control message can need a reply */
+			flush(conn);
+			poll(&pfd, 1, -1);
+			if (stats)
+				stats->n_wakeups++;
+			continue;
+		}
+		if (res < 0)
+			return res;
+
+		spa_pod_parser_init(&prs, msg->data, msg->size);
+		if (spa_pod_parser_get_struct(&prs,
+				SPA_POD_Int(&v1),
+				SPA_POD_Int(&v2),
+				SPA_POD_Int(&v3)) < 0)
+			return -EINVAL;
+
+		if (msg->opcode == OP_CONTROL) {
+			if (stats == NULL || v1 != (int)stats->n_messages)
+				return -EINVAL;
+			stats->n_messages++;
+		} else if (msg->opcode == OP_END && stats) {
+			stats->usec = v1;
+		} else if (msg->opcode == OP_STATS && stats) {
+			stats->usec = v1;
+			stats->n_wakeups = v2;
+			stats->n_messages = v3;
+		}
+		if (msg->opcode == opcode)
+			return 0;
+	}
+}
+
+static int receiver(int fd, bool ring)
+{
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+	struct pw_protocol_native_connection *conn;
+	struct stats stats;
+	uint64_t t1;
+
+	loop = pw_main_loop_new(NULL);
+	context = pw_context_new(pw_main_loop_get_loop(loop), NULL, 0);
+	conn = pw_protocol_native_connection_new(context, fd);
+
+	if (ring)
+		pw_protocol_native_connection_offer_ring(conn, RING_SIZE);
+	send_message(conn, OP_READY, 0, 0, 0);
+	flush(conn);
+
+	while (true) {
+		spa_zero(stats);
+		t1 = get_cpu_usec();
+		if (wait_message(conn, OP_END, &stats) < 0 || stats.usec != 0)
+			break;
+		send_message(conn, OP_STATS, get_cpu_usec() - t1,
+				stats.n_wakeups, stats.n_messages);
+		flush(conn);
+	}
+	pw_protocol_native_connection_destroy(conn);
+	pw_context_destroy(context);
+	pw_main_loop_destroy(loop);
+	return 0;
+}
+
+static void run(struct pw_protocol_native_connection *conn, const char *mode,
+		uint32_t batch, uint32_t rate)
+{
+	struct stats stats;
+	uint32_t i, j, n_messages = SPA_ROUND_DOWN_N(rate ? N_PACED : N_MESSAGES, batch);
+	uint64_t t1, t2, c1, c2, period = rate ? SPA_NSEC_PER_SEC / rate : 0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t1 = get_time();
+	c1 = get_cpu_usec();
+	for (i = 0; i < n_messages; i += batch) {
+		for (j = 0; j < batch; j++)
+			send_message(conn, OP_CONTROL, i + j, 0, 0);
+		flush(conn);
+		if (period) {
+			ts.tv_nsec += period * batch;
+			while (ts.tv_nsec >= (long)SPA_NSEC_PER_SEC) {
+				ts.tv_nsec -= SPA_NSEC_PER_SEC;
+				ts.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+	}
+	send_message(conn, OP_END, 0, 0, 0);
+	flush(conn);
+	spa_zero(stats);
+	wait_message(conn, OP_STATS, &stats);
+	t2 = get_time();
+	c2 = get_cpu_usec();
+
+	if (stats.n_messages != n_messages)
+		fprintf(stderr, "%s: lost messages %u != %u\n", mode,
+				stats.n_messages, n_messages);
+
+	if (rate)
+		fprintf(stderr, "%s: %u msg/s, batch %u: sender %"PRIu64" nsec/msg, "
+				"receiver %"PRIu64" nsec/msg, %u wakeups\n",
+				mode, rate, batch,
+				(c2 - c1) * 1000 / n_messages,
+				stats.usec * 1000 / n_messages, stats.n_wakeups);
+	else
+		fprintf(stderr, "%s: batch %u: %"PRIu64" nsec/msg, sender %"PRIu64" nsec/msg, "
+				"receiver %"PRIu64" nsec/msg, %u wakeups\n",
+				mode, batch, (t2 - t1) / n_messages,
+				(c2 - c1) * 1000 / n_messages,
+				stats.usec * 1000 / n_messages, stats.n_wakeups);
+}
+
+static void test_connection(bool ring)
+{
+	static const uint32_t batches[] = { 1, 16, 256 };
+	static const uint32_t rates[] = { 1000, 10000 };
+	const char *mode = ring ? "ring" : "socket";
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+	struct pw_protocol_native_connection *conn;
+	int fds[2];
+	uint32_t i;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, fds) < 0) {
+		fprintf(stderr, "socketpair: %m\n");
+		return;
+	}
+	pid = fork();
+	if (pid == 0) {
+		close(fds[1]);
+		exit(receiver(fds[0], ring));
+	}
+	close(fds[0]);
+
+	loop = pw_main_loop_new(NULL);
+	context = pw_context_new(pw_main_loop_get_loop(loop), NULL, 0);
+	conn = pw_protocol_native_connection_new(context, fds[1]);
+
+	/* handles the ring offer */
+	wait_message(conn, OP_READY, NULL);
+	flush(conn);
+
+	for (i = 0; i < SPA_N_ELEMENTS(batches); i++)
+		run(conn, mode, batches[i], 0);
+	for (i = 0; i < SPA_N_ELEMENTS(rates); i++)
+		run(conn, mode, 1, rates[i]);
+
+	send_message(conn, OP_END, 1, 0, 0);
+	flush(conn);
+	waitpid(pid, NULL, 0);
+	pw_protocol_native_connection_destroy(conn);
+	close(fds[1]);
+	pw_context_destroy(context);
+	pw_main_loop_destroy(loop);
+}
+
+int main(int argc, char *argv[])
+{
+	pw_init(&argc, &argv);
+
+	test_connection(false);
+	test_connection(true);
+
+	return 0;
+}
@@ -29,15 +29,21 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include <spa/utils/result.h>
+#include <spa/utils/ringbuffer.h>
 #include <spa/pod/builder.h>
+#include <spa/pod/parser.h>
 
 #include <pipewire/pipewire.h>
 
 #define spa_debug pw_log_debug
 #include <spa/debug/pod.h>
 
+#include <pipewire/private.h>
+
 #include "connection.h"
 
 #define MAX_BUFFER_SIZE (1024 * 32)
@@ -46,8 +52,43 @@
 
 #define HDR_SIZE	16
 
+/* messages on the socket with this id control the rings and are
+ * not passed to the protocol */
+#define RING_ID			SPA_ID_INVALID
+#define RING_OPCODE_HELLO	0	/* offer to set up rings, Int(size) */
+#define RING_OPCODE_SETUP	1	/* the ring of the sender, Int(size), Int(fd) */
+#define RING_OPCODE_WAKEUP	2	/* new messages in the ring of the sender */
+
+#ifndef F_LINUX_SPECIFIC_BASE
+#define F_LINUX_SPECIFIC_BASE 1024
+#endif
+#ifndef F_GET_SEALS
+#define F_GET_SEALS (F_LINUX_SPECIFIC_BASE + 10)
+#define F_SEAL_SHRINK   0x0002
+#endif
+
+#define RING_MIN_SIZE	4096
+#define RING_MAX_SIZE	(4 * 1024 * 1024)
+#define RING_AREA_SIZE	64
+
 static bool debug_messages = 0;
 
+/* the shared header of a ring, followed by the ring data at
+ * RING_AREA_SIZE. The writer sets wakeup when it sends a wakeup
+ * message, the reader clears it when it receives it. */
+struct ring_area {
+	struct spa_ringbuffer ring;
+	uint32_t wakeup;
+};
+
+struct ring {
+	struct pw_memblock *mem;
+	struct pw_memmap *map;
+	struct ring_area *area;
+	void *data;
+	uint32_t size;
+};
+
 struct buffer {
 	uint8_t *buffer_data;
 	size_t buffer_size;
@@ -70,6 +111,16 @@ struct impl {
 
 	uint32_t version;
 	size_t hdr_size;
+
+	/* messages without fds go through the rings when they
+	 * are set up and are ordered with the socket messages on their seq */
+	struct ring ring_in, ring_out;
+	uint32_t in_seq;
+	unsigned int ring_pending:1;
+	uint8_t *ring_data;
+	struct pw_protocol_native_message ring_msg;
+
+	const struct pw_protocol_native_message *in_msg;
 };
 
 /** \endcond */
@@ -85,15 +136,15 @@ struct impl {
 int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *conn, uint32_t index)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	struct buffer *buf = &impl->in;
+	const struct pw_protocol_native_message *msg = impl->in_msg;
 
 	if (index == SPA_ID_INVALID)
 		return -1;
 
-	if (index >= buf->msg.n_fds)
+	if (index >= msg->n_fds)
 		return -ENOENT;
 
-	return buf->msg.fds[index];
+	return msg->fds[index];
 }
 
 /** Add an fd to a connection
@@ -218,6 +269,251 @@ static void clear_buffer(struct buffer *buf)
 	buf->fds_offset = 0;
 }
 
+static void ring_clear(struct ring *r)
+{
+	if (r->map)
+		pw_memmap_free(r->map);
+	if (r->mem)
+		pw_memblock_unref(r->mem);
+	spa_zero(*r);
+}
+
+static int ring_map(struct impl *impl, struct ring *r, uint32_t size)
+{
+	r->map = pw_memblock_map(r->mem, PW_MEMMAP_FLAG_READWRITE,
+			0, RING_AREA_SIZE + size, NULL);
+	if (r->map == NULL)
+		return -errno;
+	r->area = r->map->ptr;
+	r->data = SPA_MEMBER(r->area, RING_AREA_SIZE, void);
+	r->size = size;
+	return 0;
+}
+
+/* the memory of a ring can't shrink under the mapping of the peer */
+static inline bool ring_sealed(int fd)
+{
+	int seals = fcntl(fd, F_GET_SEALS);
+	return seals >= 0 && (seals & F_SEAL_SHRINK);
+}
+
+static int ring_alloc(struct impl *impl, struct ring *r, uint32_t size)
+{
+	int res;
+
+	r->mem = pw_mempool_alloc(impl->context->pool,
+			PW_MEMBLOCK_FLAG_READWRITE |
+			PW_MEMBLOCK_FLAG_SEAL,
+			SPA_DATA_MemFd, RING_AREA_SIZE + size);
+	if (r->mem == NULL)
+		return -errno;
+	if (!ring_sealed(r->mem->fd)) {
+		ring_clear(r);
+		return -ENOTSUP;
+	}
+	if ((res = ring_map(impl, r, size)) < 0) {
+		ring_clear(r);
+		return res;
+	}
+	spa_ringbuffer_init(&r->area->ring);
+	r->area->wakeup = 0;
+	return 0;
+}
+
+static int ring_import(struct impl *impl, struct ring *r, int fd, uint32_t size)
+{
+	struct stat st;
+	int res;
+
+	/* the peer owns the memory, make sure it can't shrink it under
+	 * our mapping and that we don't map past its end */
+	if (!ring_sealed(fd) ||
+	    fstat(fd, &st) < 0 || st.st_size < RING_AREA_SIZE + size) {
+		pw_log_warn("connection %p: ring fd:%d is not sealed or too small",
+				impl, fd);
+		close(fd);
+		return -EINVAL;
+	}
+	r->mem = pw_mempool_import(impl->context->pool,
+			PW_MEMBLOCK_FLAG_READWRITE, SPA_DATA_MemFd, fd);
+	if (r->mem == NULL) {
+		res = -errno;
+		close(fd);
+		return res;
+	}
+	if ((res = ring_map(impl, r, size)) < 0) {
+		ring_clear(r);
+		return res;
+	}
+	return 0;
+}
+
+static inline bool ring_size_valid(uint32_t size)
+{
+	return size >= RING_MIN_SIZE && size <= RING_MAX_SIZE &&
+		(size & (size - 1)) == 0;
+}
+
+/* write a ring control message on the socket, control messages don't
+ * take a seq number, the seq field has the next seq of the sender */
+static int write_control(struct impl *impl, uint8_t opcode, uint32_t size, int fd)
+{
+	struct pw_protocol_native_connection *conn = &impl->this;
+	struct buffer *buf = &impl->out;
+	struct spa_pod_builder b;
+	uint32_t *p;
+
+	if ((p = connection_ensure_size(conn, buf, HDR_SIZE + 64)) == NULL)
+		return -errno;
+	if (fd >= 0 && buf->n_fds >= MAX_FDS)
+		return -ENOSPC;
+
+	b = SPA_POD_BUILDER_INIT(SPA_MEMBER(p, HDR_SIZE, void), 64);
+	spa_pod_builder_add_struct(&b,
+			SPA_POD_Int(size),
+			SPA_POD_Int(fd >= 0 ? 0 : -1));
+
+	p[0] = RING_ID;
+	p[1] = (opcode << 24) | (b.state.offset & 0xffffff);
+	p[2] = buf->seq;
+	p[3] = fd >= 0 ? 1 : 0;
+
+	buf->buffer_size += HDR_SIZE + b.state.offset;
+	if (fd >= 0)
+		buf->fds[buf->n_fds++] = fd;
+
+	spa_hook_list_call(&conn->listener_list,
+			struct pw_protocol_native_connection_events, need_flush, 0);
+	return 0;
+}
+
+static int ring_setup_out(struct impl *impl, uint32_t size)
+{
+	int res;
+
+	if ((res = ring_alloc(impl, &impl->ring_out, size)) < 0)
+		return res;
+	if ((res = write_control(impl, RING_OPCODE_SETUP, size, impl->ring_out.mem->fd)) < 0) {
+		ring_clear(&impl->ring_out);
+		return res;
+	}
+	pw_log_debug("connection %p: ring out fd:%d size:%u", impl,
+			impl->ring_out.mem->fd, size);
+	return 0;
+}
+
+static int handle_control(struct impl *impl, const struct pw_protocol_native_message *msg)
+{
+	struct spa_pod_parser prs;
+	uint32_t size;
+	int32_t index;
+	int res;
+
+	if (msg->opcode == RING_OPCODE_WAKEUP) {
+		if (impl->ring_in.area != NULL)
+			__atomic_store_n(&impl->ring_in.area->wakeup, 0, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+
+	spa_pod_parser_init(&prs, msg->data, msg->size);
+	if (spa_pod_parser_get_struct(&prs,
+			SPA_POD_Int(&size),
+			SPA_POD_Int(&index)) < 0 ||
+	    !ring_size_valid(size))
+		return -EPROTO;
+
+	switch (msg->opcode) {
+	case RING_OPCODE_HELLO:
+		if (impl->ring_out.area != NULL)
+			return 0;
+		if ((res = ring_setup_out(impl, size)) < 0)
+			pw_log_warn("connection %p: can't set up ring: %s",
+					impl, spa_strerror(res));
+		break;
+
+	case RING_OPCODE_SETUP:
+		if (impl->ring_in.area != NULL || index < 0 ||
+		    (uint32_t)index >= msg->n_fds)
+			return -EPROTO;
+		if ((impl->ring_data = realloc(impl->ring_data, size)) == NULL)
+			return -errno;
+		if ((res = ring_import(impl, &impl->ring_in, msg->fds[index], size)) < 0)
+			return res;
+		impl->in_seq = msg->seq;
+		pw_log_debug("connection %p: ring in fd:%d size:%u seq:%u", impl,
+				impl->ring_in.mem->fd, size, impl->in_seq);
+
+		if (impl->ring_out.area == NULL &&
+		    (res = ring_setup_out(impl, size)) < 0)
+			pw_log_warn("connection %p: can't set up ring: %s",
+					impl, spa_strerror(res));
+		break;
+	default:
+		return -EPROTO;
+	}
+	return 0;
+}
+
+static bool ring_write(struct impl *impl, const void *data, uint32_t size)
+{
+	struct ring *r = &impl->ring_out;
+	uint32_t index, len = SPA_ROUND_UP_N(size, 8);
+	int32_t filled;
+
+	if (len > r->size)
+		return false;
+	filled = spa_ringbuffer_get_write_index(&r->area->ring, &index);
+	if (filled < 0 || (uint32_t)filled > r->size - len)
+		return false;
+
+	spa_ringbuffer_write_data(&r->area->ring, r->data, r->size,
+			index & (r->size - 1), data, size);
+	spa_ringbuffer_write_update(&r->area->ring, index + len);
+	impl->ring_pending = true;
+	return true;
+}
+
+/* read the next message from the ring when it is the next message
+ * of the peer, returns 0 when it is not or when the ring is empty */
+static int ring_read(struct impl *impl)
+{
+	struct ring *r = &impl->ring_in;
+	struct pw_protocol_native_message *msg = &impl->ring_msg;
+	uint32_t index, hdr[4], size, len;
+	int32_t avail;
+
+	avail = spa_ringbuffer_get_read_index(&r->area->ring, &index);
+	if (avail == 0)
+		return 0;
+	if (avail < HDR_SIZE || (uint32_t)avail > r->size)
+		return -EPROTO;
+
+	spa_ringbuffer_read_data(&r->area->ring, r->data, r->size,
+			index & (r->size - 1), hdr, HDR_SIZE);
+	if (hdr[2] != impl->in_seq)
+		return 0;
+
+	size = hdr[1] & 0xffffff;
+	len = SPA_ROUND_UP_N(HDR_SIZE + size, 8);
+	if (hdr[0] == RING_ID || hdr[3] != 0 || len > (uint32_t)avail)
+		return -EPROTO;
+
+	/* copy out, the peer can change the ring at any time */
+	spa_ringbuffer_read_data(&r->area->ring, r->data, r->size,
+			(index + HDR_SIZE) & (r->size - 1), impl->ring_data, size);
+	spa_ringbuffer_read_update(&r->area->ring, index + len);
+
+	msg->id = hdr[0];
+	msg->opcode = hdr[1] >> 24;
+	msg->seq = hdr[2];
+	msg->size = size;
+	msg->data = impl->ring_data;
+	msg->n_fds = 0;
+	msg->fds = NULL;
+
+	return 1;
+}
+
 /** Make a new connection object for the given socket
  *
  * \param fd the socket
@@ -246,6 +542,7 @@ struct pw_protocol_native_connection *pw_protocol_native_connection_new(struct p
 
 	impl->hdr_size = HDR_SIZE;
 	impl->version = 3;
+	impl->in_msg = &impl->in.msg;
 
 	impl->out.buffer_data = calloc(1, MAX_BUFFER_SIZE);
 	impl->out.buffer_maxsize = MAX_BUFFER_SIZE;
@@ -266,10 +563,42 @@ no_mem:
 
 int pw_protocol_native_connection_set_fd(struct pw_protocol_native_connection *conn, int fd)
 {
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+
+	/* the rings are for the old peer */
+	ring_clear(&impl->ring_in);
+	ring_clear(&impl->ring_out);
+	impl->ring_pending = false;
+
 	conn->fd = fd;
 	return 0;
 }
 
+/** Offer shared memory rings to the peer
+ *
+ * \param conn the connection
+ * \param size the size of the rings, a power of 2
+ * \return 0 on success, < 0 on error
+ *
+ * When the peer supports it, both sides set up a ring of \a size bytes
+ * and send the messages without fds through it. The socket is then only
+ * used for messages with fds and for wakeups.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+int pw_protocol_native_connection_offer_ring(struct pw_protocol_native_connection *conn,
+		uint32_t size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+
+	if (!ring_size_valid(size))
+		return -EINVAL;
+	if (impl->version < 3)
+		return -ENOTSUP;
+
+	return write_control(impl, RING_OPCODE_HELLO, size, -1);
+}
+
 /** Destroy a connection
  *
  * \param conn the connection to destroy
@@ -284,6 +613,9 @@ void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection
 
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, destroy, 0);
 
+	ring_clear(&impl->ring_in);
+	ring_clear(&impl->ring_out);
+	free(impl->ring_data);
 	free(impl->out.buffer_data);
 	free(impl->in.buffer_data);
 	free(impl);
@@ -373,18 +705,41 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	buf = &impl->in;
 
 	while (1) {
+		if (impl->ring_in.area != NULL) {
+			if ((res = ring_read(impl)) < 0)
+				return res;
+			if (res > 0) {
+				impl->in_seq = (impl->in_seq + 1) & SPA_ASYNC_SEQ_MASK;
+				*msg = impl->in_msg = &impl->ring_msg;
+				return 1;
+			}
+		}
+
 		len = prepare_packet(conn, buf);
 		if (len < 0)
 			return len;
-		if (len == 0)
-			break;
+		if (len == 0) {
+			if (impl->version < 3 || buf->msg.id != RING_ID)
+				break;
+			if ((res = handle_control(impl, &buf->msg)) < 0)
+				return res;
+			continue;
+		}
 
 		if (connection_ensure_size(conn, buf, len) == NULL)
 			return -errno;
 		if ((res = refill_buffer(conn, buf)) < 0)
 			return res;
 	}
-	*msg = &buf->msg;
+	if (impl->ring_in.area != NULL) {
+		if ((uint32_t)buf->msg.seq != impl->in_seq) {
+			pw_log_error("connection %p: expected seq %u, got %u", conn,
+					impl->in_seq, buf->msg.seq);
+			return -EPROTO;
+		}
+		impl->in_seq = (impl->in_seq + 1) & SPA_ASYNC_SEQ_MASK;
+	}
+	*msg = impl->in_msg = &buf->msg;
 	return 1;
 }
 
@@ -461,11 +816,16 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 		p[3] = buf->msg.n_fds;
 	}
 
-	buf->buffer_size += impl->hdr_size + size;
-	if (impl->version >= 3)
-		buf->n_fds += buf->msg.n_fds;
-	else
-		buf->n_fds = buf->msg.n_fds;
+	if (impl->ring_out.area != NULL && buf->msg.n_fds == 0 &&
+	    ring_write(impl, p, impl->hdr_size + size)) {
+		/* the message is in the ring, the peer orders it on seq */
+	} else {
+		buf->buffer_size += impl->hdr_size + size;
+		if (impl->version >= 3)
+			buf->n_fds += buf->msg.n_fds;
+		else
+			buf->n_fds = buf->msg.n_fds;
+	}
 
 	if (debug_messages) {
 		pw_log_debug(">>>>>>>>> out: id:%d op:%d size:%d seq:%d",
@@ -506,6 +866,17 @@ int pw_protocol_native_connection_flush(struct pw_protocol_native_connection *co
 	size_t size;
 
 	buf = &impl->out;
+
+	/* other messages on the socket wake up the peer as well, else send one
+	 * wakeup unless the peer did not see the previous one yet */
+	if (impl->ring_pending) {
+		impl->ring_pending = false;
+		if (buf->buffer_size == 0 &&
+		    __atomic_exchange_n(&impl->ring_out.area->wakeup, 1, __ATOMIC_SEQ_CST) == 0 &&
+		    (res = write_control(impl, RING_OPCODE_WAKEUP, 0, -1)) < 0)
+			return res;
+	}
+
 	data = buf->buffer_data;
 	size = buf->buffer_size;
 	fds = buf->fds;
@@ -74,6 +74,9 @@ pw_protocol_native_connection_new(struct pw_context *context, int fd);
 
 int pw_protocol_native_connection_set_fd(struct pw_protocol_native_connection *conn, int fd);
 
+int pw_protocol_native_connection_offer_ring(struct pw_protocol_native_connection *conn,
+		uint32_t size);
+
 void
 pw_protocol_native_connection_destroy(struct pw_protocol_native_connection *conn);
 
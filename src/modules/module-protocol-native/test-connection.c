@@ -22,7 +22,10 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <unistd.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include <spa/pod/builder.h>
 #include <spa/pod/parser.h>
@@ -119,6 +122,145 @@ static void test_read_write(struct pw_protocol_native_connection *in,
 	spa_assert(read_message(in) == -1);
 }
 
+static void write_value(struct pw_protocol_native_connection *conn, int value, int fd)
+{
+	struct spa_pod_builder *b;
+
+	b = pw_protocol_native_connection_begin(conn, 1, 6, NULL);
+	spa_assert(b != NULL);
+	spa_pod_builder_add_struct(b,
+			SPA_POD_Int(value),
+			SPA_POD_Int(fd < 0 ? -1 : (int)pw_protocol_native_connection_add_fd(conn, fd)));
+	spa_assert(pw_protocol_native_connection_end(conn, b) >= 0);
+}
+
+static int read_value(struct pw_protocol_native_connection *conn, bool with_fd)
+{
+        struct spa_pod_parser prs;
+	const struct pw_protocol_native_message *msg;
+	int value, fdidx;
+
+	if (pw_protocol_native_connection_get_next(conn, &msg) != 1)
+		return -1;
+
+	spa_assert(msg->opcode == 6);
+	spa_assert(msg->id == 1);
+
+	spa_pod_parser_init(&prs, msg->data, msg->size);
+	if (spa_pod_parser_get_struct(&prs,
+                        SPA_POD_Int(&value),
+                        SPA_POD_Int(&fdidx)) < 0)
+                spa_assert_not_reached();
+
+	if (with_fd)
+		spa_assert(pw_protocol_native_connection_get_fd(conn, fdidx) >= 0);
+	else
+		spa_assert(pw_protocol_native_connection_get_fd(conn, 0) == -ENOENT);
+	return value;
+}
+
+static void test_ring(struct pw_protocol_native_connection *in,
+		struct pw_protocol_native_connection *out)
+{
+	const struct pw_protocol_native_message *msg;
+	int i, avail;
+
+	spa_assert(pw_protocol_native_connection_offer_ring(in, 1000) == -EINVAL);
+	spa_assert(pw_protocol_native_connection_offer_ring(in, 4096) == 0);
+	pw_protocol_native_connection_flush(in);
+	/* handles the offer and sets up the ring */
+	spa_assert(pw_protocol_native_connection_get_next(out, &msg) == -EAGAIN);
+	pw_protocol_native_connection_flush(out);
+	spa_assert(pw_protocol_native_connection_get_next(in, &msg) == -EAGAIN);
+	pw_protocol_native_connection_flush(in);
+	spa_assert(pw_protocol_native_connection_get_next(out, &msg) == -EAGAIN);
+
+	/* messages without fds only send a wakeup */
+	for (i = 0; i < 8; i++)
+		write_value(out, i, -1);
+	pw_protocol_native_connection_flush(out);
+	spa_assert(ioctl(in->fd, FIONREAD, &avail) < 0 || avail <= 64);
+	for (i = 0; i < 8; i++)
+		spa_assert(read_value(in, false) == i);
+	spa_assert(read_value(in, false) == -1);
+
+	/* messages with fds go on the socket and stay in order */
+	write_value(out, 10, -1);
+	write_value(out, 11, 1);
+	write_value(out, 12, -1);
+	write_value(out, 13, 2);
+	pw_protocol_native_connection_flush(out);
+	spa_assert(read_value(in, false) == 10);
+	spa_assert(read_value(in, true) == 11);
+	spa_assert(read_value(in, false) == 12);
+	spa_assert(read_value(in, true) == 13);
+	spa_assert(read_value(in, false) == -1);
+
+	/* when the ring is full, the messages go on the socket */
+	for (i = 0; i < 256; i++)
+		write_value(out, i, -1);
+	pw_protocol_native_connection_flush(out);
+	for (i = 0; i < 256; i++)
+		spa_assert(read_value(in, false) == i);
+	spa_assert(read_value(in, false) == -1);
+
+	/* and the other way around */
+	write_value(in, 20, -1);
+	pw_protocol_native_connection_flush(in);
+	spa_assert(read_value(out, false) == 20);
+}
+
+static void test_ring_unsealed(struct pw_context *context)
+{
+	struct pw_protocol_native_connection *in;
+	const struct pw_protocol_native_message *msg;
+	struct spa_pod_builder b;
+	struct msghdr mh = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov[1];
+	char cmsgbuf[CMSG_SPACE(sizeof(int))];
+	uint32_t data[32];
+	int fds[2], memfd;
+
+	spa_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	in = pw_protocol_native_connection_new(context, fds[0]);
+	spa_assert(in != NULL);
+
+	/* a ring that the peer can still shrink is refused */
+	memfd = memfd_create("test-ring", MFD_CLOEXEC);
+	spa_assert(memfd >= 0);
+	spa_assert(ftruncate(memfd, 64 + 4096) == 0);
+
+	b = SPA_POD_BUILDER_INIT(&data[4], sizeof(data) - 16);
+	spa_pod_builder_add_struct(&b,
+			SPA_POD_Int(4096),
+			SPA_POD_Int(0));
+	data[0] = SPA_ID_INVALID;
+	data[1] = (1 << 24) | b.state.offset;
+	data[2] = 0;
+	data[3] = 1;
+
+	iov[0].iov_base = data;
+	iov[0].iov_len = 16 + b.state.offset;
+	mh.msg_iov = iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsgbuf;
+	mh.msg_controllen = sizeof(cmsgbuf);
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+	spa_assert(sendmsg(fds[1], &mh, 0) == (ssize_t)iov[0].iov_len);
+
+	spa_assert(pw_protocol_native_connection_get_next(in, &msg) == -EINVAL);
+
+	close(memfd);
+	pw_protocol_native_connection_destroy(in);
+	close(fds[0]);
+	close(fds[1]);
+}
+
 int main(int argc, char *argv[])
 {
 	struct pw_main_loop *loop;
@@ -144,6 +286,8 @@ int main(int argc, char *argv[])
 	test_create(in);
 	test_create(out);
 	test_read_write(in, out);
+	test_ring(in, out);
+	test_ring_unsealed(context);
 
 	return 0;
 }
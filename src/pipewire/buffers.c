@@ -46,8 +46,66 @@ struct port {
 	uint32_t port_id;
 };
 
+/* shared buffer memory that is kept after the buffers were cleared, it
+ * is used again for buffers with the same layout and the same owner. The
+ * clients of the owner can still have the memory mapped. */
+struct cache_entry {
+	struct spa_list link;
+	uint64_t owner;
+	uint32_t n_buffers;
+	uint32_t flags;
+	struct pw_memblock *mem;
+};
+
+static void cache_entry_free(struct pw_context *context, struct cache_entry *e)
+{
+	spa_list_remove(&e->link);
+	context->n_buffer_cache--;
+	pw_memblock_unref(e->mem);
+	free(e);
+}
+
+static struct pw_memblock *cache_take(struct pw_context *context, uint64_t owner,
+		uint32_t n_buffers, uint32_t flags, size_t size)
+{
+	struct cache_entry *e;
+	struct pw_memblock *m;
+
+	spa_list_for_each(e, &context->buffer_cache, link) {
+		if (e->owner != owner ||
+		    e->n_buffers != n_buffers || e->flags != flags ||
+		    e->mem->size != size)
+			continue;
+
+		m = e->mem;
+		spa_list_remove(&e->link);
+		context->n_buffer_cache--;
+		free(e);
+
+		pw_log_debug(NAME" %p: reuse mem %p id:%u size:%zu", context, m, m->id, size);
+		return m;
+	}
+	return NULL;
+}
+
+/* the memory of reused buffers has the metadata and chunks of the
+ * previous buffers */
+static void reset_buffers(struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < n_buffers; i++) {
+		struct spa_buffer *b = buffers[i];
+
+		for (j = 0; j < b->n_metas; j++)
+			memset(b->metas[j].data, 0, b->metas[j].size);
+		for (j = 0; j < b->n_datas; j++)
+			spa_zero(*b->datas[j].chunk);
+	}
+}
+
 /* Allocate an array of buffers that can be shared */
-static int alloc_buffers(struct pw_mempool *pool,
+static int alloc_buffers(struct pw_context *context,
 			 uint32_t n_buffers,
 			 uint32_t n_params,
 			 struct spa_pod **params,
@@ -67,6 +125,7 @@ static int alloc_buffers(struct pw_mempool *pool,
 	struct spa_data *datas;
 	struct pw_memblock *m;
 	struct spa_buffer_alloc_info info = { 0, };
+	bool reused = false;
 
 	if (!SPA_FLAG_IS_SET(flags, PW_BUFFERS_FLAG_SHARED))
 		SPA_FLAG_SET(info.flags, SPA_BUFFER_ALLOC_FLAG_INLINE_ALL);
@@ -123,13 +182,27 @@ static int alloc_buffers(struct pw_mempool *pool,
 	skel = SPA_MEMBER(buffers, n_buffers * sizeof(struct spa_buffer *), void);
 	skel = SPA_PTR_ALIGN(skel, info.max_align, void);
 
-	if (SPA_FLAG_IS_SET(flags, PW_BUFFERS_FLAG_SHARED)) {
-		/* pointer to buffer structures */
-		m = pw_mempool_alloc(pool,
-				PW_MEMBLOCK_FLAG_READWRITE |
+	if (SPA_FLAG_IS_SET(flags, PW_BUFFERS_FLAG_SHARED) &&
+	    (m = cache_take(context, allocation->owner, n_buffers, flags,
+			    n_buffers * info.mem_size)) != NULL) {
+		data = m->map->ptr;
+		reused = true;
+	} else if (SPA_FLAG_IS_SET(flags, PW_BUFFERS_FLAG_SHARED)) {
+		uint32_t mem_flags = PW_MEMBLOCK_FLAG_READWRITE |
 				PW_MEMBLOCK_FLAG_SEAL |
-				PW_MEMBLOCK_FLAG_MAP,
-				SPA_DATA_MemFd,
+				PW_MEMBLOCK_FLAG_MAP |
+				PW_MEMBLOCK_FLAG_SLAB |
+				PW_MEMBLOCK_FLAG_PREFAULT;
+
+		if (SPA_FLAG_IS_SET(flags, PW_BUFFERS_FLAG_HUGETLB))
+			mem_flags |= PW_MEMBLOCK_FLAG_HUGETLB;
+		if (SPA_FLAG_IS_SET(flags, PW_BUFFERS_FLAG_MLOCK))
+			mem_flags |= PW_MEMBLOCK_FLAG_MLOCK;
+
+		/* pointer to buffer structures, they only share an fd with
+		 * the other buffers of the same clients */
+		m = pw_mempool_alloc_owned(context->pool, allocation->owner,
+				mem_flags, SPA_DATA_MemFd,
 				n_buffers * info.mem_size);
 		if (m == NULL)
 			return -errno;
@@ -142,6 +215,8 @@ static int alloc_buffers(struct pw_mempool *pool,
 
 	pw_log_debug(NAME" %p: layout buffers skel:%p data:%p", allocation, skel, data);
 	spa_buffer_alloc_layout_array(&info, n_buffers, buffers, skel, data);
+	if (reused)
+		reset_buffers(buffers, n_buffers);
 
 	allocation->mem = m;
 	allocation->n_buffers = n_buffers;
@@ -323,7 +398,7 @@ int pw_buffers_negotiate(struct pw_context *context, uint32_t flags,
 	data_aligns[0] = align;
 	data_types[0] = types;
 
-	if ((res = alloc_buffers(context->pool,
+	if ((res = alloc_buffers(context,
 				 max_buffers,
 				 n_params,
 				 params,
@@ -346,3 +421,35 @@ void pw_buffers_clear(struct pw_buffers *buffers)
 	free(buffers->buffers);
 	spa_zero(*buffers);
 }
+
+void pw_buffers_recycle(struct pw_context *context, struct pw_buffers *buffers)
+{
+	struct cache_entry *e;
+	if (buffers->mem != NULL &&
+	    context->defaults.link_buffer_cache > 0 &&
+	    SPA_FLAG_IS_SET(buffers->flags, PW_BUFFERS_FLAG_SHARED) &&
+	    (e = calloc(1, sizeof(struct cache_entry))) != NULL) {
+		e->owner = buffers->owner;
+		e->n_buffers = buffers->n_buffers;
+		e->flags = buffers->flags;
+		e->mem = buffers->mem;
+		buffers->mem = NULL;
+
+		pw_log_debug(NAME" %p: keep mem %p id:%u size:%u", context,
+				e->mem, e->mem->id, e->mem->size);
+
+		spa_list_prepend(&context->buffer_cache, &e->link);
+		if (++context->n_buffer_cache > context->defaults.link_buffer_cache)
+			cache_entry_free(context, spa_list_last(&context->buffer_cache,
+						struct cache_entry, link));
+	}
+	pw_buffers_clear(buffers);
+}
+
+void pw_buffers_clear_cache(struct pw_context *context)
+{
+	struct cache_entry *e;
+
+	spa_list_consume(e, &context->buffer_cache, link)
+		cache_entry_free(context, e);
+}
@@ -38,12 +38,17 @@ extern "C" {
 #define PW_BUFFERS_FLAG_NO_MEM		(1<<0)	/**< don't allocate buffer memory */
 #define PW_BUFFERS_FLAG_SHARED		(1<<1)	/**< buffers can be shared */
 #define PW_BUFFERS_FLAG_DYNAMIC		(1<<2)	/**< buffers have dynamic data */
+#define PW_BUFFERS_FLAG_MLOCK		(1<<3)	/**< lock the buffer memory */
+#define PW_BUFFERS_FLAG_HUGETLB		(1<<4)	/**< buffer memory from huge pages */
 
 struct pw_buffers {
 	struct pw_memblock *mem;	/**< allocated buffer memory */
 	struct spa_buffer **buffers;	/**< port buffers */
 	uint32_t n_buffers;		/**< number of port buffers */
 	uint32_t flags;			/**< flags */
+	uint64_t owner;			/**< owner of the shared memory, see
+					  *  pw_memblock_owner(). Set it before
+					  *  pw_buffers_negotiate() */
 };
 
 int pw_buffers_negotiate(struct pw_context *context, uint32_t flags,
@@ -55,13 +55,27 @@
 #define DEFAULT_VIDEO_RATE_NUM		25u
 #define DEFAULT_VIDEO_RATE_DENOM	1u
 #define DEFAULT_LINK_MAX_BUFFERS	64u
+#define DEFAULT_LINK_BUFFER_CACHE	0u
+#define DEFAULT_LINK_MLOCK		false
+#define DEFAULT_LINK_HUGEPAGES		false
 #define DEFAULT_MEM_ALLOW_MLOCK		true
+#define DEFAULT_MEM_SLAB_SIZE		0u
+#define DEFAULT_MEM_HUGEPAGES		false
+#define DEFAULT_MEM_PREFAULT		true
+#define DEFAULT_DATA_LOOPS		1u
+#define DEFAULT_FLIGHT_RECORDER		0u
+#define DEFAULT_WATCHDOG_OVERRUNS	0u
+#define DEFAULT_WATCHDOG_TIMEOUT	5000u
 
 /** \cond */
 struct impl {
 	struct pw_context this;
 	struct spa_handle *dbus_handle;
-	unsigned int recalc;
+	unsigned int recalc:1;
+	unsigned int recalc_pending:1;
+
+	struct spa_list affected_list;		/**< nodes to recalc */
+	struct pw_impl_node *target;		/**< master for unassigned nodes */
 };
 
 
@@ -173,7 +187,16 @@ static void fill_defaults(struct pw_context *this)
 	this->defaults.video_rate.num = get_default_int(p, "default.video.rate.num", DEFAULT_VIDEO_RATE_NUM);
 	this->defaults.video_rate.denom = get_default_int(p, "default.video.rate.denom", DEFAULT_VIDEO_RATE_DENOM);
 	this->defaults.link_max_buffers = get_default_int(p, "link.max-buffers", DEFAULT_LINK_MAX_BUFFERS);
+	this->defaults.link_buffer_cache = get_default_int(p, "link.buffer-cache", DEFAULT_LINK_BUFFER_CACHE);
+	this->defaults.link_mlock = get_default_bool(p, "link.mlock", DEFAULT_LINK_MLOCK);
+	this->defaults.link_hugepages = get_default_bool(p, "link.hugepages", DEFAULT_LINK_HUGEPAGES);
 	this->defaults.mem_allow_mlock = get_default_bool(p, "mem.allow-mlock", DEFAULT_MEM_ALLOW_MLOCK);
+	this->defaults.mem_slab_size = get_default_int(p, "mem.slab-size", DEFAULT_MEM_SLAB_SIZE);
+	this->defaults.mem_hugepages = get_default_bool(p, "mem.hugepages", DEFAULT_MEM_HUGEPAGES);
+	this->defaults.mem_prefault = get_default_bool(p, "mem.prefault", DEFAULT_MEM_PREFAULT);
+	this->defaults.flight_recorder = get_default_int(p, "flight-recorder.cycles", DEFAULT_FLIGHT_RECORDER);
+	this->defaults.watchdog_overruns = get_default_int(p, "watchdog.overruns", DEFAULT_WATCHDOG_OVERRUNS);
+	this->defaults.watchdog_timeout = get_default_int(p, "watchdog.timeout", DEFAULT_WATCHDOG_TIMEOUT);
 
 	this->defaults.clock_max_quantum = SPA_CLAMP(this->defaults.clock_max_quantum,
 			CLOCK_MIN_QUANTUM, CLOCK_MAX_QUANTUM);
@@ -183,6 +206,48 @@ static void fill_defaults(struct pw_context *this)
 			this->defaults.clock_min_quantum, this->defaults.clock_max_quantum);
 }
 
+static int create_data_loops(struct pw_context *this)
+{
+	struct pw_properties *props = this->properties, *pr;
+	const char *str;
+	uint32_t i, n_loops;
+	char key[128];
+	int res;
+
+	n_loops = get_default_int(props, "context.data-loops", DEFAULT_DATA_LOOPS);
+	n_loops = SPA_CLAMP(n_loops, 1u, (uint32_t)MAX_DATA_LOOPS);
+
+	for (i = 0; i < n_loops; i++) {
+		pr = pw_properties_copy(props);
+		if (pr == NULL)
+			goto error;
+
+		if ((str = pw_properties_get(pr, "context.data-loop." PW_KEY_LIBRARY_NAME_SYSTEM)))
+			pw_properties_set(pr, PW_KEY_LIBRARY_NAME_SYSTEM, str);
+
+		snprintf(key, sizeof(key), "context.data-loop.%u.cpus", i);
+		pw_properties_set(pr, "loop.cpus", pw_properties_get(props, key));
+		snprintf(key, sizeof(key), "context.data-loop.%u.rt-prio", i);
+		pw_properties_set(pr, "loop.rt-prio", pw_properties_get(props, key));
+
+		this->data_loops[i] = pw_data_loop_new(&pr->dict);
+		pw_properties_free(pr);
+		if (this->data_loops[i] == NULL)
+			goto error;
+
+		this->n_data_loops++;
+	}
+	pw_log_debug(NAME" %p: created %u data loops", this, this->n_data_loops);
+	return 0;
+
+error:
+	res = -errno;
+	for (i = 0; i < this->n_data_loops; i++)
+		pw_data_loop_destroy(this->data_loops[i]);
+	this->n_data_loops = 0;
+	return res;
+}
+
 /** Create a new context object
  *
  * \param main_loop the main loop to use
@@ -198,11 +263,12 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 {
 	struct impl *impl;
 	struct pw_context *this;
+	struct pw_properties *pool_props;
 	const char *lib, *str;
 	void *dbus_iface = NULL;
 	uint32_t n_support;
-	struct pw_properties *pr;
 	struct spa_cpu *cpu;
+	uint32_t i;
 	int res = 0;
 
 	impl = calloc(1, sizeof(struct impl) + user_data_size);
@@ -229,18 +295,24 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 
 	fill_defaults(this);
 
-	pr = pw_properties_copy(properties);
-	if ((str = pw_properties_get(pr, "context.data-loop." PW_KEY_LIBRARY_NAME_SYSTEM)))
-		pw_properties_set(pr, PW_KEY_LIBRARY_NAME_SYSTEM, str);
+	if ((res = create_data_loops(this)) < 0)
+		goto error_free;
+	this->data_loop_impl = this->data_loops[0];
 
-	this->data_loop_impl = pw_data_loop_new(&pr->dict);
-	pw_properties_free(pr);
-	if (this->data_loop_impl == NULL)  {
+	pool_props = pw_properties_new(NULL, NULL);
+	if (pool_props == NULL) {
 		res = -errno;
-		goto error_free;
+		goto error_free_loop;
 	}
-
-	this->pool = pw_mempool_new(NULL);
+	pw_properties_setf(pool_props, "mem.slab-size", "%u", this->defaults.mem_slab_size);
+	pw_properties_set(pool_props, "mem.hugepages",
+			this->defaults.mem_hugepages ? "true" : "false");
+	pw_properties_set(pool_props, "mem.prefault",
+			this->defaults.mem_prefault ? "true" : "false");
+	pw_properties_set(pool_props, "mem.allow-mlock",
+			this->defaults.mem_allow_mlock ? "true" : "false");
+
+	this->pool = pw_mempool_new(pool_props);
 	if (this->pool == NULL) {
 		res = -errno;
 		goto error_free_loop;
@@ -296,6 +368,9 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 	spa_list_init(&this->control_list[1]);
 	spa_list_init(&this->export_list);
 	spa_list_init(&this->driver_list);
+	spa_list_init(&this->dirty_list);
+	spa_list_init(&this->buffer_cache);
+	spa_list_init(&impl->affected_list);
 	spa_hook_list_init(&this->listener_list);
 	spa_hook_list_init(&this->driver_listener_list);
 
@@ -308,8 +383,14 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 
 	fill_properties(this);
 
-	if ((res = pw_data_loop_start(this->data_loop_impl)) < 0)
-		goto error_free_loop;
+	for (i = 0; i < this->n_data_loops; i++) {
+		if ((res = pw_data_loop_start(this->data_loops[i])) < 0)
+			goto error_free_loop;
+	}
+
+	this->worker_pool = pw_worker_pool_new(&properties->dict);
+	if (this->worker_pool == NULL && errno != ENOTSUP)
+		pw_log_warn(NAME" %p: can't create worker pool: %m", this);
 
 	this->sc_pagesize = sysconf(_SC_PAGESIZE);
 
@@ -323,7 +404,8 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 	return this;
 
 error_free_loop:
-	pw_data_loop_destroy(this->data_loop_impl);
+	for (i = 0; i < this->n_data_loops; i++)
+		pw_data_loop_destroy(this->data_loops[i]);
 error_free:
 	free(this);
 error_cleanup:
@@ -351,6 +433,7 @@ void pw_context_destroy(struct pw_context *context)
 	struct pw_impl_node *node;
 	struct factory_entry *entry;
 	struct pw_impl_core *core_impl;
+	uint32_t i;
 
 	pw_log_debug(NAME" %p: destroy", context);
 	pw_context_emit_destroy(context);
@@ -379,9 +462,17 @@ void pw_context_destroy(struct pw_context *context)
 	pw_log_debug(NAME" %p: free", context);
 	pw_context_emit_free(context);
 
+	pw_buffers_clear_cache(context);
 	pw_mempool_destroy(context->pool);
 
-	pw_data_loop_destroy(context->data_loop_impl);
+	/* the data loops hand nodes to the workers, stop them first */
+	for (i = 0; i < context->n_data_loops; i++)
+		pw_data_loop_stop(context->data_loops[i]);
+	if (context->worker_pool)
+		pw_worker_pool_destroy(context->worker_pool);
+
+	for (i = 0; i < context->n_data_loops; i++)
+		pw_data_loop_destroy(context->data_loops[i]);
 
 	pw_properties_free(context->properties);
 
@@ -423,6 +514,75 @@ const struct spa_support *pw_context_get_support(struct pw_context *context, uin
 	return context->support;
 }
 
+SPA_EXPORT
+struct pw_loop *pw_context_find_data_loop(struct pw_context *context, const struct spa_dict *props)
+{
+	const char *str;
+	uint32_t index;
+
+	if (props == NULL || context->n_data_loops < 2 ||
+	    (str = spa_dict_lookup(props, PW_KEY_NODE_DATA_LOOP)) == NULL)
+		return context->data_loop;
+
+	index = atoi(str);
+	if (index >= context->n_data_loops) {
+		pw_log_warn(NAME" %p: invalid data loop %u, using default", context, index);
+		return context->data_loop;
+	}
+	return pw_data_loop_get_loop(context->data_loops[index]);
+}
+
+SPA_EXPORT
+uint32_t pw_context_get_data_loop_support(struct pw_context *context, const struct spa_dict *props,
+		struct spa_support *support, uint32_t max_support)
+{
+	struct pw_loop *loop = pw_context_find_data_loop(context, props);
+	uint32_t i, n_support = SPA_MIN(context->n_support, max_support);
+
+	for (i = 0; i < n_support; i++) {
+		support[i] = context->support[i];
+		if (strcmp(support[i].type, SPA_TYPE_INTERFACE_DataLoop) == 0)
+			support[i].data = loop->loop;
+		else if (strcmp(support[i].type, SPA_TYPE_INTERFACE_DataSystem) == 0)
+			support[i].data = loop->system;
+	}
+	return n_support;
+}
+
+struct invoke_all {
+	struct pw_context *context;
+	uint32_t index;
+	spa_invoke_func_t func;
+	const void *data;
+	size_t size;
+	void *user_data;
+};
+
+static int do_invoke_all(struct spa_loop *loop,
+		bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct invoke_all p = *(const struct invoke_all *)data;
+	struct pw_loop *l;
+
+	if (p.index == 0)
+		return p.func(loop, async, seq, p.data, p.size, p.user_data);
+
+	l = pw_data_loop_get_loop(p.context->data_loops[--p.index]);
+	return pw_loop_invoke(l, do_invoke_all, seq, &p, sizeof(p), true, NULL);
+}
+
+SPA_EXPORT
+int pw_context_invoke_data_loops(struct pw_context *context,
+		spa_invoke_func_t func, uint32_t seq, const void *data, size_t size,
+		void *user_data)
+{
+	struct invoke_all p = { context, context->n_data_loops - 1,
+		func, data, size, user_data };
+	struct pw_loop *l = pw_data_loop_get_loop(context->data_loops[p.index]);
+
+	return pw_loop_invoke(l, do_invoke_all, seq, &p, sizeof(p), true, NULL);
+}
+
 SPA_EXPORT
 struct pw_loop *pw_context_get_main_loop(struct pw_context *context)
 {
@@ -781,7 +941,23 @@ static int ensure_state(struct pw_impl_node *node, bool running)
 	return pw_impl_node_set_state(node, state);
 }
 
-static int collect_nodes(struct pw_impl_node *driver)
+/* A freewheel driver doesn't take the devices, they would run at its pace.
+ * The links to them are detached until the nodes are in the same graph
+ * again. */
+static bool follow_link(struct pw_impl_node *driver, struct pw_impl_link *l,
+		struct pw_impl_node *t)
+{
+	if (driver->freewheel && t->driver && t != driver) {
+		pw_impl_link_set_detached(l, true);
+		return false;
+	}
+	if (!t->visited || t->driver_node == driver)
+		pw_impl_link_set_detached(l, false);
+
+	return l->prepared && !t->visited && t->active && !t->isolated;
+}
+
+static int collect_nodes(struct impl *impl, struct pw_impl_node *driver)
 {
 	struct spa_list queue;
 	struct pw_impl_node *n, *t;
@@ -799,6 +975,17 @@ static int collect_nodes(struct pw_impl_node *driver)
 	spa_list_append(&queue, &driver->sort_link);
 	driver->visited = true;
 
+	/* a freewheel driver starts from the nodes that want to freewheel */
+	if (driver->freewheel) {
+		spa_list_for_each(t, &impl->affected_list, recalc_link) {
+			if (t->freewheel && !t->driver && !t->visited &&
+			    t->active && !t->isolated) {
+				t->visited = true;
+				spa_list_append(&queue, &t->sort_link);
+			}
+		}
+	}
+
 	spa_list_consume(n, &queue, sort_link) {
 		spa_list_remove(&n->sort_link);
 		pw_impl_node_set_driver(n, driver);
@@ -806,7 +993,7 @@ static int collect_nodes(struct pw_impl_node *driver)
 		spa_list_for_each(p, &n->input_ports, link) {
 			spa_list_for_each(l, &p->links, input_link) {
 				t = l->output->node;
-				if (l->prepared && !t->visited && t->active) {
+				if (follow_link(driver, l, t)) {
 					t->visited = true;
 					spa_list_append(&queue, &t->sort_link);
 				}
@@ -815,7 +1002,7 @@ static int collect_nodes(struct pw_impl_node *driver)
 		spa_list_for_each(p, &n->output_ports, link) {
 			spa_list_for_each(l, &p->links, output_link) {
 				t = l->input->node;
-				if (l->prepared && !t->visited && t->active) {
+				if (follow_link(driver, l, t)) {
 					t->visited = true;
 					spa_list_append(&queue, &t->sort_link);
 				}
@@ -825,34 +1012,112 @@ static int collect_nodes(struct pw_impl_node *driver)
 	return 0;
 }
 
-int pw_context_recalc_graph(struct pw_context *context, const char *reason)
+void pw_context_mark_node_dirty(struct pw_context *context, struct pw_impl_node *node)
 {
-	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
-	struct pw_impl_node *n, *s, *target, *fallback;
+	if (node->dirty || !node->registered)
+		return;
+	pw_log_trace(NAME" %p: node %p dirty", context, node);
+	node->dirty = true;
+	spa_list_append(&context->dirty_list, &node->dirty_link);
+}
 
-	pw_log_info(NAME" %p: busy:%d reason:%s", context, impl->recalc, reason);
+static void add_affected(struct impl *impl, struct pw_impl_node *node)
+{
+	if (node->affected)
+		return;
+	node->affected = true;
+	spa_list_append(&impl->affected_list, &node->recalc_link);
+}
 
-	if (impl->recalc)
-		return -EBUSY;
+static void add_freewheel_drivers(struct impl *impl)
+{
+	struct pw_impl_node *n;
 
-	impl->recalc = true;
+	spa_list_for_each(n, &impl->this.driver_list, driver_link) {
+		if (n->freewheel && !n->exported)
+			add_affected(impl, n);
+	}
+}
+
+/* the freewheel drivers go first so that they take the nodes that want
+ * to freewheel before the driver they are linked to does */
+static void collect_drivers(struct impl *impl)
+{
+	struct pw_impl_node *n;
+
+	spa_list_for_each(n, &impl->this.driver_list, driver_link) {
+		if (n->freewheel && !n->exported && n->affected && !n->visited)
+			collect_nodes(impl, n);
+	}
+	spa_list_for_each(n, &impl->this.driver_list, driver_link) {
+		if (!n->exported && n->affected && !n->visited)
+			collect_nodes(impl, n);
+	}
+}
+
+/* Collect the nodes that need to be recalculated. We start from the
+ * dirty nodes and add the nodes they are linked to with a prepared link,
+ * their driver and their followers. The result is closed: nodes outside
+ * of it can't be grouped with a node inside of it so their driver and
+ * quantum remain valid. */
+static uint32_t collect_affected(struct impl *impl)
+{
+	struct pw_context *context = &impl->this;
+	struct pw_impl_node *n, *s;
+	struct pw_impl_port *p;
+	struct pw_impl_link *l;
+	uint32_t count = 0;
+
+	spa_list_consume(n, &context->dirty_list, dirty_link) {
+		spa_list_remove(&n->dirty_link);
+		n->dirty = false;
+		add_affected(impl, n);
+	}
+
+	spa_list_for_each(n, &impl->affected_list, recalc_link) {
+		add_affected(impl, n->driver_node);
+
+		/* a node that wants to freewheel moves between the freewheel
+		 * driver and the driver of its peers */
+		if (n->freewheel && !n->driver)
+			add_freewheel_drivers(impl);
 
-	/* start from all drivers and group all nodes that are linked
+		spa_list_for_each(s, &n->follower_list, follower_link)
+			add_affected(impl, s);
+
+		spa_list_for_each(p, &n->input_ports, link) {
+			spa_list_for_each(l, &p->links, input_link)
+				if (l->prepared)
+					add_affected(impl, l->output->node);
+		}
+		spa_list_for_each(p, &n->output_ports, link) {
+			spa_list_for_each(l, &p->links, output_link)
+				if (l->prepared)
+					add_affected(impl, l->input->node);
+		}
+		count++;
+	}
+	return count;
+}
+
+static int recalc_affected(struct impl *impl)
+{
+	struct pw_context *context = &impl->this;
+	struct pw_impl_node *n, *s, *target, *fallback;
+
+	/* start from all affected drivers and group all nodes that are linked
 	 * to it. Some nodes are not (yet) linked to anything and they
 	 * will end up 'unassigned' to a master. Other nodes are master
 	 * and if they have active followers, we can use them to schedule
 	 * the unassigned nodes. */
+	collect_drivers(impl);
+
 	target = fallback = NULL;
 	spa_list_for_each(n, &context->driver_list, driver_link) {
-		if (n->exported)
-			continue;
-
-		if (!n->visited)
-			collect_nodes(n);
-
-		/* from now on we are only interested in active master nodes.
-		 * We're going to see if there are active followers. */
-		if (!n->master || !n->active)
+		/* we are only interested in active master nodes. We're going
+		 * to see if there are active followers. A freewheel driver only
+		 * runs the nodes that asked for it. */
+		if (n->exported || !n->master || !n->active || n->freewheel)
 			continue;
 
 		/* first active master node is fallback */
@@ -875,10 +1140,22 @@ int pw_context_recalc_graph(struct pw_context *context, const char *reason)
 	if (target == NULL)
 		target = fallback;
 
-	/* now go through all available nodes. The ones we didn't visit
+	/* the unassigned nodes outside of the affected set are scheduled by
+	 * the previous target, when it changes, everything needs to move */
+	if (target != impl->target) {
+		pw_log_debug(NAME" %p: target %p -> %p, recalc all", context,
+				impl->target, target);
+		impl->target = target;
+
+		spa_list_for_each(n, &context->node_list, link)
+			add_affected(impl, n);
+		collect_drivers(impl);
+	}
+
+	/* now go through all affected nodes. The ones we didn't visit
 	 * in collect_nodes() are not linked to any master. We assign them
 	 * to either an active master of the first master */
-	spa_list_for_each(n, &context->node_list, link) {
+	spa_list_for_each(n, &impl->affected_list, recalc_link) {
 		if (n->exported)
 			continue;
 
@@ -888,13 +1165,19 @@ int pw_context_recalc_graph(struct pw_context *context, const char *reason)
 			pw_log_debug(NAME" %p: unassigned node %p: '%s' %d %d", context,
 					n, n->name, n->active, n->want_driver);
 
-			t = n->active && n->want_driver ? target : NULL;
+			t = n->active && !n->isolated && n->want_driver ? target : NULL;
 
 			pw_impl_node_set_driver(n, t);
 			if (t == NULL)
 				ensure_state(n, false);
+			else if (!t->affected) {
+				/* the target keeps its followers, only its quantum
+				 * and state are updated below. Mark it visited so that
+				 * we don't take it for an unassigned node. */
+				add_affected(impl, t);
+				t->visited = true;
+			}
 		}
-		n->visited = false;
 	}
 
 	/* assign final quantum and set state for followers and master */
@@ -904,9 +1187,8 @@ int pw_context_recalc_graph(struct pw_context *context, const char *reason)
 		uint32_t min_quantum = 0;
 		uint32_t quantum;
 
-		if (!n->master || n->exported)
+		if (!n->master || n->exported || !n->affected)
 			continue;
-
 		/* collect quantum and count active nodes */
 		spa_list_for_each(s, &n->follower_list, follower_link) {
 			if (s == n)
@@ -927,6 +1209,11 @@ int pw_context_recalc_graph(struct pw_context *context, const char *reason)
 				context->defaults.clock_min_quantum,
 				context->defaults.clock_max_quantum);
 
+		__atomic_store_n(&n->adapt.base, quantum, __ATOMIC_RELAXED);
+		if (n->adapt.enabled && n->adapt.quantum > quantum)
+			quantum = SPA_MIN(n->adapt.quantum,
+					context->defaults.clock_max_quantum);
+
 		if (n->rt.position && quantum != n->rt.position->clock.duration) {
 			pw_log_info("(%s-%u) new quantum:%"PRIu64"->%u",
 					n->name, n->info.id,
@@ -947,6 +1234,42 @@ int pw_context_recalc_graph(struct pw_context *context, const char *reason)
 		}
 		ensure_state(n, running);
 	}
+	return 0;
+}
+
+int pw_context_recalc_graph(struct pw_context *context, const char *reason)
+{
+	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
+	struct pw_impl_node *n;
+	uint32_t count;
+
+	pw_log_info(NAME" %p: busy:%d reason:%s", context, impl->recalc, reason);
+
+	if (impl->recalc) {
+		impl->recalc_pending = true;
+		return -EBUSY;
+	}
+	impl->recalc = true;
+
+again:
+	impl->recalc_pending = false;
+
+	count = collect_affected(impl);
+	pw_log_debug(NAME" %p: recalc %u nodes", context, count);
+
+	if (count > 0)
+		recalc_affected(impl);
+
+	spa_list_consume(n, &impl->affected_list, recalc_link) {
+		spa_list_remove(&n->recalc_link);
+		n->affected = false;
+		n->visited = false;
+	}
+
+	/* nodes that changed while we were busy */
+	if (impl->recalc_pending && !spa_list_is_empty(&context->dirty_list))
+		goto again;
+
 	impl->recalc = false;
 	return 0;
 }
@@ -994,7 +1317,7 @@ struct spa_handle *pw_context_load_spa_handle(struct pw_context *context,
 		const struct spa_dict *info)
 {
 	const char *lib;
-	const struct spa_support *support;
+	struct spa_support support[SPA_N_ELEMENTS(context->support)];
 	uint32_t n_support;
 	struct spa_handle *handle;
 
@@ -1010,7 +1333,8 @@ struct spa_handle *pw_context_load_spa_handle(struct pw_context *context,
 		return NULL;
 	}
 
-	support = pw_context_get_support(context, &n_support);
+	n_support = pw_context_get_data_loop_support(context, info,
+			support, SPA_N_ELEMENTS(support));
 
 	handle = pw_load_spa_handle(lib, factory_name,
 			info, n_support, support);
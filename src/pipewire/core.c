@@ -297,7 +297,7 @@ static struct pw_core *core_new(struct pw_context *context,
 	p->proxy.core = p;
 	p->context = context;
 	p->properties = properties;
-	p->pool = pw_mempool_new(NULL);
+	p->pool = pw_mempool_new(pw_properties_copy(context->pool->props));
 	p->core = p;
 	if (user_data_size > 0)
 		p->user_data = SPA_MEMBER(p, sizeof(struct pw_core), void);
@@ -23,6 +23,7 @@
  */
 
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
 #include <sys/resource.h>
 
@@ -128,6 +129,12 @@ static struct pw_data_loop *loop_new(struct pw_loop *loop, const struct spa_dict
 			goto error_loop_destroy;
 		}
 	}
+	if (props != NULL) {
+		if ((str = spa_dict_lookup(props, "loop.cpus")) != NULL)
+			this->cpus = strdup(str);
+		if ((str = spa_dict_lookup(props, "loop.rt-prio")) != NULL)
+			this->rt_prio = atoi(str);
+	}
 	spa_hook_list_init(&this->listener_list);
 
 	return this;
@@ -171,6 +178,7 @@ void pw_data_loop_destroy(struct pw_data_loop *loop)
 		pw_loop_destroy_source(loop->loop, loop->event);
 	if (loop->created)
 		pw_loop_destroy(loop->loop);
+	free(loop->cpus);
 	free(loop);
 }
 
@@ -189,6 +197,35 @@ pw_data_loop_get_loop(struct pw_data_loop *loop)
 	return loop->loop;
 }
 
+static void setup_thread(struct pw_data_loop *loop)
+{
+	int res;
+
+	if (loop->cpus != NULL) {
+		const char *str, *state = NULL;
+		cpu_set_t cpuset;
+		size_t len;
+
+		CPU_ZERO(&cpuset);
+		while ((str = pw_split_walk(loop->cpus, ", ", &len, &state)) != NULL)
+			CPU_SET(atoi(str), &cpuset);
+
+		if ((res = pthread_setaffinity_np(loop->thread, sizeof(cpuset), &cpuset)) != 0)
+			pw_log_warn(NAME" %p: can't set affinity to '%s': %s",
+					loop, loop->cpus, strerror(res));
+	}
+	if (loop->rt_prio > 0) {
+		struct sched_param sp;
+
+		spa_zero(sp);
+		sp.sched_priority = loop->rt_prio;
+		if ((res = pthread_setschedparam(loop->thread,
+				SCHED_FIFO | SCHED_RESET_ON_FORK, &sp)) != 0)
+			pw_log_warn(NAME" %p: can't set rt priority %d: %s",
+					loop, loop->rt_prio, strerror(res));
+	}
+}
+
 /** Start a data loop
  * \param loop the data loop to start
  * \return 0 if ok, -1 on error
@@ -209,6 +246,7 @@ int pw_data_loop_start(struct pw_data_loop *loop)
 			loop->running = false;
 			return -err;
 		}
+		setup_thread(loop);
 	}
 	return 0;
 }
@@ -253,6 +291,36 @@ bool pw_data_loop_in_thread(struct pw_data_loop * loop)
 	return pthread_equal(loop->thread, pthread_self());
 }
 
+struct invoke_pair {
+	struct pw_loop *loop;
+	spa_invoke_func_t func;
+	const void *data;
+	size_t size;
+	void *user_data;
+};
+
+static int do_invoke_pair(struct spa_loop *loop,
+		bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	const struct invoke_pair *p = data;
+	return pw_loop_invoke(p->loop, p->func, seq, p->data, p->size, true, p->user_data);
+}
+
+/** Call \a func in \a loop while the thread of \a other waits for it.
+ * Neither loop runs anything else in the meantime, so that a link or a
+ * follower between nodes of both loops can be changed. */
+int pw_loop_invoke_pair(struct pw_loop *other, struct pw_loop *loop,
+		spa_invoke_func_t func, uint32_t seq, const void *data, size_t size,
+		void *user_data)
+{
+	struct invoke_pair p = { loop, func, data, size, user_data };
+
+	if (other == loop)
+		return pw_loop_invoke(loop, func, seq, data, size, true, user_data);
+
+	return pw_loop_invoke(other, do_invoke_pair, seq, &p, sizeof(p), true, NULL);
+}
+
 SPA_EXPORT
 int pw_data_loop_invoke(struct pw_data_loop *loop,
 		spa_invoke_func_t func, uint32_t seq, const void *data, size_t size,
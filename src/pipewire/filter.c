@@ -793,16 +793,22 @@ static int impl_node_process(void *object)
 
 	pw_log_trace(NAME" %p: do process %p", impl, impl->rt.position);
 
-	/** first dequeue and recycle buffers */
+	/** first dequeue and recycle buffers, the peer owns the io of an
+	 * input until it has a new buffer and of an output while it has our
+	 * buffer, an async peer can write it while we run */
 	spa_list_for_each(p, &impl->port_list, link) {
 		struct spa_io_buffers *io = p->io;
+		int32_t status;
 
-		if (io == NULL ||
-		    io->buffer_id >= p->n_buffers)
+		if (io == NULL)
+			continue;
+
+		status = __atomic_load_n(&io->status, __ATOMIC_ACQUIRE);
+		if (io->buffer_id >= p->n_buffers)
 			continue;
 
 		if (p->direction == SPA_DIRECTION_INPUT) {
-			if (io->status != SPA_STATUS_HAVE_DATA)
+			if (status != SPA_STATUS_HAVE_DATA)
 				continue;
 
 			/* push new buffer */
@@ -811,7 +817,7 @@ static int impl_node_process(void *object)
 			push_queue(p, &p->dequeued, b);
 			drained = false;
 		} else {
-			if (io->status == SPA_STATUS_HAVE_DATA)
+			if (status == SPA_STATUS_HAVE_DATA)
 				continue;
 
 			/* recycle old buffer */
@@ -827,12 +833,14 @@ static int impl_node_process(void *object)
 	/** recycle/push queued buffers */
 	spa_list_for_each(p, &impl->port_list, link) {
 		struct spa_io_buffers *io = p->io;
+		int32_t status;
 
 		if (io == NULL)
 			continue;
 
+		status = __atomic_load_n(&io->status, __ATOMIC_ACQUIRE);
 		if (p->direction == SPA_DIRECTION_INPUT) {
-			if (io->status != SPA_STATUS_HAVE_DATA)
+			if (status != SPA_STATUS_HAVE_DATA)
 				continue;
 
 			/* pop buffer to recycle */
@@ -842,21 +850,22 @@ static int impl_node_process(void *object)
 			} else {
 				io->buffer_id = SPA_ID_INVALID;
 			}
-			io->status = SPA_STATUS_NEED_DATA;
+			status = SPA_STATUS_NEED_DATA;
 		} else {
-			if (io->status == SPA_STATUS_HAVE_DATA)
+			if (status == SPA_STATUS_HAVE_DATA)
 				continue;
 
 			if ((b = pop_queue(p, &p->queued)) != NULL) {
 				pw_log_trace(NAME" %p: pop %d %p", impl, b->id, io);
 				io->buffer_id = b->id;
-				io->status = SPA_STATUS_HAVE_DATA;
+				status = SPA_STATUS_HAVE_DATA;
 				drained = false;
 			} else {
 				io->buffer_id = SPA_ID_INVALID;
-				io->status = SPA_STATUS_NEED_DATA;
+				status = SPA_STATUS_NEED_DATA;
 			}
 		}
+		__atomic_store_n(&io->status, status, __ATOMIC_RELEASE);
 	}
 	if (drained && impl->draining)
 		call_drained(impl);
@@ -0,0 +1,306 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pipewire/log.h"
+#include "pipewire/private.h"
+
+#define NAME "flight-recorder"
+
+#define DUMP_INTERVAL	(10 * SPA_NSEC_PER_SEC)
+#define MAX_DUMPS	4	/* files per driver, the oldest one is reused */
+
+/** \cond */
+struct pw_flight_recorder {
+	struct pw_impl_node *driver;
+	struct pw_memblock *mem;
+	struct pw_flight_header *header;
+	struct spa_source *event;
+	uint32_t dumps;
+	uint64_t last_dump;
+};
+/** \endcond */
+
+static const char *str_reason(uint32_t reason)
+{
+	switch (reason) {
+	case PW_FLIGHT_REASON_INCOMPLETE:
+		return "incomplete";
+	case PW_FLIGHT_REASON_XRUN:
+		return "xrun";
+	}
+	return "none";
+}
+
+static const char *node_name(struct pw_context *context, uint32_t id)
+{
+	struct pw_impl_node *n;
+
+	spa_list_for_each(n, &context->node_list, link) {
+		if (n->info.id == id)
+			return n->name;
+	}
+	return "";
+}
+
+static void dump_cycle(struct pw_flight_recorder *rec, FILE *f, struct pw_flight_cycle *c)
+{
+	struct pw_context *context = rec->driver->context;
+	uint64_t start = c->entries[0].signal_time;
+	uint32_t i;
+
+	fprintf(f, "cycle %"PRIu64" nsec:%"PRIu64" quantum:%u xruns:%u%s\n",
+			c->position, c->nsec, c->duration, c->xrun_count,
+			c->flags & PW_FLIGHT_CYCLE_INCOMPLETE ? " incomplete" : "");
+	if (c->n_dropped > 0)
+		fprintf(f, "\t%u more followers not recorded\n", c->n_dropped);
+
+	for (i = 0; i < c->n_entries; i++) {
+		struct pw_flight_entry *e = &c->entries[i];
+#define REL(t)	((t) >= start ? (int64_t)((t) - start) / 1000 : -1)
+		fprintf(f, "\t%u\t%-24s status:%u pending:%d/%d signal:%"PRIi64
+				" awake:%"PRIi64" finish:%"PRIi64"\n",
+				e->id, node_name(context, e->id), e->status,
+				e->pending, e->required,
+				REL(e->signal_time), REL(e->awake_time), REL(e->finish_time));
+#undef REL
+	}
+}
+
+/* the node name comes from the client, only keep what is safe in a
+ * file name */
+static void file_name(char *dst, size_t size, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < size && name[i]; i++) {
+		char c = name[i];
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		    (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-')
+			dst[i] = c;
+		else
+			dst[i] = '_';
+	}
+	dst[i] = '\0';
+}
+
+static int dump(struct pw_flight_recorder *rec)
+{
+	struct pw_impl_node *driver = rec->driver;
+	struct pw_flight_header *h = rec->header;
+	const char *dir;
+	char path[PATH_MAX], name[64];
+	uint32_t i, n_cycles, index;
+	FILE *f;
+	int fd, res;
+
+	/* only dump in the private runtime dir, a shared dir like /tmp
+	 * has predictable names that others can take */
+	if ((dir = getenv("XDG_RUNTIME_DIR")) == NULL) {
+		pw_log_warn(NAME" %p: XDG_RUNTIME_DIR is not set, not dumping", rec);
+		return -ENOENT;
+	}
+
+	file_name(name, sizeof(name), driver->name);
+	snprintf(path, sizeof(path), "%s/pipewire-flight-%s-%u-%u.log",
+			dir, name, driver->info.id, rec->dumps++ % MAX_DUMPS);
+
+	/* replace the oldest dump with a new file, never follow a link */
+	if (unlink(path) < 0 && errno != ENOENT) {
+		pw_log_error(NAME" %p: can't remove %s: %m", rec, path);
+		return -errno;
+	}
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600)) < 0) {
+		pw_log_error(NAME" %p: can't open %s: %m", rec, path);
+		return -errno;
+	}
+	if ((f = fdopen(fd, "w")) == NULL) {
+		res = -errno;
+		pw_log_error(NAME" %p: can't open %s: %m", rec, path);
+		close(fd);
+		return res;
+	}
+
+	index = h->index;
+	n_cycles = SPA_MIN(index, h->n_cycles);
+
+	fprintf(f, "# driver %s-%u reason:%s cycles:%u\n"
+		"# per node: id name status pending/required and signal, awake\n"
+		"# and finish time in usec relative to the driver signal time\n",
+			driver->name, driver->info.id, str_reason(h->reason), n_cycles);
+
+	for (i = index - n_cycles; i != index; i++)
+		dump_cycle(rec, f, &h->cycles[i % h->n_cycles]);
+
+	fclose(f);
+
+	pw_log_warn("(%s-%u) %s: flight recorder dumped %u cycles to %s",
+			driver->name, driver->info.id, str_reason(h->reason),
+			n_cycles, path);
+	return 0;
+}
+
+static void on_freeze(void *data, uint64_t count)
+{
+	struct pw_flight_recorder *rec = data;
+	struct pw_flight_header *h = rec->header;
+	struct timespec ts;
+	uint64_t now;
+
+	if (!ATOMIC_LOAD(h->frozen))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = SPA_TIMESPEC_TO_NSEC(&ts);
+
+	if (rec->last_dump == 0 || now - rec->last_dump >= DUMP_INTERVAL) {
+		dump(rec);
+		rec->last_dump = now;
+	}
+	ATOMIC_STORE(h->frozen, 0);
+}
+
+struct pw_flight_recorder *pw_flight_recorder_new(struct pw_impl_node *driver,
+		uint32_t n_cycles)
+{
+	struct pw_context *context = driver->context;
+	struct pw_flight_recorder *rec;
+	size_t size;
+
+	rec = calloc(1, sizeof(*rec));
+	if (rec == NULL)
+		return NULL;
+
+	rec->driver = driver;
+
+	size = sizeof(struct pw_flight_header) +
+		n_cycles * sizeof(struct pw_flight_cycle);
+
+	rec->mem = pw_mempool_alloc(context->pool,
+			PW_MEMBLOCK_FLAG_READWRITE |
+			PW_MEMBLOCK_FLAG_SEAL |
+			PW_MEMBLOCK_FLAG_MAP,
+			SPA_DATA_MemFd, size);
+	if (rec->mem == NULL)
+		goto error_free;
+
+	rec->header = rec->mem->map->ptr;
+	rec->header->n_cycles = n_cycles;
+
+	rec->event = pw_loop_add_event(context->main_loop, on_freeze, rec);
+	if (rec->event == NULL)
+		goto error_unref;
+
+	pw_log_debug(NAME" %p: driver %p cycles:%u size:%zd", rec, driver,
+			n_cycles, size);
+
+	return rec;
+
+error_unref:
+	pw_memblock_unref(rec->mem);
+error_free:
+	free(rec);
+	return NULL;
+}
+
+void pw_flight_recorder_destroy(struct pw_flight_recorder *rec)
+{
+	pw_log_debug(NAME" %p: destroy", rec);
+	pw_loop_destroy_source(rec->driver->context->main_loop, rec->event);
+	pw_memblock_unref(rec->mem);
+	free(rec);
+}
+
+static void fill_entry(struct pw_flight_entry *e, uint32_t id,
+		struct pw_node_activation *a)
+{
+	e->id = id;
+	e->status = a->status;
+	e->pending = a->state[0].pending;
+	e->required = a->state[0].required;
+	e->signal_time = a->signal_time;
+	e->awake_time = a->awake_time;
+	e->finish_time = a->finish_time;
+}
+
+/* called from the data thread of the driver */
+void pw_flight_recorder_record(struct pw_flight_recorder *rec, bool incomplete)
+{
+	struct pw_impl_node *driver = rec->driver;
+	struct pw_node_activation *a = driver->rt.activation;
+	struct pw_flight_header *h = rec->header;
+	struct pw_flight_cycle *c;
+	struct pw_node_target *t;
+	uint32_t n_entries = 1, n_dropped = 0;
+
+	if (SPA_UNLIKELY(ATOMIC_LOAD(h->frozen)))
+		return;
+
+	c = &h->cycles[h->index % h->n_cycles];
+	c->position = a->position.clock.position;
+	c->nsec = a->position.clock.nsec;
+	c->duration = a->position.clock.duration;
+	c->xrun_count = a->xrun_count;
+	c->flags = incomplete ? PW_FLIGHT_CYCLE_INCOMPLETE : 0;
+
+	fill_entry(&c->entries[0], driver->info.id, a);
+
+	spa_list_for_each(t, &driver->rt.target_list, link) {
+		if (t->node == NULL || t->node == driver)
+			continue;
+		if (n_entries == PW_FLIGHT_MAX_NODES) {
+			n_dropped++;
+			continue;
+		}
+		fill_entry(&c->entries[n_entries++], t->node->info.id, t->activation);
+	}
+	c->n_entries = n_entries;
+	c->n_dropped = n_dropped;
+
+	ATOMIC_STORE(h->index, h->index + 1);
+}
+
+/* called from the data thread of the driver. Incomplete cycles were not
+ * recorded yet and are added before the recorder is frozen. */
+void pw_flight_recorder_freeze(struct pw_flight_recorder *rec, uint32_t reason)
+{
+	struct pw_flight_header *h = rec->header;
+
+	if (ATOMIC_LOAD(h->frozen))
+		return;
+
+	if (reason == PW_FLIGHT_REASON_INCOMPLETE)
+		pw_flight_recorder_record(rec, true);
+
+	h->reason = reason;
+	ATOMIC_STORE(h->frozen, 1);
+	pw_loop_signal_event(rec->driver->context->main_loop, rec->event);
+}
@@ -48,6 +48,9 @@ struct resource_data {
 	struct pw_impl_client *client;
 };
 
+/* the serials of the clients, 0 is the daemon */
+static uint32_t client_serial = 0;
+
 /** find a specific permission for a global or the default when there is none */
 static struct pw_permission *
 find_permission(struct pw_impl_client *client, uint32_t id)
@@ -226,10 +229,15 @@ static void pool_added(void *data, struct pw_memblock *block)
 	struct pw_impl_client *client = &impl->this;
 
 	pw_log_debug(NAME" %p: added block %d", client, block->id);
+	/* MLOCK is not passed on, the client locks the buffers of its nodes
+	 * itself with the mem.allow-mlock and mem.warn-mlock node properties */
 	if (client->core_resource) {
 		pw_core_resource_add_mem(client->core_resource,
 				block->id, block->type, block->fd,
-				block->flags & PW_MEMBLOCK_FLAG_READWRITE);
+				block->flags & (PW_MEMBLOCK_FLAG_READWRITE |
+					PW_MEMBLOCK_FLAG_SLAB |
+					PW_MEMBLOCK_FLAG_HUGETLB |
+					PW_MEMBLOCK_FLAG_PREFAULT));
 	}
 }
 
@@ -315,12 +323,13 @@ struct pw_impl_client *pw_context_create_client(struct pw_impl_core *core,
 	p->id = PW_ID_ANY;
 	p->permissions = 0;
 
-	this->pool = pw_mempool_new(NULL);
+	this->pool = pw_mempool_new(pw_properties_copy(core->context->pool->props));
 	if (this->pool == NULL) {
 		res = -errno;
 		goto error_clear_array;
 	}
 	pw_mempool_add_listener(this->pool, &impl->pool_listener, &pool_events, impl);
+	this->serial = __atomic_add_fetch(&client_serial, 1, __ATOMIC_RELAXED);
 
 	this->properties = properties;
 	this->permission_func = client_permission_func;
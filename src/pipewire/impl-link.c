@@ -85,6 +85,14 @@ static void info_changed(struct pw_impl_link *link)
 	link->info.change_mask = 0;
 }
 
+static void mark_nodes_dirty(struct pw_impl_link *link)
+{
+	if (link->output)
+		pw_context_mark_node_dirty(link->context, link->output->node);
+	if (link->input)
+		pw_context_mark_node_dirty(link->context, link->input->node);
+}
+
 static void pw_impl_link_update_state(struct pw_impl_link *link, enum pw_link_state state, char *error)
 {
 	enum pw_link_state old = link->info.state;
@@ -117,10 +125,12 @@ static void pw_impl_link_update_state(struct pw_impl_link *link, enum pw_link_st
 	if (old != PW_LINK_STATE_PAUSED && state == PW_LINK_STATE_PAUSED) {
 		link->prepared = true;
 		link->preparing = false;
+		mark_nodes_dirty(link);
 		pw_context_recalc_graph(link->context, "link prepared");
 	} else if (old == PW_LINK_STATE_PAUSED && state < PW_LINK_STATE_PAUSED) {
 		link->prepared = false;
 		link->preparing = false;
+		mark_nodes_dirty(link);
 		pw_context_recalc_graph(link->context, "link unprepared");
 	}
 }
@@ -387,6 +397,14 @@ static int select_io(struct pw_impl_link *this)
 	return 0;
 }
 
+static bool link_get_bool(struct pw_impl_link *this, const char *key, bool def)
+{
+	const char *str;
+	if ((str = pw_properties_get(this->properties, key)) == NULL)
+		return def;
+	return pw_properties_parse_bool(str);
+}
+
 static int do_allocation(struct pw_impl_link *this)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -427,12 +445,19 @@ static int do_allocation(struct pw_impl_link *this)
 		flags = 0;
 		/* always shared buffers for the link */
 		alloc_flags = PW_BUFFERS_FLAG_SHARED;
+		if (link_get_bool(this, "link.mlock", this->context->defaults.link_mlock))
+			SPA_FLAG_SET(alloc_flags, PW_BUFFERS_FLAG_MLOCK);
+		if (link_get_bool(this, "link.hugepages", this->context->defaults.link_hugepages))
+			SPA_FLAG_SET(alloc_flags, PW_BUFFERS_FLAG_HUGETLB);
 		/* if output port can alloc buffers, alloc skeleton buffers */
 		if (SPA_FLAG_IS_SET(out_flags, SPA_PORT_FLAG_CAN_ALLOC_BUFFERS)) {
 			SPA_FLAG_SET(alloc_flags, PW_BUFFERS_FLAG_NO_MEM);
 			flags |= SPA_NODE_BUFFERS_FLAG_ALLOC;
 		}
 
+		/* the memory is given to the clients of both nodes */
+		output->buffers.owner = pw_memblock_owner(output->node->client_serial,
+				input->node->client_serial);
 		if ((res = pw_buffers_negotiate(this->context, alloc_flags,
 						output->node->node, output->port_id,
 						input->node->node, input->port_id,
@@ -497,10 +522,15 @@ do_activate_link(struct spa_loop *loop,
 
 	pw_log_trace(NAME" %p: activate", this);
 
+	pw_worker_pool_block(this->context->worker_pool);
 	spa_list_append(&this->output->rt.mix_list, &this->rt.out_mix.rt_link);
 	spa_list_append(&this->input->rt.mix_list, &this->rt.in_mix.rt_link);
 
-	if (impl->inode != impl->onode) {
+	this->rt.in_mix.async = impl->onode->async;
+	this->rt.in_mix.hold_id = SPA_ID_INVALID;
+
+	/* the input node of an async node doesn't wait for it */
+	if (impl->inode != impl->onode && !impl->onode->async) {
 		struct pw_node_activation_state *state;
 
 		this->rt.target.activation = impl->inode->rt.activation;
@@ -512,9 +542,44 @@ do_activate_link(struct spa_loop *loop,
 		pw_log_trace(NAME" %p: node:%p state:%p pending:%d/%d", this, impl->inode,
 				state, state->pending, state->required);
 	}
+	pw_worker_pool_unblock(this->context->worker_pool);
 	return 0;
 }
 
+/* the output node gets the activation of the input node to signal it,
+ * an isolated node has no peers so that it can't wake up the graph */
+void pw_impl_link_update_peers(struct pw_impl_link *this)
+{
+	struct pw_impl_node *output_node = this->output->node;
+	struct pw_impl_node *input_node = this->input->node;
+	bool peered = !output_node->isolated && !input_node->isolated && !this->detached;
+
+	if (this->peered == peered)
+		return;
+	this->peered = peered;
+
+	pw_log_debug(NAME" %p: peered %d", this, peered);
+	if (peered)
+		pw_impl_node_emit_peer_added(output_node, input_node);
+	else
+		pw_impl_node_emit_peer_removed(output_node, input_node);
+}
+
+void pw_impl_link_set_detached(struct pw_impl_link *this, bool detached)
+{
+	if (this->detached == detached)
+		return;
+
+	pw_log_debug(NAME" %p: detached %d", this, detached);
+	this->detached = detached;
+
+	if (detached)
+		pw_impl_link_deactivate(this);
+	pw_impl_link_update_peers(this);
+	if (!detached)
+		pw_impl_link_activate(this);
+}
+
 int pw_impl_link_activate(struct pw_impl_link *this)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -523,7 +588,8 @@ int pw_impl_link_activate(struct pw_impl_link *this)
 	pw_log_debug(NAME" %p: activate activated:%d state:%s", this, impl->activated,
 			pw_link_state_as_string(this->info.state));
 
-	if (impl->activated || !this->prepared || !impl->inode->active || !impl->onode->active)
+	if (impl->activated || !this->prepared || !impl->inode->active || !impl->onode->active ||
+	    impl->inode->isolated || impl->onode->isolated || this->detached)
 		return 0;
 
 	if (!impl->io_set) {
@@ -538,8 +604,9 @@ int pw_impl_link_activate(struct pw_impl_link *this)
 			return res;
 		impl->io_set = true;
 	}
-	pw_loop_invoke(this->output->node->data_loop,
-	       do_activate_link, SPA_ID_INVALID, NULL, 0, false, this);
+	/* the mixer of the input port is changed as well */
+	pw_loop_invoke_pair(this->input->node->data_loop, this->output->node->data_loop,
+	       do_activate_link, SPA_ID_INVALID, NULL, 0, this);
 
 	impl->activated = true;
 	pw_log_info("(%s) activated", this->name);
@@ -701,10 +768,11 @@ do_deactivate_link(struct spa_loop *loop,
 
 	pw_log_trace(NAME" %p: disable %p and %p", this, &this->rt.in_mix, &this->rt.out_mix);
 
+	pw_worker_pool_block(this->context->worker_pool);
 	spa_list_remove(&this->rt.out_mix.rt_link);
 	spa_list_remove(&this->rt.in_mix.rt_link);
 
-	if (this->input->node != this->output->node) {
+	if (this->input->node != this->output->node && !this->output->node->async) {
 		struct pw_node_activation_state *state;
 
 		spa_list_remove(&this->rt.target.link);
@@ -714,6 +782,7 @@ do_deactivate_link(struct spa_loop *loop,
 		pw_log_trace(NAME" %p: node:%p state:%p pending:%d/%d", this, impl->inode,
 				state, state->pending, state->required);
 	}
+	pw_worker_pool_unblock(this->context->worker_pool);
 
 	return 0;
 }
@@ -727,8 +796,8 @@ int pw_impl_link_deactivate(struct pw_impl_link *this)
 	if (!impl->activated)
 		return 0;
 
-	pw_loop_invoke(this->output->node->data_loop,
-		       do_deactivate_link, SPA_ID_INVALID, NULL, 0, true, this);
+	pw_loop_invoke_pair(this->input->node->data_loop, this->output->node->data_loop,
+		       do_deactivate_link, SPA_ID_INVALID, NULL, 0, this);
 
 	port_set_io(this, this->output, SPA_IO_Buffers, NULL, 0,
 			&this->rt.out_mix, impl->output_destroyed);
@@ -1095,7 +1164,7 @@ struct pw_impl_link *pw_context_create_link(struct pw_context *context,
 
 	try_link_controls(impl, output, input);
 
-	pw_impl_node_emit_peer_added(output_node, input_node);
+	pw_impl_link_update_peers(this);
 
 	return this;
 
@@ -1225,10 +1294,14 @@ void pw_impl_link_destroy(struct pw_impl_link *link)
 	if (link->registered)
 		spa_list_remove(&link->link);
 
-	pw_impl_node_emit_peer_removed(link->output->node, link->input->node);
+	if (link->peered)
+		pw_impl_node_emit_peer_removed(link->output->node, link->input->node);
 
 	try_unlink_controls(impl, link->output, link->input);
 
+	if (link->prepared)
+		mark_nodes_dirty(link);
+
 	output_remove(link, link->output);
 	input_remove(link, link->input);
 
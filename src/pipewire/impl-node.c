@@ -41,6 +41,17 @@
 
 #define DEFAULT_SYNC_TIMEOUT  ((uint64_t)(5 * SPA_NSEC_PER_SEC))
 
+#define DEFAULT_ADAPT_LOW	0.25f
+#define DEFAULT_ADAPT_HIGH	0.75f
+#define DEFAULT_ADAPT_HOLD	5000
+#define ADAPT_SETTLE		16
+
+#define WATCHDOG_INTERVAL	(1 * SPA_NSEC_PER_SEC)	/* window to count overruns in */
+#define WATCHDOG_FORGET		(60 * SPA_NSEC_PER_SEC)	/* good behaviour that resets the backoff */
+#define WATCHDOG_MAX_BACKOFF	4u
+#define WATCHDOG_SLACK		(100 * SPA_NSEC_PER_MSEC)	/* the timeout can be late */
+#define WATCHDOG_PROBATION	(10 * SPA_NSEC_PER_SEC)	/* a single overrun isolates again */
+
 /** \cond */
 struct impl {
 	struct pw_impl_node this;
@@ -99,14 +110,15 @@ static void add_node(struct pw_impl_node *this, struct pw_impl_node *driver)
 	pw_log_trace(NAME" %p: add to driver %p %p %p", this, driver,
 			driver->rt.activation, this->rt.activation);
 
-	/* signal the driver */
+	/* signal the driver, async nodes don't make the driver wait */
 	this->rt.driver_target.activation = driver->rt.activation;
 	this->rt.driver_target.node = driver;
 	this->rt.driver_target.data = driver;
-	spa_list_append(&this->rt.target_list, &this->rt.driver_target.link);
-
 	dstate = &this->rt.driver_target.activation->state[0];
-	dstate->required++;
+	if (!this->async) {
+		spa_list_append(&this->rt.target_list, &this->rt.driver_target.link);
+		dstate->required++;
+	}
 
 	spa_list_append(&driver->rt.target_list, &this->rt.target.link);
 	nstate = &this->rt.activation->state[0];
@@ -121,16 +133,18 @@ static void remove_node(struct pw_impl_node *this)
 {
 	struct pw_node_activation_state *dstate, *nstate;
 
-	if (this->exported)
+	if (this->exported || this->rt.driver_target.data == NULL)
 		return;
 
 	pw_log_trace(NAME" %p: remove from driver %p %p %p",
 			this, this->rt.driver_target.data,
 			this->rt.driver_target.activation, this->rt.activation);
 
-	spa_list_remove(&this->rt.driver_target.link);
 	dstate = &this->rt.driver_target.activation->state[0];
-	dstate->required--;
+	if (!this->async) {
+		spa_list_remove(&this->rt.driver_target.link);
+		dstate->required--;
+	}
 
 	spa_list_remove(&this->rt.target.link);
 	nstate = &this->rt.activation->state[0];
@@ -139,6 +153,9 @@ static void remove_node(struct pw_impl_node *this)
 	pw_log_trace(NAME" %p: driver state:%p pending:%d/%d, node state:%p pending:%d/%d",
 			this, dstate, dstate->pending, dstate->required,
 			nstate, nstate->pending, nstate->required);
+
+	this->rt.driver_target.node = NULL;
+	this->rt.driver_target.data = NULL;
 }
 
 static int
@@ -147,8 +164,10 @@ do_node_remove(struct spa_loop *loop,
 {
 	struct pw_impl_node *this = user_data;
 	if (this->source.loop != NULL) {
+		pw_worker_pool_block(this->context->worker_pool);
 		spa_loop_remove_source(loop, &this->source);
 		remove_node(this);
+		pw_worker_pool_unblock(this->context->worker_pool);
 	}
 	return 0;
 }
@@ -166,7 +185,8 @@ static int pause_node(struct pw_impl_node *this)
 
 	node_deactivate(this);
 
-	pw_loop_invoke(this->data_loop, do_node_remove, 1, NULL, 0, true, this);
+	pw_loop_invoke_pair(this->driver_node->data_loop, this->data_loop,
+			do_node_remove, 1, NULL, 0, this);
 
 	res = spa_node_send_command(this->node,
 				    &SPA_NODE_COMMAND_INIT(SPA_NODE_COMMAND_Pause));
@@ -176,6 +196,10 @@ static int pause_node(struct pw_impl_node *this)
 	return res;
 }
 
+static int
+do_node_add(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data);
+
 static int start_node(struct pw_impl_node *this)
 {
 	int res = 0;
@@ -185,6 +209,12 @@ static int start_node(struct pw_impl_node *this)
 
 	pw_log_debug(NAME" %p: start node", this);
 
+	/* a driver starts a cycle as soon as it is started, make sure it is
+	 * part of its own graph by then or the cycle never completes */
+	if (this->master)
+		pw_loop_invoke_pair(this->driver_node->data_loop, this->data_loop,
+				do_node_add, 1, NULL, 0, this);
+
 	res = spa_node_send_command(this->node,
 				    &SPA_NODE_COMMAND_INIT(SPA_NODE_COMMAND_Start));
 
@@ -276,8 +306,10 @@ do_node_add(struct spa_loop *loop,
 	struct pw_impl_node *driver = this->driver_node;
 
 	if (this->source.loop == NULL) {
+		pw_worker_pool_block(this->context->worker_pool);
 		spa_loop_add_source(loop, &this->source);
 		add_node(this, driver);
+		pw_worker_pool_unblock(this->context->worker_pool);
 	}
 	return 0;
 }
@@ -307,7 +339,8 @@ static void node_update_state(struct pw_impl_node *node, enum pw_node_state stat
 
 	switch (state) {
 	case PW_NODE_STATE_RUNNING:
-		pw_loop_invoke(node->data_loop, do_node_add, 1, NULL, 0, true, node);
+		pw_loop_invoke_pair(node->driver_node->data_loop, node->data_loop,
+				do_node_add, 1, NULL, 0, node);
 		break;
 	default:
 		break;
@@ -544,6 +577,20 @@ static inline void insert_driver(struct pw_context *context, struct pw_impl_node
 	spa_list_append(&n->driver_link, &node->driver_link);
 }
 
+static uint32_t find_client_serial(struct pw_context *context,
+		const struct pw_properties *properties)
+{
+	struct pw_global *global;
+	const char *str;
+
+	if ((str = pw_properties_get(properties, PW_KEY_CLIENT_ID)) == NULL)
+		return 0;
+	global = pw_map_lookup(&context->globals, pw_properties_parse_int(str));
+	if (global == NULL || !pw_global_is_type(global, PW_TYPE_INTERFACE_Client))
+		return 0;
+	return ((struct pw_impl_client *)global->object)->serial;
+}
+
 SPA_EXPORT
 int pw_impl_node_register(struct pw_impl_node *this,
 		     struct pw_properties *properties)
@@ -581,6 +628,10 @@ int pw_impl_node_register(struct pw_impl_node *this,
 
 	pw_properties_update_keys(properties, &this->properties->dict, keys);
 
+	/* the client of the node exists when the node is registered, the
+	 * serial stays valid when the client goes away */
+	this->client_serial = find_client_serial(context, this->properties);
+
 	this->global = pw_global_new(context,
 				     PW_TYPE_INTERFACE_Node,
 				     PW_VERSION_NODE,
@@ -611,6 +662,7 @@ int pw_impl_node_register(struct pw_impl_node *this,
 	spa_list_for_each(port, &this->output_ports, link)
 		pw_impl_port_register(port, NULL);
 
+	pw_context_mark_node_dirty(context, this);
 	if (this->active)
 		pw_context_recalc_graph(context, "register active node");
 
@@ -639,15 +691,86 @@ do_move_nodes(struct spa_loop *loop,
 	struct pw_impl_node *driver = *(struct pw_impl_node **)data;
 	struct pw_impl_node *this = &src->this;
 
-	pw_log_trace(NAME" %p: driver:%p->%p", this, this->driver_node, driver);
+	pw_log_trace(NAME" %p: driver:%p->%p", this, this->rt.driver_target.data, driver);
 
 	if (this->source.loop != NULL) {
+		pw_worker_pool_block(this->context->worker_pool);
+		remove_node(this);
+		if (driver != NULL)
+			add_node(this, driver);
+		pw_worker_pool_unblock(this->context->worker_pool);
+	}
+	return 0;
+}
+
+/* the old and the new driver are in the data loop of the node or in one
+ * other loop, move the node with both loops idle. Otherwise the node is
+ * removed from the old driver and then added to the new one. */
+static void move_node(struct pw_impl_node *node, struct pw_impl_node *old,
+		struct pw_impl_node *driver)
+{
+	struct impl *impl = SPA_CONTAINER_OF(node, struct impl, this);
+	struct pw_impl_node *none = NULL;
+
+	if (old->data_loop == driver->data_loop || old->data_loop == node->data_loop) {
+		pw_loop_invoke_pair(driver->data_loop, node->data_loop,
+			       do_move_nodes, SPA_ID_INVALID, &driver, sizeof(struct pw_impl_node *),
+			       impl);
+	} else if (driver->data_loop == node->data_loop) {
+		pw_loop_invoke_pair(old->data_loop, node->data_loop,
+			       do_move_nodes, SPA_ID_INVALID, &driver, sizeof(struct pw_impl_node *),
+			       impl);
+	} else {
+		pw_loop_invoke_pair(old->data_loop, node->data_loop,
+			       do_move_nodes, SPA_ID_INVALID, &none, sizeof(struct pw_impl_node *),
+			       impl);
+		pw_loop_invoke_pair(driver->data_loop, node->data_loop,
+			       do_move_nodes, SPA_ID_INVALID, &driver, sizeof(struct pw_impl_node *),
+			       impl);
+	}
+}
+
+static int
+do_change_loop(struct spa_loop *loop,
+		bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	struct pw_impl_node *this = &impl->this;
+	struct pw_loop *old = this->data_loop;
+	struct pw_loop *to = *(struct pw_loop **)data;
+	bool added = this->source.loop != NULL;
+
+	pw_log_trace(NAME" %p: loop:%p->%p added:%d", this, old, to, added);
+
+	pw_worker_pool_block(this->context->worker_pool);
+	if (added) {
+		spa_loop_remove_source(this->source.loop, &this->source);
 		remove_node(this);
-		add_node(this, driver);
 	}
+	this->data_loop = to;
+	pw_impl_node_emit_data_loop_changed(this, old, to);
+	if (added) {
+		spa_loop_add_source(to->loop, &this->source);
+		add_node(this, this->driver_node);
+	}
+	pw_worker_pool_unblock(this->context->worker_pool);
 	return 0;
 }
 
+/* a movable node goes to the data loop of its new driver. Peers in any
+ * loop can wake up the node so the loop is changed with all data loops
+ * idle. */
+static void change_data_loop(struct pw_impl_node *node, struct pw_impl_node *driver)
+{
+	struct impl *impl = SPA_CONTAINER_OF(node, struct impl, this);
+
+	pw_log_debug(NAME" %p: move to data loop %p of driver %p", node,
+			driver->data_loop, driver);
+
+	pw_context_invoke_data_loops(node->context, do_change_loop, SPA_ID_INVALID,
+			&driver->data_loop, sizeof(struct pw_loop *), impl);
+}
+
 static void remove_segment_master(struct pw_impl_node *driver, uint32_t node_id)
 {
 	struct pw_node_activation *a = driver->rt.activation;
@@ -658,7 +781,6 @@ static void remove_segment_master(struct pw_impl_node *driver, uint32_t node_id)
 SPA_EXPORT
 int pw_impl_node_set_driver(struct pw_impl_node *node, struct pw_impl_node *driver)
 {
-	struct impl *impl = SPA_CONTAINER_OF(node, struct impl, this);
 	struct pw_impl_node *old = node->driver_node;
 	int res;
 
@@ -694,9 +816,11 @@ int pw_impl_node_set_driver(struct pw_impl_node *node, struct pw_impl_node *driv
 	pw_log_trace(NAME" %p: set position %p", node, &driver->rt.activation->position);
 	node->rt.position = &driver->rt.activation->position;
 
-	pw_loop_invoke(node->data_loop,
-		       do_move_nodes, SPA_ID_INVALID, &driver, sizeof(struct pw_impl_node *),
-		       true, impl);
+	if (node->movable && node->data_loop != driver->data_loop)
+		change_data_loop(node, driver);
+	else
+		move_node(node, old, driver);
+
 	return 0;
 }
 
@@ -710,12 +834,252 @@ static uint32_t flp2(uint32_t x)
 	return x - (x >> 1);
 }
 
+static const char *str_adapt_reason(uint32_t reason)
+{
+	switch (reason) {
+	case PW_NODE_ADAPT_LOAD:
+		return "load";
+	case PW_NODE_ADAPT_XRUN:
+		return "xrun";
+	case PW_NODE_ADAPT_IDLE:
+		return "idle";
+	}
+	return "none";
+}
+
+static void on_adapt_event(void *data, uint64_t count)
+{
+	struct pw_impl_node *node = data;
+	struct pw_node_adapt *ad = &node->adapt;
+	uint32_t pending = __atomic_load_n(&ad->pending, __ATOMIC_ACQUIRE);
+
+	if (pending == 0)
+		return;
+
+	pw_log_info("(%s-%u) adapt quantum:%u->%u (%s) load:%f:%f:%f",
+			node->name, node->info.id,
+			node->rt.position ? (uint32_t)node->rt.position->clock.duration : 0,
+			pending, str_adapt_reason(ad->reason),
+			node->rt.activation->cpu_load[0],
+			node->rt.activation->cpu_load[1],
+			node->rt.activation->cpu_load[2]);
+
+	ad->quantum = pending > ad->base ? pending : 0;
+	/* the data thread does not touch the request while it is pending,
+	 * it sees the new settle when it sees that the request is done */
+	ad->settle = ADAPT_SETTLE;
+	__atomic_store_n(&ad->pending, 0, __ATOMIC_RELEASE);
+
+	pw_context_mark_node_dirty(node->context, node);
+	pw_context_recalc_graph(node->context, "quantum adapt");
+}
+
+static bool check_adapt(struct pw_impl_node *node)
+{
+	struct pw_node_adapt *ad = &node->adapt;
+	const char *str;
+	bool enabled;
+
+	if ((str = pw_properties_get(node->properties, PW_KEY_NODE_ADAPT_QUANTUM)))
+		enabled = pw_properties_parse_bool(str);
+	else
+		enabled = false;
+
+	ad->load_low = DEFAULT_ADAPT_LOW;
+	ad->load_high = DEFAULT_ADAPT_HIGH;
+	if ((str = pw_properties_get(node->properties, PW_KEY_NODE_ADAPT_LOAD))) {
+		float low, high;
+		if (sscanf(str, "%f,%f", &low, &high) == 2 &&
+		    low >= 0.0f && low < high) {
+			ad->load_low = low;
+			ad->load_high = high;
+		} else {
+			pw_log_warn(NAME" %p: invalid adapt load '%s'", node, str);
+		}
+	}
+	if ((str = pw_properties_get(node->properties, PW_KEY_NODE_ADAPT_HOLD)))
+		ad->hold = pw_properties_parse_uint64(str) * SPA_NSEC_PER_MSEC;
+	else
+		ad->hold = DEFAULT_ADAPT_HOLD * SPA_NSEC_PER_MSEC;
+
+	if (enabled && ad->event == NULL)
+		ad->event = pw_loop_add_event(node->context->main_loop,
+				on_adapt_event, node);
+
+	if (ad->enabled == enabled)
+		return false;
+
+	pw_log_debug(NAME" %p: adapt quantum %d low:%f high:%f hold:%"PRIu64,
+			node, enabled, ad->load_low, ad->load_high, ad->hold);
+	ad->enabled = enabled;
+	if (enabled || ad->quantum == 0)
+		return false;
+
+	ad->quantum = 0;
+	return true;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static void watchdog_update_peers(struct pw_impl_node *node)
+{
+	struct pw_impl_port *port;
+	struct pw_impl_link *link;
+
+	spa_list_for_each(port, &node->input_ports, link) {
+		spa_list_for_each(link, &port->links, input_link)
+			pw_impl_link_update_peers(link);
+	}
+	spa_list_for_each(port, &node->output_ports, link) {
+		spa_list_for_each(link, &port->links, output_link)
+			pw_impl_link_update_peers(link);
+	}
+}
+
+static void watchdog_arm(struct pw_impl_node *node, uint64_t timeout)
+{
+	struct timespec value;
+
+	value.tv_sec = timeout / SPA_MSEC_PER_SEC;
+	value.tv_nsec = (timeout % SPA_MSEC_PER_SEC) * SPA_NSEC_PER_MSEC;
+	pw_loop_update_timer(node->context->main_loop, node->watchdog.timer,
+			&value, NULL, false);
+}
+
+static void watchdog_restore(struct pw_impl_node *node)
+{
+	struct pw_node_watchdog *wd = &node->watchdog;
+	struct spa_dict_item items[1];
+
+	if (!node->isolated)
+		return;
+
+	pw_log_info("(%s-%u) watchdog: restoring node", node->name, node->info.id);
+
+	node->isolated = false;
+	wd->restore_time = get_time_ns();
+	__atomic_store_n(&wd->probation_end, wd->restore_time + WATCHDOG_PROBATION,
+			__ATOMIC_RELAXED);
+	watchdog_update_peers(node);
+
+	items[0] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_ISOLATED, NULL);
+	pw_impl_node_update_properties(node, &SPA_DICT_INIT(items, 1));
+
+	pw_context_mark_node_dirty(node->context, node);
+	pw_context_recalc_graph(node->context, "watchdog restore");
+}
+
+static void on_watchdog_timeout(void *data, uint64_t expirations)
+{
+	struct pw_impl_node *node = data;
+	struct pw_node_activation *a = node->rt.activation;
+	uint32_t status;
+
+	if (!node->isolated)
+		return;
+
+	/* a node that is still busy with the cycle it was isolated in
+	 * did not recover, check again later */
+	status = a ? ATOMIC_LOAD(a->status) : PW_NODE_ACTIVATION_FINISHED;
+	if (status == PW_NODE_ACTIVATION_TRIGGERED ||
+	    status == PW_NODE_ACTIVATION_AWAKE) {
+		pw_log_info("(%s-%u) watchdog: node still busy, not restoring",
+				node->name, node->info.id);
+		watchdog_arm(node, node->context->defaults.watchdog_timeout);
+		return;
+	}
+	watchdog_restore(node);
+}
+
+static void on_watchdog_event(void *data, uint64_t count)
+{
+	struct pw_impl_node *node = data;
+	struct pw_node_watchdog *wd = &node->watchdog;
+	struct pw_context *context = node->context;
+	struct spa_dict_item items[1];
+	uint64_t timeout;
+	char reason[128];
+
+	/* the data thread sets it, take it so that the next overrun can
+	 * request again */
+	if (!__atomic_exchange_n(&wd->pending, false, __ATOMIC_ACQUIRE))
+		return;
+
+	if (!wd->enabled || node->isolated)
+		return;
+
+	/* isolate for longer each time the node misbehaves again soon
+	 * after it was restored */
+	if (wd->restore_time != 0 && get_time_ns() - wd->restore_time > WATCHDOG_FORGET)
+		wd->isolations = 0;
+	timeout = (uint64_t)context->defaults.watchdog_timeout <<
+		SPA_MIN(wd->isolations, WATCHDOG_MAX_BACKOFF);
+	wd->isolations++;
+
+	snprintf(reason, sizeof(reason), "%u cycles not finished in %"PRIu64" ms",
+			context->defaults.watchdog_overruns,
+			(uint64_t)(WATCHDOG_INTERVAL / SPA_NSEC_PER_MSEC));
+
+	pw_log_warn("(%s-%u) watchdog: isolating node for %"PRIu64" ms: %s",
+			node->name, node->info.id, timeout, reason);
+
+	/* the peers stop waiting for the node when its links are
+	 * deactivated, the recalc removes it from its driver. A remote
+	 * node also loses the activations of its peers so that it can't
+	 * signal them anymore */
+	node->isolated = true;
+	node_deactivate(node);
+	watchdog_update_peers(node);
+
+	items[0] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_ISOLATED, reason);
+	pw_impl_node_update_properties(node, &SPA_DICT_INIT(items, 1));
+
+	pw_context_mark_node_dirty(context, node);
+	pw_context_recalc_graph(context, "watchdog isolate");
+
+	watchdog_arm(node, timeout);
+}
+
+static void check_watchdog(struct pw_impl_node *node)
+{
+	struct pw_node_watchdog *wd = &node->watchdog;
+	struct pw_context *context = node->context;
+	const char *str;
+	bool enabled;
+
+	/* only followers are isolated, drivers keep the graph going */
+	enabled = !node->driver && context->defaults.watchdog_overruns > 0;
+	if (enabled && (str = pw_properties_get(node->properties, PW_KEY_NODE_WATCHDOG)))
+		enabled = pw_properties_parse_bool(str);
+
+	if (enabled && wd->event == NULL) {
+		wd->event = pw_loop_add_event(context->main_loop,
+				on_watchdog_event, node);
+		wd->timer = pw_loop_add_timer(context->main_loop,
+				on_watchdog_timeout, node);
+		pw_loop_set_timer_slack(context->main_loop, wd->timer,
+				WATCHDOG_SLACK);
+	}
+	if (wd->enabled == enabled)
+		return;
+
+	pw_log_debug(NAME" %p: watchdog %d", node, enabled);
+	wd->enabled = enabled;
+	if (!enabled)
+		watchdog_restore(node);
+}
+
 static void check_properties(struct pw_impl_node *node)
 {
 	struct impl *impl = SPA_CONTAINER_OF(node, struct impl, this);
 	struct pw_context *context = node->context;
 	const char *str;
-	bool driver, do_recalc = false;
+	bool driver, freewheel, do_recalc = false;
 
 	if ((str = pw_properties_get(node->properties, PW_KEY_PRIORITY_MASTER))) {
 		node->priority_master = pw_properties_parse_int(str);
@@ -744,6 +1108,17 @@ static void check_properties(struct pw_impl_node *node)
 	else
 		node->want_driver = false;
 
+	if ((str = pw_properties_get(node->properties, PW_KEY_NODE_FREEWHEEL)))
+		freewheel = pw_properties_parse_bool(str);
+	else
+		freewheel = false;
+
+	if (node->freewheel != freewheel) {
+		pw_log_info("(%s-%u) freewheel %d", node->name, node->info.id, freewheel);
+		node->freewheel = freewheel;
+		do_recalc |= node->registered;
+	}
+
 	if (node->driver != driver) {
 		pw_log_debug(NAME" %p: driver %d -> %d", node, node->driver, driver);
 		node->driver = driver;
@@ -752,6 +1127,22 @@ static void check_properties(struct pw_impl_node *node)
 				insert_driver(context, node);
 			else
 				spa_list_remove(&node->driver_link);
+			pw_context_mark_node_dirty(context, node);
+		}
+	}
+
+	check_watchdog(node);
+
+	if (node->driver && node->flight_recorder == NULL) {
+		int cycles = context->defaults.flight_recorder;
+
+		if ((str = pw_properties_get(node->properties, PW_KEY_NODE_FLIGHT_RECORDER)))
+			cycles = pw_properties_parse_int(str);
+		cycles = SPA_CLAMP(cycles, 0, PW_FLIGHT_MAX_CYCLES);
+		if (cycles > 0) {
+			node->flight_recorder = pw_flight_recorder_new(node, cycles);
+			if (node->flight_recorder == NULL)
+				pw_log_warn(NAME" %p: can't create flight recorder: %m", node);
 		}
 	}
 
@@ -772,10 +1163,14 @@ static void check_properties(struct pw_impl_node *node)
 			}
 		}
 	}
+	do_recalc |= check_adapt(node);
+
 	pw_log_debug(NAME" %p: driver:%d recalc:%d", node, node->driver, do_recalc);
 
-	if (do_recalc)
+	if (do_recalc) {
+		pw_context_mark_node_dirty(context, node);
 		pw_context_recalc_graph(context, "quantum change");
+	}
 }
 
 static const char *str_status(uint32_t status)
@@ -815,12 +1210,16 @@ static void dump_states(struct pw_impl_node *driver)
 	}
 }
 
+static inline int process_node(void *data);
+
 static inline int resume_node(struct pw_impl_node *this, int status)
 {
-	struct pw_node_target *t;
+	struct pw_node_target *t, *local = NULL;
 	struct timespec ts;
 	struct pw_node_activation *activation = this->rt.activation;
 	struct spa_system *data_system = this->context->data_system;
+	struct pw_worker_pool *pool = this->context->worker_pool;
+	bool in_worker = pw_worker_pool_in_worker(pool);
 	uint64_t nsec;
 
 	spa_system_clock_gettime(data_system, CLOCK_MONOTONIC, &ts);
@@ -833,6 +1232,7 @@ static inline int resume_node(struct pw_impl_node *this, int status)
 	spa_list_for_each(t, &this->rt.target_list, link) {
 		struct pw_node_activation *a = t->activation;
 		struct pw_node_activation_state *state = &a->state[0];
+		struct pw_impl_node *n;
 
 		pw_log_trace_fp(NAME" %p: state:%p pending:%d/%d", t->node, state,
                                 state->pending, state->required);
@@ -840,9 +1240,31 @@ static inline int resume_node(struct pw_impl_node *this, int status)
 		if (pw_node_activation_state_dec(state, 1)) {
 			a->status = PW_NODE_ACTIVATION_TRIGGERED;
 			a->signal_time = nsec;
-			t->signal(t->data);
+
+			/* with a worker pool, we keep one of the thread-safe local
+			 * nodes to run in this thread and hand off the other ones to
+			 * the workers. Remote nodes are simply woken up, local nodes
+			 * in another data loop are woken up in their data loop like
+			 * the other local nodes when we are a worker. */
+			if (t->signal != process_node) {
+				t->signal(t->data);
+				continue;
+			}
+			n = t->data;
+			if (n->data_loop != this->data_loop ||
+			    (in_worker && (!n->thread_safe || n == this->driver_node))) {
+				spa_system_eventfd_write(data_system, n->source.fd, 1);
+			} else if (pool == NULL || !n->thread_safe || n == this->driver_node) {
+				t->signal(t->data);
+			} else {
+				if (local != NULL && pw_worker_pool_push(pool, local) < 0)
+					local->signal(local->data);
+				local = t;
+			}
 		}
 	}
+	if (local != NULL)
+		local->signal(local->data);
 	return 0;
 }
 
@@ -858,6 +1280,92 @@ static inline void calculate_stats(struct pw_impl_node *this,  struct pw_node_ac
 	}
 }
 
+/* called from the data thread of a driver after each cycle. Grows the
+ * quantum on an xrun or when the short-term load is above the high
+ * threshold and shrinks it again, down to the quantum of the graph, when
+ * both short and long-term load stayed below the low threshold for the
+ * hold time. */
+static inline void adapt_quantum(struct pw_impl_node *this, struct pw_node_activation *a)
+{
+	struct pw_node_adapt *ad = &this->adapt;
+	struct defaults *def = &this->context->defaults;
+	uint32_t duration, base, quantum = 0, reason = PW_NODE_ADAPT_NONE;
+
+	if (__atomic_load_n(&ad->pending, __ATOMIC_ACQUIRE) != 0 ||
+	    ad->event == NULL || this->rt.position == NULL)
+		return;
+
+	if (ad->settle > 0) {
+		ad->settle--;
+		ad->xrun_count = a->xrun_count;
+		ad->low_since = 0;
+		return;
+	}
+
+	duration = this->rt.position->clock.duration;
+	base = __atomic_load_n(&ad->base, __ATOMIC_RELAXED);
+
+	if (a->xrun_count != ad->xrun_count)
+		reason = PW_NODE_ADAPT_XRUN;
+	else if (a->cpu_load[0] > ad->load_high)
+		reason = PW_NODE_ADAPT_LOAD;
+	ad->xrun_count = a->xrun_count;
+
+	if (reason != PW_NODE_ADAPT_NONE) {
+		ad->low_since = 0;
+		quantum = SPA_MIN(duration * 2, def->clock_max_quantum);
+	} else if (duration > base &&
+	    a->cpu_load[0] < ad->load_low && a->cpu_load[2] < ad->load_low) {
+		if (ad->low_since == 0) {
+			ad->low_since = a->signal_time;
+		} else if (a->signal_time - ad->low_since >= ad->hold) {
+			ad->low_since = 0;
+			quantum = SPA_MAX(duration / 2, base);
+			reason = PW_NODE_ADAPT_IDLE;
+		}
+	} else {
+		ad->low_since = 0;
+	}
+
+	if (quantum == 0 || quantum == duration)
+		return;
+
+	pw_log_trace_fp(NAME" %p: adapt quantum %u->%u reason:%u", this,
+			duration, quantum, reason);
+
+	ad->reason = reason;
+	ad->change_time = a->signal_time;
+	ad->changes++;
+	__atomic_store_n(&ad->pending, quantum, __ATOMIC_RELEASE);
+	pw_loop_signal_event(this->context->main_loop, ad->event);
+}
+
+/* called in the data thread for a follower that did not finish before
+ * the next cycle of its driver */
+static inline void watchdog_overrun(struct pw_impl_node *this, uint64_t nsec)
+{
+	struct pw_node_watchdog *wd = &this->watchdog;
+
+	if (!wd->enabled || wd->event == NULL ||
+	    __atomic_load_n(&wd->pending, __ATOMIC_ACQUIRE))
+		return;
+
+	if (nsec - wd->window_start > WATCHDOG_INTERVAL) {
+		wd->window_start = nsec;
+		wd->overruns = 0;
+	}
+	/* a restored node is on probation and must finish all its cycles */
+	if (++wd->overruns < this->context->defaults.watchdog_overruns &&
+	    nsec >= __atomic_load_n(&wd->probation_end, __ATOMIC_RELAXED))
+		return;
+
+	pw_log_trace_fp(NAME" %p: watchdog %u overruns", this, wd->overruns);
+
+	wd->overruns = 0;
+	__atomic_store_n(&wd->pending, true, __ATOMIC_RELEASE);
+	pw_loop_signal_event(this->context->main_loop, wd->event);
+}
+
 static inline int process_node(void *data)
 {
 	struct pw_impl_node *this = data;
@@ -897,6 +1405,12 @@ static inline int process_node(void *data)
 		/* calculate CPU time */
 		calculate_stats(this, a);
 
+		if (this->flight_recorder)
+			pw_flight_recorder_record(this->flight_recorder, false);
+
+		if (SPA_UNLIKELY(this->adapt.enabled))
+			adapt_quantum(this, a);
+
 		pw_log_trace_fp(NAME" %p: graph completed wait:%"PRIu64" run:%"PRIu64
 				" busy:%"PRIu64" period:%"PRIu64" cpu:%f:%f:%f", this,
 				a->awake_time - a->signal_time,
@@ -921,7 +1435,7 @@ static inline int process_node(void *data)
 static void node_on_fd_events(struct spa_source *source)
 {
 	struct pw_impl_node *this = source->data;
-	struct spa_system *data_system = this->context->data_system;
+	struct spa_system *data_system = this->data_loop->system;
 
 	if (SPA_UNLIKELY(source->rmask & (SPA_IO_ERR | SPA_IO_HUP))) {
 		pw_log_warn(NAME" %p: got socket error %08x", this, source->rmask);
@@ -973,7 +1487,7 @@ struct pw_impl_node *pw_context_create_node(struct pw_context *context,
 	struct impl *impl;
 	struct pw_impl_node *this;
 	size_t size;
-	struct spa_system *data_system = context->data_system;
+	const char *str;
 	int res;
 
 	impl = calloc(1, sizeof(struct impl) + user_data_size);
@@ -1000,7 +1514,12 @@ struct pw_impl_node *pw_context_create_node(struct pw_context *context,
 
 	this->properties = properties;
 
-	if ((res = spa_system_eventfd_create(data_system, SPA_FD_CLOEXEC | SPA_FD_NONBLOCK)) < 0)
+	/* the eventfd is polled by the data loop of the node, it is made by
+	 * the system of that loop */
+	this->data_loop = pw_context_find_data_loop(context, &properties->dict);
+
+	if ((res = spa_system_eventfd_create(this->data_loop->system,
+					SPA_FD_CLOEXEC | SPA_FD_NONBLOCK)) < 0)
 		goto error_clean;
 
 	this->source.fd = res;
@@ -1011,10 +1530,14 @@ struct pw_impl_node *pw_context_create_node(struct pw_context *context,
 
 	size = sizeof(struct pw_node_activation);
 
+	/* the activation is given to the clients of all the peers of the
+	 * node, it does not share its fd with other blocks */
 	this->activation = pw_mempool_alloc(this->context->pool,
 			PW_MEMBLOCK_FLAG_READWRITE |
 			PW_MEMBLOCK_FLAG_SEAL |
-			PW_MEMBLOCK_FLAG_MAP,
+			PW_MEMBLOCK_FLAG_MAP |
+			PW_MEMBLOCK_FLAG_PREFAULT |
+			PW_MEMBLOCK_FLAG_MLOCK,
 			SPA_DATA_MemFd, size);
 	if (this->activation == NULL) {
 		res = -errno;
@@ -1027,8 +1550,6 @@ struct pw_impl_node *pw_context_create_node(struct pw_context *context,
 		goto error_clean;
 	}
 
-	this->data_loop = context->data_loop;
-
 	spa_list_init(&this->follower_list);
 
 	spa_hook_list_init(&this->listener_list);
@@ -1060,6 +1581,14 @@ struct pw_impl_node *pw_context_create_node(struct pw_context *context,
 	this->rt.rate_limit.interval = 2 * SPA_NSEC_PER_SEC;
 	this->rt.rate_limit.burst = 1;
 
+	/* async can't change later, the driver and peers count on it */
+	if ((str = pw_properties_get(properties, PW_KEY_NODE_ASYNC)) != NULL)
+		this->async = pw_properties_parse_bool(str);
+	/* only nodes that don't rely on running in their data loop thread
+	 * are given to the workers */
+	if ((str = pw_properties_get(properties, PW_KEY_NODE_THREAD_SAFE)) != NULL)
+		this->thread_safe = pw_properties_parse_bool(str);
+
 	check_properties(this);
 
 	this->driver_node = this;
@@ -1071,8 +1600,8 @@ struct pw_impl_node *pw_context_create_node(struct pw_context *context,
 error_clean:
 	if (this->activation)
 		pw_memblock_unref(this->activation);
-	if (this->source.fd != -1)
-		spa_system_close(this->context->data_system, this->source.fd);
+	if (this->data_loop != NULL && this->source.fd != -1)
+		spa_system_close(this->data_loop->system, this->source.fd);
 	free(impl);
 error_exit:
 	if (properties)
@@ -1359,9 +1888,13 @@ static int node_ready(void *data, int status)
 		int sync_type, all_ready, update_sync, target_sync;
 		uint32_t owner[2], reposition_owner;
 		uint64_t min_timeout = UINT64_MAX;
+		bool incomplete = state->pending > 0;
 
-		if (SPA_UNLIKELY(state->pending > 0)) {
+		if (SPA_UNLIKELY(incomplete)) {
 			pw_context_driver_emit_incomplete(node->context, node);
+			if (node->flight_recorder)
+				pw_flight_recorder_freeze(node->flight_recorder,
+						PW_FLIGHT_REASON_INCOMPLETE);
 			if (ratelimit_test(&node->rt.rate_limit, a->signal_time)) {
 				pw_log_warn("(%s-%u) graph not finished: state:%p quantum:%"PRIu64
 						" pending %d/%d", node->name, node->info.id,
@@ -1382,8 +1915,24 @@ static int node_ready(void *data, int status)
 		spa_list_for_each(t, &driver->rt.target_list, link) {
 			struct pw_node_activation *ta = t->activation;
 
-			ta->status = PW_NODE_ACTIVATION_NOT_TRIGGERED;
-			pw_node_activation_state_reset(&ta->state[0]);
+			/* the followers that are still busy are the ones that
+			 * made the graph late, the others are waiting for them */
+			if (SPA_UNLIKELY(incomplete) && t->node && t->node != node &&
+			    !t->node->async &&
+			    (ta->status == PW_NODE_ACTIVATION_TRIGGERED ||
+			     ta->status == PW_NODE_ACTIVATION_AWAKE))
+				watchdog_overrun(t->node, a->signal_time);
+
+			/* an async node that is still busy with a previous
+			 * cycle is not triggered again until it finished */
+			if (SPA_UNLIKELY(t->node && t->node->async &&
+			    (ta->status == PW_NODE_ACTIVATION_TRIGGERED ||
+			     ta->status == PW_NODE_ACTIVATION_AWAKE))) {
+				pw_log_trace_fp(NAME" %p: async node %p busy", node, t->node);
+			} else {
+				ta->status = PW_NODE_ACTIVATION_NOT_TRIGGERED;
+				pw_node_activation_state_reset(&ta->state[0]);
+			}
 
 			if (SPA_LIKELY(t->node)) {
 				uint32_t id = t->node->info.id;
@@ -1450,6 +1999,9 @@ static int node_xrun(void *data, uint64_t trigger, uint64_t delay, struct spa_po
 	a->xrun_delay = delay;
 	a->max_delay = SPA_MAX(a->max_delay, delay);
 
+	if (this->flight_recorder)
+		pw_flight_recorder_freeze(this->flight_recorder, PW_FLIGHT_REASON_XRUN);
+
 	if (ratelimit_test(&this->rt.rate_limit, a->signal_time)) {
 		pw_log_error(NAME" %p: XRun! count:%u time:%"PRIu64" delay:%"PRIu64" max:%"PRIu64,
 				this, a->xrun_count, trigger, delay, a->max_delay);
@@ -1548,16 +2100,23 @@ void pw_impl_node_destroy(struct pw_impl_node *node)
 	/* remove ourself as a follower from the driver node */
 	spa_list_remove(&node->follower_link);
 	remove_segment_master(node->driver_node, node->info.id);
+	if (node->driver_node != node)
+		pw_context_mark_node_dirty(node->context, node->driver_node);
 
 	spa_list_consume(follower, &node->follower_list, follower_link) {
 		pw_log_debug(NAME" %p: reassign follower %p", impl, follower);
 		pw_impl_node_set_driver(follower, NULL);
+		pw_context_mark_node_dirty(node->context, follower);
 	}
 
 	if (node->registered) {
 		spa_list_remove(&node->link);
 		if (node->driver)
 			spa_list_remove(&node->driver_link);
+		if (node->dirty)
+			spa_list_remove(&node->dirty_link);
+		node->registered = false;
+		node->dirty = false;
 	}
 
 	if (node->node) {
@@ -1590,6 +2149,15 @@ void pw_impl_node_destroy(struct pw_impl_node *node)
 
 	pw_memblock_unref(node->activation);
 
+	if (node->adapt.event)
+		pw_loop_destroy_source(node->context->main_loop, node->adapt.event);
+	if (node->flight_recorder)
+		pw_flight_recorder_destroy(node->flight_recorder);
+	if (node->watchdog.event)
+		pw_loop_destroy_source(node->context->main_loop, node->watchdog.event);
+	if (node->watchdog.timer)
+		pw_loop_destroy_source(node->context->main_loop, node->watchdog.timer);
+
 	pw_work_queue_destroy(impl->work);
 
 	pw_map_clear(&node->input_port_map);
@@ -1599,7 +2167,7 @@ void pw_impl_node_destroy(struct pw_impl_node *node)
 
 	clear_info(node);
 
-	spa_system_close(node->context->data_system, node->source.fd);
+	spa_system_close(node->data_loop->system, node->source.fd);
 	free(impl);
 }
 
@@ -1874,9 +2442,11 @@ int pw_impl_node_set_active(struct pw_impl_node *node, bool active)
 		node->active = active;
 		pw_impl_node_emit_active_changed(node, active);
 
-		if (node->registered)
+		if (node->registered) {
+			pw_context_mark_node_dirty(node->context, node);
 			pw_context_recalc_graph(node->context,
 					active ? "node activate" : "node deactivate");
+		}
 	}
 	return 0;
 }
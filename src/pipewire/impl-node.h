@@ -51,7 +51,7 @@ struct pw_impl_port;
 
 /** Node events, listen to them with \ref pw_impl_node_add_listener */
 struct pw_impl_node_events {
-#define PW_VERSION_IMPL_NODE_EVENTS	0
+#define PW_VERSION_IMPL_NODE_EVENTS	1
 	uint32_t version;
 
 	/** the node is destroyed */
@@ -95,6 +95,10 @@ struct pw_impl_node_events {
 	void (*peer_added) (void *data, struct pw_impl_node *peer);
 	/** a peer was removed */
 	void (*peer_removed) (void *data, struct pw_impl_node *peer);
+
+	/** the node moved to another data loop. Called from a data loop
+	 * while all data loops are idle. Since version 1 */
+	void (*data_loop_changed) (void *data, struct pw_loop *old, struct pw_loop *loop);
 };
 
 /** Create a new node \memberof pw_impl_node */
@@ -159,6 +159,24 @@ static int schedule_mix_input(void *object)
 	spa_list_for_each(mix, &this->rt.mix_list, rt_link) {
 		pw_log_trace_fp(NAME" %p: mix input %d %p->%p %d %d", this,
 				mix->port.port_id, mix->io, io, mix->io->status, mix->io->buffer_id);
+		if (SPA_UNLIKELY(mix->async)) {
+			/* the async node runs at the same time and owns the io
+			 * until it has a new buffer. We take it and hand back the
+			 * buffer of the previous time, the node would otherwise
+			 * reuse the new buffer while we still read it */
+			if (__atomic_load_n(&mix->io->status, __ATOMIC_ACQUIRE) !=
+			    SPA_STATUS_HAVE_DATA) {
+				io->buffer_id = SPA_ID_INVALID;
+				io->status = SPA_STATUS_NEED_DATA;
+				break;
+			}
+			*io = *mix->io;
+			mix->io->buffer_id = mix->hold_id;
+			mix->hold_id = io->buffer_id;
+			__atomic_store_n(&mix->io->status, SPA_STATUS_NEED_DATA,
+					__ATOMIC_RELEASE);
+			break;
+		}
 		*io = *mix->io;
 		mix->io->status = SPA_STATUS_NEED_DATA;
 		break;
@@ -621,11 +639,14 @@ static int do_add_port(struct spa_loop *loop,
 		       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
         struct pw_impl_port *this = user_data;
+	struct pw_worker_pool *pool = this->node->context->worker_pool;
 
+	pw_worker_pool_block(pool);
 	if (this->direction == PW_DIRECTION_INPUT)
 		spa_list_append(&this->node->rt.input_mix, &this->rt.node_link);
 	else
 		spa_list_append(&this->node->rt.output_mix, &this->rt.node_link);
+	pw_worker_pool_unblock(pool);
 
 	return 0;
 }
@@ -927,8 +948,11 @@ static int do_remove_port(struct spa_loop *loop,
 			  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
         struct pw_impl_port *this = user_data;
+	struct pw_worker_pool *pool = this->node->context->worker_pool;
 
+	pw_worker_pool_block(pool);
 	spa_list_remove(&this->rt.node_link);
+	pw_worker_pool_unblock(pool);
 
 	return 0;
 }
@@ -1173,7 +1197,7 @@ int pw_impl_port_set_param(struct pw_impl_port *port, uint32_t id, uint32_t flag
 		pw_log_debug(NAME" %p: %d %p %d", port, port->state, param, res);
 
 		/* setting the format always destroys the negotiated buffers */
-		pw_buffers_clear(&port->buffers);
+		pw_buffers_recycle(node->context, &port->buffers);
 		pw_buffers_clear(&port->mix_buffers);
 
 		if (param == NULL || res < 0) {
@@ -141,6 +141,34 @@ extern "C" {
 #define PW_KEY_NODE_ALWAYS_PROCESS	"node.always-process"	/**< process even when unlinked */
 #define PW_KEY_NODE_PAUSE_ON_IDLE	"node.pause-on-idle"	/**< pause the node when idle */
 #define PW_KEY_NODE_DRIVER		"node.driver"		/**< node can drive the graph */
+#define PW_KEY_NODE_FREEWHEEL		"node.freewheel"	/**< a driver that runs the graph as fast
+								  *  as possible. Other nodes are moved to
+								  *  this driver, with the nodes linked to
+								  *  them, when the property is true */
+#define PW_KEY_NODE_DATA_LOOP		"node.data-loop"	/**< index of the data loop of the
+								  *  node when the context has
+								  *  multiple data loops */
+#define PW_KEY_NODE_SPIN_WAIT		"node.spin-wait"	/**< max time in nanoseconds the thread of
+								  *  a client node busy-waits for the next
+								  *  wakeup before blocking, 0 disables */
+#define PW_KEY_NODE_ADAPT_QUANTUM	"node.adapt-quantum"	/**< a driver adapts its quantum to the
+								  *  measured load and xruns */
+#define PW_KEY_NODE_ADAPT_LOAD		"node.adapt-load"	/**< low and high load thresholds for
+								  *  quantum adaptation as "low,high",
+								  *  default "0.25,0.75" */
+#define PW_KEY_NODE_ADAPT_HOLD		"node.adapt-hold"	/**< time in milliseconds the load must
+								  *  stay low before the quantum shrinks */
+#define PW_KEY_NODE_ASYNC		"node.async"		/**< the graph doesn't wait for the node,
+								  *  its output is used one cycle later */
+#define PW_KEY_NODE_THREAD_SAFE		"node.thread-safe"	/**< the node can be processed by the workers
+								  *  of the data loop, not only in its own
+								  *  data loop thread */
+#define PW_KEY_NODE_FLIGHT_RECORDER	"node.flight-recorder"	/**< number of cycles a driver keeps in
+								  *  its flight recorder, 0 disables */
+#define PW_KEY_NODE_WATCHDOG		"node.watchdog"		/**< the watchdog can isolate the node
+								  *  when it is too slow, default true */
+#define PW_KEY_NODE_ISOLATED		"node.isolated"		/**< reason why the watchdog isolated
+								  *  the node, unset when restored */
 #define PW_KEY_NODE_STREAM		"node.stream"		/**< node is a stream, the server side should
 								  *  add a converter */
 /** Port keys */
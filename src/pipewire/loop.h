@@ -72,6 +72,7 @@ pw_loop_destroy(struct pw_loop *loop);
 #define pw_loop_update_timer(l,...)	spa_loop_utils_update_timer((l)->utils,__VA_ARGS__)
 #define pw_loop_add_signal(l,...)	spa_loop_utils_add_signal((l)->utils,__VA_ARGS__)
 #define pw_loop_destroy_source(l,...)	spa_loop_utils_destroy_source((l)->utils,__VA_ARGS__)
+#define pw_loop_set_timer_slack(l,...)	spa_loop_utils_set_timer_slack((l)->utils,__VA_ARGS__)
 
 #ifdef __cplusplus
 }
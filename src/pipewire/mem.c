@@ -27,8 +27,10 @@
 #include <string.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -37,12 +39,18 @@
 #include <spa/utils/list.h>
 #include <spa/buffer/buffer.h>
 
+#include <pipewire/array.h>
 #include <pipewire/log.h>
 #include <pipewire/map.h>
 #include <pipewire/mem.h>
+#include <pipewire/properties.h>
 
 #define NAME "mempool"
 
+#define SLAB_ALIGN	64
+#define SLAB_FLAGS	(PW_MEMBLOCK_FLAG_SEAL | PW_MEMBLOCK_FLAG_PREFAULT | PW_MEMBLOCK_FLAG_MLOCK)
+#define DEFAULT_HUGEPAGE_SIZE	(2u * 1024 * 1024)
+
 #ifndef __FreeBSD__
 #define USE_MEMFD
 #endif
@@ -72,6 +80,14 @@ static inline int memfd_create(const char *name, unsigned int flags)
 #define MFD_ALLOW_SEALING 0x0002U
 #endif
 
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB       0x0004U
+#endif
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
 /* fcntl() seals-related flags */
 
 #ifndef F_LINUX_SPECIFIC_BASE
@@ -95,6 +111,13 @@ static struct spa_list _mempools = SPA_LIST_INIT(&_mempools);
 #define pw_mempool_emit_added(p,b)	pw_mempool_emit(p, added, 0, b)
 #define pw_mempool_emit_removed(p,b)	pw_mempool_emit(p, removed, 0, b)
 
+/* a hash table of lists, items are linked with a spa_list in the item */
+struct hash {
+	struct spa_list *buckets;
+	uint32_t mask;
+	uint32_t n_items;
+};
+
 struct mempool {
 	struct pw_mempool this;
 
@@ -105,6 +128,31 @@ struct mempool {
 	struct pw_map map;
 	struct spa_list blocks;
 	uint32_t pagesize;
+
+	uint32_t slab_size;
+	struct spa_list slabs;
+
+	uint32_t hugepage_size;		/* 0 when huge pages are not used */
+	unsigned int prefault:1;
+	unsigned int mlock:1;
+	unsigned int warned_mlock:1;
+
+	struct pw_array ranges;		/* struct range, for find_ptr */
+	struct hash fds;		/* memblocks not in a slab, by fd */
+	struct hash tags;		/* memmaps by tag */
+	struct hash tags0;		/* memmaps by tag[0] */
+};
+
+/* a memfd that is mapped once and carved up into blocks. All blocks
+ * of a slab have the same owner, they are given to the same clients. */
+struct slab {
+	struct spa_list link;
+	uint64_t owner;
+	int fd;
+	uint32_t size;
+	uint32_t used;
+	void *ptr;
+	struct pw_array blocks;		/* struct memblock *, sorted on offset */
 };
 
 struct memblock {
@@ -112,6 +160,9 @@ struct memblock {
 	struct spa_list link;
 	struct spa_list mappings;
 	struct spa_list maps;
+
+	struct slab *slab;
+	struct spa_list fd_link;
 };
 
 struct mapping {
@@ -120,6 +171,7 @@ struct mapping {
 	uint32_t offset;
 	uint32_t size;
 	unsigned int do_unmap:1;
+	unsigned int indexed:1;
 	struct spa_list link;
 	void *ptr;
 };
@@ -128,31 +180,236 @@ struct memmap {
 	struct pw_memmap this;
 	struct mapping *mapping;
 	struct spa_list link;
+	struct spa_list tag_link;
+	struct spa_list tag0_link;
+};
+
+/* The mapped memory of a pool, a mapping or a slab. Mapped memory does
+ * not overlap, the only mappings that share memory are the ones of the
+ * blocks of a slab, which are found with the slab. */
+struct range {
+	void *start;
+	void *end;
+	struct mapping *mapping;
+	struct slab *slab;
 };
 
+static inline uint32_t hash_int(uint32_t val)
+{
+	return val * 2654435761u;
+}
+
+static inline uint32_t hash_tag(const uint32_t tag[5])
+{
+	uint32_t i, h = 2166136261u;
+	for (i = 0; i < 5; i++)
+		h = (h ^ tag[i]) * 16777619u;
+	return h;
+}
+
+static inline struct spa_list *hash_bucket(struct hash *h, uint32_t hash)
+{
+	return &h->buckets[hash & h->mask];
+}
+
+static struct spa_list *hash_alloc_buckets(uint32_t n_buckets)
+{
+	struct spa_list *buckets;
+	uint32_t i;
+
+	buckets = calloc(n_buckets, sizeof(struct spa_list));
+	if (buckets == NULL)
+		return NULL;
+	for (i = 0; i < n_buckets; i++)
+		spa_list_init(&buckets[i]);
+	return buckets;
+}
+
+static int hash_init(struct hash *h)
+{
+	h->buckets = hash_alloc_buckets(64);
+	if (h->buckets == NULL)
+		return -errno;
+	h->mask = 63;
+	h->n_items = 0;
+	return 0;
+}
+
+/* double the number of buckets, when this fails the lists get longer */
+static void hash_grow(struct hash *h, uint32_t (*rehash) (struct spa_list *link))
+{
+	uint32_t i, n_buckets = (h->mask + 1) * 2;
+	struct spa_list *buckets, *link;
+
+	buckets = hash_alloc_buckets(n_buckets);
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i <= h->mask; i++) {
+		while (!spa_list_is_empty(&h->buckets[i])) {
+			link = h->buckets[i].next;
+			spa_list_remove(link);
+			spa_list_append(&buckets[rehash(link) & (n_buckets - 1)], link);
+		}
+	}
+	free(h->buckets);
+	h->buckets = buckets;
+	h->mask = n_buckets - 1;
+}
+
+static void hash_insert(struct hash *h, struct spa_list *link, uint32_t hash,
+		uint32_t (*rehash) (struct spa_list *link))
+{
+	if (h->n_items >= 2 * (h->mask + 1))
+		hash_grow(h, rehash);
+	spa_list_append(hash_bucket(h, hash), link);
+	h->n_items++;
+}
+
+static void hash_remove(struct hash *h, struct spa_list *link)
+{
+	spa_list_remove(link);
+	h->n_items--;
+}
+
+static uint32_t rehash_fd(struct spa_list *link)
+{
+	struct memblock *b = SPA_CONTAINER_OF(link, struct memblock, fd_link);
+	return hash_int(b->this.fd);
+}
+
+static uint32_t rehash_tag(struct spa_list *link)
+{
+	struct memmap *mm = SPA_CONTAINER_OF(link, struct memmap, tag_link);
+	return hash_tag(mm->this.tag);
+}
+
+static uint32_t rehash_tag0(struct spa_list *link)
+{
+	struct memmap *mm = SPA_CONTAINER_OF(link, struct memmap, tag0_link);
+	return hash_int(mm->this.tag[0]);
+}
+
+/* ranges are sorted on descending address, mmap hands out addresses
+ * from the top down so that new ranges are usually added at the end */
+static struct range *range_find(struct mempool *impl, const void *ptr)
+{
+	struct range *r = impl->ranges.data;
+	uint32_t lo = 0, hi = pw_array_get_len(&impl->ranges, struct range), mid;
+
+	/* find the first range that starts at or below ptr */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (r[mid].start > ptr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < pw_array_get_len(&impl->ranges, struct range) && ptr < r[lo].end)
+		return &r[lo];
+	return NULL;
+}
+
+static int range_add(struct mempool *impl, void *ptr, uint32_t size,
+		struct mapping *mapping, struct slab *slab)
+{
+	struct range *r;
+	uint32_t lo = 0, hi = pw_array_get_len(&impl->ranges, struct range), mid;
+
+	r = impl->ranges.data;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (r[mid].start > ptr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (pw_array_add(&impl->ranges, sizeof(struct range)) == NULL)
+		return -errno;
+
+	r = pw_array_get_unchecked(&impl->ranges, lo, struct range);
+	memmove(r + 1, r, SPA_PTRDIFF(pw_array_end(&impl->ranges), r + 1));
+	r->start = ptr;
+	r->end = SPA_MEMBER(ptr, size, void);
+	r->mapping = mapping;
+	r->slab = slab;
+	return 0;
+}
+
+static void range_remove(struct mempool *impl, void *ptr)
+{
+	struct range *r = range_find(impl, ptr);
+	if (r != NULL && r->start == ptr)
+		pw_array_remove(&impl->ranges, r);
+}
+
+static uint32_t get_hugepage_size(void)
+{
+	FILE *f;
+	char line[128];
+	unsigned long kb = 0;
+
+	if ((f = fopen("/proc/meminfo", "re")) != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+				break;
+		}
+		fclose(f);
+	}
+	return kb > 0 ? kb * 1024 : DEFAULT_HUGEPAGE_SIZE;
+}
+
 struct pw_mempool *pw_mempool_new(struct pw_properties *props)
 {
 	struct mempool *impl;
 	struct pw_mempool *this;
+	const char *str;
 
 	impl = calloc(1, sizeof(struct mempool));
 	if (impl == NULL)
 		return NULL;
 
+	if (hash_init(&impl->fds) < 0 ||
+	    hash_init(&impl->tags) < 0 ||
+	    hash_init(&impl->tags0) < 0)
+		goto error_free;
+
 	this = &impl->this;
 	this->props = props;
 
 	impl->pagesize = sysconf(_SC_PAGESIZE);
 
+	if (props && (str = pw_properties_get(props, "mem.slab-size")) != NULL &&
+	    atoi(str) > 0)
+		impl->slab_size = SPA_ROUND_UP_N((uint32_t)atoi(str), impl->pagesize);
+	if (props && (str = pw_properties_get(props, "mem.hugepages")) != NULL &&
+	    pw_properties_parse_bool(str))
+		impl->hugepage_size = get_hugepage_size();
+	impl->prefault = true;
+	if (props && (str = pw_properties_get(props, "mem.prefault")) != NULL)
+		impl->prefault = pw_properties_parse_bool(str);
+	impl->mlock = true;
+	if (props && (str = pw_properties_get(props, "mem.allow-mlock")) != NULL)
+		impl->mlock = pw_properties_parse_bool(str);
+
 	pw_log_debug(NAME" %p: new", this);
 
 	spa_hook_list_init(&impl->listener_list);
 	pw_map_init(&impl->map, 64, 64);
 	spa_list_init(&impl->blocks);
+	spa_list_init(&impl->slabs);
+	pw_array_init(&impl->ranges, 64 * sizeof(struct range));
 
 	spa_list_append(&_mempools, &impl->link);
 
 	return this;
+
+error_free:
+	free(impl->fds.buckets);
+	free(impl->tags.buckets);
+	free(impl->tags0.buckets);
+	free(impl);
+	return NULL;
 }
 
 void pw_mempool_clear(struct pw_mempool *pool)
@@ -177,12 +434,17 @@ void pw_mempool_destroy(struct pw_mempool *pool)
 	spa_list_remove(&impl->link);
 
 	pw_map_clear(&impl->map);
+	pw_array_clear(&impl->ranges);
+	free(impl->fds.buckets);
+	free(impl->tags.buckets);
+	free(impl->tags0.buckets);
 	if (pool->props)
 		pw_properties_free(pool->props);
 	free(impl);
 }
 
 
+SPA_EXPORT
 void pw_mempool_add_listener(struct pw_mempool *pool,
 			     struct spa_hook *listener,
 			     const struct pw_mempool_events *events,
@@ -253,6 +515,27 @@ int pw_memblock_map_old(struct pw_memblock *mem)
 }
 #endif
 
+static inline int prefault_flags(struct mempool *impl, enum pw_memblock_flags flags)
+{
+	return (flags & PW_MEMBLOCK_FLAG_PREFAULT) && impl->prefault ? MAP_POPULATE : 0;
+}
+
+static void lock_memory(struct mempool *impl, enum pw_memblock_flags flags,
+		void *ptr, size_t size)
+{
+	if (!(flags & PW_MEMBLOCK_FLAG_MLOCK) || !impl->mlock)
+		return;
+	if (mlock(ptr, size) < 0) {
+		/* running into RLIMIT_MEMLOCK is normal for unprivileged processes,
+		 * only warn once for the other errors */
+		bool warn = errno != ENOMEM && !impl->warned_mlock;
+		pw_log(warn ? SPA_LOG_LEVEL_WARN : SPA_LOG_LEVEL_DEBUG,
+				NAME" %p: Failed to mlock memory %p %zd: %m", impl, ptr, size);
+		if (warn)
+			impl->warned_mlock = true;
+	}
+}
+
 static struct mapping * memblock_find_mapping(struct memblock *b,
 		uint32_t flags, uint32_t offset, uint32_t size)
 {
@@ -270,6 +553,32 @@ static struct mapping * memblock_find_mapping(struct memblock *b,
 	return NULL;
 }
 
+static struct mapping * memblock_add_mapping(struct memblock *b,
+		void *ptr, uint32_t offset, uint32_t size)
+{
+	struct mempool *p = SPA_CONTAINER_OF(b->this.pool, struct mempool, this);
+	struct mapping *m;
+
+	m = calloc(1, sizeof(struct mapping));
+	if (m == NULL)
+		return NULL;
+	/* the blocks of a slab are found with the range of the slab */
+	if (b->slab == NULL) {
+		if (range_add(p, ptr, size, m, NULL) < 0) {
+			free(m);
+			return NULL;
+		}
+		m->indexed = true;
+	}
+	m->ptr = ptr;
+	m->block = b;
+	m->offset = offset;
+	m->size = size;
+	b->this.ref++;
+	spa_list_append(&b->mappings, &m->link);
+	return m;
+}
+
 static struct mapping * memblock_map(struct memblock *b,
 		enum pw_memmap_flags flags, uint32_t offset, uint32_t size)
 {
@@ -288,6 +597,8 @@ static struct mapping * memblock_map(struct memblock *b,
 	else
 		fl |= MAP_SHARED;
 
+	fl |= prefault_flags(p, b->this.flags);
+
 	if (flags & PW_MEMMAP_FLAG_TWICE) {
 		pw_log_error(NAME" %p: implement me PW_MEMMAP_FLAG_TWICE", p);
 		errno = ENOTSUP;
@@ -302,18 +613,20 @@ static struct mapping * memblock_map(struct memblock *b,
 		return NULL;
 	}
 
-	m = calloc(1, sizeof(struct mapping));
+	m = memblock_add_mapping(b, ptr, offset, size);
 	if (m == NULL) {
 		munmap(ptr, size);
 		return NULL;
 	}
-	m->ptr = ptr;
 	m->do_unmap = true;
-	m->block = b;
-	m->offset = offset;
-	m->size = size;
-	b->this.ref++;
-	spa_list_append(&b->mappings, &m->link);
+
+#ifdef MADV_HUGEPAGE
+	/* transparent huge pages for blocks that could not get huge pages */
+	if ((b->this.flags & PW_MEMBLOCK_FLAG_HUGETLB) && p->hugepage_size > 0 &&
+	    size >= p->hugepage_size)
+		madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+	lock_memory(p, b->this.flags, ptr, size);
 
         pw_log_debug(NAME" %p: block:%p fd:%d map:%p ptr:%p (%d %d) block-ref:%d", p, &b->this,
 			b->this.fd, m, m->ptr, offset, size, b->this.ref);
@@ -329,6 +642,8 @@ static void mapping_unmap(struct mapping *m)
         pw_log_debug(NAME" %p: mapping:%p block:%p fd:%d ptr:%p size:%d block-ref:%d",
 			p, m, b, b->this.fd, m->ptr, m->size, b->this.ref);
 
+	if (m->indexed)
+		range_remove(p, m->ptr);
 	if (m->do_unmap)
 		munmap(m->ptr, m->size);
 	spa_list_remove(&m->link);
@@ -346,12 +661,25 @@ struct pw_memmap * pw_memblock_map(struct pw_memblock *block,
 	struct mapping *m;
 	struct memmap *mm;
 	struct pw_map_range range;
+	uint32_t fd_offset = block->offset + offset;
+	struct stat st;
 
-	pw_map_range_init(&range, offset, size, p->pagesize);
-
-	m = memblock_find_mapping(b, flags, range.offset, range.size);
-	if (m == NULL)
+	m = memblock_find_mapping(b, flags, fd_offset, size);
+	if (m == NULL && b->slab != NULL) {
+		/* all blocks of a slab use the mapping of the slab */
+		m = memblock_add_mapping(b, b->slab->ptr, 0, b->slab->size);
+	}
+	else if (m == NULL &&
+	    (block->flags & (PW_MEMBLOCK_FLAG_SLAB | PW_MEMBLOCK_FLAG_HUGETLB)) &&
+	    fstat(block->fd, &st) == 0 && st.st_size >= (off_t)fd_offset + size) {
+		/* the fd is shared with other blocks or can only be mapped
+		 * in huge pages, map all of it once */
+		m = memblock_map(b, flags, 0, st.st_size);
+	}
+	else if (m == NULL) {
+		pw_map_range_init(&range, fd_offset, size, p->pagesize);
 		m = memblock_map(b, flags, range.offset, range.size);
+	}
 	if (m == NULL)
 		return NULL;
 
@@ -368,10 +696,13 @@ struct pw_memmap * pw_memblock_map(struct pw_memblock *block,
 	mm->this.flags = flags;
 	mm->this.offset = offset;
 	mm->this.size = size;
-	mm->this.ptr = SPA_MEMBER(m->ptr, range.start, void);
+	mm->this.ptr = SPA_MEMBER(m->ptr, fd_offset - m->offset, void);
 	if (tag)
 		memcpy(mm->this.tag, tag, sizeof(mm->this.tag));
 
+	hash_insert(&p->tags, &mm->tag_link, hash_tag(mm->this.tag), rehash_tag);
+	hash_insert(&p->tags0, &mm->tag0_link, hash_int(mm->this.tag[0]), rehash_tag0);
+
 	spa_list_append(&b->maps, &mm->link);
 
         pw_log_debug(NAME" %p: map:%p block:%p fd:%d ptr:%p (%d %d) mapping:%p ref:%d", p,
@@ -407,6 +738,8 @@ int pw_memmap_free(struct pw_memmap *map)
 			&mm->this, b, b->this.fd, mm->this.ptr, m, m->ref);
 
 	spa_list_remove(&mm->link);
+	hash_remove(&p->tags, &mm->tag_link);
+	hash_remove(&p->tags0, &mm->tag0_link);
 
 	if (--m->ref == 0)
 		mapping_unmap(m);
@@ -428,8 +761,237 @@ static inline enum pw_memmap_flags block_flags_to_mem(enum pw_memblock_flags fla
 	return fl;
 }
 
-/** Create a new memblock
+static int alloc_fd(struct mempool *impl, size_t size, bool seal, bool hugetlb)
+{
+	struct pw_mempool *pool = &impl->this;
+	int fd, res;
+
+#ifdef USE_MEMFD
+	fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING |
+			(hugetlb ? MFD_HUGETLB : 0));
+	if (fd == -1) {
+		res = -errno;
+		pw_log(hugetlb ? SPA_LOG_LEVEL_DEBUG : SPA_LOG_LEVEL_ERROR,
+				NAME" %p: Failed to create memfd: %m", pool);
+		return res;
+	}
+#else
+	if (hugetlb)
+		return -ENOTSUP;
+	char filename[] = "/dev/shm/pipewire-tmpfile.XXXXXX";
+	fd = mkostemp(filename, O_CLOEXEC);
+	if (fd == -1) {
+		res = -errno;
+		pw_log_error(NAME" %p: Failed to create temporary file: %m", pool);
+		return res;
+	}
+	unlink(filename);
+#endif
+
+	if (ftruncate(fd, size) < 0) {
+		res = -errno;
+		pw_log_warn(NAME" %p: Failed to truncate temporary file: %m", pool);
+		close(fd);
+		return res;
+	}
+#ifdef USE_MEMFD
+	if (seal) {
+		unsigned int seals = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
+		if (fcntl(fd, F_ADD_SEALS, seals) == -1) {
+			pw_log_warn(NAME" %p: Failed to add seals: %m", pool);
+		}
+	}
+#endif
+	return fd;
+}
+
+/* allocate an fd and map it, for huge pages this fails when not enough
+ * huge pages can be reserved */
+static void *alloc_mapped_fd(struct mempool *impl, enum pw_memblock_flags flags,
+		size_t size, int *fd)
+{
+	bool hugetlb = flags & PW_MEMBLOCK_FLAG_HUGETLB;
+	void *ptr;
+	int res;
+
+	if ((res = alloc_fd(impl, size, flags & PW_MEMBLOCK_FLAG_SEAL, hugetlb)) < 0) {
+		errno = -res;
+		return NULL;
+	}
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | prefault_flags(impl, flags), res, 0);
+	if (ptr == MAP_FAILED) {
+		pw_log(hugetlb ? SPA_LOG_LEVEL_DEBUG : SPA_LOG_LEVEL_ERROR,
+				NAME" %p: Failed to mmap fd:%d size:%zd: %m", impl, res, size);
+		close(res);
+		return NULL;
+	}
+	lock_memory(impl, flags, ptr, size);
+	*fd = res;
+	return ptr;
+}
+
+/* allocate a mapped block from huge pages, the block uses all of the
+ * rounded up size of the fd */
+static int hugetlb_alloc(struct mempool *impl, struct memblock *b, size_t size)
+{
+	struct mapping *m;
+	void *ptr;
+	int res;
+
+	size = SPA_ROUND_UP_N(size, impl->hugepage_size);
+	if ((ptr = alloc_mapped_fd(impl, b->this.flags, size, &b->this.fd)) == NULL)
+		return -errno;
+
+	if ((m = memblock_add_mapping(b, ptr, 0, size)) == NULL) {
+		res = -errno;
+		munmap(ptr, size);
+		close(b->this.fd);
+		return res;
+	}
+	m->do_unmap = true;
+
+	pw_log_debug(NAME" %p: block:%p fd:%d hugetlb size:%zd", impl, b, b->this.fd, size);
+	return 0;
+}
+
+static struct slab *slab_new(struct mempool *impl, uint64_t owner)
+{
+	struct slab *s;
+	int res;
+
+	s = calloc(1, sizeof(struct slab));
+	if (s == NULL)
+		return NULL;
+
+	/* the blocks in a slab are activations, io areas and buffers that
+	 * are used in the processing threads */
+	s->owner = owner;
+	s->size = impl->slab_size;
+	s->ptr = NULL;
+	if (impl->hugepage_size > 0 && s->size % impl->hugepage_size == 0)
+		s->ptr = alloc_mapped_fd(impl, SLAB_FLAGS | PW_MEMBLOCK_FLAG_HUGETLB,
+				s->size, &s->fd);
+	if (s->ptr == NULL &&
+	    (s->ptr = alloc_mapped_fd(impl, SLAB_FLAGS, s->size, &s->fd)) == NULL) {
+		res = -errno;
+		goto error_free;
+	}
+	if ((res = range_add(impl, s->ptr, s->size, NULL, s)) < 0) {
+		munmap(s->ptr, s->size);
+		close(s->fd);
+		goto error_free;
+	}
+	pw_array_init(&s->blocks, 64 * sizeof(struct memblock *));
+	spa_list_append(&impl->slabs, &s->link);
+
+	pw_log_debug(NAME" %p: slab:%p owner:%"PRIx64" fd:%d ptr:%p size:%u", impl, s,
+			owner, s->fd, s->ptr, s->size);
+
+	return s;
+
+error_free:
+	free(s);
+	errno = -res;
+	return NULL;
+}
+
+static void slab_free(struct mempool *impl, struct slab *s)
+{
+	pw_log_debug(NAME" %p: slab:%p fd:%d", impl, s, s->fd);
+	spa_list_remove(&s->link);
+	range_remove(impl, s->ptr);
+	pw_array_clear(&s->blocks);
+	munmap(s->ptr, s->size);
+	close(s->fd);
+	free(s);
+}
+
+/* find the first gap in a slab that can hold size bytes and add the
+ * block to the slab there */
+static bool slab_insert(struct slab *s, struct memblock *b, uint32_t size)
+{
+	struct memblock **sb;
+	uint32_t i, n_blocks, offset = 0;
+
+	if (s->size - s->used < size)
+		return false;
+
+	sb = s->blocks.data;
+	n_blocks = pw_array_get_len(&s->blocks, struct memblock *);
+	for (i = 0; i < n_blocks; i++) {
+		if (sb[i]->this.offset - offset >= size)
+			break;
+		offset = SPA_ROUND_UP_N(sb[i]->this.offset + sb[i]->this.size, SLAB_ALIGN);
+	}
+	if (offset > s->size || s->size - offset < size)
+		return false;
+
+	if (pw_array_add(&s->blocks, sizeof(struct memblock *)) == NULL)
+		return false;
+
+	sb = s->blocks.data;
+	memmove(&sb[i + 1], &sb[i], (n_blocks - i) * sizeof(struct memblock *));
+	sb[i] = b;
+	s->used += size;
+
+	b->slab = s;
+	b->this.offset = offset;
+	b->this.fd = s->fd;
+	return true;
+}
+
+/* find the block of a slab that contains offset */
+static struct memblock **slab_find(struct slab *s, uint32_t offset)
+{
+	struct memblock **sb = s->blocks.data;
+	uint32_t lo = 0, hi = pw_array_get_len(&s->blocks, struct memblock *), mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (offset < sb[mid]->this.offset)
+			hi = mid;
+		else if (offset >= sb[mid]->this.offset + sb[mid]->this.size)
+			lo = mid + 1;
+		else
+			return &sb[mid];
+	}
+	return NULL;
+}
+
+static int slab_alloc(struct mempool *impl, uint64_t owner, struct memblock *b, size_t size)
+{
+	struct slab *s;
+
+	spa_list_for_each(s, &impl->slabs, link) {
+		if (s->owner == owner && slab_insert(s, b, size))
+			return 0;
+	}
+	if ((s = slab_new(impl, owner)) == NULL)
+		return -errno;
+	if (!slab_insert(s, b, size)) {
+		slab_free(impl, s);
+		return -ENOSPC;
+	}
+	return 0;
+}
+
+static void slab_release(struct mempool *impl, struct memblock *b)
+{
+	struct slab *s = b->slab;
+	struct memblock **sb;
+
+	if ((sb = slab_find(s, b->this.offset)) != NULL)
+		pw_array_remove(&s->blocks, sb);
+	s->used -= b->this.size;
+	b->slab = NULL;
+	if (pw_array_get_len(&s->blocks, struct memblock *) == 0)
+		slab_free(impl, s);
+}
+
+/** Create a new memblock for an owner
  * \param pool the pool to use
+ * \param owner the owner of the block, see \ref pw_memblock_owner
  * \param flags memblock flags
  * \param type the requested memory type one of enum spa_data_type
  * \param size size to allocate
@@ -437,8 +999,8 @@ static inline enum pw_memmap_flags block_flags_to_mem(enum pw_memblock_flags fla
  * \memberof pw_memblock
  */
 SPA_EXPORT
-struct pw_memblock * pw_mempool_alloc(struct pw_mempool *pool, enum pw_memblock_flags flags,
-		uint32_t type, size_t size)
+struct pw_memblock * pw_mempool_alloc_owned(struct pw_mempool *pool, uint64_t owner,
+		enum pw_memblock_flags flags, uint32_t type, size_t size)
 {
 	struct mempool *impl = SPA_CONTAINER_OF(pool, struct mempool, this);
 	struct memblock *b;
@@ -456,38 +1018,29 @@ struct pw_memblock * pw_mempool_alloc(struct pw_mempool *pool, enum pw_memblock_
 	spa_list_init(&b->mappings);
 	spa_list_init(&b->maps);
 
-#ifdef USE_MEMFD
-	b->this.fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
-	if (b->this.fd == -1) {
-		res = -errno;
-		pw_log_error(NAME" %p: Failed to create memfd: %m", pool);
-		goto error_free;
-	}
-#else
-	char filename[] = "/dev/shm/pipewire-tmpfile.XXXXXX";
-	b->this.fd = mkostemp(filename, O_CLOEXEC);
-	if (b->this.fd == -1) {
-		res = -errno;
-		pw_log_error(NAME" %p: Failed to create temporary file: %m", pool);
-		goto error_free;
+	/* small blocks are carved out of a slab when the pool has them */
+	if ((flags & PW_MEMBLOCK_FLAG_SLAB) &&
+	    type == SPA_DATA_MemFd &&
+	    size > 0 && size <= impl->slab_size / 4 &&
+	    slab_alloc(impl, owner, b, size) == 0) {
+		b->this.flags &= ~PW_MEMBLOCK_FLAG_DONT_CLOSE;
+	} else if ((flags & PW_MEMBLOCK_FLAG_HUGETLB) &&
+	    (flags & PW_MEMBLOCK_FLAG_MAP) &&
+	    type == SPA_DATA_MemFd &&
+	    impl->hugepage_size > 0 && size >= impl->hugepage_size &&
+	    hugetlb_alloc(impl, b, size) == 0) {
+		b->this.flags &= ~PW_MEMBLOCK_FLAG_SLAB;
+	} else {
+		/* blocks that could not get huge pages keep the flag so that
+		 * they are mapped with transparent huge pages */
+		b->this.flags &= ~PW_MEMBLOCK_FLAG_SLAB;
+		if ((res = alloc_fd(impl, size, flags & PW_MEMBLOCK_FLAG_SEAL, false)) < 0)
+			goto error_free;
+		b->this.fd = res;
 	}
-	unlink(filename);
-#endif
 
-	if (ftruncate(b->this.fd, size) < 0) {
-		res = -errno;
-		pw_log_warn(NAME" %p: Failed to truncate temporary file: %m", pool);
-		goto error_close;
-	}
-#ifdef USE_MEMFD
-	if (flags & PW_MEMBLOCK_FLAG_SEAL) {
-		unsigned int seals = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
-		if (fcntl(b->this.fd, F_ADD_SEALS, seals) == -1) {
-			pw_log_warn(NAME" %p: Failed to add seals: %m", pool);
-		}
-	}
-#endif
 	if (flags & PW_MEMBLOCK_FLAG_MAP && size > 0) {
+		/* huge page blocks are already mapped and find their mapping */
 		b->this.map = pw_memblock_map(&b->this,
 				block_flags_to_mem(flags), 0, size, NULL);
 		if (b->this.map == NULL) {
@@ -500,33 +1053,63 @@ struct pw_memblock * pw_mempool_alloc(struct pw_mempool *pool, enum pw_memblock_
 
 	b->this.id = pw_map_insert_new(&impl->map, b);
 	spa_list_append(&impl->blocks, &b->link);
-	pw_log_debug(NAME" %p: block:%p id:%d type:%u", pool, &b->this, b->this.id, type);
+	if (b->slab == NULL)
+		hash_insert(&impl->fds, &b->fd_link, hash_int(b->this.fd), rehash_fd);
+	pw_log_debug(NAME" %p: block:%p id:%d type:%u fd:%d offset:%u owner:%"PRIx64,
+			pool, &b->this, b->this.id, type, b->this.fd, b->this.offset, owner);
 
 	pw_mempool_emit_added(impl, &b->this);
 
 	return &b->this;
 
 error_close:
-	close(b->this.fd);
+	if (b->slab)
+		slab_release(impl, b);
+	else
+		close(b->this.fd);
 error_free:
 	free(b);
 	errno = -res;
 	return NULL;
 }
 
+/** Create a new memblock
+ * \param pool the pool to use
+ * \param flags memblock flags
+ * \param type the requested memory type one of enum spa_data_type
+ * \param size size to allocate
+ * \return a memblock structure or NULL with errno on error
+ * \memberof pw_memblock
+ */
+SPA_EXPORT
+struct pw_memblock * pw_mempool_alloc(struct pw_mempool *pool, enum pw_memblock_flags flags,
+		uint32_t type, size_t size)
+{
+	return pw_mempool_alloc_owned(pool, 0, flags, type, size);
+}
+
 static struct memblock * mempool_find_fd(struct pw_mempool *pool, int fd)
 {
 	struct mempool *impl = SPA_CONTAINER_OF(pool, struct mempool, this);
-	struct memblock *b;
+	struct memblock *b = NULL;
+	struct slab *s;
 
-	spa_list_for_each(b, &impl->blocks, link) {
-		if (fd == b->this.fd) {
-			pw_log_debug(NAME" %p: found %p id:%d fd:%d ref:%d",
-					pool, &b->this, b->this.id, fd, b->this.ref);
-			return b;
+	spa_list_for_each(b, hash_bucket(&impl->fds, hash_int(fd)), fd_link) {
+		if (fd == b->this.fd)
+			goto found;
+	}
+	/* the blocks of a slab share the fd of the slab */
+	spa_list_for_each(s, &impl->slabs, link) {
+		if (fd == s->fd) {
+			b = *(struct memblock **) pw_array_first(&s->blocks);
+			goto found;
 		}
 	}
 	return NULL;
+found:
+	pw_log_debug(NAME" %p: found %p id:%d fd:%d ref:%d",
+			pool, &b->this, b->this.id, fd, b->this.ref);
+	return b;
 }
 
 SPA_EXPORT
@@ -556,6 +1139,7 @@ struct pw_memblock * pw_mempool_import(struct pw_mempool *pool,
 	b->this.flags = flags;
 	b->this.id = pw_map_insert_new(&impl->map, b);
 	spa_list_append(&impl->blocks, &b->link);
+	hash_insert(&impl->fds, &b->fd_link, hash_int(fd), rehash_fd);
 
 	pw_log_debug(NAME" %p: block:%p id:%u flags:%08x type:%u fd:%d",
 			pool, b, b->this.id, flags, type, fd);
@@ -581,7 +1165,8 @@ struct pw_memmap * pw_mempool_import_map(struct pw_mempool *pool,
 	struct pw_memblock *old, *block;
 	struct memblock *b;
 	struct pw_memmap *map;
-	struct mapping *m;
+	struct memmap *mm;
+	struct mapping *m, *om;
 	uint32_t offset;
 
 	old = pw_mempool_find_ptr(other, data);
@@ -594,24 +1179,21 @@ struct pw_memmap * pw_mempool_import_map(struct pw_mempool *pool,
 	if (block == NULL)
 		return NULL;
 
-	if (block->ref == 1) {
-		b = SPA_CONTAINER_OF(block, struct memblock, this);
+	/* the imported block is the whole fd, blocks of a slab share it */
+	offset = old->offset + old->map->offset + SPA_PTRDIFF(data, old->map->ptr);
+
+	b = SPA_CONTAINER_OF(block, struct memblock, this);
+	mm = SPA_CONTAINER_OF(old->map, struct memmap, this);
+	om = mm->mapping;
 
-		m = calloc(1, sizeof(struct mapping));
+	if (memblock_find_mapping(b, 0, offset, size) == NULL) {
+		m = memblock_add_mapping(b, om->ptr, om->offset, om->size);
 		if (m == NULL) {
 			pw_memblock_unref(block);
 			return NULL;
 		}
-		m->ptr = old->map->ptr;
-		m->block = b;
-		m->offset = old->map->offset;
-		m->size = old->map->size;
-		spa_list_append(&b->mappings, &m->link);
-	} else {
-		block->ref--;
 	}
-
-	offset = SPA_PTRDIFF(data, old->map->ptr);
+	block->ref--;
 
 	map = pw_memblock_map(block,
 			block_flags_to_mem(block->flags), offset, size, tag);
@@ -653,6 +1235,7 @@ void pw_memblock_free(struct pw_memblock *block)
 	struct pw_mempool *pool = block->pool;
 	struct mempool *impl = SPA_CONTAINER_OF(pool, struct mempool, this);
 	struct memmap *mm;
+	struct mapping *m;
 
 	spa_return_if_fail(block != NULL);
 
@@ -672,9 +1255,24 @@ void pw_memblock_free(struct pw_memblock *block)
 	spa_list_consume(mm, &b->maps, link)
 		pw_memmap_free(&mm->this);
 
-	if (block->fd != -1 && !(block->flags & PW_MEMBLOCK_FLAG_DONT_CLOSE)) {
-		pw_log_debug(NAME" %p: close fd:%d", pool, block->fd);
-		close(block->fd);
+	/* mappings that were never used by a map */
+	spa_list_consume(m, &b->mappings, link) {
+		if (m->indexed)
+			range_remove(impl, m->ptr);
+		if (m->do_unmap)
+			munmap(m->ptr, m->size);
+		spa_list_remove(&m->link);
+		free(m);
+	}
+
+	if (b->slab != NULL) {
+		slab_release(impl, b);
+	} else {
+		hash_remove(&impl->fds, &b->fd_link);
+		if (block->fd != -1 && !(block->flags & PW_MEMBLOCK_FLAG_DONT_CLOSE)) {
+			pw_log_debug(NAME" %p: close fd:%d", pool, block->fd);
+			close(block->fd);
+		}
 	}
 	free(b);
 }
@@ -683,19 +1281,22 @@ SPA_EXPORT
 struct pw_memblock * pw_mempool_find_ptr(struct pw_mempool *pool, const void *ptr)
 {
 	struct mempool *impl = SPA_CONTAINER_OF(pool, struct mempool, this);
-	struct memblock *b;
-	struct mapping *m;
+	struct memblock *b, **sb;
+	struct range *r;
 
-	spa_list_for_each(b, &impl->blocks, link) {
-		spa_list_for_each(m, &b->mappings, link) {
-			if (ptr >= m->ptr && ptr < SPA_MEMBER(m->ptr, m->size, void)) {
-				pw_log_debug(NAME" %p: block:%p id:%d for %p", pool,
-						b, b->this.id, ptr);
-				return &b->this;
-			}
-		}
+	if ((r = range_find(impl, ptr)) == NULL)
+		return NULL;
+
+	if (r->slab != NULL) {
+		sb = slab_find(r->slab, SPA_PTRDIFF(ptr, r->slab->ptr));
+		if (sb == NULL)
+			return NULL;
+		b = *sb;
+	} else {
+		b = r->mapping->block;
 	}
-	return NULL;
+	pw_log_debug(NAME" %p: block:%p id:%d for %p", pool, b, b->this.id, ptr);
+	return &b->this;
 }
 
 SPA_EXPORT
@@ -733,13 +1334,26 @@ struct pw_memmap * pw_mempool_find_tag(struct pw_mempool *pool, uint32_t tag[5],
 
 	pw_log_debug(NAME" %p: find tag %zd", pool, size);
 
-	spa_list_for_each(b, &impl->blocks, link) {
-		spa_list_for_each(mm, &b->maps, link) {
-			if (memcmp(tag, mm->this.tag, size) == 0) {
-				pw_log_debug(NAME" %p: found %p", pool, mm);
-				return &mm->this;
+	if (size >= sizeof(mm->this.tag)) {
+		spa_list_for_each(mm, hash_bucket(&impl->tags, hash_tag(tag)), tag_link) {
+			if (memcmp(tag, mm->this.tag, sizeof(mm->this.tag)) == 0)
+				goto found;
+		}
+	} else if (size >= sizeof(uint32_t)) {
+		spa_list_for_each(mm, hash_bucket(&impl->tags0, hash_int(tag[0])), tag0_link) {
+			if (memcmp(tag, mm->this.tag, size) == 0)
+				goto found;
+		}
+	} else {
+		spa_list_for_each(b, &impl->blocks, link) {
+			spa_list_for_each(mm, &b->maps, link) {
+				if (memcmp(tag, mm->this.tag, size) == 0)
+					goto found;
 			}
 		}
 	}
 	return NULL;
+found:
+	pw_log_debug(NAME" %p: found %p", pool, mm);
+	return &mm->this;
 }
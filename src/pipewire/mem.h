@@ -39,6 +39,17 @@ enum pw_memblock_flags {
 	PW_MEMBLOCK_FLAG_SEAL = (1 << 2),
 	PW_MEMBLOCK_FLAG_MAP = (1 << 3),
 	PW_MEMBLOCK_FLAG_DONT_CLOSE = (1 << 4),
+	PW_MEMBLOCK_FLAG_SLAB = (1 << 5),	/**< the block may share its fd with other
+						  *  blocks of the same owner, at an offset in
+						  *  the fd. Imported blocks with this flag map
+						  *  the fd once. */
+	PW_MEMBLOCK_FLAG_HUGETLB = (1 << 6),	/**< allocate from huge pages when the pool
+						  *  allows it and the block is big enough.
+						  *  Imported blocks with this flag map the
+						  *  fd once. */
+	PW_MEMBLOCK_FLAG_PREFAULT = (1 << 7),	/**< populate the pages when mapping */
+	PW_MEMBLOCK_FLAG_MLOCK = (1 << 8),	/**< lock the mappings in memory, this flag is
+						  *  not passed to clients */
 
 	PW_MEMBLOCK_FLAG_READWRITE = PW_MEMBLOCK_FLAG_READABLE | PW_MEMBLOCK_FLAG_WRITABLE,
 };
@@ -70,6 +81,7 @@ struct pw_memblock {
 	int fd;				/**< fd */
 	uint32_t size;			/**< size of memory */
 	struct pw_memmap *map;		/**< optional map when PW_MEMBLOCK_FLAG_MAP was given */
+	uint32_t offset;		/**< offset of the memory in fd */
 };
 
 /** a mapped region of a pw_memblock */
@@ -96,7 +108,11 @@ struct pw_mempool_events {
 	void (*removed) (void *data, struct pw_memblock *block);
 };
 
-/** Create a new memory pool */
+/** Create a new memory pool
+ *
+ * The pool uses the properties mem.slab-size, mem.hugepages, mem.prefault
+ * and mem.allow-mlock to decide how the blocks with the SLAB, HUGETLB,
+ * PREFAULT and MLOCK flags are allocated and mapped. */
 struct pw_mempool *pw_mempool_new(struct pw_properties *props);
 
 /** Listen for events */
@@ -116,6 +132,21 @@ void pw_mempool_destroy(struct pw_mempool *pool);
 struct pw_memblock * pw_mempool_alloc(struct pw_mempool *pool,
 		enum pw_memblock_flags flags, uint32_t type, size_t size);
 
+/** Make the owner of a memory block that is given to two clients, or to
+ * one when \a a or \a b is 0. Use the serials of the clients, they are
+ * never reused. */
+static inline uint64_t pw_memblock_owner(uint32_t a, uint32_t b)
+{
+	return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+/** Allocate a memory block of an owner from the pool. Blocks with the
+ * PW_MEMBLOCK_FLAG_SLAB flag only share an fd with blocks of the same
+ * owner. Blocks allocated with \ref pw_mempool_alloc() have owner 0, use
+ * that only for blocks that are not given to clients. */
+struct pw_memblock * pw_mempool_alloc_owned(struct pw_mempool *pool, uint64_t owner,
+		enum pw_memblock_flags flags, uint32_t type, size_t size);
+
 /** Import a block from another pool */
 struct pw_memblock * pw_mempool_import_block(struct pw_mempool *pool,
 		struct pw_memblock *mem);
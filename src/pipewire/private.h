@@ -29,8 +29,15 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h> /* for pthread_t */
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include "pipewire/impl.h"
 
@@ -56,7 +63,16 @@ struct defaults {
 	struct spa_rectangle video_size;
 	struct spa_fraction video_rate;
 	uint32_t link_max_buffers;
+	uint32_t link_buffer_cache;
+	unsigned int link_mlock;
+	unsigned int link_hugepages;
 	unsigned int mem_allow_mlock;
+	uint32_t mem_slab_size;
+	unsigned int mem_hugepages;
+	unsigned int mem_prefault;
+	uint32_t flight_recorder;
+	uint32_t watchdog_overruns;
+	uint32_t watchdog_timeout;
 };
 
 struct ratelimit {
@@ -173,6 +189,8 @@ struct pw_impl_client {
 	struct pw_client_info info;	/**< client info */
 
 	struct pw_mempool *pool;		/**< client mempool */
+	uint32_t serial;			/**< never reused, owner of the memory
+						  *  that is given to the client */
 	struct pw_resource *core_resource;	/**< core resource object */
 	struct pw_resource *client_resource;	/**< client resource object */
 
@@ -313,6 +331,10 @@ struct pw_context {
 	struct spa_list control_list[2];	/**< list of controls, indexed by direction */
 	struct spa_list export_list;		/**< list of export types */
 	struct spa_list driver_list;		/**< list of driver nodes */
+	struct spa_list dirty_list;		/**< nodes changed since the last graph recalc */
+	struct spa_list buffer_cache;		/**< shared buffer memory kept for reuse,
+						  *  most recently used first */
+	uint32_t n_buffer_cache;
 
 	struct spa_hook_list driver_listener_list;
 	struct spa_hook_list listener_list;
@@ -321,6 +343,11 @@ struct pw_context {
 	struct pw_loop *data_loop;	/**< data loop for data passing */
         struct pw_data_loop *data_loop_impl;
 	struct spa_system *data_system;	/**< data system for data passing */
+#define MAX_DATA_LOOPS	16
+	struct pw_data_loop *data_loops[MAX_DATA_LOOPS];	/**< all data loops, the first one
+								  *  is data_loop_impl */
+	uint32_t n_data_loops;
+	struct pw_worker_pool *worker_pool;	/**< optional workers to process followers */
 
 	struct spa_support support[16];	/**< support for spa plugins */
 	uint32_t n_support;		/**< number of support items */
@@ -345,10 +372,74 @@ struct pw_data_loop {
 	struct spa_source *event;
 
 	pthread_t thread;
+	char *cpus;			/**< cpus to run the thread on, or NULL */
+	int rt_prio;			/**< SCHED_FIFO priority or 0 */
 	unsigned int created:1;
 	unsigned int running:1;
 };
 
+int pw_loop_invoke_pair(struct pw_loop *other, struct pw_loop *loop,
+		spa_invoke_func_t func, uint32_t seq, const void *data, size_t size,
+		void *user_data);
+
+struct pw_worker_pool;
+struct pw_node_target;
+
+/* The worker pool is internal to libpipewire. Only pw_worker_pool_block()
+ * and pw_worker_pool_unblock() are exported, for the modules that change
+ * the targets or mixers of nodes in the data loop, like client-node. */
+struct pw_worker_pool *pw_worker_pool_new(const struct spa_dict *props);
+void pw_worker_pool_destroy(struct pw_worker_pool *pool);
+int pw_worker_pool_push(struct pw_worker_pool *pool, struct pw_node_target *target);
+bool pw_worker_pool_in_worker(struct pw_worker_pool *pool);
+void pw_worker_pool_block(struct pw_worker_pool *pool);
+void pw_worker_pool_unblock(struct pw_worker_pool *pool);
+
+#define PW_FLIGHT_MAX_NODES	32
+#define PW_FLIGHT_MAX_CYCLES	1024
+
+struct pw_flight_entry {
+	uint32_t id;
+	uint32_t status;
+	int32_t pending;
+	int32_t required;
+	uint64_t signal_time;
+	uint64_t awake_time;
+	uint64_t finish_time;
+};
+
+struct pw_flight_cycle {
+	uint64_t position;			/**< clock position */
+	uint64_t nsec;				/**< clock time */
+	uint32_t duration;			/**< quantum */
+	uint32_t xrun_count;
+#define PW_FLIGHT_CYCLE_INCOMPLETE	(1<<0)
+	uint32_t flags;
+	uint32_t n_entries;			/**< the driver followed by its followers */
+	uint32_t n_dropped;			/**< followers that did not fit in entries */
+	struct pw_flight_entry entries[PW_FLIGHT_MAX_NODES];
+};
+
+/** The last cycles of a driver, in shared memory. Written by the data
+ * thread until it is frozen, the main thread dumps it and thaws it. */
+struct pw_flight_header {
+	uint32_t n_cycles;
+	uint32_t index;				/**< total number of recorded cycles */
+	uint32_t frozen;
+#define PW_FLIGHT_REASON_NONE		0
+#define PW_FLIGHT_REASON_INCOMPLETE	1
+#define PW_FLIGHT_REASON_XRUN		2
+	uint32_t reason;
+	struct pw_flight_cycle cycles[0];
+};
+
+struct pw_flight_recorder;
+
+struct pw_flight_recorder *pw_flight_recorder_new(struct pw_impl_node *driver, uint32_t n_cycles);
+void pw_flight_recorder_destroy(struct pw_flight_recorder *rec);
+void pw_flight_recorder_record(struct pw_flight_recorder *rec, bool incomplete);
+void pw_flight_recorder_freeze(struct pw_flight_recorder *rec, uint32_t reason);
+
 #define pw_main_loop_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_main_loop_events, m, v, ##__VA_ARGS__)
 #define pw_main_loop_emit_destroy(o) pw_main_loop_emit(o, destroy, 0)
 
@@ -432,7 +523,22 @@ struct pw_node_target {
 	void *data;
 };
 
+#define PW_NODE_ACTIVATION_CACHE_LINE		64
+#define PW_NODE_ACTIVATION_STATS_OFFSET		4096
+
+/** The shared memory that the driver, the peers and the node itself use to
+ * schedule the node. The processes of all these nodes write to it in every
+ * cycle, the fields are grouped by writer, each group on its own cache
+ * lines, so that the writes of one process don't invalidate the lines that
+ * another process uses in the same cycle. The statistics are on their own
+ * page.
+ *
+ * Clients of version 3 of the client-node interface use the layout of
+ * struct pw_node_activation_legacy, module-client-node converts between
+ * them. */
 struct pw_node_activation {
+	/* written by the driver and the peers that trigger the node and by
+	 * the node when it wakes up */
 #define PW_NODE_ACTIVATION_NOT_TRIGGERED	0
 #define PW_NODE_ACTIVATION_TRIGGERED		1
 #define PW_NODE_ACTIVATION_AWAKE		2
@@ -446,42 +552,109 @@ struct pw_node_activation {
 	struct pw_node_activation_state state[2];	/* one current state and one next state,
 							 * as version flag */
 	uint64_t signal_time;
-	uint64_t awake_time;
+
+#define PW_NODE_ACTIVATION_FUTEX_WAITING	(1u<<31)
+#define PW_NODE_ACTIVATION_FUTEX_KICK		(1u<<30)
+#define PW_NODE_ACTIVATION_FUTEX_COUNT		(PW_NODE_ACTIVATION_FUTEX_KICK - 1)
+	uint32_t futex;					/* number of pending wakeups, the WAITING flag is
+							 * set when the node sleeps on the futex, the KICK
+							 * flag wakes it up without a wakeup */
+
+	/* written by the node when it runs */
+	uint64_t awake_time SPA_ALIGNED(PW_NODE_ACTIVATION_CACHE_LINE);
 	uint64_t finish_time;
 	uint64_t prev_signal_time;
 
+	/* written by the node now and then, read by the peers and the driver
+	 * in every cycle */
+#define PW_NODE_ACTIVATION_COMMAND_NONE		0
+#define PW_NODE_ACTIVATION_COMMAND_START	1
+#define PW_NODE_ACTIVATION_COMMAND_STOP		2
+	uint32_t command SPA_ALIGNED(PW_NODE_ACTIVATION_CACHE_LINE);
+							/* next command */
+	uint32_t reposition_owner;			/* owner id with new reposition info, last one
+							 * to update wins */
+	uint64_t sync_timeout;				/* sync timeout in nanoseconds
+							 * position goes to RUNNING without waiting any
+							 * longer for sync clients. */
+	uint64_t sync_left;				/* number of cycles before timeout */
+
+#define PW_NODE_ACTIVATION_WAKEUP_EVENTFD	0	/* write to the eventfd of the node */
+#define PW_NODE_ACTIVATION_WAKEUP_FUTEX		1	/* wake up the futex word */
+	uint32_t wakeup;				/* how the node wants to be woken up, set by
+							 * the node before it is activated. FUTEX is only
+							 * used when the server allows it in wakeup_futex,
+							 * by JACK clients that wait in jack_cycle_wait().
+							 * Nodes that wait in a loop, like JACK clients
+							 * with a process callback and remote-node, always
+							 * use the eventfd. */
+	uint32_t wakeup_futex;				/* set by the server when all the peers that can
+							 * wake up the node check wakeup */
+
 	/* updates */
-	struct spa_io_segment reposition;		/* reposition info, used when driver reposition_owner
+	struct spa_io_segment reposition SPA_ALIGNED(PW_NODE_ACTIVATION_CACHE_LINE);
+							/* reposition info, used when driver reposition_owner
 							 * has this node id */
 	struct spa_io_segment segment;			/* update for the extra segment info fields.
 							 * used when driver segment_owner has this node id */
 
 	/* for drivers, shared with all nodes */
-	uint32_t segment_owner[32];			/* id of owners for each segment info struct.
+	uint32_t segment_owner[32] SPA_ALIGNED(PW_NODE_ACTIVATION_CACHE_LINE);
+							/* id of owners for each segment info struct.
 							 * nodes that want to update segment info need to
 							 * CAS their node id in this array. */
-	struct spa_io_position position;		/* contains current position and segment info.
+	struct spa_io_position position SPA_ALIGNED(PW_NODE_ACTIVATION_CACHE_LINE);
+							/* contains current position and segment info.
 							 * extra info is updated by nodes that have set
 							 * themselves as owner in the segment structs */
 
-	uint64_t sync_timeout;				/* sync timeout in nanoseconds
-							 * position goes to RUNNING without waiting any
-							 * longer for sync clients. */
-	uint64_t sync_left;				/* number of cycles before timeout */
-
-
-	float cpu_load[3];				/* averaged over short, medium, long time */
+	/* statistics, written by the node */
+	float cpu_load[3] SPA_ALIGNED(PW_NODE_ACTIVATION_STATS_OFFSET);
+							/* averaged over short, medium, long time */
 	uint32_t xrun_count;				/* number of xruns */
 	uint64_t xrun_time;				/* time of last xrun in microseconds */
 	uint64_t xrun_delay;				/* delay of last xrun in microseconds */
 	uint64_t max_delay;				/* max of all xruns in microseconds */
 
-#define PW_NODE_ACTIVATION_COMMAND_NONE		0
-#define PW_NODE_ACTIVATION_COMMAND_START	1
-#define PW_NODE_ACTIVATION_COMMAND_STOP		2
-	uint32_t command;				/* next command */
-	uint32_t reposition_owner;			/* owner id with new reposition info, last one
-							 * to update wins */
+	uint32_t spin_time;				/* current time in nsec the node busy-waits
+							 * for a wakeup, 0 when not spinning */
+	uint32_t spin_hits;				/* wakeups that arrived while spinning */
+	uint32_t spin_misses;				/* spins that ended in a blocking wait */
+};
+
+/** The layout of struct pw_node_activation before the fields were grouped
+ * by writer. It is frozen, clients of version 3 of the client-node
+ * interface map it. */
+struct pw_node_activation_legacy {
+	uint32_t status;
+
+	unsigned int version:1;
+	unsigned int pending_sync:1;
+	unsigned int pending_new_pos:1;
+
+	struct pw_node_activation_state state[2];
+	uint64_t signal_time;
+	uint64_t awake_time;
+	uint64_t finish_time;
+	uint64_t prev_signal_time;
+
+	struct spa_io_segment reposition;
+	struct spa_io_segment segment;
+
+	uint32_t segment_owner[32];
+	struct spa_io_position position;
+
+	uint64_t sync_timeout;
+	uint64_t sync_left;
+
+	float cpu_load[3];
+	uint32_t xrun_count;
+	uint64_t xrun_time;
+	uint64_t xrun_delay;
+	uint64_t max_delay;
+
+	uint32_t command;
+	uint32_t reposition_owner;
 };
 
 #define ATOMIC_CAS(v,ov,nv)						\
@@ -497,6 +670,158 @@ struct pw_node_activation {
 #define ATOMIC_STORE(s,v)		__atomic_store_n(&(s), (v), __ATOMIC_SEQ_CST)
 #define ATOMIC_XCHG(s,v)		__atomic_exchange_n(&(s), (v), __ATOMIC_SEQ_CST)
 
+/** Wake up the node of \a a with the futex when it asked for it.
+ * Returns false when the eventfd of the node should be used. */
+static inline bool pw_node_activation_futex_wake(struct pw_node_activation *a)
+{
+#ifdef __linux__
+	uint32_t old;
+
+	if (SPA_LIKELY(ATOMIC_LOAD(a->wakeup) != PW_NODE_ACTIVATION_WAKEUP_FUTEX))
+		return false;
+
+	old = __atomic_fetch_add(&a->futex, 1, __ATOMIC_SEQ_CST);
+	if (old & PW_NODE_ACTIVATION_FUTEX_WAITING)
+		syscall(SYS_futex, &a->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/** Make the thread that waits on the futex of \a a return from
+ * pw_node_activation_futex_wait() without a wakeup. */
+static inline void pw_node_activation_futex_kick(struct pw_node_activation *a)
+{
+#ifdef __linux__
+	uint32_t old;
+
+	old = __atomic_fetch_or(&a->futex, PW_NODE_ACTIVATION_FUTEX_KICK, __ATOMIC_SEQ_CST);
+	if (old & PW_NODE_ACTIVATION_FUTEX_WAITING)
+		syscall(SYS_futex, &a->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+/** Wait for wakeups on the futex of \a a for at most \a timeout, or
+ * forever when NULL. Returns the number of wakeups, 0 on timeout or
+ * when kicked or a negative errno. */
+static inline int pw_node_activation_futex_wait(struct pw_node_activation *a,
+		const struct timespec *timeout)
+{
+#ifdef __linux__
+	uint32_t v;
+
+	while (true) {
+		v = ATOMIC_LOAD(a->futex);
+		if (v & PW_NODE_ACTIVATION_FUTEX_COUNT) {
+			v = __atomic_fetch_and(&a->futex, PW_NODE_ACTIVATION_FUTEX_KICK,
+					__ATOMIC_SEQ_CST);
+			return v & PW_NODE_ACTIVATION_FUTEX_COUNT;
+		}
+		if (v & PW_NODE_ACTIVATION_FUTEX_KICK) {
+			__atomic_fetch_and(&a->futex, PW_NODE_ACTIVATION_FUTEX_COUNT,
+					__ATOMIC_SEQ_CST);
+			return 0;
+		}
+		if (v == 0 && !ATOMIC_CAS(a->futex, 0, PW_NODE_ACTIVATION_FUTEX_WAITING))
+			continue;
+
+		if (syscall(SYS_futex, &a->futex, FUTEX_WAIT,
+				PW_NODE_ACTIVATION_FUTEX_WAITING, timeout, NULL, 0) < 0) {
+			if (errno == ETIMEDOUT) {
+				/* no wakeup came in, stop asking for futex wakes */
+				if (ATOMIC_CAS(a->futex, PW_NODE_ACTIVATION_FUTEX_WAITING, 0))
+					return 0;
+			} else if (errno != EAGAIN && errno != EINTR)
+				return -errno;
+		}
+	}
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/** Adaptive spin-then-block wait of a node thread. The thread busy-waits
+ * for the status of its activation to become TRIGGERED for at most
+ * spin_time before it blocks. The spin_time is calibrated from the time
+ * between the start of the wait and the signal and from the wakeup
+ * latency of blocking waits. When that doesn't fit in \a max, spinning
+ * is disabled until it does again. */
+struct pw_node_spin {
+	uint64_t max;		/**< max spin time, 0 disables */
+	uint64_t start;		/**< start of the current wait */
+	uint64_t gap;		/**< average time from start of wait to signal */
+	uint64_t latency;	/**< average signal to awake time when blocking */
+	uint64_t last_signal;	/**< signal_time of the last wakeup */
+	bool hit;		/**< the last wakeup arrived while spinning */
+};
+
+static inline uint64_t pw_node_spin_get_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static inline void pw_node_spin_init(struct pw_node_spin *s,
+		struct pw_node_activation *a, uint64_t max)
+{
+	spa_zero(*s);
+	s->max = max;
+	a->spin_time = SPA_MIN(max, (uint64_t)UINT32_MAX);
+}
+
+/** Busy-wait for a wakeup, returns true when the activation was
+ * triggered before the spin time ran out */
+static inline bool pw_node_spin_wait(struct pw_node_spin *s, struct pw_node_activation *a)
+{
+	uint64_t end;
+
+	s->start = pw_node_spin_get_nsec();
+	s->hit = false;
+
+	if (a->spin_time == 0 || ATOMIC_LOAD(a->status) == PW_NODE_ACTIVATION_TRIGGERED)
+		return false;
+
+	end = s->start + a->spin_time;
+	do {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		__asm__ __volatile__("yield");
+#endif
+		if (ATOMIC_LOAD(a->status) == PW_NODE_ACTIVATION_TRIGGERED) {
+			a->spin_hits++;
+			s->hit = true;
+			return true;
+		}
+	} while (pw_node_spin_get_nsec() < end);
+
+	a->spin_misses++;
+	return false;
+}
+
+#define PW_NODE_SPIN_AVG(avg,val)	((avg) == 0 ? (val) : (avg) + ((int64_t)(val) - (int64_t)(avg)) / 8)
+
+/** Update the spin time after a wakeup at \a awake_time */
+static inline void pw_node_spin_update(struct pw_node_spin *s, struct pw_node_activation *a,
+		uint64_t awake_time)
+{
+	uint64_t signal_time = a->signal_time, spin;
+
+	if (s->max == 0 || signal_time == s->last_signal ||
+	    signal_time < s->start || awake_time < signal_time)
+		return;
+	s->last_signal = signal_time;
+
+	s->gap = PW_NODE_SPIN_AVG(s->gap, signal_time - s->start);
+	if (!s->hit)
+		s->latency = PW_NODE_SPIN_AVG(s->latency, awake_time - signal_time);
+
+	spin = s->gap + s->latency;
+	a->spin_time = spin <= s->max ? spin : 0;
+}
+
 #define SEQ_WRITE(s)			ATOMIC_INC(s)
 #define SEQ_WRITE_SUCCESS(s1,s2)	((s1) + 1 == (s2) && ((s2) & 1) == 0)
 
@@ -521,6 +846,58 @@ struct pw_node_activation {
 #define pw_impl_node_emit_driver_changed(n,o,d)		pw_impl_node_emit(n, driver_changed, 0, o, d)
 #define pw_impl_node_emit_peer_added(n,p)		pw_impl_node_emit(n, peer_added, 0, p)
 #define pw_impl_node_emit_peer_removed(n,p)		pw_impl_node_emit(n, peer_removed, 0, p)
+#define pw_impl_node_emit_data_loop_changed(n,o,l)	pw_impl_node_emit(n, data_loop_changed, 1, o, l)
+
+#define PW_NODE_ADAPT_NONE	0
+#define PW_NODE_ADAPT_LOAD	1	/**< grown because of high load */
+#define PW_NODE_ADAPT_XRUN	2	/**< grown because of an xrun */
+#define PW_NODE_ADAPT_IDLE	3	/**< shrunk because of low load */
+
+/** Adaptive quantum state of a driver. The data thread measures and
+ * requests a new quantum, the main thread applies it in the graph.
+ * pending hands the request over: the data thread only writes the other
+ * fields before it stores a request, the main thread only writes settle
+ * before it clears it. */
+struct pw_node_adapt {
+	bool enabled;
+	float load_low;			/**< shrink when the load stays below */
+	float load_high;		/**< grow when the load goes above */
+	uint64_t hold;			/**< time in nsec the load must stay low */
+
+	struct spa_source *event;	/**< wakes up the main thread */
+	uint32_t base;			/**< quantum of the graph without adaptation */
+	uint32_t quantum;		/**< adapted quantum or 0 */
+
+	/* data thread */
+	uint32_t pending;		/**< requested quantum, 0 when none */
+	uint32_t reason;		/**< reason of the last request */
+	uint32_t settle;		/**< cycles to wait after a change */
+	uint32_t xrun_count;		/**< last seen xrun count */
+	uint64_t low_since;		/**< start of low load or 0 */
+	uint64_t change_time;		/**< signal time of the last request */
+	uint32_t changes;		/**< number of requests */
+};
+
+/** Watchdog of a follower. The data thread counts the cycles the node
+ * did not finish in time, the main thread isolates the node from the
+ * graph and restores it when the timer expires and the node finished
+ * its last cycle. A restored node is isolated again by a single
+ * overrun until its probation ends. */
+struct pw_node_watchdog {
+	bool enabled;
+
+	struct spa_source *event;	/**< wakes up the main thread */
+	struct spa_source *timer;	/**< restores the node */
+	uint32_t isolations;		/**< number of isolations since the last forget */
+	uint64_t restore_time;		/**< time of the last restore */
+	uint64_t probation_end;		/**< read by the data thread */
+
+	/* data thread */
+	bool pending;			/**< isolation requested, atomic, cleared
+					  *  by the main thread */
+	uint32_t overruns;		/**< overruns in the current window */
+	uint64_t window_start;		/**< start of the current window */
+};
 
 struct pw_impl_node {
 	struct pw_context *context;		/**< context object */
@@ -548,8 +925,21 @@ struct pw_impl_node {
 					  *  is selected to drive the graph */
 	unsigned int visited:1;		/**< for sorting */
 	unsigned int want_driver:1;	/**< this node wants to be assigned to a driver */
+	unsigned int dirty:1;		/**< node is in the context dirty_list */
+	unsigned int affected:1;	/**< node is part of the current recalc */
+	unsigned int async:1;		/**< the driver and the peers don't wait for
+					  *  this node, they use its output of the
+					  *  previous cycle */
+	unsigned int isolated:1;	/**< removed from the graph by the watchdog */
+	unsigned int thread_safe:1;	/**< can be processed by the workers */
+	unsigned int freewheel:1;	/**< a freewheel driver or a node that
+					  *  wants to be driven by one */
+	unsigned int movable:1;		/**< the node follows its driver to the data
+					  *  loop of the driver */
 
 	uint32_t port_user_data_size;	/**< extra size for port user data */
+	uint32_t client_serial;		/**< serial of the client of the node, 0 when
+					  *  the node is not made by a client */
 
 	struct spa_list driver_link;
 	struct pw_impl_node *driver_node;
@@ -557,6 +947,8 @@ struct pw_impl_node {
 	struct spa_list follower_link;
 
 	struct spa_list sort_link;	/**< link used to sort nodes */
+	struct spa_list dirty_link;	/**< link in context dirty_list */
+	struct spa_list recalc_link;	/**< link in the list of nodes to recalc */
 
 	struct spa_node *node;		/**< SPA node implementation */
 	struct spa_hook listener;
@@ -568,9 +960,14 @@ struct pw_impl_node {
 
 	struct spa_hook_list listener_list;
 
-	struct pw_loop *data_loop;		/**< the data loop for this node */
+	struct pw_loop *data_loop;		/**< the data loop of the implementation, peers
+						  *  in other loops wake up the node with its
+						  *  eventfd */
 
 	uint32_t quantum_size;			/**< desired quantum */
+	struct pw_node_adapt adapt;		/**< adaptive quantum when driving */
+	struct pw_flight_recorder *flight_recorder;	/**< last cycles when driving */
+	struct pw_node_watchdog watchdog;	/**< isolates the node when it is too slow */
 	struct spa_source source;		/**< source to remotely trigger this node */
 	struct pw_memblock *activation;
 	struct {
@@ -605,6 +1002,9 @@ struct pw_impl_port_mix {
 	struct spa_io_buffers *io;
 	uint32_t id;
 	unsigned int have_buffers:1;
+	unsigned int async:1;		/**< the io is written by an async node */
+	uint32_t hold_id;		/**< the buffer of the async node that is still
+					  *  in use, handed back with the next one */
 };
 
 struct pw_impl_port_implementation {
@@ -753,6 +1153,9 @@ struct pw_impl_link {
 	unsigned int feedback:1;
 	unsigned int preparing:1;
 	unsigned int prepared:1;
+	unsigned int peered:1;		/**< the output node can signal the input node */
+	unsigned int detached:1;	/**< not scheduled, it links a freewheeling
+					  *  node and a device */
 };
 
 #define pw_resource_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_resource_events, m, v, ##__VA_ARGS__)
@@ -995,6 +1398,33 @@ void pw_proxy_remove(struct pw_proxy *proxy);
 
 int pw_context_recalc_graph(struct pw_context *context, const char *reason);
 
+/** Mark \a node as changed, the next pw_context_recalc_graph() will
+ * recalculate the part of the graph that \a node is connected to */
+void pw_context_mark_node_dirty(struct pw_context *context, struct pw_impl_node *node);
+
+/** Get the data loop selected with PW_KEY_NODE_DATA_LOOP in \a props, or
+ * the first data loop. Remote nodes without a selected loop are movable
+ * and later follow their driver, see pw_impl_node_set_driver() */
+struct pw_loop *pw_context_find_data_loop(struct pw_context *context, const struct spa_dict *props);
+
+/** Fill \a support with the context support, using the data loop selected
+ * in \a props */
+uint32_t pw_context_get_data_loop_support(struct pw_context *context, const struct spa_dict *props,
+		struct spa_support *support, uint32_t max_support);
+
+/** Call \a func in the first data loop while all other data loops wait,
+ * to change state that is shared by the data loops */
+int pw_context_invoke_data_loops(struct pw_context *context,
+		spa_invoke_func_t func, uint32_t seq, const void *data, size_t size,
+		void *user_data);
+
+/** Clear \a buffers and keep their shared memory in the buffer cache of
+ * \a context, the next negotiation of buffers with the same layout uses it */
+void pw_buffers_recycle(struct pw_context *context, struct pw_buffers *buffers);
+
+/** Free the buffer cache of \a context */
+void pw_buffers_clear_cache(struct pw_context *context);
+
 void pw_impl_port_update_info(struct pw_impl_port *port, const struct spa_port_info *info);
 
 int pw_impl_port_register(struct pw_impl_port *port,
@@ -1075,6 +1505,12 @@ int pw_impl_link_activate(struct pw_impl_link *link);
 /** Deactivate a link \memberof pw_impl_link */
 int pw_impl_link_deactivate(struct pw_impl_link *link);
 
+/** Give or revoke the peer activation of the nodes of a link \memberof pw_impl_link */
+void pw_impl_link_update_peers(struct pw_impl_link *link);
+
+/** Stop or restart the scheduling of a link \memberof pw_impl_link */
+void pw_impl_link_set_detached(struct pw_impl_link *link, bool detached);
+
 struct pw_control *
 pw_control_new(struct pw_context *context,
 	       struct pw_impl_port *owner,		/**< can be NULL */
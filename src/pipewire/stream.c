@@ -739,7 +739,7 @@ static int impl_node_process_input(void *object)
 	pw_log_trace(NAME" %p: process in status:%d id:%d ticks:%"PRIu64" delay:%"PRIi64,
 			stream, io->status, io->buffer_id, impl->time.ticks, impl->time.delay);
 
-	if (io->status != SPA_STATUS_HAVE_DATA)
+	if (__atomic_load_n(&io->status, __ATOMIC_ACQUIRE) != SPA_STATUS_HAVE_DATA)
 		goto done;
 
 	if ((b = get_buffer(stream, io->buffer_id)) == NULL)
@@ -758,7 +758,7 @@ done:
 	}
 
 	io->buffer_id = b ? b->id : SPA_ID_INVALID;
-	io->status = SPA_STATUS_NEED_DATA;
+	__atomic_store_n(&io->status, SPA_STATUS_NEED_DATA, __ATOMIC_RELEASE);
 
 	return SPA_STATUS_HAVE_DATA;
 }
@@ -775,7 +775,8 @@ static int impl_node_process_output(void *object)
 again:
 	pw_log_trace(NAME" %p: process out status:%d id:%d", stream, io->status, io->buffer_id);
 
-	if ((res = io->status) != SPA_STATUS_HAVE_DATA) {
+	/* the peer owns the io while it has our buffer */
+	if ((res = __atomic_load_n(&io->status, __ATOMIC_ACQUIRE)) != SPA_STATUS_HAVE_DATA) {
 		/* recycle old buffer */
 		if ((b = get_buffer(stream, io->buffer_id)) != NULL) {
 			pw_log_trace(NAME" %p: recycle buffer %d", stream, b->id);
@@ -785,18 +786,19 @@ again:
 		/* pop new buffer */
 		if ((b = pop_queue(impl, &impl->queued)) != NULL) {
 			io->buffer_id = b->id;
-			res = io->status = SPA_STATUS_HAVE_DATA;
+			res = SPA_STATUS_HAVE_DATA;
 			pw_log_trace(NAME" %p: pop %d %p", stream, b->id, io);
 		} else if (impl->draining) {
 			impl->drained = true;
 			io->buffer_id = SPA_ID_INVALID;
-			res = io->status = SPA_STATUS_DRAINED;
+			res = SPA_STATUS_DRAINED;
 			pw_log_trace(NAME" %p: draining", stream);
 		} else {
 			io->buffer_id = SPA_ID_INVALID;
-			res = io->status = SPA_STATUS_NEED_DATA;
+			res = SPA_STATUS_NEED_DATA;
 			pw_log_trace(NAME" %p: no more buffers %p", stream, io);
 		}
+		__atomic_store_n(&io->status, res, __ATOMIC_RELEASE);
 	}
 
 	if (!impl->draining &&
@@ -804,7 +806,7 @@ again:
 	    spa_ringbuffer_get_read_index(&impl->dequeued.ring, &index) > 0) {
 		call_process(impl);
 		if (spa_ringbuffer_get_read_index(&impl->queued.ring, &index) > 0 &&
-		    io->status == SPA_STATUS_NEED_DATA)
+		    __atomic_load_n(&io->status, __ATOMIC_ACQUIRE) == SPA_STATUS_NEED_DATA)
 			goto again;
 	}
 	copy_position(impl, impl->queued.outcount);
@@ -0,0 +1,356 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include <spa/utils/result.h>
+
+#include "pipewire/log.h"
+#include "pipewire/properties.h"
+#include "pipewire/utils.h"
+#include "pipewire/private.h"
+
+#define NAME "worker-pool"
+
+#define MAX_WORKERS	64
+#define QUEUE_SIZE	1024u		/* must be a power of 2 */
+#define QUEUE_MASK	(QUEUE_SIZE - 1)
+
+/** \cond */
+struct cell {
+	uint32_t seq;
+	struct pw_node_target *target;
+};
+
+struct worker {
+	struct pw_worker_pool *pool;
+	pthread_t thread;
+	uint32_t index;
+	int cpu;
+};
+
+struct pw_worker_pool {
+	/* bounded MPMC queue, producers are the threads that complete a
+	 * node, consumers are the workers */
+	struct cell cells[QUEUE_SIZE];
+	uint32_t enqueue_pos SPA_ALIGNED(64);
+	uint32_t dequeue_pos SPA_ALIGNED(64);
+
+	/* queued and running jobs, and the number of threads that wait for
+	 * the workers to be idle. The blockers sleep on the busy futex until
+	 * the last job wakes them up. */
+	uint32_t busy SPA_ALIGNED(64);
+	uint32_t blocked;
+
+	sem_t sem;
+
+	int rt_prio;
+	uint32_t n_workers;
+	struct worker workers[MAX_WORKERS];
+
+	bool running;
+};
+
+static __thread struct pw_worker_pool *current_pool;
+/** \endcond */
+
+/* a job is done or was not queued, the last one wakes up the threads that
+ * wait for the workers to be idle */
+static void pool_done(struct pw_worker_pool *pool)
+{
+	if (__atomic_sub_fetch(&pool->busy, 1, __ATOMIC_SEQ_CST) == 0 &&
+	    __atomic_load_n(&pool->blocked, __ATOMIC_SEQ_CST) > 0) {
+#ifdef __linux__
+		syscall(SYS_futex, &pool->busy, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+	}
+}
+
+static struct pw_node_target *pool_dequeue(struct pw_worker_pool *pool)
+{
+	struct cell *c;
+	uint32_t pos, seq;
+	int32_t diff;
+
+	pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+	while (true) {
+		c = &pool->cells[pos & QUEUE_MASK];
+		seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)seq - (int32_t)(pos + 1);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&pool->dequeue_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_store_n(&c->seq, pos + QUEUE_SIZE, __ATOMIC_RELEASE);
+	return c->target;
+}
+
+/** Queue a target for processing by one of the workers.
+ * Returns -ENOSPC when the queue is full and -EBUSY when the pool is
+ * blocked, the caller should then signal the target itself. */
+int pw_worker_pool_push(struct pw_worker_pool *pool, struct pw_node_target *target)
+{
+	struct cell *c;
+	uint32_t pos, seq;
+	int32_t diff;
+
+	/* count the job before checking the block so that either the
+	 * blocker waits for the job or the job is not queued */
+	__atomic_add_fetch(&pool->busy, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->blocked, __ATOMIC_SEQ_CST) > 0) {
+		pool_done(pool);
+		return -EBUSY;
+	}
+
+	pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+	while (true) {
+		c = &pool->cells[pos & QUEUE_MASK];
+		seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)seq - (int32_t)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&pool->enqueue_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			pool_done(pool);
+			return -ENOSPC;
+		} else {
+			pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	c->target = target;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+
+	sem_post(&pool->sem);
+	return 0;
+}
+
+/** Check if the current thread is one of the workers of \a pool */
+bool pw_worker_pool_in_worker(struct pw_worker_pool *pool)
+{
+	return pool != NULL && current_pool == pool;
+}
+
+/** Wait until the workers are idle and keep them idle until
+ * pw_worker_pool_unblock() is called. The nodes that become ready
+ * in the meantime are processed by the thread that completes their
+ * last dependency.
+ *
+ * This is called from the data loop before the targets and mixers
+ * of the nodes are changed. It must not be called from a worker.
+ * The caller sleeps until the last job is done, it doesn't spin, the
+ * workers can run on its cpu with the same rt priority. */
+SPA_EXPORT
+void pw_worker_pool_block(struct pw_worker_pool *pool)
+{
+	uint32_t busy;
+
+	if (pool == NULL)
+		return;
+
+	/* the increment is ordered before the load of busy, a job that
+	 * finishes after it sees the blocker and wakes it up */
+	__atomic_add_fetch(&pool->blocked, 1, __ATOMIC_SEQ_CST);
+	while ((busy = __atomic_load_n(&pool->busy, __ATOMIC_SEQ_CST)) > 0) {
+#ifdef __linux__
+		syscall(SYS_futex, &pool->busy, FUTEX_WAIT, busy, NULL, NULL, 0);
+#else
+		sched_yield();
+#endif
+	}
+}
+
+SPA_EXPORT
+void pw_worker_pool_unblock(struct pw_worker_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	__atomic_sub_fetch(&pool->blocked, 1, __ATOMIC_RELEASE);
+}
+
+static void worker_setup(struct worker *w)
+{
+	struct pw_worker_pool *pool = w->pool;
+	int res;
+
+	if (w->cpu >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(w->cpu, &cpuset);
+		if ((res = pthread_setaffinity_np(w->thread, sizeof(cpuset), &cpuset)) != 0)
+			pw_log_warn(NAME" %p: worker %u can't set affinity to cpu %d: %s",
+					pool, w->index, w->cpu, strerror(res));
+	}
+	if (pool->rt_prio > 0) {
+		struct sched_param sp;
+		spa_zero(sp);
+		sp.sched_priority = pool->rt_prio;
+		if ((res = pthread_setschedparam(w->thread, SCHED_FIFO | SCHED_RESET_ON_FORK, &sp)) != 0)
+			pw_log_warn(NAME" %p: worker %u can't set rt priority %d: %s",
+					pool, w->index, pool->rt_prio, strerror(res));
+	}
+}
+
+static void *do_work(void *user_data)
+{
+	struct worker *w = user_data;
+	struct pw_worker_pool *pool = w->pool;
+	struct pw_node_target *t;
+
+	pw_log_debug(NAME" %p: worker %u started on cpu %d", pool, w->index, sched_getcpu());
+	current_pool = pool;
+
+	while (true) {
+		if (sem_wait(&pool->sem) < 0) {
+			if (errno == EINTR)
+				continue;
+			pw_log_error(NAME" %p: worker %u wait error: %m", pool, w->index);
+			break;
+		}
+		if (!__atomic_load_n(&pool->running, __ATOMIC_ACQUIRE))
+			break;
+
+		/* a wakeup can find the head of the queue not yet published
+		 * while later cells are, drain so that nothing is left behind */
+		while ((t = pool_dequeue(pool)) != NULL) {
+			pw_log_trace_fp(NAME" %p: worker %u signal %p", pool, w->index, t->node);
+			t->signal(t->data);
+			pool_done(pool);
+		}
+	}
+	pw_log_debug(NAME" %p: worker %u stopped", pool, w->index);
+	return NULL;
+}
+
+static uint32_t parse_cpus(const char *str, int *cpus, uint32_t max)
+{
+	const char *s, *state = NULL;
+	size_t len;
+	uint32_t n = 0;
+
+	while (n < max && (s = pw_split_walk(str, ", ", &len, &state)) != NULL)
+		cpus[n++] = atoi(s);
+	return n;
+}
+
+/** Make a new worker pool
+ *
+ * Properties:
+ *  - context.data-loop.workers: number of worker threads
+ *  - context.data-loop.worker-cpus: comma separated list of cpus, worker N
+ *    is pinned to entry N modulo the number of entries
+ *  - context.data-loop.worker-rt-prio: SCHED_FIFO priority of the workers,
+ *    0 keeps the default policy
+ */
+struct pw_worker_pool *pw_worker_pool_new(const struct spa_dict *props)
+{
+	struct pw_worker_pool *pool;
+	const char *str;
+	int cpus[MAX_WORKERS], res;
+	uint32_t i, n_workers = 0, n_cpus = 0;
+
+	if ((str = spa_dict_lookup(props, "context.data-loop.workers")) != NULL)
+		n_workers = SPA_MIN((uint32_t)atoi(str), (uint32_t)MAX_WORKERS);
+	if (n_workers == 0) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(struct pw_worker_pool));
+	if (pool == NULL)
+		return NULL;
+
+	pw_log_debug(NAME" %p: new %u workers", pool, n_workers);
+
+	for (i = 0; i < QUEUE_SIZE; i++)
+		pool->cells[i].seq = i;
+
+	if ((str = spa_dict_lookup(props, "context.data-loop.worker-cpus")) != NULL)
+		n_cpus = parse_cpus(str, cpus, MAX_WORKERS);
+	if ((str = spa_dict_lookup(props, "context.data-loop.worker-rt-prio")) != NULL)
+		pool->rt_prio = atoi(str);
+
+	if (sem_init(&pool->sem, 0, 0) < 0) {
+		res = -errno;
+		goto error_free;
+	}
+
+	pool->running = true;
+	for (i = 0; i < n_workers; i++) {
+		struct worker *w = &pool->workers[i];
+
+		w->pool = pool;
+		w->index = i;
+		w->cpu = n_cpus > 0 ? cpus[i % n_cpus] : -1;
+
+		if ((res = pthread_create(&w->thread, NULL, do_work, w)) != 0) {
+			pw_log_error(NAME" %p: can't create worker: %s", pool, strerror(res));
+			res = -res;
+			goto error_stop;
+		}
+		pool->n_workers++;
+		worker_setup(w);
+	}
+	return pool;
+
+error_stop:
+	pw_worker_pool_destroy(pool);
+	errno = -res;
+	return NULL;
+error_free:
+	free(pool);
+	errno = -res;
+	return NULL;
+}
+
+/** Stop all workers and free the pool */
+void pw_worker_pool_destroy(struct pw_worker_pool *pool)
+{
+	uint32_t i;
+
+	pw_log_debug(NAME" %p: destroy", pool);
+
+	__atomic_store_n(&pool->running, false, __ATOMIC_RELEASE);
+	for (i = 0; i < pool->n_workers; i++)
+		sem_post(&pool->sem);
+	for (i = 0; i < pool->n_workers; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	sem_destroy(&pool->sem);
+	free(pool);
+}
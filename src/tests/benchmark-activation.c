@@ -0,0 +1,235 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/private.h>
+
+#define MAX_FOLLOWERS	64
+#define MAX_CYCLES	10000
+
+/* A driver and its followers run the cycles of a graph, each node in
+ * its own thread like a client process. They touch the fields of the
+ * activations that the nodes touch in each cycle. The same cycles run
+ * with the legacy layout, with the futex word appended like before the
+ * fields were grouped by writer, and with the layout of
+ * struct pw_node_activation. */
+struct layout {
+	const char *name;
+	size_t size;
+	size_t status;
+	size_t state;
+	size_t signal_time;
+	size_t awake_time;
+	size_t finish_time;
+	size_t command;
+	size_t reposition_owner;
+	size_t position;
+	size_t cpu_load;
+	size_t xrun_count;
+	size_t futex;
+};
+
+#define LEGACY(f)	offsetof(struct pw_node_activation_legacy, f)
+#define CURRENT(f)	offsetof(struct pw_node_activation, f)
+
+static const struct layout layouts[] = {
+	{ "legacy", sizeof(struct pw_node_activation_legacy) + 8,
+		LEGACY(status), LEGACY(state), LEGACY(signal_time),
+		LEGACY(awake_time), LEGACY(finish_time), LEGACY(command),
+		LEGACY(reposition_owner), LEGACY(position), LEGACY(cpu_load),
+		LEGACY(xrun_count), sizeof(struct pw_node_activation_legacy) + 4, },
+	{ "current", sizeof(struct pw_node_activation),
+		CURRENT(status), CURRENT(state), CURRENT(signal_time),
+		CURRENT(awake_time), CURRENT(finish_time), CURRENT(command),
+		CURRENT(reposition_owner), CURRENT(position), CURRENT(cpu_load),
+		CURRENT(xrun_count), CURRENT(futex), },
+};
+
+#define FIELD(a,l,f,t)	SPA_MEMBER(a, (l)->f, t)
+
+struct data {
+	const struct layout *layout;
+	uint32_t n_followers;
+	size_t stride;
+	uint8_t *mem;
+	pthread_t threads[MAX_FOLLOWERS];
+};
+
+static inline void *get_activation(struct data *d, uint32_t i)
+{
+	return d->mem + i * d->stride;
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static void wakeup(uint32_t *futex)
+{
+	__atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static void wait_wakeup(uint32_t *futex)
+{
+	while (__atomic_load_n(futex, __ATOMIC_SEQ_CST) == 0)
+		syscall(SYS_futex, futex, FUTEX_WAIT, 0, NULL, NULL, 0);
+	__atomic_sub_fetch(futex, 1, __ATOMIC_SEQ_CST);
+}
+
+struct follower {
+	struct data *d;
+	uint32_t index;
+};
+
+static void *follower(void *user_data)
+{
+	struct follower *f = user_data;
+	struct data *d = f->d;
+	const struct layout *l = d->layout;
+	void *da = get_activation(d, 0);
+	void *a = get_activation(d, f->index);
+	struct spa_io_position *pos = FIELD(da, l, position, struct spa_io_position);
+	uint64_t position = 0;
+	int i;
+
+	for (i = 0; i < MAX_CYCLES; i++) {
+		wait_wakeup(FIELD(a, l, futex, uint32_t));
+
+		*FIELD(a, l, status, uint32_t) = PW_NODE_ACTIVATION_AWAKE;
+		*FIELD(a, l, awake_time, uint64_t) = get_time();
+
+		position += pos->clock.position;
+
+		*FIELD(a, l, xrun_count, uint32_t) += 1;
+		*FIELD(a, l, finish_time, uint64_t) = get_time();
+		*FIELD(a, l, status, uint32_t) = PW_NODE_ACTIVATION_FINISHED;
+
+		if (pw_node_activation_state_dec(FIELD(da, l, state,
+						struct pw_node_activation_state), 1))
+			wakeup(FIELD(da, l, futex, uint32_t));
+	}
+	free(f);
+	return (void*)(uintptr_t)position;
+}
+
+static void test_activation(const struct layout *l, uint32_t n_followers)
+{
+	struct data d;
+	void *da;
+	struct spa_io_position *pos;
+	float *cpu_load;
+	uint64_t t1, t2;
+	uint32_t i;
+	int j;
+
+	spa_zero(d);
+	d.layout = l;
+	d.n_followers = n_followers;
+	/* activations are in their own memfd, page aligned */
+	d.stride = SPA_ROUND_UP_N(l->size, 4096);
+	spa_assert(posix_memalign((void**)&d.mem, 4096, d.stride * (n_followers + 1)) == 0);
+	memset(d.mem, 0, d.stride * (n_followers + 1));
+
+	da = get_activation(&d, 0);
+	pos = FIELD(da, l, position, struct spa_io_position);
+	cpu_load = FIELD(da, l, cpu_load, float);
+	FIELD(da, l, state, struct pw_node_activation_state)->required = n_followers;
+	for (i = 1; i <= n_followers; i++)
+		FIELD(get_activation(&d, i), l, state, struct pw_node_activation_state)->required = 1;
+
+	for (i = 0; i < n_followers; i++) {
+		struct follower *f = calloc(1, sizeof(struct follower));
+		f->d = &d;
+		f->index = i + 1;
+		pthread_create(&d.threads[i], NULL, follower, f);
+	}
+
+	t1 = get_time();
+	for (j = 0; j < MAX_CYCLES; j++) {
+		uint64_t nsec = get_time();
+		uint32_t command = 0;
+
+		pw_node_activation_state_reset(FIELD(da, l, state, struct pw_node_activation_state));
+		pos->clock.position += 1024;
+		cpu_load[0] = cpu_load[1] = cpu_load[2] = 0.1f;
+
+		for (i = 1; i <= n_followers; i++) {
+			void *a = get_activation(&d, i);
+
+			command |= *FIELD(a, l, command, uint32_t) |
+				*FIELD(a, l, reposition_owner, uint32_t);
+			*FIELD(a, l, status, uint32_t) = PW_NODE_ACTIVATION_NOT_TRIGGERED;
+			pw_node_activation_state_reset(FIELD(a, l, state,
+						struct pw_node_activation_state));
+		}
+		for (i = 1; i <= n_followers; i++) {
+			void *a = get_activation(&d, i);
+
+			*FIELD(a, l, status, uint32_t) = PW_NODE_ACTIVATION_TRIGGERED;
+			*FIELD(a, l, signal_time, uint64_t) = nsec;
+			if (pw_node_activation_state_dec(FIELD(a, l, state,
+							struct pw_node_activation_state), 1))
+				wakeup(FIELD(a, l, futex, uint32_t));
+		}
+		wait_wakeup(FIELD(da, l, futex, uint32_t));
+		spa_assert(command == 0);
+	}
+	t2 = get_time();
+
+	for (i = 0; i < n_followers; i++)
+		pthread_join(d.threads[i], NULL);
+
+	fprintf(stderr, "%s: %u followers: elapsed %"PRIu64" count %u = %"PRIu64" nsec/cycle\n",
+			l->name, n_followers, t2 - t1, MAX_CYCLES,
+			(t2 - t1) / MAX_CYCLES);
+
+	free(d.mem);
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t n_followers[] = { 1, 4, 16, MAX_FOLLOWERS };
+	uint32_t i, j;
+
+	/* warmup */
+	test_activation(&layouts[0], 1);
+
+	for (i = 0; i < SPA_N_ELEMENTS(n_followers); i++) {
+		for (j = 0; j < SPA_N_ELEMENTS(layouts); j++)
+			test_activation(&layouts[j], n_followers[i]);
+	}
+	return 0;
+}
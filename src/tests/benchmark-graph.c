@@ -0,0 +1,313 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/node/utils.h>
+#include <spa/param/param.h>
+#include <spa/pod/builder.h>
+#include <spa/utils/hook.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/impl.h>
+
+#define MAX_NODES	2048
+#define GROUP_SIZE	8		/* nodes in a group, the first one is a driver */
+#define FANOUT		2		/* links from a node to the next nodes in the group */
+
+/* a node with one control input and one notify output port. Links between
+ * control ports don't need format negotiation or buffers so they get
+ * prepared right away. */
+struct node {
+	struct spa_node node;
+	struct spa_hook_list hooks;
+	struct spa_node_info info;
+	struct spa_port_info port_info;
+	struct pw_impl_node *impl;
+};
+
+struct data {
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+
+	uint32_t n_nodes;
+	struct node nodes[MAX_NODES];
+
+	uint32_t n_links;
+	struct pw_impl_link *links[MAX_NODES * FANOUT];
+};
+
+static int node_add_listener(void *object, struct spa_hook *listener,
+		const struct spa_node_events *events, void *data)
+{
+	struct node *n = object;
+	struct spa_hook_list save;
+
+	spa_hook_list_isolate(&n->hooks, &save, listener, events, data);
+
+	n->info.change_mask = SPA_NODE_CHANGE_MASK_FLAGS;
+	spa_node_emit_info(&n->hooks, &n->info);
+	n->port_info.change_mask = SPA_PORT_CHANGE_MASK_FLAGS;
+	spa_node_emit_port_info(&n->hooks, SPA_DIRECTION_INPUT, 0, &n->port_info);
+	spa_node_emit_port_info(&n->hooks, SPA_DIRECTION_OUTPUT, 0, &n->port_info);
+
+	spa_hook_list_join(&n->hooks, &save);
+	return 0;
+}
+
+static int node_set_callbacks(void *object, const struct spa_node_callbacks *callbacks,
+		void *data)
+{
+	return 0;
+}
+
+static int node_enum_params(void *object, int seq, uint32_t id,
+		uint32_t start, uint32_t num, const struct spa_pod *filter)
+{
+	return 0;
+}
+
+static int node_set_param(void *object, uint32_t id, uint32_t flags,
+		const struct spa_pod *param)
+{
+	return -ENOTSUP;
+}
+
+static int node_set_io(void *object, uint32_t id, void *data, size_t size)
+{
+	return 0;
+}
+
+static int node_send_command(void *object, const struct spa_command *command)
+{
+	return 0;
+}
+
+static int node_port_enum_params(void *object, int seq,
+		enum spa_direction direction, uint32_t port_id,
+		uint32_t id, uint32_t start, uint32_t num,
+		const struct spa_pod *filter)
+{
+	struct node *n = object;
+	struct spa_result_node_params result;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+	if (id != SPA_PARAM_IO || start > 0)
+		return 0;
+
+	result.id = id;
+	result.index = 0;
+	result.next = 1;
+	result.param = spa_pod_builder_add_object(&b,
+			SPA_TYPE_OBJECT_ParamIO, id,
+			SPA_PARAM_IO_id, SPA_POD_Id(direction == SPA_DIRECTION_INPUT ?
+				SPA_IO_Control : SPA_IO_Notify),
+			SPA_PARAM_IO_size, SPA_POD_Int(sizeof(struct spa_io_sequence)));
+
+	spa_node_emit_result(&n->hooks, seq, 0, SPA_RESULT_TYPE_NODE_PARAMS, &result);
+	return 0;
+}
+
+static int node_port_set_param(void *object,
+		enum spa_direction direction, uint32_t port_id,
+		uint32_t id, uint32_t flags, const struct spa_pod *param)
+{
+	return 0;
+}
+
+static int node_port_use_buffers(void *object,
+		enum spa_direction direction, uint32_t port_id, uint32_t flags,
+		struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	return 0;
+}
+
+static int node_port_set_io(void *object,
+		enum spa_direction direction, uint32_t port_id,
+		uint32_t id, void *data, size_t size)
+{
+	return 0;
+}
+
+static int node_process(void *object)
+{
+	return SPA_STATUS_OK;
+}
+
+static const struct spa_node_methods node_methods = {
+	SPA_VERSION_NODE_METHODS,
+	.add_listener = node_add_listener,
+	.set_callbacks = node_set_callbacks,
+	.enum_params = node_enum_params,
+	.set_param = node_set_param,
+	.set_io = node_set_io,
+	.send_command = node_send_command,
+	.port_enum_params = node_port_enum_params,
+	.port_set_param = node_port_set_param,
+	.port_use_buffers = node_port_use_buffers,
+	.port_set_io = node_port_set_io,
+	.process = node_process,
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static void iterate(struct data *d)
+{
+	struct pw_loop *loop = pw_main_loop_get_loop(d->loop);
+
+	pw_loop_enter(loop);
+	while (pw_loop_iterate(loop, 0) > 0);
+	pw_loop_leave(loop);
+}
+
+static void make_nodes(struct data *d, uint32_t n_nodes)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_nodes; i++) {
+		struct node *n = &d->nodes[i];
+		struct pw_properties *props;
+
+		n->node.iface = SPA_INTERFACE_INIT(SPA_TYPE_INTERFACE_Node,
+				SPA_VERSION_NODE, &node_methods, n);
+		spa_hook_list_init(&n->hooks);
+		n->info = SPA_NODE_INFO_INIT();
+		n->info.max_input_ports = 1;
+		n->info.max_output_ports = 1;
+		n->port_info = SPA_PORT_INFO_INIT();
+
+		props = pw_properties_new(NULL, NULL);
+		pw_properties_setf(props, PW_KEY_NODE_NAME, "node-%u", i);
+		if (i % GROUP_SIZE == 0)
+			pw_properties_set(props, PW_KEY_NODE_DRIVER, "true");
+
+		n->impl = pw_context_create_node(d->context, props, 0);
+		spa_assert(n->impl != NULL);
+		pw_impl_node_set_implementation(n->impl, &n->node);
+		pw_impl_node_register(n->impl, NULL);
+		pw_impl_node_set_active(n->impl, true);
+	}
+	d->n_nodes = n_nodes;
+	iterate(d);
+}
+
+static void make_links(struct data *d)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < d->n_nodes; i++) {
+		for (j = 1; j <= FANOUT; j++) {
+			struct pw_impl_port *out, *in;
+			struct pw_impl_link *l;
+
+			if (i % GROUP_SIZE + j >= GROUP_SIZE || i + j >= d->n_nodes)
+				break;
+
+			out = pw_impl_node_find_port(d->nodes[i].impl, PW_DIRECTION_OUTPUT, 0);
+			in = pw_impl_node_find_port(d->nodes[i + j].impl, PW_DIRECTION_INPUT, 0);
+
+			l = pw_context_create_link(d->context, out, in, NULL, NULL, 0);
+			spa_assert(l != NULL);
+			pw_impl_link_register(l, NULL);
+			d->links[d->n_links++] = l;
+		}
+	}
+	iterate(d);
+}
+
+static void destroy_links(struct data *d)
+{
+	while (d->n_links > 0)
+		pw_impl_link_destroy(d->links[--d->n_links]);
+	iterate(d);
+}
+
+static void destroy_nodes(struct data *d)
+{
+	while (d->n_nodes > 0)
+		pw_impl_node_destroy(d->nodes[--d->n_nodes].impl);
+}
+
+static void test_graph(struct data *d, uint32_t n_nodes)
+{
+	uint64_t t1, t2, t3, t4;
+	uint32_t n_links;
+
+	t1 = get_time();
+	make_nodes(d, n_nodes);
+	t2 = get_time();
+	make_links(d);
+	n_links = d->n_links;
+	t3 = get_time();
+	destroy_links(d);
+	t4 = get_time();
+	destroy_nodes(d);
+
+	fprintf(stderr, "%u nodes: create elapsed %"PRIu64" us\n",
+			n_nodes, (t2 - t1) / 1000);
+	fprintf(stderr, "%u nodes: %u links create elapsed %"PRIu64" us = %"PRIu64"/sec\n",
+			n_nodes, n_links, (t3 - t2) / 1000,
+			n_links * (uint64_t)SPA_NSEC_PER_SEC / (t3 - t2));
+	fprintf(stderr, "%u nodes: %u links destroy elapsed %"PRIu64" us = %"PRIu64"/sec\n",
+			n_nodes, n_links, (t4 - t3) / 1000,
+			n_links * (uint64_t)SPA_NSEC_PER_SEC / (t4 - t3));
+}
+
+int main(int argc, char *argv[])
+{
+	struct data *d;
+
+	pw_init(&argc, &argv);
+
+	d = calloc(1, sizeof(struct data));
+	spa_assert(d != NULL);
+
+	d->loop = pw_main_loop_new(NULL);
+	d->context = pw_context_new(pw_main_loop_get_loop(d->loop),
+			pw_properties_new(
+				PW_KEY_CONTEXT_PROFILE_MODULES, "none",
+				NULL), 0);
+	spa_assert(d->context != NULL);
+
+	test_graph(d, 256);
+	test_graph(d, 1024);
+	test_graph(d, 2048);
+
+	pw_context_destroy(d->context);
+	pw_main_loop_destroy(d->loop);
+	free(d);
+
+	return 0;
+}
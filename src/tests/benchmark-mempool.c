@@ -0,0 +1,370 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+#include <spa/buffer/buffer.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/private.h>
+
+#define MAX_LINKS	1024
+#define MAX_BLOCKS	10000
+#define N_LOOKUPS	10000
+#define N_BUFFERS	8
+#define BUFFER_SIZE	(sizeof(struct spa_buffer) + sizeof(struct spa_meta) + \
+			 sizeof(struct spa_data) + sizeof(struct spa_chunk) + 1024 * sizeof(float))
+#define SLAB_SIZE	"2097152"
+#define VIDEO_BUFFERS	4
+#define VIDEO_SIZE	(1920 * 1080 * 4)
+
+/* The memory of a link is set up like a client-node does: the server
+ * allocates the activation of the node and the shared buffers in its
+ * pool, imports them in the pool of the client, which sends the fds of
+ * new blocks, and the client maps the memory it was given an id, offset
+ * and size for. */
+struct data {
+	struct pw_mempool *server;
+	struct pw_mempool *client;
+	struct pw_mempool *remote;
+	struct spa_hook client_listener;
+
+	uint32_t n_sent;
+	struct pw_memblock *remote_blocks[4 * MAX_LINKS];
+
+	struct pw_memblock *blocks[2 * MAX_LINKS];
+	struct pw_memblock *imported[2 * MAX_LINKS];
+	struct pw_memmap *maps[2 * MAX_LINKS];
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static uint32_t count_lines(const char *path)
+{
+	FILE *f;
+	uint32_t n = 0;
+	int c;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+	while ((c = fgetc(f)) != EOF)
+		if (c == '\n')
+			n++;
+	fclose(f);
+	return n;
+}
+
+static uint32_t count_fds(void)
+{
+	DIR *dir;
+	uint32_t n = 0;
+
+	if ((dir = opendir("/proc/self/fd")) == NULL)
+		return 0;
+	while (readdir(dir) != NULL)
+		n++;
+	closedir(dir);
+	return n;
+}
+
+static void client_added(void *data, struct pw_memblock *block)
+{
+	struct data *d = data;
+	struct pw_memblock *m;
+
+	/* what the client does with the fd it receives in add_mem */
+	m = pw_mempool_import(d->remote,
+			block->flags & (PW_MEMBLOCK_FLAG_READWRITE |
+				PW_MEMBLOCK_FLAG_SLAB |
+				PW_MEMBLOCK_FLAG_HUGETLB |
+				PW_MEMBLOCK_FLAG_PREFAULT),
+			block->type, dup(block->fd));
+	spa_assert(m != NULL);
+	spa_assert(block->id < SPA_N_ELEMENTS(d->remote_blocks));
+	d->remote_blocks[block->id] = m;
+	d->n_sent++;
+}
+
+static const struct pw_mempool_events client_events = {
+	PW_VERSION_MEMPOOL_EVENTS,
+	.added = client_added,
+};
+
+static void share_block(struct data *d, uint32_t i, uint32_t flags, size_t size)
+{
+	struct pw_memblock *b, *m;
+
+	b = pw_mempool_alloc(d->server, flags, SPA_DATA_MemFd, size);
+	spa_assert(b != NULL);
+	*(uint32_t*)b->map->ptr = i;
+
+	m = pw_mempool_import_block(d->client, b);
+	spa_assert(m != NULL);
+
+	d->maps[i] = pw_memblock_map(d->remote_blocks[m->id],
+			PW_MEMMAP_FLAG_READWRITE, b->offset, size, NULL);
+	spa_assert(d->maps[i] != NULL);
+	spa_assert(*(uint32_t*)d->maps[i]->ptr == i);
+
+	d->blocks[i] = b;
+	d->imported[i] = m;
+}
+
+static void test_links(const char *slab_size, uint32_t n_links)
+{
+	struct data d;
+	uint32_t i, fds, maps;
+	uint64_t t1, t2, t3;
+
+	spa_zero(d);
+	fds = count_fds();
+	maps = count_lines("/proc/self/maps");
+
+	d.server = pw_mempool_new(pw_properties_new("mem.slab-size", slab_size, NULL));
+	d.client = pw_mempool_new(NULL);
+	d.remote = pw_mempool_new(NULL);
+	pw_mempool_add_listener(d.client, &d.client_listener, &client_events, &d);
+
+	t1 = get_time();
+	for (i = 0; i < n_links; i++) {
+		share_block(&d, 2 * i,
+				PW_MEMBLOCK_FLAG_READWRITE |
+				PW_MEMBLOCK_FLAG_SEAL |
+				PW_MEMBLOCK_FLAG_MAP |
+				PW_MEMBLOCK_FLAG_SLAB,
+				sizeof(struct pw_node_activation));
+		share_block(&d, 2 * i + 1,
+				PW_MEMBLOCK_FLAG_READWRITE |
+				PW_MEMBLOCK_FLAG_SEAL |
+				PW_MEMBLOCK_FLAG_MAP |
+				PW_MEMBLOCK_FLAG_SLAB,
+				N_BUFFERS * BUFFER_SIZE);
+	}
+	t2 = get_time();
+
+	fds = count_fds() - fds;
+	maps = count_lines("/proc/self/maps") - maps;
+
+	t3 = get_time();
+	for (i = 0; i < 2 * n_links; i++) {
+		pw_memmap_free(d.maps[i]);
+		pw_memblock_unref(d.imported[i]);
+		pw_memblock_unref(d.blocks[i]);
+	}
+	pw_mempool_destroy(d.remote);
+	pw_mempool_destroy(d.client);
+	pw_mempool_destroy(d.server);
+
+	fprintf(stderr, "slab-size %s: %u links: setup %"PRIu64" nsec/link, teardown %"PRIu64
+			" nsec/link, fds sent %u, fds open %u, mappings %u\n",
+			slab_size, n_links, (t2 - t1) / n_links, (get_time() - t3) / n_links,
+			d.n_sent, fds, maps);
+}
+
+/* Lookups in a pool with many blocks, like the ones done when buffers
+ * are used on ports and ios are set on mixers */
+static void test_lookups(const char *slab_size, uint32_t n_blocks)
+{
+	struct pw_mempool *pool;
+	struct pw_memblock **blocks;
+	struct pw_memmap *mm;
+	uint32_t i, idx, seed = 1, tag[5];
+	uint64_t t1, t2, t3, t4, t5;
+
+	pool = pw_mempool_new(pw_properties_new("mem.slab-size", slab_size, NULL));
+	blocks = calloc(n_blocks, sizeof(struct pw_memblock *));
+	spa_assert(pool != NULL && blocks != NULL);
+
+	t1 = get_time();
+	for (i = 0; i < n_blocks; i++) {
+		blocks[i] = pw_mempool_alloc(pool,
+				PW_MEMBLOCK_FLAG_READWRITE |
+				PW_MEMBLOCK_FLAG_MAP |
+				PW_MEMBLOCK_FLAG_SLAB,
+				SPA_DATA_MemFd, 4096);
+		spa_assert(blocks[i] != NULL);
+		tag[0] = i / 16;
+		tag[1] = i;
+		tag[2] = tag[3] = tag[4] = 0;
+		spa_assert(pw_memblock_map(blocks[i], PW_MEMMAP_FLAG_READWRITE,
+					0, 4096, tag) != NULL);
+	}
+	t2 = get_time();
+	for (i = 0; i < N_LOOKUPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		idx = (seed >> 8) % n_blocks;
+		spa_assert(pw_mempool_find_ptr(pool,
+				SPA_MEMBER(blocks[idx]->map->ptr, 100, void)) == blocks[idx]);
+	}
+	t3 = get_time();
+	for (i = 0; i < N_LOOKUPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		idx = (seed >> 8) % n_blocks;
+		spa_assert(pw_mempool_find_fd(pool, blocks[idx]->fd)->fd == blocks[idx]->fd);
+	}
+	t4 = get_time();
+	for (i = 0; i < N_LOOKUPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		idx = (seed >> 8) % n_blocks;
+		tag[0] = idx / 16;
+		tag[1] = idx;
+		mm = pw_mempool_find_tag(pool, tag, sizeof(tag));
+		spa_assert(mm != NULL && mm->block == blocks[idx]);
+		spa_assert(pw_mempool_find_tag(pool, tag, sizeof(uint32_t)) != NULL);
+	}
+	t5 = get_time();
+
+	pw_mempool_destroy(pool);
+	free(blocks);
+
+	fprintf(stderr, "slab-size %s: %u blocks: alloc %"PRIu64" nsec/block, find_ptr %"PRIu64
+			" nsec, find_fd %"PRIu64" nsec, find_tag %"PRIu64" nsec\n",
+			slab_size, n_blocks, (t2 - t1) / n_blocks,
+			(t3 - t2) / N_LOOKUPS, (t4 - t3) / N_LOOKUPS, (t5 - t4) / N_LOOKUPS);
+}
+
+static uint64_t touch_pages(void *ptr, size_t size, uint32_t val)
+{
+	uint64_t t = get_time();
+	size_t i;
+
+	for (i = 0; i < size; i += 64)
+		*(uint32_t*)SPA_MEMBER(ptr, i, void) = val;
+	return get_time() - t;
+}
+
+/* The first cycles of a newly linked stream: the client writes all of
+ * the buffers once and the server reads them, every page is touched
+ * for the first time in both mappings unless the mappings were
+ * prefaulted when the link was set up. */
+static void test_first_cycle(const char *prefault, const char *hugepages,
+		const char *name, uint32_t n_buffers, size_t buffer_size)
+{
+	struct data d;
+	struct pw_properties *props;
+	struct pw_memmap *server, *client;
+	uint64_t t1, t2, first = 0, next = 0;
+	uint32_t i;
+
+	spa_zero(d);
+	props = pw_properties_new(
+			"mem.prefault", prefault,
+			"mem.hugepages", hugepages,
+			"mem.allow-mlock", "false",
+			NULL);
+	d.server = pw_mempool_new(pw_properties_copy(props));
+	d.client = pw_mempool_new(NULL);
+	d.remote = pw_mempool_new(props);
+	pw_mempool_add_listener(d.client, &d.client_listener, &client_events, &d);
+
+	t1 = get_time();
+	share_block(&d, 0,
+			PW_MEMBLOCK_FLAG_READWRITE |
+			PW_MEMBLOCK_FLAG_SEAL |
+			PW_MEMBLOCK_FLAG_MAP |
+			PW_MEMBLOCK_FLAG_PREFAULT |
+			PW_MEMBLOCK_FLAG_MLOCK,
+			sizeof(struct pw_node_activation));
+	share_block(&d, 1,
+			PW_MEMBLOCK_FLAG_READWRITE |
+			PW_MEMBLOCK_FLAG_SEAL |
+			PW_MEMBLOCK_FLAG_MAP |
+			PW_MEMBLOCK_FLAG_HUGETLB |
+			PW_MEMBLOCK_FLAG_PREFAULT |
+			PW_MEMBLOCK_FLAG_MLOCK,
+			n_buffers * buffer_size);
+	t2 = get_time();
+
+	server = d.blocks[1]->map;
+	client = d.maps[1];
+	for (i = 0; i < 2; i++) {
+		uint64_t t;
+		t = touch_pages(d.maps[0]->ptr, d.maps[0]->size, i);
+		t += touch_pages(client->ptr, client->size, i);
+		t += touch_pages(server->ptr, server->size, i);
+		t += touch_pages(d.blocks[0]->map->ptr, d.blocks[0]->map->size, i);
+		if (i == 0)
+			first = t;
+		else
+			next = t;
+	}
+	spa_assert(*(uint32_t*)server->ptr == 1);
+
+	for (i = 0; i < 2; i++) {
+		pw_memmap_free(d.maps[i]);
+		pw_memblock_unref(d.imported[i]);
+		pw_memblock_unref(d.blocks[i]);
+	}
+	pw_mempool_destroy(d.remote);
+	pw_mempool_destroy(d.client);
+	pw_mempool_destroy(d.server);
+
+	fprintf(stderr, "prefault %s hugepages %s: %s %u x %zd: setup %"PRIu64" nsec, "
+			"first cycle %"PRIu64" nsec, next cycle %"PRIu64" nsec\n",
+			prefault, hugepages, name, n_buffers, buffer_size,
+			t2 - t1, first, next);
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t n_links[] = { 16, 128, MAX_LINKS };
+	struct rlimit rl;
+	uint32_t i;
+
+	pw_init(&argc, &argv);
+
+	/* without slabs each link uses 4 fds */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	/* warmup */
+	test_links("0", 16);
+
+	for (i = 0; i < SPA_N_ELEMENTS(n_links); i++) {
+		test_links("0", n_links[i]);
+		test_links(SLAB_SIZE, n_links[i]);
+	}
+	test_lookups("0", MAX_BLOCKS);
+	test_lookups(SLAB_SIZE, MAX_BLOCKS);
+
+	for (i = 0; i < 2; i++) {
+		test_first_cycle("false", "false", "audio", N_BUFFERS, BUFFER_SIZE);
+		test_first_cycle("true", "false", "audio", N_BUFFERS, BUFFER_SIZE);
+		test_first_cycle("false", "false", "video", VIDEO_BUFFERS, VIDEO_SIZE);
+		test_first_cycle("true", "false", "video", VIDEO_BUFFERS, VIDEO_SIZE);
+		test_first_cycle("true", "true", "video", VIDEO_BUFFERS, VIDEO_SIZE);
+	}
+	return 0;
+}
@@ -0,0 +1,839 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/node/utils.h>
+#include <spa/param/param.h>
+#include <spa/pod/builder.h>
+#include <spa/utils/hook.h>
+#include <spa/utils/names.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/impl.h>
+#include <pipewire/private.h>
+
+#define MAX_NODES	1024u
+#define MAX_CLIENTS	64u
+#define MAX_CYCLES	65536
+#define WARMUP_CYCLES	16
+
+#define DEFAULT_QUANTUM	128
+#define DEFAULT_RATE	48000
+#define DEFAULT_CYCLES	256
+#define DEFAULT_COST	10		/* usec of work per node when searching */
+
+/* Runs graphs of nodes on a node-driver and measures, in the data thread,
+ * the duration of each cycle, the part of it that was not spent in the
+ * process function of the nodes and how long each node took to wake up
+ * after it was signaled. The nodes are local nodes in chains, fan-in,
+ * fan-out or random DAGs, linked with control ports, or client nodes
+ * that are exported over the native protocol by a context per client,
+ * each with its own data thread. */
+enum topology {
+	TOPOLOGY_CHAIN,
+	TOPOLOGY_FANIN,
+	TOPOLOGY_FANOUT,
+	TOPOLOGY_DAG,
+	TOPOLOGY_CLIENTS,
+};
+
+static const char * const topology_names[] = {
+	[TOPOLOGY_CHAIN] = "chain",
+	[TOPOLOGY_FANIN] = "fanin",
+	[TOPOLOGY_FANOUT] = "fanout",
+	[TOPOLOGY_DAG] = "dag",
+	[TOPOLOGY_CLIENTS] = "clients",
+};
+
+struct node {
+	struct spa_node node;
+	struct spa_hook_list hooks;
+	struct spa_node_info info;
+	struct spa_port_info port_info;
+	uint64_t cost;
+	bool ports;
+	struct pw_impl_node *impl;
+};
+
+struct client {
+	struct pw_context *context;
+	struct pw_core *core;
+	struct pw_proxy *proxy;
+	struct node node;
+};
+
+struct config {
+	enum topology topology;
+	uint32_t n_nodes;
+	uint32_t quantum;
+	uint32_t rate;
+	uint64_t cost;
+	uint32_t n_cycles;
+	uint32_t n_workers;
+};
+
+struct result {
+	uint32_t n_samples;
+	uint32_t late;
+	uint64_t cycle_avg;
+	uint64_t cycle_p99;
+	uint64_t cycle_max;
+	uint64_t overhead_avg;
+	uint64_t wakeup[4];		/* p50, p90, p99, max */
+};
+
+struct data {
+	struct pw_main_loop *loop;
+	struct config config;
+	char server_name[64];
+
+	struct pw_context *context;
+	struct spa_hook context_listener;
+	struct spa_hook driver_listener;
+	struct spa_handle *handle;
+	struct pw_impl_node *driver;
+	struct spa_source *timer;
+	uint64_t deadline;
+
+	struct node nodes[MAX_NODES];
+	uint32_t n_links;
+	struct pw_impl_link *links[MAX_NODES * 2];
+	struct client clients[MAX_CLIENTS];
+
+	/* written in the data thread */
+	uint32_t warmup;
+	uint32_t n_samples;
+	uint32_t late;
+	uint64_t cycle[MAX_CYCLES];
+	uint64_t overhead[MAX_CYCLES];
+	uint32_t n_wakeup;
+	uint32_t max_wakeup;
+	uint32_t *wakeup;
+};
+
+static int node_add_listener(void *object, struct spa_hook *listener,
+		const struct spa_node_events *events, void *data)
+{
+	struct node *n = object;
+	struct spa_hook_list save;
+
+	spa_hook_list_isolate(&n->hooks, &save, listener, events, data);
+
+	n->info.change_mask = SPA_NODE_CHANGE_MASK_FLAGS;
+	spa_node_emit_info(&n->hooks, &n->info);
+	if (n->ports) {
+		n->port_info.change_mask = SPA_PORT_CHANGE_MASK_FLAGS;
+		spa_node_emit_port_info(&n->hooks, SPA_DIRECTION_INPUT, 0, &n->port_info);
+		spa_node_emit_port_info(&n->hooks, SPA_DIRECTION_OUTPUT, 0, &n->port_info);
+	}
+	spa_hook_list_join(&n->hooks, &save);
+	return 0;
+}
+
+static int node_set_callbacks(void *object, const struct spa_node_callbacks *callbacks,
+		void *data)
+{
+	return 0;
+}
+
+static int node_enum_params(void *object, int seq, uint32_t id,
+		uint32_t start, uint32_t num, const struct spa_pod *filter)
+{
+	return 0;
+}
+
+static int node_set_param(void *object, uint32_t id, uint32_t flags,
+		const struct spa_pod *param)
+{
+	return -ENOTSUP;
+}
+
+static int node_set_io(void *object, uint32_t id, void *data, size_t size)
+{
+	return 0;
+}
+
+static int node_send_command(void *object, const struct spa_command *command)
+{
+	return 0;
+}
+
+static int node_port_enum_params(void *object, int seq,
+		enum spa_direction direction, uint32_t port_id,
+		uint32_t id, uint32_t start, uint32_t num,
+		const struct spa_pod *filter)
+{
+	struct node *n = object;
+	struct spa_result_node_params result;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+	if (id != SPA_PARAM_IO || start > 0)
+		return 0;
+
+	result.id = id;
+	result.index = 0;
+	result.next = 1;
+	result.param = spa_pod_builder_add_object(&b,
+			SPA_TYPE_OBJECT_ParamIO, id,
+			SPA_PARAM_IO_id, SPA_POD_Id(direction == SPA_DIRECTION_INPUT ?
+				SPA_IO_Control : SPA_IO_Notify),
+			SPA_PARAM_IO_size, SPA_POD_Int(sizeof(struct spa_io_sequence)));
+
+	spa_node_emit_result(&n->hooks, seq, 0, SPA_RESULT_TYPE_NODE_PARAMS, &result);
+	return 0;
+}
+
+static int node_port_set_param(void *object,
+		enum spa_direction direction, uint32_t port_id,
+		uint32_t id, uint32_t flags, const struct spa_pod *param)
+{
+	return 0;
+}
+
+static int node_port_use_buffers(void *object,
+		enum spa_direction direction, uint32_t port_id, uint32_t flags,
+		struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	return 0;
+}
+
+static int node_port_set_io(void *object,
+		enum spa_direction direction, uint32_t port_id,
+		uint32_t id, void *data, size_t size)
+{
+	return 0;
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static int node_process(void *object)
+{
+	struct node *n = object;
+
+	if (n->cost > 0) {
+		uint64_t end = get_time() + n->cost;
+		while (get_time() < end);
+	}
+	return SPA_STATUS_HAVE_DATA;
+}
+
+static const struct spa_node_methods node_methods = {
+	SPA_VERSION_NODE_METHODS,
+	.add_listener = node_add_listener,
+	.set_callbacks = node_set_callbacks,
+	.enum_params = node_enum_params,
+	.set_param = node_set_param,
+	.set_io = node_set_io,
+	.send_command = node_send_command,
+	.port_enum_params = node_port_enum_params,
+	.port_set_param = node_port_set_param,
+	.port_use_buffers = node_port_use_buffers,
+	.port_set_io = node_port_set_io,
+	.process = node_process,
+};
+
+static void init_node(struct data *d, struct node *n, bool ports)
+{
+	spa_zero(*n);
+	n->node.iface = SPA_INTERFACE_INIT(SPA_TYPE_INTERFACE_Node,
+			SPA_VERSION_NODE, &node_methods, n);
+	spa_hook_list_init(&n->hooks);
+	n->info = SPA_NODE_INFO_INIT();
+	n->info.max_input_ports = ports ? 1 : 0;
+	n->info.max_output_ports = ports ? 1 : 0;
+	n->port_info = SPA_PORT_INFO_INIT();
+	n->ports = ports;
+	n->cost = d->config.cost;
+}
+
+static struct pw_properties *node_props(struct data *d, uint32_t i)
+{
+	struct pw_properties *props;
+
+	props = pw_properties_new(
+			PW_KEY_NODE_ALWAYS_PROCESS, "true",
+			PW_KEY_NODE_THREAD_SAFE, "true",
+			NULL);
+	pw_properties_setf(props, PW_KEY_NODE_NAME, "benchmark-node-%u", i);
+	return props;
+}
+
+/* called in the data thread when the driver completed a cycle */
+static void driver_start(void *data, struct pw_impl_node *node)
+{
+	struct data *d = data;
+	struct pw_node_activation *a = node->rt.activation;
+	struct pw_node_target *t;
+	uint64_t cycle, busy = 0, period;
+	uint32_t n_ran = 0, n_wakeup = d->n_wakeup;
+
+	if (node != d->driver || d->n_samples == d->config.n_cycles)
+		return;
+	if (a->finish_time <= a->signal_time)
+		return;
+
+	spa_list_for_each(t, &node->rt.target_list, link) {
+		struct pw_node_activation *na = t->activation;
+
+		if (t->node == NULL || t->node == node)
+			continue;
+		if (na->status != PW_NODE_ACTIVATION_FINISHED ||
+		    na->signal_time < a->signal_time ||
+		    na->awake_time < na->signal_time ||
+		    na->finish_time < na->awake_time)
+			continue;
+
+		if (n_wakeup < d->max_wakeup)
+			d->wakeup[n_wakeup++] = na->awake_time - na->signal_time;
+		busy += na->finish_time - na->awake_time;
+		n_ran++;
+	}
+
+	/* start when all nodes are in the graph */
+	if (d->warmup < WARMUP_CYCLES) {
+		d->warmup = n_ran < d->config.n_nodes ? 0 : d->warmup + 1;
+		return;
+	}
+
+	cycle = a->finish_time - a->signal_time;
+	period = (uint64_t)d->config.quantum * SPA_NSEC_PER_SEC / d->config.rate;
+	if (cycle > period || n_ran < d->config.n_nodes)
+		d->late++;
+
+	d->cycle[d->n_samples] = cycle;
+	d->overhead[d->n_samples] = cycle > busy ? cycle - busy : 0;
+	d->n_wakeup = n_wakeup;
+	__atomic_store_n(&d->n_samples, d->n_samples + 1, __ATOMIC_RELEASE);
+}
+
+static const struct pw_context_driver_events driver_events = {
+	PW_VERSION_CONTEXT_DRIVER_EVENTS,
+	.start = driver_start,
+};
+
+static void check_access(void *data, struct pw_impl_client *client)
+{
+	struct pw_permission permissions[1] = {
+		PW_PERMISSION_INIT(PW_ID_ANY, PW_PERM_RWX),
+	};
+	pw_impl_client_update_permissions(client, 1, permissions);
+}
+
+static const struct pw_context_events context_events = {
+	PW_VERSION_CONTEXT_EVENTS,
+	.check_access = check_access,
+};
+
+static void on_timer(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+
+	if (__atomic_load_n(&d->n_samples, __ATOMIC_ACQUIRE) == d->config.n_cycles ||
+	    get_time() > d->deadline)
+		pw_main_loop_quit(d->loop);
+}
+
+static void iterate(struct data *d)
+{
+	struct pw_loop *loop = pw_main_loop_get_loop(d->loop);
+
+	pw_loop_enter(loop);
+	while (pw_loop_iterate(loop, 0) > 0);
+	pw_loop_leave(loop);
+}
+
+static void link_nodes(struct data *d, uint32_t from, uint32_t to)
+{
+	struct pw_impl_port *out, *in;
+	struct pw_impl_link *l;
+
+	out = pw_impl_node_find_port(d->nodes[from].impl, PW_DIRECTION_OUTPUT, 0);
+	in = pw_impl_node_find_port(d->nodes[to].impl, PW_DIRECTION_INPUT, 0);
+
+	l = pw_context_create_link(d->context, out, in, NULL, NULL, 0);
+	spa_assert(l != NULL);
+	pw_impl_link_register(l, NULL);
+	d->links[d->n_links++] = l;
+}
+
+static void make_nodes(struct data *d)
+{
+	uint32_t i, n_nodes = d->config.n_nodes, seed = 1;
+
+	for (i = 0; i < n_nodes; i++) {
+		struct node *n = &d->nodes[i];
+
+		init_node(d, n, true);
+		n->impl = pw_context_create_node(d->context, node_props(d, i), 0);
+		spa_assert(n->impl != NULL);
+		pw_impl_node_set_implementation(n->impl, &n->node);
+		pw_impl_node_register(n->impl, NULL);
+		pw_impl_node_set_active(n->impl, true);
+	}
+
+	for (i = 1; i < n_nodes; i++) {
+		switch (d->config.topology) {
+		case TOPOLOGY_CHAIN:
+			link_nodes(d, i - 1, i);
+			break;
+		case TOPOLOGY_FANIN:
+			link_nodes(d, i - 1, n_nodes - 1);
+			break;
+		case TOPOLOGY_FANOUT:
+			link_nodes(d, 0, i);
+			break;
+		case TOPOLOGY_DAG:
+			/* one or two inputs from random earlier nodes, always the
+			 * same graph for the same number of nodes */
+			seed = seed * 1103515245 + 12345;
+			link_nodes(d, (seed >> 16) % i, i);
+			if (i > 1 && (seed & (1 << 8))) {
+				uint32_t from = ((seed >> 16) + 1 + (seed >> 24)) % i;
+				if (from != (seed >> 16) % i)
+					link_nodes(d, from, i);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	iterate(d);
+}
+
+static int make_clients(struct data *d)
+{
+	struct pw_loop *loop = pw_main_loop_get_loop(d->loop);
+	uint32_t i;
+
+	for (i = 0; i < d->config.n_nodes; i++) {
+		struct client *c = &d->clients[i];
+		struct pw_properties *props;
+
+		c->context = pw_context_new(loop,
+				pw_properties_new(
+					PW_KEY_CONTEXT_PROFILE_MODULES, "none",
+					NULL), 0);
+		if (c->context == NULL)
+			return -errno;
+		pw_context_load_module(c->context, "libpipewire-module-protocol-native", NULL, NULL);
+		pw_context_load_module(c->context, "libpipewire-module-client-node", NULL, NULL);
+
+		c->core = pw_context_connect(c->context,
+				pw_properties_new(
+					PW_KEY_REMOTE_NAME, d->server_name,
+					NULL), 0);
+		if (c->core == NULL)
+			return -errno;
+
+		init_node(d, &c->node, false);
+		props = node_props(d, i);
+		c->proxy = pw_core_export(c->core, SPA_TYPE_INTERFACE_Node,
+				&props->dict, &c->node.node, 0);
+		pw_properties_free(props);
+		if (c->proxy == NULL)
+			return -errno;
+	}
+	return 0;
+}
+
+static void destroy_clients(struct data *d)
+{
+	uint32_t i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		struct client *c = &d->clients[i];
+
+		if (c->context == NULL)
+			continue;
+		if (c->proxy)
+			pw_proxy_destroy(c->proxy);
+		if (c->core)
+			pw_core_disconnect(c->core);
+		pw_context_destroy(c->context);
+		spa_zero(*c);
+	}
+	iterate(d);
+}
+
+static int compare_u64(const void *p1, const void *p2)
+{
+	uint64_t v1 = *(const uint64_t *)p1, v2 = *(const uint64_t *)p2;
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static int compare_u32(const void *p1, const void *p2)
+{
+	uint32_t v1 = *(const uint32_t *)p1, v2 = *(const uint32_t *)p2;
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static void make_result(struct data *d, struct result *res)
+{
+	uint64_t sum = 0, overhead = 0;
+	uint32_t i, n = d->n_samples;
+
+	spa_zero(*res);
+	res->n_samples = n;
+	res->late = d->late;
+	if (n == 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		sum += d->cycle[i];
+		overhead += d->overhead[i];
+	}
+	qsort(d->cycle, n, sizeof(uint64_t), compare_u64);
+	res->cycle_avg = sum / n;
+	res->cycle_p99 = d->cycle[(n - 1) * 99 / 100];
+	res->cycle_max = d->cycle[n - 1];
+	res->overhead_avg = overhead / n;
+
+	if ((n = d->n_wakeup) == 0)
+		return;
+	qsort(d->wakeup, n, sizeof(uint32_t), compare_u32);
+	res->wakeup[0] = d->wakeup[(n - 1) * 50 / 100];
+	res->wakeup[1] = d->wakeup[(n - 1) * 90 / 100];
+	res->wakeup[2] = d->wakeup[(n - 1) * 99 / 100];
+	res->wakeup[3] = d->wakeup[n - 1];
+}
+
+static int run(struct data *d, const struct config *config, struct result *res)
+{
+	struct pw_loop *loop = pw_main_loop_get_loop(d->loop);
+	struct timespec value;
+	char quantum[16], rate[16], workers[16];
+	void *iface;
+	int r = 0;
+
+	d->config = *config;
+	d->n_links = 0;
+	d->warmup = 0;
+	d->n_samples = 0;
+	d->late = 0;
+	d->n_wakeup = 0;
+	d->max_wakeup = config->n_cycles * config->n_nodes;
+	d->wakeup = calloc(d->max_wakeup, sizeof(uint32_t));
+	spa_assert(d->wakeup != NULL);
+
+	snprintf(quantum, sizeof(quantum), "%u", config->quantum);
+	snprintf(rate, sizeof(rate), "%u", config->rate);
+	snprintf(workers, sizeof(workers), "%u", config->n_workers);
+
+	d->context = pw_context_new(loop,
+			pw_properties_new(
+				PW_KEY_CONTEXT_PROFILE_MODULES, "none",
+				PW_KEY_CORE_DAEMON, config->topology == TOPOLOGY_CLIENTS ? "1" : "0",
+				PW_KEY_CORE_NAME, d->server_name,
+				"default.clock.rate", rate,
+				"default.clock.quantum", quantum,
+				"default.clock.min-quantum", quantum,
+				"context.data-loop.workers", workers,
+				NULL), 0);
+	spa_assert(d->context != NULL);
+	pw_context_add_listener(d->context, &d->context_listener, &context_events, d);
+	spa_hook_list_append(&d->context->driver_listener_list,
+			&d->driver_listener, &driver_events, d);
+
+	pw_context_add_spa_lib(d->context, "support.*", "support/libspa-support");
+	d->handle = pw_context_load_spa_handle(d->context, SPA_NAME_SUPPORT_NODE_DRIVER, NULL);
+	spa_assert(d->handle != NULL);
+	spa_assert(spa_handle_get_interface(d->handle, SPA_TYPE_INTERFACE_Node, &iface) >= 0);
+
+	d->driver = pw_context_create_node(d->context,
+			pw_properties_new(
+				PW_KEY_NODE_NAME, "benchmark-driver",
+				PW_KEY_NODE_DRIVER, "true",
+				NULL), 0);
+	spa_assert(d->driver != NULL);
+	pw_impl_node_set_implementation(d->driver, iface);
+	pw_impl_node_register(d->driver, NULL);
+	pw_impl_node_set_active(d->driver, true);
+
+	if (config->topology == TOPOLOGY_CLIENTS) {
+		if (pw_context_load_module(d->context, "libpipewire-module-protocol-native", NULL, NULL) == NULL ||
+		    pw_context_load_module(d->context, "libpipewire-module-client-node", NULL, NULL) == NULL ||
+		    (r = make_clients(d)) < 0) {
+			r = r < 0 ? r : -errno;
+			goto done;
+		}
+	} else {
+		make_nodes(d);
+	}
+
+	/* give up when the cycles don't complete */
+	d->deadline = get_time() + 5 * SPA_NSEC_PER_SEC +
+		(uint64_t)config->n_cycles * 4 * config->quantum * SPA_NSEC_PER_SEC / config->rate;
+	value.tv_sec = 0;
+	value.tv_nsec = 10 * SPA_NSEC_PER_MSEC;
+	d->timer = pw_loop_add_timer(loop, on_timer, d);
+	pw_loop_update_timer(loop, d->timer, &value, &value, false);
+
+	pw_main_loop_run(d->loop);
+
+	pw_loop_destroy_source(loop, d->timer);
+
+done:
+	/* stop the graph before the results are read */
+	pw_impl_node_set_active(d->driver, false);
+	destroy_clients(d);
+	pw_context_destroy(d->context);
+	pw_unload_spa_handle(d->handle);
+
+	make_result(d, res);
+	free(d->wakeup);
+	d->wakeup = NULL;
+
+	if (r == 0 && res->n_samples < config->n_cycles)
+		r = -ETIMEDOUT;
+	return r;
+}
+
+static void print_result(const struct config *config, const struct result *res, int r)
+{
+	fprintf(stderr, "%s: %u nodes quantum %u/%u cost %"PRIu64" us: ",
+			topology_names[config->topology], config->n_nodes,
+			config->quantum, config->rate, config->cost / 1000);
+	if (r < 0 && res->n_samples == 0) {
+		fprintf(stderr, "failed: %s\n", spa_strerror(r));
+		return;
+	}
+	fprintf(stderr, "cycle avg %"PRIu64" p99 %"PRIu64" max %"PRIu64" us, "
+			"overhead %"PRIu64" us = %"PRIu64" ns/node, "
+			"wakeup p50 %"PRIu64" p90 %"PRIu64" p99 %"PRIu64" max %"PRIu64" us, "
+			"late %u/%u%s\n",
+			res->cycle_avg / 1000, res->cycle_p99 / 1000, res->cycle_max / 1000,
+			res->overhead_avg / 1000, res->overhead_avg / config->n_nodes,
+			res->wakeup[0] / 1000, res->wakeup[1] / 1000,
+			res->wakeup[2] / 1000, res->wakeup[3] / 1000,
+			res->late, res->n_samples,
+			r < 0 ? " (incomplete)" : "");
+}
+
+static bool sustainable(struct data *d, struct config *config)
+{
+	struct result res;
+	int r;
+
+	r = run(d, config, &res);
+	print_result(config, &res, r);
+	return r >= 0 && res.late * 100 <= res.n_samples;
+}
+
+/* the largest number of nodes where 99% of the cycles complete within the
+ * period, doubling first and then bisecting to within 1/8 */
+static uint32_t search_max_nodes(struct data *d, struct config *config)
+{
+	uint32_t good = 0, bad = 0, max;
+
+	max = config->topology == TOPOLOGY_CLIENTS ? MAX_CLIENTS : MAX_NODES;
+
+	for (config->n_nodes = 8; config->n_nodes <= max; config->n_nodes *= 2) {
+		if (!sustainable(d, config)) {
+			bad = config->n_nodes;
+			break;
+		}
+		good = config->n_nodes;
+	}
+	while (bad > 0 && bad - good > SPA_MAX(good / 8, 1u)) {
+		config->n_nodes = (good + bad) / 2;
+		if (sustainable(d, config))
+			good = config->n_nodes;
+		else
+			bad = config->n_nodes;
+	}
+	fprintf(stderr, "%s: max sustainable nodes with cost %"PRIu64" us at quantum %u/%u: %u%s\n",
+			topology_names[config->topology], config->cost / 1000,
+			config->quantum, config->rate, good, bad == 0 ? " (limit)" : "");
+	return good;
+}
+
+static void show_help(const char *name)
+{
+        fprintf(stdout, "%s [options]\n"
+		"  -h, --help                            Show this help\n"
+		"  -t, --topology                        chain, fanin, fanout, dag or clients\n"
+		"  -n, --nodes                           Number of nodes (default 64)\n"
+		"  -q, --quantum                         Quantum in samples (default %u)\n"
+		"  -r, --rate                            Rate (default %u)\n"
+		"  -c, --cost                            Usec of work per node and cycle\n"
+		"  -C, --cycles                          Cycles to measure (default %u)\n"
+		"  -s, --search                          Find the max sustainable node count\n"
+		"  -w, --workers                         Worker threads of the data loop (default 0)\n"
+		"Without a topology, a set of topologies is measured and the max\n"
+		"sustainable node count of a dag is searched.\n",
+		name, DEFAULT_QUANTUM, DEFAULT_RATE, DEFAULT_CYCLES);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data *d;
+	struct config config;
+	struct result res;
+	char tmpdir[] = "/tmp/pipewire-benchmark-XXXXXX";
+	bool topology = false, search = false;
+	static const struct option long_options[] = {
+		{ "help",	no_argument,		NULL, 'h' },
+		{ "topology",	required_argument,	NULL, 't' },
+		{ "nodes",	required_argument,	NULL, 'n' },
+		{ "quantum",	required_argument,	NULL, 'q' },
+		{ "rate",	required_argument,	NULL, 'r' },
+		{ "cost",	required_argument,	NULL, 'c' },
+		{ "cycles",	required_argument,	NULL, 'C' },
+		{ "search",	no_argument,		NULL, 's' },
+		{ "workers",	required_argument,	NULL, 'w' },
+		{ NULL, 0, NULL, 0}
+	};
+	uint32_t i;
+	int c, r;
+
+	pw_init(&argc, &argv);
+
+	spa_zero(config);
+	config.n_nodes = 64;
+	config.quantum = DEFAULT_QUANTUM;
+	config.rate = DEFAULT_RATE;
+	config.n_cycles = DEFAULT_CYCLES;
+
+	while ((c = getopt_long(argc, argv, "ht:n:q:r:c:C:sw:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		case 't':
+			for (i = 0; i < SPA_N_ELEMENTS(topology_names); i++) {
+				if (strcmp(optarg, topology_names[i]) == 0)
+					break;
+			}
+			if (i == SPA_N_ELEMENTS(topology_names)) {
+				show_help(argv[0]);
+				return -1;
+			}
+			config.topology = i;
+			topology = true;
+			break;
+		case 'n':
+			config.n_nodes = atoi(optarg);
+			break;
+		case 'q':
+			config.quantum = atoi(optarg);
+			break;
+		case 'r':
+			config.rate = atoi(optarg);
+			break;
+		case 'c':
+			config.cost = atoll(optarg) * SPA_NSEC_PER_USEC;
+			break;
+		case 'C':
+			config.n_cycles = atoi(optarg);
+			break;
+		case 's':
+			search = true;
+			break;
+		case 'w':
+			config.n_workers = atoi(optarg);
+			break;
+		default:
+			show_help(argv[0]);
+			return -1;
+		}
+	}
+	config.n_cycles = SPA_CLAMP(config.n_cycles, 1u, (uint32_t)MAX_CYCLES);
+	config.quantum = SPA_MAX(config.quantum, 1u);
+	config.rate = SPA_MAX(config.rate, 1u);
+
+	/* the clients need a runtime dir to find the server socket */
+	if (getenv("XDG_RUNTIME_DIR") == NULL) {
+		if (mkdtemp(tmpdir) == NULL) {
+			fprintf(stderr, "can't make runtime dir: %m\n");
+			return -1;
+		}
+		setenv("XDG_RUNTIME_DIR", tmpdir, 1);
+	} else
+		tmpdir[0] = '\0';
+
+	d = calloc(1, sizeof(struct data));
+	spa_assert(d != NULL);
+	snprintf(d->server_name, sizeof(d->server_name), "pipewire-benchmark-%d", getpid());
+
+	d->loop = pw_main_loop_new(NULL);
+	spa_assert(d->loop != NULL);
+
+	if (topology) {
+		config.n_nodes = SPA_CLAMP(config.n_nodes, 1u,
+				config.topology == TOPOLOGY_CLIENTS ? MAX_CLIENTS : MAX_NODES);
+		if (search)
+			search_max_nodes(d, &config);
+		else {
+			r = run(d, &config, &res);
+			print_result(&config, &res, r);
+		}
+	} else {
+		static const uint32_t sizes[] = { 16, 256 };
+		static const uint32_t client_sizes[] = { 4, 16 };
+		uint32_t j;
+
+		/* the scheduling overhead with nodes that do nothing */
+		for (i = TOPOLOGY_CHAIN; i <= TOPOLOGY_DAG; i++) {
+			for (j = 0; j < SPA_N_ELEMENTS(sizes); j++) {
+				config.topology = i;
+				config.n_nodes = sizes[j];
+				r = run(d, &config, &res);
+				print_result(&config, &res, r);
+			}
+		}
+		for (j = 0; j < SPA_N_ELEMENTS(client_sizes); j++) {
+			config.topology = TOPOLOGY_CLIENTS;
+			config.n_nodes = client_sizes[j];
+			r = run(d, &config, &res);
+			print_result(&config, &res, r);
+		}
+		/* the capacity with nodes that do some work */
+		config.topology = TOPOLOGY_DAG;
+		if (config.cost == 0)
+			config.cost = DEFAULT_COST * SPA_NSEC_PER_USEC;
+		search_max_nodes(d, &config);
+	}
+
+	pw_main_loop_destroy(d->loop);
+	free(d);
+
+	if (tmpdir[0] != '\0')
+		rmdir(tmpdir);
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/private.h>
+
+#define MAX_COUNT 100000
+
+/* Two nodes wake each other up in turn, like a driver and a follower
+ * in a graph cycle. The eventfd path polls before reading, like the
+ * data loop does. */
+struct data {
+	struct pw_node_activation *activation[2];
+	int fd[2];
+	bool futex;
+};
+
+static void wakeup(struct data *d, int i)
+{
+	uint64_t cmd = 1;
+
+	if (d->futex && pw_node_activation_futex_wake(d->activation[i]))
+		return;
+	if (write(d->fd[i], &cmd, sizeof(cmd)) != sizeof(cmd))
+		fprintf(stderr, "write failed: %m\n");
+}
+
+static void wait_wakeup(struct data *d, int i)
+{
+	struct pollfd pfd;
+	uint64_t cmd;
+
+	if (d->futex && d->activation[i]->wakeup == PW_NODE_ACTIVATION_WAKEUP_FUTEX) {
+		spa_assert(pw_node_activation_futex_wait(d->activation[i], NULL) > 0);
+		return;
+	}
+	pfd.fd = d->fd[i];
+	pfd.events = POLLIN;
+	spa_assert(poll(&pfd, 1, -1) == 1);
+	if (read(d->fd[i], &cmd, sizeof(cmd)) != sizeof(cmd))
+		fprintf(stderr, "read failed: %m\n");
+}
+
+static void *follower(void *user_data)
+{
+	struct data *d = user_data;
+	int i;
+
+	for (i = 0; i < MAX_COUNT; i++) {
+		wait_wakeup(d, 1);
+		wakeup(d, 0);
+	}
+	return NULL;
+}
+
+static void test_wakeup(struct data *d, bool futex, bool peer_futex)
+{
+	struct timespec ts;
+	uint64_t t1, t2;
+	pthread_t thread;
+	int i;
+
+	d->futex = futex;
+	d->activation[0]->wakeup = d->activation[1]->wakeup = peer_futex ?
+		PW_NODE_ACTIVATION_WAKEUP_FUTEX : PW_NODE_ACTIVATION_WAKEUP_EVENTFD;
+
+	pthread_create(&thread, NULL, follower, d);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t1 = SPA_TIMESPEC_TO_NSEC(&ts);
+
+	for (i = 0; i < MAX_COUNT; i++) {
+		wakeup(d, 1);
+		wait_wakeup(d, 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t2 = SPA_TIMESPEC_TO_NSEC(&ts);
+
+	pthread_join(thread, NULL);
+
+	fprintf(stderr, "%s%s: elapsed %"PRIu64" count %u = %"PRIu64" nsec/wakeup\n",
+			futex ? "futex" : "eventfd",
+			futex && !peer_futex ? " (eventfd peer)" : "",
+			t2 - t1, MAX_COUNT, (t2 - t1) / (2 * MAX_COUNT));
+}
+
+int main(int argc, char *argv[])
+{
+	struct data d;
+
+	spa_zero(d);
+	spa_assert(posix_memalign((void**)&d.activation[0], PW_NODE_ACTIVATION_STATS_OFFSET,
+				sizeof(struct pw_node_activation)) == 0);
+	spa_assert(posix_memalign((void**)&d.activation[1], PW_NODE_ACTIVATION_STATS_OFFSET,
+				sizeof(struct pw_node_activation)) == 0);
+	memset(d.activation[0], 0, sizeof(struct pw_node_activation));
+	memset(d.activation[1], 0, sizeof(struct pw_node_activation));
+	d.fd[0] = eventfd(0, EFD_CLOEXEC);
+	d.fd[1] = eventfd(0, EFD_CLOEXEC);
+	spa_assert(d.fd[0] >= 0 && d.fd[1] >= 0);
+
+	/* warmup */
+	test_wakeup(&d, false, false);
+
+	test_wakeup(&d, false, false);
+	test_wakeup(&d, true, false);
+	test_wakeup(&d, true, true);
+
+	close(d.fd[0]);
+	close(d.fd[1]);
+	free(d.activation[0]);
+	free(d.activation[1]);
+
+	return 0;
+}
@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <signal.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <spa/utils/result.h>
 #include <spa/pod/parser.h>
@@ -35,11 +37,48 @@
 
 #define MAX_NAME		128
 #define MAX_FOLLOWERS		64
+#define MAX_BUCKETS		16
+#define MAX_NODES		256
 #define DEFAULT_FILENAME	"profiler.log"
+#define READ_INTERVAL		(10 * SPA_NSEC_PER_MSEC)
 
 struct follower {
 	uint32_t id;
 	char name[MAX_NAME];
+	uint32_t spin_hits;
+	uint32_t spin_misses;
+	uint32_t critical;
+	int64_t min_slack;
+	uint32_t n_slack;
+	uint64_t histogram[MAX_BUCKETS];
+	bool have_xrun_count;
+	uint32_t xrun_count;
+	bool traced;			/**< the name of the track was written */
+};
+
+struct node {
+	uint32_t id;
+	char name[MAX_NAME];
+};
+
+struct measurement {
+	int64_t period;
+	int64_t prev_signal;
+	int64_t signal;
+	int64_t awake;
+	int64_t finish;
+	int32_t status;
+	int64_t spin_time;
+	bool ran;
+	uint32_t xruns;			/**< new xruns in this cycle */
+};
+
+struct point {
+	int64_t count;
+	float cpu_load[3];
+	struct spa_io_clock clock;
+	struct measurement driver;
+	struct measurement follower[MAX_FOLLOWERS];
 };
 
 struct data {
@@ -55,6 +94,11 @@ struct data {
 	const char *filename;
 	FILE *output;
 
+	const char *trace_filename;
+	FILE *trace;
+	bool trace_empty;
+	bool trace_driver;
+
 	int64_t count;
 	int64_t start_status;
 	int64_t last_status;
@@ -64,26 +108,26 @@ struct data {
 	int check_profiler;
 
 	uint32_t driver_id;
+	uint32_t driver_xrun_count;
+	uint32_t adapt_changes;
+	bool truncated;
+	int64_t n_paths;
 
 	int n_followers;
 	struct follower followers[MAX_FOLLOWERS];
-};
 
-struct measurement {
-	int64_t period;
-	int64_t prev_signal;
-	int64_t signal;
-	int64_t awake;
-	int64_t finish;
-	int32_t status;
-};
+	/* the names of the nodes, from the registry */
+	int n_nodes;
+	struct node nodes[MAX_NODES];
 
-struct point {
-	int64_t count;
-	float cpu_load[3];
-	struct spa_io_clock clock;
-	struct measurement driver;
-	struct measurement follower[MAX_FOLLOWERS];
+	/* the records in the ring of the profiler */
+	struct pw_profiler_ring *ring;
+	uint32_t ring_size;
+	uint64_t read_index;
+	struct spa_source *ring_timer;
+	struct point point;
+	uint32_t pending;
+	bool skip;
 };
 
 static int process_info(struct data *d, const struct spa_pod *pod, struct point *point)
@@ -112,6 +156,17 @@ static int process_clock(struct data *d, const struct spa_pod *pod, struct point
 	return 0;
 }
 
+static int check_driver(struct data *d, uint32_t driver_id)
+{
+	if (d->driver_id == 0) {
+		d->driver_id = driver_id;
+		fprintf(stderr, "logging driver %u\n", driver_id);
+	}
+	else if (d->driver_id != driver_id)
+		return -1;
+	return 0;
+}
+
 static int process_driver_block(struct data *d, const struct spa_pod *pod, struct point *point)
 {
 	union {
@@ -129,17 +184,56 @@ static int process_driver_block(struct data *d, const struct spa_pod *pod, struc
 			SPA_POD_Long(&driver.finish),
 			SPA_POD_Int(&driver.status));
 
-	if (d->driver_id == 0) {
-		d->driver_id = driver_id;
-		fprintf(stderr, "logging driver %u\n", driver_id);
-	}
-	else if (d->driver_id != driver_id)
+	if (check_driver(d, driver_id) < 0)
 		return -1;
 
 	point->driver = driver;
 	return 0;
 }
 
+static const char *adapt_reason(uint32_t reason)
+{
+	switch (reason) {
+	case 1:
+		return "load";
+	case 2:
+		return "xrun";
+	case 3:
+		return "idle";
+	}
+	return "none";
+}
+
+static int driver_adapt(struct data *d, struct point *point, uint32_t base, uint32_t quantum,
+		uint32_t pending, uint32_t reason, uint32_t changes, int64_t change_time)
+{
+	if (changes == d->adapt_changes)
+		return 0;
+
+	d->adapt_changes = changes;
+	fprintf(stderr, "\nadapt quantum %"PRIu64" -> %u (%s) base:%u at %"PRIi64"\n",
+			point->clock.duration, pending ? pending : quantum,
+			adapt_reason(reason), base, change_time);
+	return 0;
+}
+
+static int process_driver_adapt(struct data *d, const struct spa_pod *pod, struct point *point)
+{
+	uint32_t base, quantum, pending, reason, changes;
+	int64_t change_time;
+
+	if (spa_pod_parse_struct(pod,
+			SPA_POD_Int(&base),
+			SPA_POD_Int(&quantum),
+			SPA_POD_Int(&pending),
+			SPA_POD_Int(&reason),
+			SPA_POD_Int(&changes),
+			SPA_POD_Long(&change_time)) < 0)
+		return 0;
+
+	return driver_adapt(d, point, base, quantum, pending, reason, changes, change_time);
+}
+
 static int find_follower(struct data *d, uint32_t id, const char *name)
 {
 	int i;
@@ -167,6 +261,78 @@ static int add_follower(struct data *d, uint32_t id, const char *name)
 	return idx;
 }
 
+static int process_critical_path(struct data *d, const struct spa_pod *pod, struct point *point)
+{
+	int64_t period, length;
+	struct spa_pod *path;
+	uint32_t i, n_ids, ids[MAX_FOLLOWERS];
+	int j;
+
+	if (spa_pod_parse_struct(pod,
+			SPA_POD_Long(&period),
+			SPA_POD_Long(&length),
+			SPA_POD_Pod(&path)) < 0)
+		return 0;
+
+	n_ids = spa_pod_copy_array(path, SPA_TYPE_Int, ids, MAX_FOLLOWERS);
+	for (i = 0; i < n_ids; i++) {
+		for (j = 0; j < d->n_followers; j++) {
+			if (d->followers[j].id == ids[i]) {
+				d->followers[j].critical++;
+				break;
+			}
+		}
+	}
+	d->n_paths++;
+	return 0;
+}
+
+static int process_follower_slack(struct data *d, const struct spa_pod *pod, struct point *point)
+{
+	uint32_t id;
+	const char *name;
+	int64_t slack;
+	bool critical;
+	int idx;
+
+	if (spa_pod_parse_struct(pod,
+			SPA_POD_Int(&id),
+			SPA_POD_String(&name),
+			SPA_POD_Long(&slack),
+			SPA_POD_Bool(&critical)) < 0)
+		return 0;
+
+	if ((idx = find_follower(d, id, name)) < 0)
+		return 0;
+
+	if (d->followers[idx].n_slack++ == 0 || slack < d->followers[idx].min_slack)
+		d->followers[idx].min_slack = slack;
+	return 0;
+}
+
+static int process_follower_histogram(struct data *d, const struct spa_pod *pod, struct point *point)
+{
+	uint32_t id;
+	const char *name;
+	struct spa_pod *pod_buckets;
+	uint32_t i, n_buckets, buckets[MAX_BUCKETS];
+	int idx;
+
+	if (spa_pod_parse_struct(pod,
+			SPA_POD_Int(&id),
+			SPA_POD_String(&name),
+			SPA_POD_Pod(&pod_buckets)) < 0)
+		return 0;
+
+	if ((idx = find_follower(d, id, name)) < 0)
+		return 0;
+
+	n_buckets = spa_pod_copy_array(pod_buckets, SPA_TYPE_Int, buckets, MAX_BUCKETS);
+	for (i = 0; i < n_buckets; i++)
+		d->followers[idx].histogram[i] += buckets[i];
+	return 0;
+}
+
 static int process_follower_block(struct data *d, const struct spa_pod *pod, struct point *point)
 {
 	uint32_t id;
@@ -183,6 +349,7 @@ static int process_follower_block(struct data *d, const struct spa_pod *pod, str
 			SPA_POD_Long(&m.awake),
 			SPA_POD_Long(&m.finish),
 			SPA_POD_Int(&m.status));
+	m.ran = m.status != 0 && m.awake >= m.signal && m.finish >= m.awake;
 
 	if ((idx = find_follower(d, id, name)) < 0) {
 		if ((idx = add_follower(d, id, name)) < 0) {
@@ -194,6 +361,156 @@ static int process_follower_block(struct data *d, const struct spa_pod *pod, str
 	return 0;
 }
 
+static int process_follower_spin(struct data *d, const struct spa_pod *pod, struct point *point)
+{
+	uint32_t id, hits, misses;
+	const char *name;
+	int64_t spin_time;
+	int idx;
+
+	if (spa_pod_parse_struct(pod,
+			SPA_POD_Int(&id),
+			SPA_POD_String(&name),
+			SPA_POD_Long(&spin_time),
+			SPA_POD_Int(&hits),
+			SPA_POD_Int(&misses)) < 0)
+		return 0;
+
+	if ((idx = find_follower(d, id, name)) < 0)
+		return 0;
+
+	point->follower[idx].spin_time = spin_time;
+	d->followers[idx].spin_hits = hits;
+	d->followers[idx].spin_misses = misses;
+	return 0;
+}
+
+static const char *node_name(struct data *d, uint32_t id)
+{
+	int i;
+	for (i = 0; i < d->n_nodes; i++) {
+		if (d->nodes[i].id == id)
+			return d->nodes[i].name;
+	}
+	return "";
+}
+
+static void trace_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(f, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+/* starts a trace event, timestamps are in usec */
+static void trace_event(struct data *d, const char *name, char ph, uint32_t tid, int64_t ts)
+{
+	fprintf(d->trace, "%s\n{\"name\":", d->trace_empty ? "" : ",");
+	trace_string(d->trace, name);
+	fprintf(d->trace, ",\"ph\":\"%c\",\"pid\":%u,\"tid\":%u", ph, d->driver_id, tid);
+	if (ph != 'M')
+		fprintf(d->trace, ",\"ts\":%"PRIi64".%03"PRIi64, ts / 1000, ts % 1000);
+	d->trace_empty = false;
+}
+
+static void trace_name(struct data *d, const char *type, uint32_t tid, const char *name)
+{
+	trace_event(d, type, 'M', tid, 0);
+	fprintf(d->trace, ",\"args\":{\"name\":");
+	trace_string(d->trace, name);
+	fprintf(d->trace, "}}");
+}
+
+/* a slice from signal to finish with a nested slice from awake to finish,
+ * the gap at the start is the time the node waited to be scheduled */
+static void trace_measurement(struct data *d, uint32_t tid, const char *name,
+		struct measurement *m)
+{
+	if (m->signal <= 0 || m->finish < m->signal)
+		return;
+
+	trace_event(d, name, 'X', tid, m->signal);
+	fprintf(d->trace, ",\"dur\":%.3f,\"args\":{\"wait\":%.3f,\"busy\":%.3f,\"status\":%d}}",
+			(m->finish - m->signal) / 1000.0,
+			m->awake >= m->signal ? (m->awake - m->signal) / 1000.0 : 0.0,
+			m->awake >= m->signal ? (m->finish - m->awake) / 1000.0 : 0.0,
+			m->status);
+
+	if (m->awake >= m->signal && m->finish >= m->awake) {
+		trace_event(d, "process", 'X', tid, m->awake);
+		fprintf(d->trace, ",\"dur\":%.3f}", (m->finish - m->awake) / 1000.0);
+	}
+	if (m->xruns > 0) {
+		trace_event(d, "xrun", 'i', tid, m->finish);
+		fprintf(d->trace, ",\"s\":\"t\",\"args\":{\"count\":%u}}", m->xruns);
+	}
+}
+
+/* every node is a track in the process of the driver, the driver has
+ * the cycles and the cpu load */
+static void trace_point(struct data *d, struct point *point)
+{
+	int i;
+
+	if (!d->trace_driver) {
+		const char *str = node_name(d, d->driver_id);
+		char name[MAX_NAME + 16];
+		snprintf(name, sizeof(name), "%s/%u",
+				str[0] ? str : point->clock.name, d->driver_id);
+		trace_name(d, "process_name", d->driver_id, name);
+		trace_name(d, "thread_name", d->driver_id, "driver");
+		d->trace_driver = true;
+	}
+
+	trace_event(d, "cycle", 'X', d->driver_id, point->driver.signal);
+	fprintf(d->trace, ",\"dur\":%.3f,\"args\":{\"position\":%"PRIu64
+			",\"quantum\":%"PRIu64",\"rate\":%u,\"delay\":%"PRIi64"}}",
+			point->driver.finish > point->driver.signal ?
+				(point->driver.finish - point->driver.signal) / 1000.0 : 0.0,
+			point->clock.position, point->clock.duration,
+			point->clock.rate.denom, point->clock.delay);
+	if (point->driver.awake >= point->driver.signal &&
+	    point->driver.finish >= point->driver.awake) {
+		trace_event(d, "process", 'X', d->driver_id, point->driver.awake);
+		fprintf(d->trace, ",\"dur\":%.3f}",
+				(point->driver.finish - point->driver.awake) / 1000.0);
+	}
+	if (point->driver.xruns > 0) {
+		trace_event(d, "xrun", 'i', d->driver_id, point->driver.finish);
+		fprintf(d->trace, ",\"s\":\"p\",\"args\":{\"count\":%u}}",
+				point->driver.xruns);
+	}
+	trace_event(d, "cpu load", 'C', d->driver_id, point->driver.signal);
+	fprintf(d->trace, ",\"args\":{\"load\":%f}}", point->cpu_load[0]);
+
+	for (i = 0; i < d->n_followers; i++) {
+		struct follower *f = &d->followers[i];
+		struct measurement *m = &point->follower[i];
+
+		if (!m->ran && m->xruns == 0)
+			continue;
+		if (!f->traced && f->name[0] != '\0') {
+			char name[MAX_NAME + 16];
+			snprintf(name, sizeof(name), "%s/%u", f->name, f->id);
+			trace_name(d, "thread_name", f->id, name);
+			f->traced = true;
+		}
+		if (m->ran)
+			trace_measurement(d, f->id, "cycle", m);
+		else if (m->xruns > 0) {
+			trace_event(d, "xrun", 'i', f->id, point->driver.finish);
+			fprintf(d->trace, ",\"s\":\"t\",\"args\":{\"count\":%u}}", m->xruns);
+		}
+	}
+}
+
 static void dump_point(struct data *d, struct point *point)
 {
 	int i;
@@ -226,14 +543,15 @@ static void dump_point(struct data *d, struct point *point)
 			int64_t d5 = (point->follower[i].awake - point->driver.signal) / 1000;
 			int64_t d6 = (point->follower[i].finish - point->driver.signal) / 1000;
 
-			fprintf(d->output, "%u\t%"PRIi64"\t%"PRIi64"\t%"PRIi64"\t%"PRIi64"\t%"PRIi64"\t%d\t0\t",
+			fprintf(d->output, "%u\t%"PRIi64"\t%"PRIi64"\t%"PRIi64"\t%"PRIi64"\t%"PRIi64"\t%d\t%"PRIi64"\t",
 					d->followers[i].id,
 					d4 > 0 ? d4 : 0,
 					d5 > 0 ? d5 : 0,
 					d6 > 0 ? d6 : 0,
 					(d5 > 0 && d4 > 0 && d5 > d4) ? d5 - d4 : 0,
 					(d6 > 0 && d5 > 0 && d6 > d5) ? d6 - d5 : 0,
-					point->follower[i].status);
+					point->follower[i].status,
+					point->follower[i].spin_time / 1000);
 		}
 	}
 	fprintf(d->output, "\n");
@@ -247,6 +565,8 @@ static void dump_point(struct data *d, struct point *point)
 				point->cpu_load[0], point->cpu_load[1], point->cpu_load[2]);
 		d->last_status = point->clock.nsec;
 	}
+	if (d->trace)
+		trace_point(d, point);
 	d->count++;
 }
 
@@ -260,6 +580,35 @@ static void dump_scripts(struct data *d)
 
 	fprintf(stderr, "\ndumping scripts for %d followers\n", d->n_followers);
 
+	for (i = 0; i < d->n_followers; i++) {
+		if (d->followers[i].spin_hits == 0 && d->followers[i].spin_misses == 0)
+			continue;
+		fprintf(stderr, "follower %u (\"%s\") spin-wait hits %u misses %u\n",
+				d->followers[i].id, d->followers[i].name,
+				d->followers[i].spin_hits, d->followers[i].spin_misses);
+	}
+	for (i = 0; i < d->n_followers; i++) {
+		struct follower *f = &d->followers[i];
+		int j;
+
+		if (f->n_slack == 0)
+			continue;
+		fprintf(stderr, "follower %u (\"%s\") on critical path %.1f%% min slack %"PRIi64" us\n",
+				f->id, f->name,
+				d->n_paths ? f->critical * 100.0 / d->n_paths : 0.0,
+				f->min_slack / 1000);
+		fprintf(stderr, "  process time histogram (us):");
+		for (j = 0; j < MAX_BUCKETS; j++) {
+			if (f->histogram[j] == 0)
+				continue;
+			if (j == MAX_BUCKETS - 1)
+				fprintf(stderr, " >=%u:%"PRIu64, 1u << (j - 1), f->histogram[j]);
+			else
+				fprintf(stderr, " <%u:%"PRIu64, 1u << j, f->histogram[j]);
+		}
+		fprintf(stderr, "\n");
+	}
+
 	out = fopen("Timing1.plot", "w");
 	if (out == NULL) {
 		pw_log_error("Can't open Timing1.plot: %m");
@@ -446,9 +795,24 @@ static void profiler_profile(void *data, const struct spa_pod *pod)
 			case SPA_PROFILER_driverBlock:
 				res = process_driver_block(d, &p->value, &point);
 				break;
+			case SPA_PROFILER_driverAdapt:
+				process_driver_adapt(d, &p->value, &point);
+				break;
+			case SPA_PROFILER_driverCriticalPath:
+				process_critical_path(d, &p->value, &point);
+				break;
+			case SPA_PROFILER_followerSlack:
+				process_follower_slack(d, &p->value, &point);
+				break;
+			case SPA_PROFILER_followerHistogram:
+				process_follower_histogram(d, &p->value, &point);
+				break;
 			case SPA_PROFILER_followerBlock:
 				process_follower_block(d, &p->value, &point);
 				break;
+			case SPA_PROFILER_followerSpin:
+				process_follower_spin(d, &p->value, &point);
+				break;
 			default:
 				break;
 			}
@@ -462,11 +826,205 @@ static void profiler_profile(void *data, const struct spa_pod *pod)
 	}
 }
 
+static int process_driver_record(struct data *d, const struct pw_profiler_record *r,
+		struct point *point)
+{
+	const struct pw_profiler_driver *dr = &r->driver;
+
+	point->count = r->count;
+	point->cpu_load[0] = dr->cpu_load[0];
+	point->cpu_load[1] = dr->cpu_load[1];
+	point->cpu_load[2] = dr->cpu_load[2];
+
+	point->clock.flags = dr->clock_flags;
+	point->clock.id = dr->clock_id;
+	point->clock.nsec = dr->nsec;
+	point->clock.rate = dr->rate;
+	point->clock.position = dr->position;
+	point->clock.duration = dr->duration;
+	point->clock.delay = dr->delay;
+	point->clock.rate_diff = dr->rate_diff;
+	point->clock.next_nsec = dr->next_nsec;
+
+	if (check_driver(d, r->id) < 0)
+		return -1;
+
+	point->driver.prev_signal = r->prev_signal;
+	point->driver.signal = r->signal;
+	point->driver.awake = r->awake;
+	point->driver.finish = r->finish;
+	point->driver.status = r->status;
+	point->driver.ran = true;
+	if (d->count > 0)
+		point->driver.xruns = dr->xrun_count - d->driver_xrun_count;
+	d->driver_xrun_count = dr->xrun_count;
+
+	if ((dr->flags & PW_PROFILER_DRIVER_TRUNCATED) && !d->truncated) {
+		pw_log_warn("driver %u has more followers than the profiler records",
+				r->id);
+		d->truncated = true;
+	}
+	if (dr->flags & PW_PROFILER_DRIVER_ADAPT)
+		driver_adapt(d, point, dr->adapt_base, dr->adapt_quantum,
+				dr->adapt_pending, dr->adapt_reason,
+				dr->adapt_changes, dr->adapt_change_time);
+	d->n_paths++;
+	return 0;
+}
+
+static int process_follower_record(struct data *d, const struct pw_profiler_record *r,
+		struct point *point)
+{
+	const struct pw_profiler_follower *fr = &r->follower;
+	struct follower *f;
+	struct measurement *m;
+	int i, idx;
+
+	/* the ring has ids only, the name can come later from the registry */
+	for (idx = 0; idx < d->n_followers; idx++) {
+		if (d->followers[idx].id == r->id)
+			break;
+	}
+	if (idx == d->n_followers &&
+	    (idx = add_follower(d, r->id, node_name(d, r->id))) < 0) {
+		pw_log_warn("too many followers");
+		return -ENOSPC;
+	}
+	f = &d->followers[idx];
+
+	m = &point->follower[idx];
+	m->prev_signal = r->prev_signal;
+	m->signal = r->signal;
+	m->awake = r->awake;
+	m->finish = r->finish;
+	m->status = r->status;
+	m->ran = fr->flags & PW_PROFILER_FOLLOWER_RAN;
+	if (f->have_xrun_count)
+		m->xruns = fr->xrun_count - f->xrun_count;
+	if (fr->flags & PW_PROFILER_FOLLOWER_UNFINISHED)
+		m->xruns++;
+	f->xrun_count = fr->xrun_count;
+	f->have_xrun_count = true;
+
+	if (fr->flags & PW_PROFILER_FOLLOWER_SPIN) {
+		m->spin_time = fr->spin_time;
+		f->spin_hits = fr->spin_hits;
+		f->spin_misses = fr->spin_misses;
+	}
+	if (fr->flags & PW_PROFILER_FOLLOWER_CRITICAL)
+		f->critical++;
+	if (fr->flags & PW_PROFILER_FOLLOWER_RAN) {
+		if (f->n_slack++ == 0 || fr->slack < f->min_slack)
+			f->min_slack = fr->slack;
+	}
+	if (fr->flags & PW_PROFILER_FOLLOWER_HISTOGRAM) {
+		for (i = 0; i < MAX_BUCKETS; i++)
+			f->histogram[i] += fr->buckets[i];
+	}
+	return 0;
+}
+
+/* a point is complete when the records of all followers of the driver
+ * are processed */
+static void process_record(struct data *d, const struct pw_profiler_record *r)
+{
+	struct point *point = &d->point;
+
+	switch (r->type) {
+	case PW_PROFILER_RECORD_DRIVER:
+		spa_zero(*point);
+		d->pending = r->driver.n_followers;
+		d->skip = process_driver_record(d, r, point) < 0;
+		break;
+	case PW_PROFILER_RECORD_FOLLOWER:
+		if (d->pending == 0 || r->count != point->count)
+			return;
+		d->pending--;
+		if (!d->skip && process_follower_record(d, r, point) < 0)
+			d->skip = true;
+		break;
+	default:
+		return;
+	}
+	if (d->pending == 0 && !d->skip)
+		dump_point(d, point);
+}
+
+static void read_ring(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	struct pw_profiler_record r;
+	int res;
+
+	while ((res = pw_profiler_ring_read(d->ring, d->read_index, &r)) != 0) {
+		if (res < 0) {
+			pw_log_warn("too slow, records lost");
+			d->read_index = pw_profiler_ring_oldest(d->ring);
+			d->pending = 0;
+			continue;
+		}
+		process_record(d, &r);
+		d->read_index++;
+	}
+}
+
+static void profiler_ring(void *data, int fd, uint32_t size)
+{
+	struct data *d = data;
+	struct timespec value;
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		pw_log_error("can't map profiler ring: %m");
+		return;
+	}
+	if (d->ring != NULL || !pw_profiler_ring_check(ptr, size)) {
+		pw_log_error("invalid profiler ring");
+		munmap(ptr, size);
+		return;
+	}
+	d->ring = ptr;
+	d->ring_size = size;
+	d->read_index = __atomic_load_n(&d->ring->write_index, __ATOMIC_ACQUIRE);
+
+	value.tv_sec = 0;
+	value.tv_nsec = READ_INTERVAL;
+	d->ring_timer = pw_loop_add_timer(pw_main_loop_get_loop(d->loop), read_ring, d);
+	pw_loop_update_timer(pw_main_loop_get_loop(d->loop), d->ring_timer,
+			&value, &value, false);
+}
+
 static const struct pw_profiler_events profiler_events = {
 	PW_VERSION_PROFILER_EVENTS,
         .profile = profiler_profile,
+	.ring = profiler_ring,
 };
 
+static void add_node(struct data *d, uint32_t id, const struct spa_dict *props)
+{
+	const char *str;
+	struct node *n;
+	int i;
+
+	if (props == NULL || (str = spa_dict_lookup(props, PW_KEY_NODE_NAME)) == NULL)
+		return;
+	if (d->n_nodes == MAX_NODES)
+		return;
+
+	n = &d->nodes[d->n_nodes++];
+	n->id = id;
+	strncpy(n->name, str, MAX_NAME);
+	n->name[MAX_NAME-1] = '\0';
+
+	/* the follower could be in the ring before the node was announced */
+	for (i = 0; i < d->n_followers; i++) {
+		if (d->followers[i].id == id && d->followers[i].name[0] == '\0')
+			strcpy(d->followers[i].name, n->name);
+	}
+}
+
 static void registry_event_global(void *data, uint32_t id,
 				  uint32_t permissions, const char *type, uint32_t version,
 				  const struct spa_dict *props)
@@ -474,6 +1032,10 @@ static void registry_event_global(void *data, uint32_t id,
 	struct data *d = data;
 	struct pw_proxy *proxy;
 
+	if (strcmp(type, PW_TYPE_INTERFACE_Node) == 0) {
+		add_node(d, id, props);
+		return;
+	}
 	if (strcmp(type, PW_TYPE_INTERFACE_Profiler) != 0)
 		return;
 
@@ -497,9 +1059,23 @@ error_proxy:
 	return;
 }
 
+static void registry_event_global_remove(void *data, uint32_t id)
+{
+	struct data *d = data;
+	int i;
+
+	for (i = 0; i < d->n_nodes; i++) {
+		if (d->nodes[i].id == id) {
+			d->nodes[i] = d->nodes[--d->n_nodes];
+			break;
+		}
+	}
+}
+
 static const struct pw_registry_events registry_events = {
 	PW_VERSION_REGISTRY_EVENTS,
 	.global = registry_event_global,
+	.global_remove = registry_event_global_remove,
 };
 
 static void on_core_error(void *_data, uint32_t id, int seq, int res, const char *message)
@@ -544,7 +1120,8 @@ static void show_help(const char *name)
 		"  -h, --help                            Show this help\n"
 		"      --version                         Show version\n"
 		"  -r, --remote                          Remote daemon name\n"
-		"  -o, --output                          Profiler output name (default \"%s\")\n",
+		"  -o, --output                          Profiler output name (default \"%s\")\n"
+		"  -t, --trace                           Also write a Chrome trace event file\n",
 		name,
 		DEFAULT_FILENAME);
 }
@@ -560,13 +1137,14 @@ int main(int argc, char *argv[])
 		{ "version",	no_argument,		NULL, 'V' },
 		{ "remote",	required_argument,	NULL, 'r' },
 		{ "output",	required_argument,	NULL, 'o' },
+		{ "trace",	required_argument,	NULL, 't' },
 		{ NULL, 0, NULL, 0}
 	};
 	int c;
 
 	pw_init(&argc, &argv);
 
-	while ((c = getopt_long(argc, argv, "hVr:o:", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "hVr:o:t:", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'h':
 			show_help(argv[0]);
@@ -585,6 +1163,9 @@ int main(int argc, char *argv[])
 		case 'r':
 			opt_remote = optarg;
 			break;
+		case 't':
+			data.trace_filename = optarg;
+			break;
 		default:
 			show_help(argv[0]);
 			return -1;
@@ -629,6 +1210,17 @@ int main(int argc, char *argv[])
 
 	fprintf(stderr, "Logging to %s\n", data.filename);
 
+	if (data.trace_filename != NULL) {
+		data.trace = fopen(data.trace_filename, "w");
+		if (data.trace == NULL) {
+			fprintf(stderr, "Can't open file %s: %m\n", data.trace_filename);
+			return -1;
+		}
+		fprintf(data.trace, "{\"traceEvents\":[");
+		data.trace_empty = true;
+		fprintf(stderr, "Tracing to %s\n", data.trace_filename);
+	}
+
 	pw_core_add_listener(data.core,
 				   &data.core_listener,
 				   &core_events, &data);
@@ -642,10 +1234,19 @@ int main(int argc, char *argv[])
 
 	pw_main_loop_run(data.loop);
 
+	if (data.ring != NULL) {
+		read_ring(&data, 0);
+		munmap(data.ring, data.ring_size);
+	}
+
 	pw_context_destroy(data.context);
 	pw_main_loop_destroy(data.loop);
 
 	fclose(data.output);
+	if (data.trace != NULL) {
+		fprintf(data.trace, "\n],\"displayTimeUnit\":\"ns\"}\n");
+		fclose(data.trace);
+	}
 
 	dump_scripts(&data);
 
@@ -0,0 +1,711 @@
+/* PipeWire
+ *
+ * Copyright © 2020 Wim Taymans
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <locale.h>
+#include <sys/mman.h>
+
+#include <ncurses.h>
+
+#include <spa/utils/result.h>
+
+#include <pipewire/impl.h>
+#include <extensions/profiler.h>
+
+#define MAX_NAME		128
+#define MAX_NODES		1024
+#define READ_INTERVAL		(10 * SPA_NSEC_PER_MSEC)
+#define DEFAULT_DELAY		1
+
+enum sort {
+	SORT_ID,
+	SORT_WAIT,
+	SORT_BUSY,
+	SORT_LOAD,
+	SORT_XRUN,
+};
+
+struct node {
+	struct spa_list link;
+	uint32_t id;
+	char name[MAX_NAME];
+
+	bool driver;
+	uint32_t driver_id;		/**< the driver of the last cycle */
+	uint64_t quantum;
+	struct spa_fraction rate;
+	bool have_xrun_count;
+	uint32_t xrun_count;		/**< last xrun count of the activation */
+
+	/* measurements since the last refresh */
+	uint32_t n_cycles;
+	int64_t wait_sum;
+	int64_t busy_sum;
+	int64_t period_sum;
+	int64_t busy_max;
+
+	/* what is shown, updated on each refresh */
+	bool active;
+	int64_t wait;
+	int64_t busy;
+	int64_t max;
+	double load;
+	uint32_t xruns;			/**< total since start */
+};
+
+struct data {
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+
+	struct pw_core *core;
+	struct spa_hook core_listener;
+
+	struct pw_registry *registry;
+	struct spa_hook registry_listener;
+
+	struct pw_proxy *profiler;
+	struct spa_hook profiler_listener;
+	int check_profiler;
+	int check_ring;
+
+	struct spa_list nodes;
+	uint32_t n_nodes;
+
+	/* the records in the ring of the profiler */
+	struct pw_profiler_ring *ring;
+	uint32_t ring_size;
+	uint64_t read_index;
+	struct spa_source *ring_timer;
+	uint64_t lost;
+
+	/* the driver record of the cycle that is read */
+	struct pw_profiler_record driver;
+	uint32_t pending;
+
+	struct spa_source *refresh_timer;
+	struct spa_source *input;
+	enum sort sort;
+	bool batch;
+	int iterations;
+};
+
+static struct node *find_node(struct data *d, uint32_t id)
+{
+	struct node *n;
+	spa_list_for_each(n, &d->nodes, link) {
+		if (n->id == id)
+			return n;
+	}
+	return NULL;
+}
+
+static struct node *add_node(struct data *d, uint32_t id, const char *name)
+{
+	struct node *n;
+
+	if ((n = find_node(d, id)) == NULL) {
+		if (d->n_nodes == MAX_NODES)
+			return NULL;
+		n = calloc(1, sizeof(struct node));
+		if (n == NULL)
+			return NULL;
+		n->id = id;
+		spa_list_append(&d->nodes, &n->link);
+		d->n_nodes++;
+	}
+	if (name != NULL) {
+		strncpy(n->name, name, MAX_NAME);
+		n->name[MAX_NAME-1] = '\0';
+	}
+	return n;
+}
+
+static void remove_node(struct data *d, struct node *n)
+{
+	spa_list_remove(&n->link);
+	d->n_nodes--;
+	free(n);
+}
+
+static void update_node(struct node *n, const struct pw_profiler_record *dr,
+		int64_t wait, int64_t busy, uint32_t xrun_count)
+{
+	const struct pw_profiler_driver *drv = &dr->driver;
+	int64_t period;
+
+	n->driver_id = dr->id;
+	n->quantum = drv->duration;
+	n->rate = drv->rate;
+
+	/* only count the xruns that happened while we were watching */
+	if (n->have_xrun_count)
+		n->xruns += xrun_count - n->xrun_count;
+	n->xrun_count = xrun_count;
+	n->have_xrun_count = true;
+
+	if (wait < 0 || busy < 0)
+		return;
+
+	period = drv->period > 0 ? drv->period : dr->signal - dr->prev_signal;
+	n->n_cycles++;
+	n->wait_sum += wait;
+	n->busy_sum += busy;
+	n->period_sum += SPA_MAX(period, 0);
+	n->busy_max = SPA_MAX(n->busy_max, busy);
+}
+
+static void process_driver_record(struct data *d, const struct pw_profiler_record *r)
+{
+	struct node *n;
+
+	d->driver = *r;
+	d->pending = r->driver.n_followers;
+
+	if ((n = find_node(d, r->id)) == NULL)
+		return;
+
+	n->driver = true;
+	update_node(n, r, r->awake - r->signal, r->finish - r->awake,
+			r->driver.xrun_count);
+}
+
+static void process_follower_record(struct data *d, const struct pw_profiler_record *r)
+{
+	const struct pw_profiler_follower *f = &r->follower;
+	struct node *n;
+
+	if ((n = find_node(d, r->id)) == NULL)
+		return;
+
+	n->driver = false;
+	if (f->flags & PW_PROFILER_FOLLOWER_UNFINISHED)
+		n->xruns++;
+	if (f->flags & PW_PROFILER_FOLLOWER_RAN)
+		update_node(n, &d->driver, r->awake - r->signal, r->finish - r->awake,
+				f->xrun_count);
+	else
+		update_node(n, &d->driver, -1, -1, f->xrun_count);
+}
+
+static void process_record(struct data *d, const struct pw_profiler_record *r)
+{
+	switch (r->type) {
+	case PW_PROFILER_RECORD_DRIVER:
+		process_driver_record(d, r);
+		break;
+	case PW_PROFILER_RECORD_FOLLOWER:
+		if (d->pending == 0 || r->count != d->driver.count)
+			break;
+		d->pending--;
+		process_follower_record(d, r);
+		break;
+	default:
+		break;
+	}
+}
+
+static void read_ring(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	struct pw_profiler_record r;
+	int res;
+
+	while ((res = pw_profiler_ring_read(d->ring, d->read_index, &r)) != 0) {
+		if (res < 0) {
+			uint64_t oldest = pw_profiler_ring_oldest(d->ring);
+			d->lost += oldest - d->read_index;
+			d->read_index = oldest;
+			d->pending = 0;
+			continue;
+		}
+		process_record(d, &r);
+		d->read_index++;
+	}
+}
+
+static int compare_node(const void *p1, const void *p2, void *user_data)
+{
+	const struct node *n1 = *(const struct node **)p1;
+	const struct node *n2 = *(const struct node **)p2;
+	enum sort sort = *(enum sort *)user_data;
+
+	switch (sort) {
+	case SORT_WAIT:
+		if (n1->wait != n2->wait)
+			return n1->wait < n2->wait ? 1 : -1;
+		break;
+	case SORT_BUSY:
+		if (n1->busy != n2->busy)
+			return n1->busy < n2->busy ? 1 : -1;
+		break;
+	case SORT_LOAD:
+		if (n1->load != n2->load)
+			return n1->load < n2->load ? 1 : -1;
+		break;
+	case SORT_XRUN:
+		if (n1->xruns != n2->xruns)
+			return n1->xruns < n2->xruns ? 1 : -1;
+		break;
+	default:
+		break;
+	}
+	return n1->id < n2->id ? -1 : n1->id > n2->id;
+}
+
+static const char *sort_name(enum sort sort)
+{
+	switch (sort) {
+	case SORT_WAIT:
+		return "wait";
+	case SORT_BUSY:
+		return "busy";
+	case SORT_LOAD:
+		return "load";
+	case SORT_XRUN:
+		return "xruns";
+	default:
+		return "id";
+	}
+}
+
+static char *print_time(char *buf, size_t len, const struct node *n, int64_t val)
+{
+	if (!n->active)
+		snprintf(buf, len, "%8s", "---");
+	else if (val < 1000000)
+		snprintf(buf, len, "%6.1fus", val / 1000.0);
+	else if (val < 1000000000)
+		snprintf(buf, len, "%6.1fms", val / 1000000.0);
+	else
+		snprintf(buf, len, "%6.1fs ", val / 1000000000.0);
+	return buf;
+}
+
+static void print_line(struct data *d, const struct node *n, bool follower)
+{
+	char line[512], wait[16], busy[16], max[16], load[16], quantum[16], rate[16];
+
+	if (n->active) {
+		snprintf(quantum, sizeof(quantum), "%6"PRIu64, n->quantum);
+		snprintf(rate, sizeof(rate), "%6u", n->rate.denom);
+		snprintf(load, sizeof(load), "%5.2f", n->load);
+	} else {
+		snprintf(quantum, sizeof(quantum), "%6s", "---");
+		snprintf(rate, sizeof(rate), "%6s", "---");
+		snprintf(load, sizeof(load), "%5s", "---");
+	}
+	snprintf(line, sizeof(line), "%c %4u %s %s %s %s %s %s %6u %s%s",
+			n->active ? 'R' : 'I', n->id, quantum, rate,
+			print_time(wait, sizeof(wait), n, n->wait),
+			print_time(busy, sizeof(busy), n, n->busy),
+			print_time(max, sizeof(max), n, n->max),
+			load, n->xruns,
+			follower ? " + " : "", n->name);
+
+	if (d->batch)
+		printf("%s\n", line);
+	else
+		printw("%.*s\n", COLS > 1 ? COLS - 1 : 0, line);
+}
+
+static void print_header(struct data *d, uint32_t n_active)
+{
+	const char *title = "S   ID  QUANT   RATE     WAIT     BUSY      MAX  LOAD  XRUNS NAME";
+
+	if (d->batch) {
+		printf("%u nodes, %u running, sort by %s%s\n%s\n",
+				d->n_nodes, n_active, sort_name(d->sort),
+				d->lost ? ", records lost" : "", title);
+		return;
+	}
+	printw("%u nodes, %u running, sort by %s%s\n"
+		"keys: (i)d (w)ait (b)usy (l)oad (x)runs (q)uit\n\n",
+			d->n_nodes, n_active, sort_name(d->sort),
+			d->lost ? ", records lost" : "");
+	attron(A_REVERSE);
+	printw("%-*.*s\n", COLS > 1 ? COLS - 1 : 0, COLS > 1 ? COLS - 1 : 0, title);
+	attroff(A_REVERSE);
+}
+
+/* drivers are sorted among themselves, each one followed by its sorted
+ * followers. Nodes that did not run since the last refresh come last. */
+static void draw(struct data *d)
+{
+	struct node *n, *sorted[MAX_NODES];
+	uint32_t i, j, n_sorted = 0, n_active = 0;
+
+	spa_list_for_each(n, &d->nodes, link) {
+		sorted[n_sorted++] = n;
+		if (n->active)
+			n_active++;
+	}
+	qsort_r(sorted, n_sorted, sizeof(struct node *), compare_node, &d->sort);
+
+	if (!d->batch)
+		erase();
+	print_header(d, n_active);
+
+	for (i = 0; i < n_sorted; i++) {
+		struct node *dr = sorted[i];
+
+		if (!dr->active || !dr->driver)
+			continue;
+		print_line(d, dr, false);
+		for (j = 0; j < n_sorted; j++) {
+			n = sorted[j];
+			if (n->active && !n->driver && n->driver_id == dr->id)
+				print_line(d, n, true);
+		}
+	}
+	for (i = 0; i < n_sorted; i++) {
+		n = sorted[i];
+		if (!n->active || (!n->driver && find_node(d, n->driver_id) == NULL))
+			print_line(d, n, false);
+	}
+	if (d->batch) {
+		printf("\n");
+		fflush(stdout);
+	} else
+		refresh();
+}
+
+static void do_refresh(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	struct node *n;
+
+	read_ring(d, 0);
+
+	spa_list_for_each(n, &d->nodes, link) {
+		n->active = n->n_cycles > 0;
+		if (n->active) {
+			n->wait = n->wait_sum / n->n_cycles;
+			n->busy = n->busy_sum / n->n_cycles;
+			n->max = n->busy_max;
+			n->load = n->period_sum > 0 ?
+				(double)n->busy_sum / n->period_sum : 0.0;
+		}
+		n->n_cycles = 0;
+		n->wait_sum = n->busy_sum = n->period_sum = n->busy_max = 0;
+	}
+	draw(d);
+
+	if (d->iterations > 0 && --d->iterations == 0)
+		pw_main_loop_quit(d->loop);
+}
+
+static void on_input(void *data, int fd, uint32_t mask)
+{
+	struct data *d = data;
+	int ch;
+
+	while ((ch = getch()) != ERR) {
+		switch (ch) {
+		case 'q':
+		case 'Q':
+			pw_main_loop_quit(d->loop);
+			return;
+		case 'i':
+			d->sort = SORT_ID;
+			break;
+		case 'w':
+			d->sort = SORT_WAIT;
+			break;
+		case 'b':
+			d->sort = SORT_BUSY;
+			break;
+		case 'l':
+			d->sort = SORT_LOAD;
+			break;
+		case 'x':
+			d->sort = SORT_XRUN;
+			break;
+		case KEY_RESIZE:
+			break;
+		default:
+			continue;
+		}
+		draw(d);
+	}
+}
+
+static void profiler_ring(void *data, int fd, uint32_t size)
+{
+	struct data *d = data;
+	struct timespec value;
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		pw_log_error("can't map profiler ring: %m");
+		return;
+	}
+	if (d->ring != NULL || !pw_profiler_ring_check(ptr, size)) {
+		pw_log_error("invalid profiler ring");
+		munmap(ptr, size);
+		return;
+	}
+	d->ring = ptr;
+	d->ring_size = size;
+	d->read_index = __atomic_load_n(&d->ring->write_index, __ATOMIC_ACQUIRE);
+
+	value.tv_sec = 0;
+	value.tv_nsec = READ_INTERVAL;
+	d->ring_timer = pw_loop_add_timer(pw_main_loop_get_loop(d->loop), read_ring, d);
+	pw_loop_update_timer(pw_main_loop_get_loop(d->loop), d->ring_timer,
+			&value, &value, false);
+}
+
+static const struct pw_profiler_events profiler_events = {
+	PW_VERSION_PROFILER_EVENTS,
+	.ring = profiler_ring,
+};
+
+static void registry_event_global(void *data, uint32_t id,
+				  uint32_t permissions, const char *type, uint32_t version,
+				  const struct spa_dict *props)
+{
+	struct data *d = data;
+	struct pw_proxy *proxy;
+
+	if (strcmp(type, PW_TYPE_INTERFACE_Node) == 0) {
+		const char *str = props ? spa_dict_lookup(props, PW_KEY_NODE_NAME) : NULL;
+		add_node(d, id, str ? str : "");
+		return;
+	}
+	if (strcmp(type, PW_TYPE_INTERFACE_Profiler) != 0)
+		return;
+
+	if (d->profiler != NULL)
+		return;
+
+	proxy = pw_registry_bind(d->registry, id, type, PW_VERSION_PROFILER, 0);
+	if (proxy == NULL) {
+		pw_log_error("failed to create proxy: %m");
+		return;
+	}
+	d->profiler = proxy;
+	pw_proxy_add_object_listener(proxy, &d->profiler_listener, &profiler_events, d);
+}
+
+static void registry_event_global_remove(void *data, uint32_t id)
+{
+	struct data *d = data;
+	struct node *n;
+
+	if ((n = find_node(d, id)) != NULL)
+		remove_node(d, n);
+}
+
+static const struct pw_registry_events registry_events = {
+	PW_VERSION_REGISTRY_EVENTS,
+	.global = registry_event_global,
+	.global_remove = registry_event_global_remove,
+};
+
+static void on_core_error(void *_data, uint32_t id, int seq, int res, const char *message)
+{
+	struct data *data = _data;
+
+	pw_log_error("error id:%u seq:%d res:%d (%s): %s",
+			id, seq, res, spa_strerror(res), message);
+
+	if (id == PW_ID_CORE)
+		pw_main_loop_quit(data->loop);
+}
+
+static void on_core_done(void *_data, uint32_t id, int seq)
+{
+	struct data *d = _data;
+
+	if (seq == d->check_profiler) {
+		if (d->profiler == NULL) {
+			pw_log_error("no Profiler Interface found, please load one in the server");
+			pw_main_loop_quit(d->loop);
+		} else {
+			/* the ring is sent when the profiler is bound */
+			d->check_ring = pw_core_sync(d->core, 0, 0);
+		}
+	} else if (seq == d->check_ring) {
+		if (d->ring == NULL) {
+			pw_log_error("the Profiler has no record ring, the server is too old");
+			pw_main_loop_quit(d->loop);
+		}
+	}
+}
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.error = on_core_error,
+	.done = on_core_done,
+};
+
+static void do_quit(void *data, int signal_number)
+{
+	struct data *d = data;
+	pw_main_loop_quit(d->loop);
+}
+
+static void show_help(const char *name)
+{
+        fprintf(stdout, "%s [options]\n"
+		"  -h, --help                            Show this help\n"
+		"      --version                         Show version\n"
+		"  -r, --remote                          Remote daemon name\n"
+		"  -b, --batch-mode                      Print to stdout, without curses\n"
+		"  -d, --delay                           Seconds between updates (default %d)\n"
+		"  -n, --iterations                      Exit after this many updates\n",
+		name,
+		DEFAULT_DELAY);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	struct pw_loop *l;
+	struct timespec value;
+	struct node *n;
+	const char *opt_remote = NULL;
+	int delay = DEFAULT_DELAY;
+	static const struct option long_options[] = {
+		{ "help",	no_argument,		NULL, 'h' },
+		{ "version",	no_argument,		NULL, 'V' },
+		{ "remote",	required_argument,	NULL, 'r' },
+		{ "batch-mode",	no_argument,		NULL, 'b' },
+		{ "delay",	required_argument,	NULL, 'd' },
+		{ "iterations",	required_argument,	NULL, 'n' },
+		{ NULL, 0, NULL, 0}
+	};
+	int c;
+
+	setlocale(LC_ALL, "");
+	pw_init(&argc, &argv);
+
+	while ((c = getopt_long(argc, argv, "hVr:bd:n:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		case 'V':
+			fprintf(stdout, "%s\n"
+				"Compiled with libpipewire %s\n"
+				"Linked with libpipewire %s\n",
+				argv[0],
+				pw_get_headers_version(),
+				pw_get_library_version());
+			return 0;
+		case 'r':
+			opt_remote = optarg;
+			break;
+		case 'b':
+			data.batch = true;
+			break;
+		case 'd':
+			delay = SPA_MAX(atoi(optarg), 1);
+			break;
+		case 'n':
+			data.iterations = atoi(optarg);
+			break;
+		default:
+			show_help(argv[0]);
+			return -1;
+		}
+	}
+
+	spa_list_init(&data.nodes);
+
+	data.loop = pw_main_loop_new(NULL);
+	if (data.loop == NULL) {
+		fprintf(stderr, "Can't create data loop: %m\n");
+		return -1;
+	}
+
+	l = pw_main_loop_get_loop(data.loop);
+	pw_loop_add_signal(l, SIGINT, do_quit, &data);
+	pw_loop_add_signal(l, SIGTERM, do_quit, &data);
+
+	data.context = pw_context_new(l, NULL, 0);
+	if (data.context == NULL) {
+		fprintf(stderr, "Can't create context: %m\n");
+		return -1;
+	}
+
+	pw_context_load_module(data.context, PW_EXTENSION_MODULE_PROFILER, NULL, NULL);
+
+	data.core = pw_context_connect(data.context,
+			pw_properties_new(
+				PW_KEY_REMOTE_NAME, opt_remote,
+				NULL),
+			0);
+	if (data.core == NULL) {
+		fprintf(stderr, "Can't connect: %m\n");
+		return -1;
+	}
+
+	pw_core_add_listener(data.core,
+				   &data.core_listener,
+				   &core_events, &data);
+	data.registry = pw_core_get_registry(data.core,
+					  PW_VERSION_REGISTRY, 0);
+	pw_registry_add_listener(data.registry,
+				       &data.registry_listener,
+				       &registry_events, &data);
+
+	data.check_profiler = pw_core_sync(data.core, 0, 0);
+
+	value.tv_sec = delay;
+	value.tv_nsec = 0;
+	data.refresh_timer = pw_loop_add_timer(l, do_refresh, &data);
+	pw_loop_update_timer(l, data.refresh_timer, &value, &value, false);
+
+	if (!data.batch) {
+		initscr();
+		cbreak();
+		noecho();
+		nodelay(stdscr, TRUE);
+		keypad(stdscr, TRUE);
+		curs_set(0);
+		data.input = pw_loop_add_io(l, STDIN_FILENO, SPA_IO_IN, false, on_input, &data);
+	}
+
+	pw_main_loop_run(data.loop);
+
+	if (!data.batch)
+		endwin();
+
+	if (data.ring != NULL)
+		munmap(data.ring, data.ring_size);
+
+	pw_context_destroy(data.context);
+	pw_main_loop_destroy(data.loop);
+
+	spa_list_consume(n, &data.nodes, link)
+		remove_node(&data, n);
+
+	return 0;
+}